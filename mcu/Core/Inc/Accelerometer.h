@@ -30,5 +30,53 @@
 // how data is transfered to the terminal by UART.
 #pragma once
 
+// Average of every sample drained from the FIFO by one read
+typedef struct
+{
+	short x;
+	short y;
+	short z;
+	unsigned int count;        // number of samples averaged
+	unsigned int timestamp_us; // Profiler_Micros() time of the middle of the window
+} AccelerometerSample;
+
+// Output data rate, CTRL_REG1_A ODR bits (page 25 of the LSM303DLHC datasheet).  The
+// accelerometer has no separate low-pass setting, its bandwidth follows the data rate.
+typedef enum
+{
+	ACCELEROMETER_ODR_1HZ = 1,
+	ACCELEROMETER_ODR_10HZ,
+	ACCELEROMETER_ODR_25HZ,
+	ACCELEROMETER_ODR_50HZ,
+	ACCELEROMETER_ODR_100HZ,
+	ACCELEROMETER_ODR_200HZ,
+	ACCELEROMETER_ODR_400HZ
+} AccelerometerOdr;
+
+// Full scale, CTRL_REG4_A FS bits
+typedef enum
+{
+	ACCELEROMETER_RANGE_2G,
+	ACCELEROMETER_RANGE_4G,
+	ACCELEROMETER_RANGE_8G,
+	ACCELEROMETER_RANGE_16G
+} AccelerometerRange;
+
+// Called from interrupt context after every burst, whether it succeeded or not
+typedef void (*AccelerometerCallback)(void);
+
 void AccelerometerInit();
+
+// Polled register writes: call before the first AccelerometerStartRead().  Puts the FIFO
+// in stream mode and routes its watermark (1 to 31 samples) to the INT1 pin.
+void AccelerometerConfigure(AccelerometerOdr odr, AccelerometerRange range, unsigned char watermark);
+void AccelerometerSetCallback(AccelerometerCallback callback);
+
+// Start a background read of every sample in the FIFO.  The getters return the average
+// of the last completed one.  Returns 0 if the bus is busy.
+int AccelerometerStartRead();
+void GetAccelerometerSample(AccelerometerSample* sample);
 void GetAccelerometerValues(short* x, short* y, short* z);
+
+// Time between two samples at the configured output data rate, s
+float AccelerometerSamplePeriod();
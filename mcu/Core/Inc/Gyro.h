@@ -28,5 +28,69 @@
 // board.
 #pragma once
 
+// Average of every sample drained from the FIFO by one read
+typedef struct
+{
+	short raw[3];              // x, y, z in counts
+	float rate[3];             // x, y, z in rad/s
+	unsigned int count;        // number of samples averaged
+	float dt;                  // time they cover, s
+	unsigned int timestamp_us; // Profiler_Micros() time of the middle of the window
+} GyroSample;
+
+// Output data rate, CTRL_REG1 DR bits (page 31 of the L3GD20 datasheet)
+typedef enum
+{
+	GYRO_ODR_95HZ,
+	GYRO_ODR_190HZ,
+	GYRO_ODR_380HZ,
+	GYRO_ODR_760HZ
+} GyroOdr;
+
+// CTRL_REG1 BW bits.  The low-pass cut-off depends on the output data rate, see table 21:
+// 12.5 to 25 Hz at 95 Hz, 12.5 to 70 Hz at 190 Hz, 20 to 100 Hz at 380 Hz, 30 to 100 Hz
+// at 760 Hz.
+typedef enum
+{
+	GYRO_BANDWIDTH_0,
+	GYRO_BANDWIDTH_1,
+	GYRO_BANDWIDTH_2,
+	GYRO_BANDWIDTH_3
+} GyroBandwidth;
+
+// Full scale, CTRL_REG4 FS bits
+typedef enum
+{
+	GYRO_RANGE_250DPS,
+	GYRO_RANGE_500DPS,
+	GYRO_RANGE_2000DPS
+} GyroRange;
+
+// Called from interrupt context after every burst, whether it succeeded or not
+typedef void (*GyroCallback)(void);
+
 void GyroInit();
+
+// Polled register writes: call before the first GyroStartRead().  Puts the FIFO in
+// stream mode and routes its watermark (1 to 31 samples) to the DRDY/INT2 pin.
+void GyroConfigure(GyroOdr odr, GyroBandwidth bandwidth, GyroRange range, unsigned char watermark);
+void GyroSetCallback(GyroCallback callback);
+
+// Change the FIFO watermark between two reads.  Returns 0 if a read is in progress.
+int GyroSetWatermark(unsigned char watermark);
+
+// Start a background read of every sample in the FIFO.  The getters return the
+// average of the last completed one.  Returns 0 if a read is already in progress.
+int GyroStartRead();
+void GetGyroSample(GyroSample* sample);
 void GetGyroValues(short* x, short* y, short* z);
+
+// Time between two samples at the configured output data rate, s
+float GyroSamplePeriod();
+
+// Abandon a read that has been running for too long.  Call periodically from an
+// interrupt of higher priority than the gyro DMA.
+void GyroCheckTimeout();
+
+// Polled waits and reads that timed out since boot
+unsigned int GyroTimeoutCount();
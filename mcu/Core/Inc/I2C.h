@@ -1,5 +1,18 @@
 #pragma once
 
+// Called from interrupt context when an asynchronous transfer ends.  error is 0
+// on success, otherwise the I2C1_SR1 error bits (AF, BERR, ARLO, ...),
+// I2C_ERROR_DMA or I2C_ERROR_TIMEOUT.
+typedef void (*I2CCallback)(unsigned int error);
+
+#define I2C_ERROR_DMA (1 << 16)
+#define I2C_ERROR_TIMEOUT (1 << 17)
+
+void I2CInit();
+
+// Polled primitives, only for use at init time when no asynchronous transfer
+// can be in progress.  Every wait is bounded: a device that never answers
+// costs a few milliseconds and a timeout count, not a hang.
 void I2CStartRestart();
 void I2CStop();
 void I2CEnableAcknowledge();
@@ -8,4 +21,21 @@ void I2CSendSlaveAddress(unsigned short address);
 void I2CSendRegister(unsigned short registerAddress);
 void I2CWaitIfBusy();
 void I2CWriteByte(unsigned char data);
-unsigned char I2CGetData();
\ No newline at end of file
+unsigned char I2CGetData();
+
+// Asynchronous register read: write registerAddress to the device, then read
+// length bytes into buffer with a repeated start, DMA and interrupts.  Returns
+// 1 if the transfer was started, 0 if one is already in progress.  The buffer
+// must stay valid until callback is called.
+int I2CReadAsync(unsigned char writeAddress, unsigned char registerAddress,
+                 unsigned char* buffer, unsigned short length, I2CCallback callback);
+int I2CIsBusy();
+
+// Abandon a transfer, and free the bus, when it has been busy for too long.
+// Call periodically from an interrupt of higher priority than the bus.
+void I2CCheckTimeout();
+
+// Failed transfers, timeouts (polled or asynchronous) and bus recoveries since boot
+unsigned int I2CErrorCount();
+unsigned int I2CTimeoutCount();
+unsigned int I2CRecoveryCount();
@@ -1,4 +1,8 @@
 #pragma once
 
 void MagnetometerInit();
+
+// Start a background burst read of the three axes.  GetMagnetometerValues() returns the
+// last completed one.
+void MagnetometerStartRead();
 void GetMagnetometerValues(short *x, short *y, short *z);
@@ -35,5 +35,6 @@ typedef struct {
 
 void  PIDController_Init(PIDController *pid);
 float PIDController_Update(PIDController *pid, float setpoint, float measurement);
+void  PIDController_BackCalculate(PIDController *pid, float shortfall);
 
 #endif
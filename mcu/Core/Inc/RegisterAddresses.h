@@ -51,7 +51,9 @@
 #define GPIOB_MODER          GPIOB_BASE_ADDRESS + 0x00 // GPIO port mode register
 #define GPIOB_OSPEEDR        GPIOB_BASE_ADDRESS + 0x08 // GPIO port output speed register
 #define GPIOB_PUPR           GPIOB_BASE_ADDRESS + 0x0C // GPIO port pull-up/pull-down register
+#define GPIOB_IDR            GPIOB_BASE_ADDRESS + 0x10 // GPIO port input data register
 #define GPIOB_ODR            GPIOB_BASE_ADDRESS + 0x14 // GPIO port output data register
+#define GPIOB_BSRR           GPIOB_BASE_ADDRESS + 0x18 // GPIO port bit set/reset register
 #define GPIOB_AFRL           GPIOB_BASE_ADDRESS + 0x20 // GPIO alternate function low register
 #define GPIOB_AFRH           GPIOB_BASE_ADDRESS + 0x24 // GPIO alternate function high register
 
@@ -66,6 +68,7 @@
 
 #define SPI1_BASE_ADDRESS    0x40013000
 #define SPI1_CR1             SPI1_BASE_ADDRESS + 0x00 // SPI control register 1
+#define SPI1_CR2             SPI1_BASE_ADDRESS + 0x04 // SPI control register 2
 #define SPI1_SR              SPI1_BASE_ADDRESS + 0x08 // SPI status register
 #define SPI1_DR              SPI1_BASE_ADDRESS + 0x0C // SPI data register
 #define SPI1_BSRR            SPI1_BASE_ADDRESS + 0x18 // GPIO port bit set/reset register
@@ -88,19 +91,56 @@
 #define USART2_CR3           USART2_BASE_ADDRESS + 0x14 // Control register 3
 
 #define DMA1_BASE_ADDRESS    0x40026000
+#define DMA1_LISR            DMA1_BASE_ADDRESS + 0x00 // DMA low interrupt status register
+#define DMA1_LIFCR           DMA1_BASE_ADDRESS + 0x08 // DMA low interrupt flag clear register
 #define DMA1_HISR            DMA1_BASE_ADDRESS + 0x04 // DMA high interrupt status register
 #define DMA1_HIFCR           DMA1_BASE_ADDRESS + 0x0C // DMA high interrupt flag clear register
+#define DMA1_S0CR            DMA1_BASE_ADDRESS + (0x10 + (0 * 0x18)) // DMA stream 0 configuration register
+#define DMA1_S0NDTR          DMA1_BASE_ADDRESS + (0x14 + (0 * 0x18)) // DMA stream 0 number of data register
+#define DMA1_S0PAR           DMA1_BASE_ADDRESS + (0x18 + (0 * 0x18)) // DMA stream 0 peripheral address register
+#define DMA1_S0M0AR          DMA1_BASE_ADDRESS + (0x1C + (0 * 0x18)) // DMA stream 0 memory 0 address register
 #define DMA1_S6CR            DMA1_BASE_ADDRESS + (0x10 + (6 * 0x18)) // DMA stream 6 FIFO control register
 #define DMA1_S6NDTR          DMA1_BASE_ADDRESS + (0x14 + (6 * 0x18)) // DMA stream 6 number of data register
 #define DMA1_S6PAR           DMA1_BASE_ADDRESS + (0x18 + (6 * 0x18)) // DMA stream 6 peripheral address register
 #define DMA1_S6M0AR          DMA1_BASE_ADDRESS + (0x1C + (6 * 0x18)) // DMA stream 6 memory 0 address register
 #define DMA1_S6FCR           DMA1_BASE_ADDRESS + (0x24 + (6 * 0x24)) // DMA stream 6 FIFO control register
 
+#define DMA2_BASE_ADDRESS    0x40026400
+#define DMA2_LISR            DMA2_BASE_ADDRESS + 0x00 // DMA low interrupt status register
+#define DMA2_LIFCR           DMA2_BASE_ADDRESS + 0x08 // DMA low interrupt flag clear register
+#define DMA2_S0CR            DMA2_BASE_ADDRESS + (0x10 + (0 * 0x18)) // DMA stream 0 configuration register
+#define DMA2_S0NDTR          DMA2_BASE_ADDRESS + (0x14 + (0 * 0x18)) // DMA stream 0 number of data register
+#define DMA2_S0PAR           DMA2_BASE_ADDRESS + (0x18 + (0 * 0x18)) // DMA stream 0 peripheral address register
+#define DMA2_S0M0AR          DMA2_BASE_ADDRESS + (0x1C + (0 * 0x18)) // DMA stream 0 memory 0 address register
+#define DMA2_S3CR            DMA2_BASE_ADDRESS + (0x10 + (3 * 0x18)) // DMA stream 3 configuration register
+#define DMA2_S3NDTR          DMA2_BASE_ADDRESS + (0x14 + (3 * 0x18)) // DMA stream 3 number of data register
+#define DMA2_S3PAR           DMA2_BASE_ADDRESS + (0x18 + (3 * 0x18)) // DMA stream 3 peripheral address register
+#define DMA2_S3M0AR          DMA2_BASE_ADDRESS + (0x1C + (3 * 0x18)) // DMA stream 3 memory 0 address register
+
 #define NVIC_BASE_ADDRESS    0xE000E100  // See pg 218 of PM2014
 #define NVIC_ISER0           NVIC_BASE_ADDRESS + 0x00  // "Interrupt set-enable registers" See pg 209 of PM2014
 #define NVIC_ISER1           NVIC_BASE_ADDRESS + 0x04  // "Interrupt set-enable registers" See pg 209 of PM2014
+#define NVIC_ISPR1           NVIC_BASE_ADDRESS + 0x104 // "Interrupt set-pending registers", see NVIC_ISPRx in PM2014
+#define NVIC_IPR(irq)        (NVIC_BASE_ADDRESS + 0x300 + (irq))  // "Interrupt priority registers", one byte per interrupt, see NVIC_IPRx in PM2014
 
 #define FLASH_BASE_ADDRESS   0x40023C00
 #define FLASH_ACR            FLASH_BASE_ADDRESS + 0x00  // Flash access control register (pg 58)
 
+#ifdef PERIPHERAL_EMULATOR
+
+// Host build: every access goes to the register model of sim/emulator instead of the bus, so
+// the drivers run unmodified against emulated peripherals and sensors.
+#include <stdint.h>
+
+volatile unsigned int* Emulator_Register(uintptr_t address);
+volatile unsigned char* Emulator_RegisterByte(uintptr_t address);
+
+#define ACCESS(address)      (*Emulator_Register((uintptr_t)(address)))
+#define ACCESS_BYTE(address) (*Emulator_RegisterByte((uintptr_t)(address)))
+
+#else
+
 #define ACCESS(address)      *((volatile unsigned int*)(address))
+#define ACCESS_BYTE(address) *((volatile unsigned char*)(address))
+
+#endif
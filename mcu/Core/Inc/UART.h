@@ -24,12 +24,25 @@
  * THE SOFTWARE.
  */
 
-// Allows for sending UART data to a terminal program using STM32F411 pin
-// PA2.  To use, setup a serial terminal (like Putty) at 9598 baud rate,
-// 8 data bits, 1 stop bit, no parity or flow control.  Then call UartInit()
-// and send strings to the terminal using SendString().
+// Asynchronous transmit path of the serial link (USART6, PC6, 115200 baud, 8N1).
+// Data is copied into a ring buffer and drained by DMA2 stream 6 in the
+// background, so writing never waits for the UART and is safe from interrupts.
+// A write that doesn't fit in the free space is dropped as a whole and counted,
+// it is never truncated and never blocks.  A writer that builds its data in
+// place takes a reservation first and commits it once filled, the interrupts
+// are only masked to reserve and to queue.  See telemetry.h for the framing of
+// what is sent.
 
 #pragma once
 
+#include <stdint.h>
+
+// Must be a power of two
+#define UART_TX_BUFFER_SIZE 2048
+
 void UartInit();
-void SendString(char* string);
+int UartWrite(const void* data, uint32_t length);
+int UartReserve(uint32_t length, uint32_t* position);
+void UartCommit(uint32_t position, const void* data, uint32_t length);
+void UartTxComplete();
+uint32_t UartDroppedFrames();
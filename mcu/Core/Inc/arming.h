@@ -0,0 +1,51 @@
+#ifndef ARMING_H
+#define ARMING_H
+
+#include <stdint.h>
+
+/*
+ * ESC arming sequence, stepped by a scheduler task so that the control tick,
+ * the estimator and the safety checks run from boot on.
+ *
+ * The ESCs power up with the board.  An ESC that sees the top of the throttle
+ * range at power up starts a range calibration, so a calibration holds the
+ * top for ARMING_CALIBRATE and the stop that follows sets the bottom.  Every
+ * boot then holds the motors stopped until the ESCs arm and spins them up at
+ * idle before the rate task takes them over.
+ */
+
+typedef enum
+{
+    ARMING_CALIBRATE, /* top of the range, 3 s */
+    ARMING_STOP,      /* 0, 1 s */
+    ARMING_SPIN_UP,   /* ARMING_IDLE_COMMAND, 1 s */
+    ARMING_ARMED
+} ArmingState;
+
+/* Idle command of the spin-up, in the range of Motor_Write() */
+#define ARMING_IDLE_COMMAND 100.0f
+
+typedef struct
+{
+    volatile ArmingState state;
+    uint32_t since_us;
+    int calibrating;
+    volatile int calibrated;
+} Arming;
+
+void Arming_Start(Arming *arming, int calibrate, uint32_t now_us);
+
+/* Motor commands of the sequence at now_us, left untouched once armed.
+ * Returns the state they belong to. */
+ArmingState Arming_Step(Arming *arming, uint32_t now_us, float *left, float *right);
+
+/* Starts the current phase over: the ESCs get all of it again after the motors
+ * were left without commands, by a stall of the tick */
+void Arming_Hold(Arming *arming, uint32_t now_us);
+
+ArmingState Arming_State(const Arming *arming);
+
+/* 1 once a calibration has run to its end */
+int Arming_Calibrated(const Arming *arming);
+
+#endif
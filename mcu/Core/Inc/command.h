@@ -0,0 +1,21 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+/*
+ * Parsing of the parameter commands of the serial link, "<parameter>:<value>"
+ * as in "p:1.5" or "q:2e3".
+ *
+ * Commands are applied at the PendSV priority, which preempts the main loop in
+ * the middle of a printf(), so the parser uses nothing of the C library: no
+ * stdio, no locale, no errno.  It only reads its arguments and writes its
+ * results and can run in any context.
+ */
+
+/* Reads the parameter letter, the colon and a decimal number with an optional
+ * sign, fraction and exponent.  Blanks before the number and anything after it
+ * are ignored, as sscanf("%c:%f") did.  Returns 1 on success, 0 if the command
+ * doesn't have that form or the value isn't finite, *parameter and *value are
+ * then left alone. */
+int Command_Parse(const char *command, char *parameter, float *value);
+
+#endif
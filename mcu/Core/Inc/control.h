@@ -0,0 +1,84 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include "PID.h"
+#include "kalman.h"
+#include "ilqr.h"
+#include "mixer.h"
+
+/*
+ * Estimator, control laws and motor mixing of the arm.
+ *
+ * Nothing in here touches a peripheral, so the firmware tasks and the host
+ * simulator run the same code.  Control_Rate() runs every tick: it propagates
+ * the angle with the gyro and closes the cascade rate loop.  Control_Estimate()
+ * and Control_Law() run at the angle rate: accelerometer angle and estimator,
+ * then the outer loop or the full state controller.  Control_Mix() turns the
+ * differential force command dF into the two motor commands.
+ *
+ * dF is positive when the arm has to turn toward negative angles: it is the
+ * right motor thrust minus the left one, on top of the arm bias, in units of
+ * CONTROL_THRUST_PER_UNIT.  The mixer splits it over both motors and reports
+ * what it could apply, and the PID integrator tracks that (back-calculation).
+ */
+
+typedef enum
+{
+    CONTROL_CASCADE,
+    CONTROL_PID,
+    CONTROL_LQR
+} ControlLaw;
+
+typedef enum
+{
+    CONTROL_COMPLEMENTARY,
+    CONTROL_KALMAN,
+    CONTROL_KALMAN_STEADY_STATE
+} ControlFilter;
+
+/* Range of the control loop rate, the rate of the tick */
+#define CONTROL_RATE_MIN_HZ 10
+#define CONTROL_RATE_MAX_HZ 2000
+
+/* Motor commands, the range of Motor_Write() */
+#define CONTROL_MOTOR_MAX 1000.0f
+
+/* N of thrust per unit of dF, the thrust per command of the linear mixing the
+ * gains were first tuned with */
+#define CONTROL_THRUST_PER_UNIT 0.01f
+
+typedef struct
+{
+    ControlLaw law;
+    ControlFilter filter;
+    float setpoint;            /* deg */
+    float cascade_a;           /* outer angle loop gain */
+    float cascade_b;           /* inner rate loop gain */
+    float complementary_alpha; /* for the period of the angle step */
+
+    PIDController *pid;
+    KalmanFilter *kalman;
+    LQR_Controller *lqr;
+    Mixer *mixer;
+
+    /* Shared by the steps */
+    float theta;      /* angle estimate, rad, propagated with the gyro between two angle steps */
+    float theta_acc;  /* angle from the accelerometer, rad */
+    float qf;         /* pitch rate, rad/s */
+    float angle_term; /* cascade: output of the outer angle loop */
+    float dF;         /* differential force command */
+    float dF_applied; /* the part of dF the motors could make at the last mix */
+
+    float motor_rpm[2]; /* measured left and right motor speeds, RPM, 0 if unknown */
+} Control;
+
+/* rate in rad/s, dt the time it was measured over */
+void Control_Rate(Control *control, float rate, float dt);
+
+/* Raw accelerometer axes.  Without fuse the estimate stays the gyro integral. */
+void Control_Estimate(Control *control, short ax, short ay, short az, int fuse);
+void Control_Law(Control *control);
+
+void Control_Mix(Control *control, float *left, float *right);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef DEFERRED_H
+#define DEFERRED_H
+
+#include <stdint.h>
+
+/*
+ * Work deferred to the PendSV exception, the lowest priority of the system
+ * (see the priority plan in main.h).  An interrupt handler posts a function
+ * and returns at once.  The function runs as soon as no other interrupt is
+ * active, before the main loop resumes, and every interrupt can preempt it.
+ */
+
+typedef void (*DeferredFunction)(void);
+
+/* Can be called from any context.  Returns 0 if the queue was full and the
+ * function was dropped. */
+int Deferred_Post(DeferredFunction function);
+
+/* Call from PendSV_Handler only */
+void Deferred_Run(void);
+
+uint32_t Deferred_Dropped(void);
+
+#endif
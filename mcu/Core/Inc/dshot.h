@@ -0,0 +1,64 @@
+#ifndef DSHOT_H
+#define DSHOT_H
+
+#include <stdint.h>
+
+/*
+ * DShot frame encoding and bidirectional eRPM reply decoding.
+ *
+ * Nothing in here touches a peripheral, motor.c moves the bits and the host
+ * tools can run the same code.
+ *
+ * A frame is 16 bits sent most significant first: an 11-bit value (0 stop,
+ * 1 to 47 ESC commands, 48 to 2047 throttle), the telemetry request bit and a
+ * 4-bit checksum, the XOR of the three nibbles above it.  Every bit is a
+ * pulse of the same period, 3/4 of it long for a 1 and 3/8 for a 0.
+ *
+ * In bidirectional mode the line is inverted, idle high, the checksum is
+ * inverted too, and after every frame the ESC drives the line back with its
+ * eRPM: 21 bits at 5/4 of the frame bit rate.  The reply carries 16 bits
+ * (3-bit exponent, 9-bit mantissa of the electrical period in us, and an
+ * inverted checksum), each nibble mapped to a 5-bit GCR code with at most two
+ * zeros in a row, and every 1 of the GCR word sent as a level change.
+ */
+
+#define DSHOT_FRAME_BITS 16
+#define DSHOT_REPLY_BITS 21
+
+#define DSHOT_THROTTLE_MIN 48
+#define DSHOT_THROTTLE_MAX 2047
+
+/* Reply of a stopped motor, the longest period the reply can carry */
+#define DSHOT_PERIOD_STOPPED 0xFFFFFFFFu
+
+/* Throttle value of a command in [0, command_max]: 0 stops the motor, anything
+ * above spreads over DSHOT_THROTTLE_MIN to DSHOT_THROTTLE_MAX.  The values 1
+ * to 47 are ESC commands and never come out. */
+uint16_t Dshot_Throttle(float command, float command_max);
+
+/* Mechanical speed in RPM of a motor with poles magnet poles, from the
+ * electrical period of its reply.  0 for DSHOT_PERIOD_STOPPED. */
+float Dshot_Rpm(uint32_t period_us, uint32_t poles);
+
+/* 16-bit frame for an 11-bit value */
+uint16_t Dshot_Frame(uint16_t value, int telemetry, int inverted);
+
+/* Timer compare values of the frame bits, most significant first, one every
+ * stride entries of slots */
+void Dshot_Encode(uint16_t frame, uint32_t one, uint32_t zero, uint32_t *slots, uint32_t stride);
+
+/*
+ * Levels of the reply from samples of the line, bit pin of each sample, taken
+ * at samples_per_bit_q8 / 256 samples per reply bit.  The reply is the first
+ * falling edge from start on.  Each run between two edges is rounded to a
+ * number of bits, so the clock of the ESC is tracked edge to edge.  Returns 0
+ * if there is no reply in the samples.
+ */
+int Dshot_Levels(const uint16_t *samples, uint32_t count, uint32_t start, uint32_t pin,
+                 uint32_t samples_per_bit_q8, uint32_t *levels);
+
+/* Electrical period in us, or DSHOT_PERIOD_STOPPED, from the 21 levels.  Returns 0
+ * for a GCR code that doesn't exist or a wrong checksum. */
+int Dshot_DecodeReply(uint32_t levels, uint32_t *period_us);
+
+#endif
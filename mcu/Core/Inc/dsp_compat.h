@@ -0,0 +1,32 @@
+#ifndef DSP_COMPAT_H
+#define DSP_COMPAT_H
+
+/*
+ * The part of CMSIS the control sources (kalman.c, ilqr.c, PID.c) rely on, so
+ * they also compile unchanged with a host compiler, for tests, sanitizer runs
+ * and simulation (see the host build of the top-level CMakeLists.txt).
+ *
+ * On the target this is arm_math.h and the barrier is DMB.  On the host
+ * float32_t is a plain float and the barrier a C11 fence.  No arm_mat_*_f32
+ * function is needed: the filter and the DARE solvers work on fixed size
+ * arrays.
+ */
+
+#if defined(__arm__)
+
+#include "arm_math.h"
+
+/* Orders the writes to a double buffer before the store that publishes it */
+#define DSP_BARRIER() __DMB()
+
+#else
+
+#include <stdint.h>
+
+typedef float float32_t;
+
+#define DSP_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#endif
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+/*
+ * Single-precision math for the control path.
+ *
+ * The Cortex-M4 FPU only does single precision: any double in an expression
+ * (an M_PI, a 0.5 literal, atan2() instead of atan2f()) turns it into soft-float
+ * library calls costing hundreds of cycles each.  These kernels take and return
+ * floats only.  The host build makes double promotions and silent double to
+ * float narrowing errors on the firmware sources; the pragmas below are only a
+ * backup for the STM32CubeIDE build, whose flags are not in the tree, and cover
+ * the files that include this header.
+ *
+ * Maximum absolute errors, checked against libm in double precision:
+ *   FastMath_Atan2f  2.0e-6 rad over the whole circle
+ *   FastMath_Asinf   2.0e-6 rad over [-1, 1]
+ *   FastMath_Sqrtf   correctly rounded (VSQRT.F32)
+ */
+
+#include <math.h>
+
+#pragma GCC diagnostic error "-Wdouble-promotion"
+#pragma GCC diagnostic error "-Wfloat-conversion"
+
+#define FASTMATH_PI 3.14159265f
+#define FASTMATH_PI_2 1.57079633f
+
+#define FASTMATH_RAD_TO_DEG (180.0f / FASTMATH_PI)
+#define FASTMATH_DEG_TO_RAD (FASTMATH_PI / 180.0f)
+
+/* VSQRT.F32 is exact and takes 14 cycles, sqrtf() would also go through the
+ * errno handling of the library for negative inputs */
+static inline float FastMath_Sqrtf(float x)
+{
+#if defined(__ARM_FP) && (__ARM_FP & 4)
+    float root;
+    __asm__("vsqrt.f32 %0, %1" : "=t"(root) : "t"(x));
+    return root;
+#else
+    return sqrtf(x);
+#endif
+}
+
+/* atan(z) for |z| <= 1, odd minimax polynomial of degree 11 */
+static inline float FastMath_AtanUnit(float z)
+{
+    const float z2 = z * z;
+    return z * (0.99997726f +
+                z2 * (-0.33262347f +
+                      z2 * (0.19354346f +
+                            z2 * (-0.11643287f +
+                                  z2 * (0.05265332f +
+                                        z2 * -0.01172120f)))));
+}
+
+/* Same conventions as atan2f(), one division and a polynomial.  Returns 0 for
+ * (0, 0). */
+static inline float FastMath_Atan2f(float y, float x)
+{
+    const float ax = fabsf(x);
+    const float ay = fabsf(y);
+    if (ax == 0.0f && ay == 0.0f)
+        return 0.0f;
+
+    // Fold onto the first octant so the polynomial argument stays in [0, 1]
+    float angle;
+    if (ay <= ax)
+        angle = FastMath_AtanUnit(ay / ax);
+    else
+        angle = FASTMATH_PI_2 - FastMath_AtanUnit(ax / ay);
+
+    if (x < 0.0f)
+        angle = FASTMATH_PI - angle;
+    return y < 0.0f ? -angle : angle;
+}
+
+/* asin(x) = atan2(x, sqrt(1 - x^2)), x is clamped to [-1, 1] */
+static inline float FastMath_Asinf(float x)
+{
+    x = x > 1.0f ? 1.0f : x;
+    x = x < -1.0f ? -1.0f : x;
+    return FastMath_Atan2f(x, FastMath_Sqrtf(1.0f - x * x));
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef GYRO_BIAS_H
+#define GYRO_BIAS_H
+
+#include <stdint.h>
+
+/*
+ * Zero-rate offset of the gyro, rad/s per axis, stepped once per control tick
+ * with the gyro rate of the tick.
+ *
+ * At boot the bias is the average of the first GyroBias.samples gyro samples.
+ * The arm has to stay still for it: a sample set further than motion_rate
+ * from the average so far is motion, the average is thrown away and starts
+ * over with the next set.  Until the average completes the bias is the one
+ * the calibration was started from, the one stored by the last boot.
+ *
+ * Afterwards the bias follows the slow drift of the offset with temperature.
+ * Once every axis has stayed within rest_rate of the bias for rest_time_s the
+ * arm is taken to be at rest, and the bias low-passes the rate with the time
+ * constant tracking_tau_s.  A real rotation slower than rest_rate held for
+ * that long would be taken in too, the time constant keeps it small.
+ */
+
+/* Parameters of the rig, for the firmware and the simulator.  Half a second
+ * of samples fits twice in the stop of the arming sequence, before the spin-up
+ * shakes the arm. */
+#define GYRO_BIAS_CALIBRATION_S 0.5f
+#define GYRO_BIAS_MOTION_RAD_S 0.05f
+#define GYRO_BIAS_REST_RAD_S 0.02f
+#define GYRO_BIAS_REST_S 0.5f
+#define GYRO_BIAS_TRACKING_TAU_S 20.0f
+/* Variance of the Kalman bias state once the calibration is subtracted, (rad/s)^2 */
+#define GYRO_BIAS_RESIDUAL_VARIANCE 1e-4f
+
+typedef enum
+{
+    GYRO_BIAS_CALIBRATING,
+    GYRO_BIAS_TRACKING
+} GyroBiasState;
+
+typedef struct
+{
+    /* Parameters */
+    uint32_t samples;     /* gyro samples averaged by the calibration */
+    float motion_rate;    /* rad/s */
+    float rest_rate;      /* rad/s */
+    float rest_time_s;
+    float tracking_tau_s;
+
+    /* State */
+    GyroBiasState state;
+    float bias[3];
+    float sum[3];
+    uint32_t count;
+    uint32_t restarts; /* calibrations started over on motion */
+    float rest_s;
+
+} GyroBias;
+
+/* Starts the calibration from the bias, or from 0 if it is NULL */
+void GyroBias_Init(GyroBias *gb, const float bias[3]);
+
+/* rate: average of the count gyro samples read over dt, count 0 if there was
+ * no new one.  Returns 1 on the tick the calibration completes. */
+int GyroBias_Update(GyroBias *gb, const float rate[3], uint32_t count, float dt);
+
+#endif
@@ -1,20 +1,37 @@
-#include <arm_math.h>
+#ifndef ILQR_H
+#define ILQR_H
+
+#include "dsp_compat.h"
 
 #define NUMBER_STATES 2
-#define NUMBER_CONTROLS 2
-#define EPSILON 1e-6
-#define MAX_ITER 1000
+#define NUMBER_CONTROLS 1
+#define EPSILON 1e-6f
+#define MAX_ITER 10000
 
 typedef struct
 {
-    float state[NUMBER_STATES];
-    float u_rest[NUMBER_CONTROLS];
-    arm_matrix_instance_f32 Q;
-    arm_matrix_instance_f32 R;
-    arm_matrix_instance_f32 K;
-    arm_matrix_instance_f32 A;
-    arm_matrix_instance_f32 B;
+    /* Cost weights: Q = diag(q_angle, q_rate), R = r */
+    float q_angle;
+    float q_rate;
+    float r;
+
+    /* Sample time (in seconds) */
+    float T;
+
+    /* Double-buffered state feedback gain: the ISR only reads K[active],
+     * LQR_synthesize only writes the other one and then flips active. */
+    float K[2][NUMBER_STATES];
+    volatile uint32_t active;
+
 } LQR_Controller;
 
-void LQR_init(LQR_Controller *lqr);
-void LQR_update(LQR_Controller *lqr, float state[NUMBER_STATES], float control[NUMBER_CONTROLS]);
+/* Both return the iterations of the Riccati solver, or -1 if it did not
+ * converge and the gain was not changed */
+int LQR_init(LQR_Controller *lqr);
+int LQR_synthesize(LQR_Controller *lqr);
+/* State feedback u = K x for the state {angle in rad, rate in rad/s}.  u is
+ * the differential thrust in newtons, the input of B in LQR_solve_dare(), it
+ * acts on the arm through the lever L. */
+float LQR_update(LQR_Controller *lqr, const float state[NUMBER_STATES]);
+
+#endif
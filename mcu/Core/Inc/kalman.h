@@ -1,7 +1,58 @@
-#include "arm_math.h"
+#ifndef KALMAN_H
+#define KALMAN_H
+
+#include "dsp_compat.h"
 
 #define NUM_STATES 3
 #define NUM_MEASUREMENTS 2
 #define NUM_INPUTS 2
 
-float kalman_filter(float32_t y_data[NUM_MEASUREMENTS], float32_t u_data[NUM_INPUTS]);
+#define KALMAN_SS_EPSILON 1e-7f
+#define KALMAN_SS_MAX_ITER 20000
+
+/* Constant model terms, derived from the tuning parameters outside the ISR */
+typedef struct
+{
+    float32_t T;
+    float32_t Q[NUM_STATES * NUM_STATES];
+    float32_t R[NUM_MEASUREMENTS];
+    float32_t G_rate;  /* G(0,0): gyro rate to angle */
+    float32_t G_force; /* G(1,1): differential force to velocity */
+
+    /* Converged (steady-state) Kalman gain, NUM_STATES x NUM_MEASUREMENTS */
+    float32_t K[NUM_STATES * NUM_MEASUREMENTS];
+
+} KalmanModel;
+
+typedef struct
+{
+    /* Process noise spectral densities (angle, velocity, gyro bias) */
+    float32_t a;
+    float32_t b;
+    float32_t c;
+
+    /* Measurement noise variances (accelerometer angle, gyro rate) */
+    float32_t r_angle;
+    float32_t r_rate;
+
+    /* Sample time (in seconds) */
+    float32_t T;
+
+    /* Double-buffered model: the ISR only reads model[active], the main loop
+     * only writes the other one and then flips active. */
+    KalmanModel model[2];
+    volatile uint32_t active;
+
+    /* Filter "memory": state [angle; velocity; gyro bias] and its covariance */
+    float32_t x[NUM_STATES];
+    float32_t P[NUM_STATES * NUM_STATES];
+
+} KalmanFilter;
+
+int KalmanFilter_Init(KalmanFilter *kf);
+int KalmanFilter_Synthesize(KalmanFilter *kf);
+void KalmanFilter_ResetBias(KalmanFilter *kf, float32_t variance);
+float KalmanFilter_Update(KalmanFilter *kf, const float32_t y[NUM_MEASUREMENTS], const float32_t u[NUM_INPUTS]);
+float KalmanFilter_UpdateSteadyState(KalmanFilter *kf, const float32_t y[NUM_MEASUREMENTS], const float32_t u[NUM_INPUTS]);
+
+#endif
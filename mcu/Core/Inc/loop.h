@@ -0,0 +1,61 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdint.h>
+#include "control.h"
+#include "gyro_bias.h"
+#include "arming.h"
+#include "safety.h"
+#include "sensors.h"
+
+/*
+ * Body of the control tick, from the sensor set to the motor commands.
+ *
+ * The scheduler tasks of main.c and the closed loop simulator both run it, so
+ * the simulated tick is the firmware one: gyro bias calibration and
+ * correction, rate loop and mixing, the arming sequence, the estimator and the
+ * control law, and the gating of the motors by the arming state and the safety
+ * mode.  Nothing in here touches a peripheral or a clock: the caller passes
+ * the sensor set, the time and the safety mode in, and writes the commands to
+ * the motors when a step says so.
+ *
+ * Every tick runs Loop_Rate() then Loop_Arming(), and every angle period
+ * Loop_Estimate() then Loop_Law(), in that order.
+ */
+
+/* Events of a step */
+#define LOOP_WRITE_MOTORS (1u << 0)         /* left and right go to the motors */
+#define LOOP_GYRO_BIAS_CALIBRATED (1u << 1) /* the startup calibration completed, the bias can be stored */
+#define LOOP_ARMED (1u << 2)                /* the ESCs armed, the rate step drives the motors from now on */
+
+typedef struct
+{
+    Control *control;
+    GyroBias *gyro_bias;
+    Arming *arming;
+
+    /* Variance of the Kalman bias state once the calibration is subtracted, (rad/s)^2 */
+    float gyro_bias_residual_variance;
+
+    /* Nominal tick period, s, the integration step when no new gyro sample came in */
+    float tick_period_s;
+
+    /* State */
+    uint32_t last_gyro_us;
+    float left; /* motor commands of the last step, after the safety cut */
+    float right;
+} Loop;
+
+/* Rate task: bias, rate loop and mixing.  The motors take the commands once
+ * the ESCs are armed. */
+uint32_t Loop_Rate(Loop *loop, const SensorSet *set, SafetyMode mode);
+
+/* Arming task: the commands of the sequence, until the ESCs are armed */
+uint32_t Loop_Arming(Loop *loop, uint32_t now_us, SafetyMode mode);
+
+/* Angle task: accelerometer angle and estimator, then the control law once
+ * the motors run */
+void Loop_Estimate(Loop *loop, const SensorSet *set, SafetyMode mode);
+void Loop_Law(Loop *loop);
+
+#endif
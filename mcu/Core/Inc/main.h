@@ -41,6 +41,27 @@ extern "C" {
 
 /* Exported constants --------------------------------------------------------*/
 /* USER CODE BEGIN EC */
+/* Interrupt priority plan.  NVIC_PRIORITYGROUP_4: all four bits are preemption
+ * levels, 0 is the highest.
+ *   0   TIM2: the control tick and the start of the sensor rounds.  DMA1
+ *       stream 6: end of a DShot frame, the lines turn around for the reply.
+ *       CONTROL_TICK_IRQn: the control tick in data-ready mode, pended by the
+ *       gyro completion.
+ *   1   sensor buses: gyro SPI DMA, I2C1 event, error and DMA, IMU EXTI lines.
+ *       DMA2 stream 5: end of the DShot reply sampling, decoding.
+ *   2   USART6 and its DMA streams: queue commands, move telemetry
+ *   3   SysTick
+ *   15  PendSV: command parsing and parameter changes, see deferred.h
+ * Everything else, the gain synthesis and the reports, runs in the main loop. */
+#define IRQ_PRIORITY_CONTROL 0
+#define IRQ_PRIORITY_SENSOR_BUS 1
+#define IRQ_PRIORITY_UART 2
+#define IRQ_PRIORITY_SYSTICK 3
+#define IRQ_PRIORITY_DEFERRED 15
+
+/* SPI5 isn't wired on the board, its vector only ever fires from software */
+#define CONTROL_TICK_IRQn SPI5_IRQn
+#define CONTROL_TICK_IRQHandler SPI5_IRQHandler
 
 /* USER CODE END EC */
 
@@ -0,0 +1,43 @@
+#ifndef MIXER_H
+#define MIXER_H
+
+/*
+ * Thrust allocation of the two motors.
+ *
+ * The controllers ask for a collective thrust and a differential, right minus
+ * left, both in N.  The differential is split evenly between the motors.  If a
+ * motor would leave its thrust range, both motors shift together so that the
+ * differential, which turns the arm, is kept whole.  Only when no shift can
+ * hold it is the differential itself clipped, and the allocation returns what
+ * was actually applied for the controllers' anti-windup.
+ *
+ * Thrust is roughly the square of the propeller speed, so it isn't linear in
+ * the motor command.  Each motor has a thrust stand calibration,
+ *     thrust = linear * command + quadratic * command^2,
+ * and Mixer_Init() tabulates its inverse at evenly spaced thrusts.  A command
+ * is then one multiply, one table index and one interpolation.
+ */
+
+#define MIXER_TABLE_POINTS 33
+
+/* Thrust stand fit of one motor, N against the command range of Motor_Write() */
+typedef struct
+{
+    float linear;
+    float quadratic;
+} MixerCalibration;
+
+typedef struct
+{
+    float max_thrust[2];                    /* N at the top of the command range */
+    float points_per_newton[2];             /* table points per N of thrust */
+    float command[2][MIXER_TABLE_POINTS];   /* command for each tabulated thrust */
+} Mixer;
+
+/* left then right */
+void Mixer_Init(Mixer *mixer, const MixerCalibration calibration[2]);
+
+/* Motor commands for the thrusts, N.  Returns the differential applied. */
+float Mixer_Allocate(const Mixer *mixer, float collective, float differential, float *left, float *right);
+
+#endif
@@ -1,4 +1,3 @@
-#define L 0.4
-#define J 0.04
-#define Ts 0.1f    // Sampling time
+#define L 0.4f
+#define J 0.04f
 #define sig_p 0.1f // Measurement noise
\ No newline at end of file
@@ -2,9 +2,94 @@
  * motor.h
  *
  *  Created on: May 29, 2024
- *      
+ *
  */
+#ifndef MOTOR_H
+#define MOTOR_H
+
 #include <stdint.h>
 
-void l_motor(uint32_t angle);
-void r_motor(uint32_t angle);
+/*
+ * ESC outputs on TIM4: channel 2 drives the left motor, channel 1 the right
+ * one.
+ *
+ * For the analog protocols the command range maps linearly onto the pulse
+ * width range of the protocol, rounded to the nearest count of the timer
+ * clock.  The compare and reload registers are preloaded, so a new command
+ * only takes effect at the start of a pulse and never cuts one short or
+ * stretches it.
+ *
+ * Standard PWM runs free at MOTOR_PWM_FRAME_HZ.  The OneShot protocols start
+ * a pulse on every Motor_Write(), so the ESCs get each command of the control
+ * tick as soon as it is computed.  If the writes stop, the timer keeps
+ * repeating the last pulse once per counter wrap.
+ *
+ * The DShot protocols send a frame for each Motor_Send() (see dshot.h).  The
+ * timer period is one bit, and every update event has DMA1 stream 6 burst the
+ * compares of the next bit of both channels from a buffer, so a frame costs
+ * one buffer fill.  If the frames stop, the ESCs stop the motors.
+ *
+ * Bidirectional DShot has the ESCs answer every frame with the motor speed on
+ * the same line.  When the frame is out the pins turn into inputs with a
+ * pull-up, TIM1 has DMA2 stream 5 copy the GPIOD input register into a buffer
+ * at three samples per reply bit, and the replies are decoded when the buffer
+ * is full.  The pins are outputs again at the next Motor_Send().
+ */
+
+typedef enum
+{
+    MOTOR_PWM,        /* 1000 to 2000 us */
+    MOTOR_ONESHOT125, /* 125 to 250 us */
+    MOTOR_MULTISHOT,  /* 5 to 25 us */
+    MOTOR_DSHOT150,   /* 150 kbit/s */
+    MOTOR_DSHOT300,   /* 300 kbit/s */
+    MOTOR_DSHOT600    /* 600 kbit/s */
+} MotorProtocol;
+
+typedef struct
+{
+    uint32_t frames;  /* DShot frames sent */
+    uint32_t replies; /* valid eRPM replies */
+    uint32_t errors;  /* missing or corrupt replies, DMA errors */
+    uint32_t skipped; /* Motor_Send() calls with the last frame still going */
+} MotorCounters;
+
+/* Motor commands: 0 is the low end of the pulse range, MOTOR_COMMAND_MAX the
+ * top.  In DShot 0 is the stop value and anything above spreads over the 2000
+ * throttle steps. */
+#define MOTOR_COMMAND_MAX 1000.0f
+
+/* Frame rate of standard PWM, the fastest most PWM ESCs take */
+#define MOTOR_PWM_FRAME_HZ 400
+
+/* Magnet poles of the motors, the eRPM reply counts electrical revolutions */
+#define MOTOR_POLES 14
+
+/* Reprograms TIM4, set up by MX_TIM4_Init(), for the protocol.  Call before
+ * the channels are started.  bidirectional asks DShot ESCs for the motor
+ * speed, the other protocols ignore it. */
+void Motor_Init(MotorProtocol protocol, int bidirectional);
+
+/* Commands out of range are clamped */
+void Motor_Write(float left, float right);
+
+/* Sends the last written commands as a DShot frame.  Nothing to do for the
+ * analog protocols. */
+void Motor_Send(void);
+
+MotorProtocol Motor_Protocol(void);
+
+/* 1 for the DShot protocols */
+int Motor_Digital(void);
+
+/* Timer counts, or DShot throttle steps, per unit of command, the resolution
+ * of the outputs */
+float Motor_CountsPerCommand(void);
+
+/* Mechanical speed of the left and right motors from the last valid replies,
+ * RPM.  0 without bidirectional DShot. */
+void Motor_Rpm(float rpm[2]);
+
+void Motor_Counters(MotorCounters *counters);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+
+/* Stages of the control tick, in execution order: the rate task marks the
+ * sensors and the motors on every tick, the angle task the filter and the
+ * controller on its own ticks.  PROFILE_TOTAL covers the whole tick and
+ * PROFILE_PERIOD the time between two tick entries.  PROFILE_LATENCY is the
+ * sensor-to-actuator latency, from the start of the oldest sensor read to the
+ * motor outputs being written. */
+typedef enum
+{
+    PROFILE_SENSORS,
+    PROFILE_MOTORS,
+    PROFILE_FILTER,
+    PROFILE_CONTROLLER,
+    PROFILE_TOTAL,
+    PROFILE_PERIOD,
+    PROFILE_LATENCY,
+    PROFILE_NUM_STAGES
+} ProfileStage;
+
+/* Boot phases, each marked once when it ends, in microseconds from
+ * Profiler_Init() right after the clock setup */
+typedef enum
+{
+    BOOT_PERIPHERALS,     /* CubeMX peripheral init */
+    BOOT_SENSORS,         /* sensor drivers configured, first round started */
+    BOOT_CONTROL,         /* settings and controllers, the tick timer is running */
+    BOOT_FIRST_TICK,      /* first control tick */
+    BOOT_SETTINGS_ERASED, /* full settings log erased in the arming stop, if it was */
+    BOOT_ARMED,           /* ESCs armed, the rate task has the motors */
+    BOOT_NUM_PHASES
+} BootPhase;
+
+/* Time to the first control tick the boot has to stay under */
+#define BOOT_FIRST_TICK_TARGET_US 20000
+
+/* Log-linear histogram: PROFILE_SUB_BINS bins per power of two of cycles */
+#define PROFILE_SUB_BITS 2
+#define PROFILE_SUB_BINS (1 << PROFILE_SUB_BITS)
+#define PROFILE_NUM_BINS (32 * PROFILE_SUB_BINS)
+
+typedef struct
+{
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t count;
+    uint32_t hist[PROFILE_NUM_BINS];
+} ProfileStat;
+
+void Profiler_Init(void);
+void Profiler_Reset(void);
+
+void Profiler_TickStart(void);
+void Profiler_Mark(ProfileStage stage);
+void Profiler_TickEnd(void);
+void Profiler_Latency(uint32_t sample_us);
+
+void Profiler_BootMark(BootPhase phase);
+
+void Profiler_Report(void);
+
+uint32_t Profiler_Micros(void);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef SAFETY_H
+#define SAFETY_H
+
+#include <stdint.h>
+
+/*
+ * Deadline supervision and degraded modes of the control loop.
+ *
+ * Every control tick is timed against its period.  A tick that ran longer is
+ * an overrun, and SAFETY_MAX_CONSECUTIVE_OVERRUNS of them in a row cut the
+ * motors.  The independent watchdog is only refreshed at the end of a tick
+ * that met its deadline, so a loop that stops ticking, or never finishes a
+ * tick, resets the MCU.
+ *
+ * Sensor freshness is checked from the TIM2 update, which keeps running in
+ * both sensor modes: without accelerometer samples the estimator runs on the
+ * gyro alone until they come back, without gyro samples the motors are cut.
+ * The motor cut is latched until the next reset.
+ */
+
+#define SAFETY_MAX_CONSECUTIVE_OVERRUNS 5
+
+typedef enum
+{
+    SAFETY_NORMAL,
+    SAFETY_GYRO_ONLY,
+    SAFETY_MOTOR_CUT
+} SafetyMode;
+
+typedef struct
+{
+    uint32_t tick_overruns;     /* ticks that ran past their period */
+    uint32_t gyro_only_entries; /* times the accelerometer went stale */
+    uint8_t watchdog_reset;     /* the last reset came from the watchdog */
+} SafetyCounters;
+
+/* Records the cause of the last reset.  Call once, early. */
+void Safety_Init(void);
+
+/* Starts the watchdog, which can't be stopped, and the sensor supervision.
+ * Call right before the control tick starts. */
+void Safety_Start(void);
+
+/* Period of the control tick and the time each sensor takes to fill its FIFO
+ * to the watermark, the watermark times the sample period.  They set the
+ * overrun deadline and how old a sample can get before it is stale. */
+void Safety_SetTickPeriod(uint32_t tick_us, uint32_t gyro_window_us, uint32_t accelerometer_window_us);
+
+/* Call from the TIM2 update, before the tick */
+void Safety_CheckSensors(void);
+
+/* Call at the end of every control tick with its duration */
+void Safety_TickEnd(uint32_t cycles);
+
+/* Around a stall of the tick, a flash erase: the watchdog is stretched over
+ * hold_ms, and on resume it is back to its period and the sensors get their
+ * stale time again, counted from the resume.  Call both with the interrupts
+ * masked, so the sensor check can't run in between. */
+void Safety_Suspend(uint32_t hold_ms);
+void Safety_Resume(void);
+
+SafetyMode Safety_Mode(void);
+int Safety_WatchdogReset(void);
+void Safety_Counters(SafetyCounters *counters);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+/*
+ * Cooperative multi-rate scheduler.
+ *
+ * Scheduler_Tick() runs once per base tick, the control rate.  Each task is
+ * released every period ticks, starting at its offset, so tasks of the same
+ * period can be spread over different ticks.  Nothing is ever preempted by the
+ * scheduler, every task runs to completion.
+ *
+ * SCHEDULER_TICK tasks run inside Scheduler_Tick(), in table order, so the
+ * order of the table is their priority.  SCHEDULER_BACKGROUND tasks are only
+ * marked pending by the tick and run from the main loop by
+ * Scheduler_RunPending(), again highest first.
+ *
+ * The deadline of a release is the next one.  A deadline miss is a tick task
+ * that finished after it, or a background task that was released again before
+ * the previous release had finished.  An overrun is a run that took longer
+ * than the task budget.
+ */
+
+typedef void (*SchedulerFunction)(void);
+
+typedef enum
+{
+    SCHEDULER_TICK,
+    SCHEDULER_BACKGROUND
+} SchedulerContext;
+
+typedef struct
+{
+    const char *name;
+    SchedulerFunction run;
+    SchedulerContext context;
+    uint32_t period;    /* in base ticks */
+    uint32_t offset;    /* tick of the first release, less than period */
+    uint32_t budget_us; /* expected worst case execution time */
+
+    /* Owned by the scheduler */
+    volatile uint32_t pending;
+    volatile uint32_t running;
+    uint32_t budget_cycles;
+    uint32_t runs;
+    uint32_t misses;
+    uint32_t overruns;
+    uint32_t max_cycles;
+} SchedulerTask;
+
+void Scheduler_Init(SchedulerTask *tasks, uint32_t count, uint32_t tick_us);
+void Scheduler_SetTickPeriod(uint32_t tick_us);
+void Scheduler_SetPeriod(SchedulerTask *task, uint32_t period);
+
+void Scheduler_Tick(void);
+void Scheduler_RunPending(void);
+
+void Scheduler_Report(void);
+
+#endif
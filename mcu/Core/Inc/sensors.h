@@ -0,0 +1,51 @@
+#ifndef SENSORS_H
+#define SENSORS_H
+
+#include <stdint.h>
+#include "Gyro.h"
+#include "Accelerometer.h"
+
+/*
+ * Pipelined IMU acquisition.
+ *
+ * The gyro and accelerometer reads of one round run on their buses in the
+ * background, each draining and averaging its sensor's FIFO.  When the last
+ * one lands, the pair is published as a SensorSet in a ping-pong buffer, so
+ * the control step always reads the most recent complete set without waiting
+ * and never sees a half written one.
+ *
+ * In timer mode a round is started a little ahead of each control tick (see
+ * Sensors_StartRound).  In data-ready mode the sensors start their own reads
+ * from their FIFO watermark lines and every gyro read publishes a set with the
+ * latest accelerometer sample.
+ */
+
+typedef enum
+{
+    SENSORS_TIMER,
+    SENSORS_DATA_READY
+} SensorsMode;
+
+typedef struct
+{
+    GyroSample gyro;
+    AccelerometerSample accelerometer;
+    uint32_t timestamp_us; /* oldest sample of the set, the start of its latency */
+    uint32_t seq;          /* incremented for every set */
+} SensorSet;
+
+/* Called from interrupt context every time a set is published */
+typedef void (*SensorsCallback)(void);
+
+void Sensors_Init(SensorsCallback callback);
+void Sensors_SetMode(SensorsMode mode);
+SensorsMode Sensors_GetMode(void);
+void Sensors_SetGyroWatermark(uint32_t watermark);
+
+void Sensors_StartRound(void);
+void Sensors_DataReady(uint16_t pin);
+void Sensors_CheckBuses(void);
+
+void Sensors_Latest(SensorSet *set);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <stdint.h>
+
+/*
+ * Settings kept across power cycles, in the last flash sector (sector 7,
+ * 128 KB at 0x08060000, left out of the FLASH region of the linker script).
+ *
+ * The sector is a log of records: every save programs a new record after the
+ * last one and the load takes the last record with a valid CRC, so a save cut
+ * short by a power loss leaves the previous settings in place.  Programming
+ * a record stalls the flash for a few tens of microseconds, erasing the sector
+ * for a second or more, so a full sector is left as it is by the boot and only
+ * erased by Settings_Compact(), when the caller can afford the stall.  Every
+ * record holds its own length: a record written before fields were added to
+ * the end of Settings still loads, the fields it lacks keep their defaults.
+ */
+
+/* Longest erase of the 128 KB sector, 2 s at 32-bit parallelism, with margin */
+#define SETTINGS_ERASE_MAX_MS 4000
+
+#define SETTINGS_ESC_CALIBRATED (1u << 0) /* the throttle range of the ESCs is calibrated */
+#define SETTINGS_GYRO_BIAS (1u << 1)      /* gyro_bias holds a calibration */
+
+/* New fields go at the end, with a flag if 0 isn't a usable default */
+typedef struct
+{
+    uint32_t flags;
+    float gyro_bias[3]; /* rad/s, see gyro_bias.h */
+} Settings;
+
+/* Loads the last record.  Call once at boot, before the control tick starts. */
+void Settings_Init(void);
+
+const Settings *Settings_Get(void);
+
+/* Appends the settings to the log.  Returns 0 if they couldn't be written, a
+ * full sector stays full until Settings_Compact(). */
+int Settings_Save(const Settings *settings);
+
+/* 1 when the sector has no room left for a record */
+int Settings_Full(void);
+
+/* Erases the sector and starts the log over with the current settings.  Every
+ * fetch from the flash stalls for up to SETTINGS_ERASE_MAX_MS meanwhile, the
+ * control tick and the watchdog refresh included.  Returns 0 if the erase or
+ * the record failed. */
+int Settings_Compact(void);
+
+#endif
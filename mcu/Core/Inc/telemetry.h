@@ -0,0 +1,65 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+/*
+ * Binary telemetry frames sent over the serial link.
+ *
+ * Each frame is
+ *     COBS( header | payload | crc16 ) 0x00
+ * where the header and payload are the packed little-endian structs below and
+ * crc16 is CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) of header | payload,
+ * sent low byte first.  COBS removes every 0x00 from the frame so the zero byte
+ * is an unambiguous delimiter and the receiver resynchronises after any loss.
+ */
+
+#define TELEMETRY_SAMPLE 0x01 /* payload: TelemetrySample */
+#define TELEMETRY_TEXT 0x02   /* payload: ASCII text, e.g. printf output */
+#define TELEMETRY_HEALTH 0x03 /* payload: TelemetryHealth */
+
+#define TELEMETRY_MAX_PAYLOAD 96
+
+typedef struct __attribute__((packed))
+{
+    uint8_t type;
+    uint16_t seq;          /* incremented for every frame, gaps are lost frames */
+    uint32_t timestamp_us; /* free-running microsecond time of the frame */
+} TelemetryHeader;
+
+/* State of one control loop tick, all angles in rad and rates in rad/s */
+typedef struct __attribute__((packed))
+{
+    float angle;    /* accelerometer angle */
+    float rate;     /* gyro rate */
+    float estimate; /* estimator output */
+    float control;  /* controller output dF */
+    float left_motor;
+    float right_motor;
+    float left_rpm; /* measured by bidirectional DShot, 0 without it */
+    float right_rpm;
+} TelemetrySample;
+
+/* Safety state and fault counters, all counted since boot */
+typedef struct __attribute__((packed))
+{
+    uint8_t mode;           /* SafetyMode */
+    uint8_t watchdog_reset; /* 1 if the last reset came from the watchdog */
+    uint32_t tick_overruns;
+    uint32_t gyro_only_entries;
+    uint32_t gyro_timeouts;
+    uint32_t i2c_errors;
+    uint32_t i2c_timeouts;
+    uint32_t i2c_recoveries;
+    uint32_t esc_errors;  /* missing or corrupt DShot replies */
+    uint32_t esc_skipped; /* DShot frames not sent, the last one was still going */
+    uint8_t gyro_bias_state;     /* GyroBiasState */
+    uint32_t gyro_bias_restarts; /* calibrations started over on motion */
+    float gyro_bias[3];          /* rad/s, subtracted from the gyro rates */
+} TelemetryHealth;
+
+void Telemetry_SendSample(const TelemetrySample *sample);
+void Telemetry_SendHealth(const TelemetryHealth *health);
+void Telemetry_SendText(const char *text, uint32_t length);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+/*
+ * Boot-time tuning of the estimators and controllers, shared by the firmware
+ * and the host tools.  Every value can also be changed at run time over the
+ * serial link, see Command_Apply() in main.c.
+ */
+
+#define PID_KP 1.4f
+#define PID_KI 0.4f
+#define PID_KD 8.2f
+
+#define PID_TAU 0.02f
+
+#define PID_LIM_MIN -400.0f
+#define PID_LIM_MAX 400.0f
+
+#define PID_LIM_MIN_INT -50.0f
+#define PID_LIM_MAX_INT 50.0f
+
+#define CASCADE_A 1.0f
+#define CASCADE_B 2.8f
+
+/* Time constant of the complementary filter, alpha is derived from it for the
+ * angle period: 0.99 at 100 Hz */
+#define COMPLEMENTARY_TAU_S 1.0f
+
+#define KALMAN_Q_ANGLE 0.1f
+#define KALMAN_Q_VELOCITY 0.2f
+#define KALMAN_Q_BIAS 0.3f
+
+#define KALMAN_R_ANGLE 0.6f
+#define KALMAN_R_RATE 0.2f
+
+/* R weighs the differential thrust in newtons */
+#define LQR_Q_ANGLE 1000.0f
+#define LQR_Q_RATE 10.0f
+#define LQR_R 100.0f
+
+#endif
@@ -24,13 +24,24 @@
  * THE SOFTWARE.
  */
 
+#include "stm32f4xx.h"
 #include "RegisterAddresses.h"
 #include "I2C.h"
+#include "Accelerometer.h"
+#include "profiler.h"
 
 // See page 21 of the LSM303DLHC datasheet for more info about these values
 #define ACCELEROMETER_READ  0x33
 #define ACCELEROMETER_WRITE 0x32
 
+// Setting the MSB of the register address enables auto-increment, see page 20
+#define ACCELEROMETER_INCREMENT 0x80
+#define ACCELEROMETER_OUT_X_L 0x28
+#define ACCELEROMETER_FIFO_SRC 0x2F
+
+// The FIFO holds 32 samples of 6 bytes
+#define ACCELEROMETER_FIFO_DEPTH 32
+
 unsigned char ReadFromAccelerometer(unsigned short registerAddress)
 {
 	I2CWaitIfBusy();
@@ -75,73 +86,82 @@ void WriteToAccelerometer(unsigned short registerAddress, unsigned char data)
 	I2CStop();
 }
 
-// See page 33 of UM1842.  It shows the LSM303DLHC (the accelerometer) is connected to the STM32F411 using
-// the following pins for I2C communication:
-// SCL  --> PB6
-// SDA  --> PB9
+static unsigned char buffer[6 * ACCELEROMETER_FIFO_DEPTH];
+static AccelerometerSample samples[2];
+static volatile unsigned int active = 0;
+static volatile int reading = 0;
+static unsigned int readStart = 0;
+static float samplePeriod = 1.0f / 50.0f;
+static AccelerometerCallback sampleCallback = 0;
+
+static void AccelerometerReadDone()
+{
+	reading = 0;
+	if(sampleCallback)
+	{
+		sampleCallback();
+	}
+}
+
+// Runs in the DMA or I2C error interrupt.  The average of the samples is written to the buffer
+// the reader isn't using, then published by flipping the index, so a reader never sees a half
+// updated sample.
+static void AccelerometerSamplesComplete(unsigned int error)
+{
+	if(!error)
+	{
+		const unsigned int count = samples[active ^ 1].count;
+		int sum[3] = {0, 0, 0};
+		for(unsigned int n = 0; n < count; n++)
+		{
+			// OUT_X_L_A to OUT_Z_H_A, little-endian
+			const unsigned char* data = &buffer[6 * n];
+			for(int i = 0; i < 3; i++)
+			{
+				sum[i] += (short)((data[2 * i + 1] << 8) | data[2 * i]);
+			}
+		}
+
+		AccelerometerSample* sample = &samples[active ^ 1];
+		sample->x = (short)(sum[0] / (int)count);
+		sample->y = (short)(sum[1] / (int)count);
+		sample->z = (short)(sum[2] / (int)count);
+
+		// The newest sample is about when the read started, the average sits half the window
+		// before it
+		sample->timestamp_us = readStart - (unsigned int)(0.5f * (count - 1) * samplePeriod * 1e6f);
+		__DMB();
+		active ^= 1;
+	}
+
+	AccelerometerReadDone();
+}
+
+static void AccelerometerLevelComplete(unsigned int error)
+{
+	// See FIFO_SRC_REG_A in the datasheet.  Bit 6 overrun (the FIFO is full), bits 0-4 the
+	// number of stored samples.
+	const unsigned int count = (buffer[0] & (1 << 6)) ? ACCELEROMETER_FIFO_DEPTH : (buffer[0] & 0x1F);
+	if(error || count == 0)
+	{
+		AccelerometerReadDone();
+		return;
+	}
+
+	// In FIFO mode the address wraps from OUT_Z_H_A back to OUT_X_L_A, so one burst drains
+	// all the samples
+	samples[active ^ 1].count = count;
+	if(!I2CReadAsync(ACCELEROMETER_WRITE, ACCELEROMETER_INCREMENT | ACCELEROMETER_OUT_X_L,
+	                 buffer, 6 * count, AccelerometerSamplesComplete))
+	{
+		AccelerometerReadDone();
+	}
+}
+
+// The bus itself is set up by I2CInit(), see I2C.c for the pins and timing.
 void AccelerometerInit()
 {
-	// Give a clock to port B as pins PB6 and PB9 are connected to the accelerometer (pg 33 of UM1842) and
-	// page 116 of RM0383 for the RCC AHB register info.
-	ACCESS(RCC_AHB1ENR) |= (1 << 1);
-
-	// See page 156 of the datasheet.  We configure PB6 and PB9 to alternate function.
-	ACCESS(GPIOB_MODER) |= ((1 << 13) | (1 << 19));
-
-	// See pages 21 and 22 of the ST UM1842 document.  It shows the LSM303DLHC uses I2C1.  Then, looking at
-	// page 149 of ST RM0383 shows I2C1 is alternate function 4.  Then looking at pages 160 and 161 shows
-	// which bits to set of the AFRL and AFRH registers: Pin 6 = bits 24-27 of AFRL and pin 9 = bits 4-7 of
-	// AFRH.
-	ACCESS(GPIOB_AFRL) |= (4 << 24);
-	ACCESS(GPIOB_AFRH) |= (4 << 4);
-
-	// Set the pins to fast speed.  See pg 157 for more info on the register.  Pin 6 corresponds to
-	// bits 12/13, 9=18/19.
-	ACCESS(GPIOB_OSPEEDR) |= ((2 << 12) | (2 << 18));
-
-	// See page 117.  We give a clock to I2C1 by setting bit 21 of the RCC APB1 peripheral clock enable register.
-	ACCESS(RCC_APB1ENR) |= (1 << 21);
-
-	// See page 495 of the datasheet for info on CR2 peripheral clock frequency.  We set the clock to 2 MHz.
-	ACCESS(I2C1_CR2) &= ~(0x3F);
-	ACCESS(I2C1_CR2) |= (0x02);
-
-	// So, breaking and inspecting the RCC registers, I see we have the following clock values:
-	//    PLLM = 16
-	//    PLLN = 192
-	//    PLLP = 2
-	//    AHB Prescaler = 1
-	//    APB1 Prescaler = 1
-	//    APB2 Prescaler = 1
-	// ...using STM32CubeMX with these values shows a clock speed of 16 MHz.
-	// See page 503 of the datasheet for info on the CCR (clock control register).  We're just using Sm mode.
-	// Note the example:
-	//    "For instance: in Sm mode, to generate a 100 kHz SCL frequency:
-	//     If FREQR = 08, TPCLK1 = 125 ns so CCR must be programmed with 0x28
-	//     (0x28 <=> 40d x 125 ns = 5000 ns.)"
-	// So, 125 ns = 8 MHz clock.  We have a 16 MHz clock, so if I just substitute in 62.5 for 125 we can
-	// compensate by doubling 40d to 80d which = 0x50.
-	ACCESS(I2C1_CCR) &= ~(0xFFF);
-	ACCESS(I2C1_CCR) |= 0x50;
-
-	// See page 503 for info on the TRISE (rise time) register.  It shows the following example:
-	//    "In Sm mode, the maximum allowed SCL rise time is 1000 ns.  If, in the I2C_CR2 register, the
-	//     value of FREQ[5:0] bits is equal to 0x08 and TPCLK1 = 125 ns therefore the TRISE[5:0] bits
-	//     must be programmed with 09h. (1000 ns / 125 ns = 8 + 1)"
-	// We have FREQ set to 0x02.  So this should give us:
-	// 1000 ns / 500 ns = 2 + 1
-	// So we should be able to set this to 3.
-	ACCESS(I2C1_TRISE) &= ~(0x3F);
-	ACCESS(I2C1_TRISE) |= 0x03;
-
-	// See page 496 for info on OAR1 (I2C Own address register 1).  We set the following:
-	//   Bit 1-7: Interface Address: 100001 = 0x21
-	//   Bit 14: b/c the datasheet says "bit 14 Should always be kept at 1 by software"
-	// Note that we're using 7 bit addressing mode so we leave bit 15 as zero
-	ACCESS(I2C1_OAR1) |= ((0x21 << 1) | (1 << 14));
-
-	// Enable I2C1.  See page 494 of the datasheet.
-	ACCESS(I2C1_CR1) |= 1;
+	I2CInit();
 
 	// The device on the STM32F411E-DISCO board is apparently the LSM303DLHC, this has its
 	// own datasheet if you go search for it.  But there is also a LSM303D and it has its own
@@ -163,9 +183,75 @@ void AccelerometerInit()
 	WriteToAccelerometer(0x20, 0x47);
 }
 
+void AccelerometerConfigure(AccelerometerOdr odr, AccelerometerRange range, unsigned char watermark)
+{
+	// See page 25 of the LSM303DLHC datasheet.  CTRL_REG1_A: bits 4-7 output data rate, bits 0-2
+	// enable the X, Y and Z axes.
+	WriteToAccelerometer(0x20, (odr << 4) | 0x07);
+
+	// See page 26.  CTRL_REG3_A bit 2: FIFO watermark on the INT1 pin.
+	WriteToAccelerometer(0x22, (1 << 2));
+
+	// See page 27.  CTRL_REG4_A bit 7: block data update, so the burst never mixes the low and
+	// high bytes of two samples.  Bits 4-5: full scale.  Bit 3: high resolution.
+	WriteToAccelerometer(0x23, (1 << 7) | (range << 4) | (1 << 3));
+
+	// See CTRL_REG5_A and FIFO_CTRL_REG_A in the datasheet.  CTRL_REG5_A bit 6 enables the
+	// FIFO.  FIFO_CTRL_REG_A bits 6-7 = 10 selects stream mode, where the oldest samples are
+	// overwritten when it is full, and bits 0-4 are the watermark level.
+	WriteToAccelerometer(0x24, (1 << 6));
+	WriteToAccelerometer(0x2E, (2 << 6) | (watermark & 0x1F));
+
+	static const float odrHz[] = {0.0f, 1.0f, 10.0f, 25.0f, 50.0f, 100.0f, 200.0f, 400.0f};
+	samplePeriod = 1.0f / odrHz[odr];
+}
+
+void AccelerometerSetCallback(AccelerometerCallback callback)
+{
+	sampleCallback = callback;
+}
+
+// Two bursts: the FIFO fill level, then every stored sample
+int AccelerometerStartRead()
+{
+	// Only record the start of a read that actually goes on the bus.  The callers run at
+	// different priorities, so the flag is claimed with the interrupts off.
+	unsigned int primask = __get_PRIMASK();
+	__disable_irq();
+	if(reading || I2CIsBusy())
+	{
+		__set_PRIMASK(primask);
+		return 0;
+	}
+	reading = 1;
+	__set_PRIMASK(primask);
+
+	// In data-ready mode this is called from the watermark edge
+	readStart = Profiler_Micros();
+
+	if(!I2CReadAsync(ACCELEROMETER_WRITE, ACCELEROMETER_FIFO_SRC, buffer, 1, AccelerometerLevelComplete))
+	{
+		reading = 0;
+		return 0;
+	}
+	return 1;
+}
+
+// Latest completed sample, never waits for the bus
+void GetAccelerometerSample(AccelerometerSample* sample)
+{
+	*sample = samples[active];
+}
+
 void GetAccelerometerValues(short* x, short* y, short* z)
 {
-	*x = ((ReadFromAccelerometer(0x29) << 8) | ReadFromAccelerometer(0x28));
-	*y = ((ReadFromAccelerometer(0x2B) << 8) | ReadFromAccelerometer(0x2A));
-	*z = ((ReadFromAccelerometer(0x2D) << 8) | ReadFromAccelerometer(0x2C));
+	const AccelerometerSample* sample = &samples[active];
+	*x = sample->x;
+	*y = sample->y;
+	*z = sample->z;
+}
+
+float AccelerometerSamplePeriod()
+{
+	return samplePeriod;
 }
@@ -24,14 +24,82 @@
  * THE SOFTWARE.
  */
 
+#include "stm32f4xx.h"
 #include "RegisterAddresses.h"
+#include "Gyro.h"
+#include "main.h"
+#include "profiler.h"
+#include "fastmath.h"
+
+
+// See page 25 of the L3GD20 datasheet: bit 7 of the first byte is read, bit 6 auto-increment
+#define GYRO_READ 0x80
+#define GYRO_INCREMENT 0x40
+#define GYRO_OUT_X_L 0x28
+#define GYRO_FIFO_SRC 0x2F
+
+// The FIFO holds 32 samples of 6 bytes
+#define GYRO_FIFO_DEPTH 32
+#define GYRO_BURST_LENGTH (1 + 6 * GYRO_FIFO_DEPTH)
+
+// DMA2 stream 0 (SPI1_RX) and stream 3 (SPI1_TX) bits in LISR/LIFCR
+#define DMA_S0_FLAGS ((1 << 0) | (1 << 2) | (1 << 3) | (1 << 4) | (1 << 5))
+#define DMA_S0_TEIF  (1 << 3)
+#define DMA_S0_TCIF  (1 << 5)
+#define DMA_S3_FLAGS ((1 << 22) | (1 << 24) | (1 << 25) | (1 << 26) | (1 << 27))
+
+// Polled waits give up after this many reads of the register
+#define GYRO_TIMEOUT_LOOPS 10000
+
+// Both frames of a read take under 300 us at 6 MHz, a read still running after this is stuck
+#define GYRO_TIMEOUT_US 2000
+
+// A read is two SPI frames: the FIFO fill level, then every stored sample
+typedef enum
+{
+	GYRO_IDLE,
+	GYRO_READ_LEVEL,
+	GYRO_READ_SAMPLES
+} GyroState;
+
+static unsigned char txBuffer[GYRO_BURST_LENGTH];
+static unsigned char rxBuffer[GYRO_BURST_LENGTH];
+static GyroSample samples[2];
+static volatile unsigned int active = 0;
+static volatile GyroState state = GYRO_IDLE;
+static unsigned int readStart = 0;
+static unsigned int readCount = 0;
+static GyroCallback sampleCallback = 0;
+static unsigned int timeoutCount = 0;
+
+// See page 9 of the L3GD20 datasheet.  At the default 250 dps full scale one count is
+// 8.75 mdps.
+static float radPerCount = 0.00875f * FASTMATH_DEG_TO_RAD;
+
+// Output data rate, for the time covered by the samples of one read
+static float samplePeriod = 1.0f / 95.0f;
+
+// Wait until the bits of mask in the register read value.  Returns 0 and counts a timeout if
+// they never do.
+static int GyroWait(uintptr_t address, unsigned int mask, unsigned int value)
+{
+	for(unsigned int i = 0; i < GYRO_TIMEOUT_LOOPS; i++)
+	{
+		if((ACCESS(address) & mask) == value)
+		{
+			return 1;
+		}
+	}
+	timeoutCount++;
+	return 0;
+}
 
 void WaitForSPI1RXReady()
 {
 	// See page 605 of the datasheet for info on the SPI status register
 	// If Bit0 == 0 then SPI RX is empty
 	// If Bit7 == 1 then SPI is busy
-	while((ACCESS(SPI1_SR) & 1) == 0 || (ACCESS(SPI1_SR) & (1 << 7)) == 1) { }
+	GyroWait(SPI1_SR, (1 | (1 << 7)), 1);
 }
 
 void WaitForSPI1TXReady()
@@ -39,7 +107,7 @@ void WaitForSPI1TXReady()
 	// See page 605 of the datasheet for info on the SPI status register
 	// If Bit1 == 0 then SPI TX buffer is not empty
 	// If Bit7 == 1 then SPI is busy
-	while((ACCESS(SPI1_SR) & (1 << 1)) == 0 || (ACCESS(SPI1_SR) & (1 << 7)) == 1) { }
+	GyroWait(SPI1_SR, ((1 << 1) | (1 << 7)), (1 << 1));
 }
 
 // See page 25 of the L3GD20 datasheet for details on how we send commands to, and make
@@ -115,16 +183,18 @@ void GyroInit()
 	ACCESS(GPIOA_OSPEEDR) |= ((2 << 10) | (2 << 12) | (2 << 14));
 	ACCESS(GPIOE_OSPEEDR) |= (2 << 6);
 
-	// Enable clock for SPI1
+	// Enable clock for SPI1, and for DMA2 (bit 22 of AHB1ENR) which runs the burst reads
 	ACCESS(RCC_APB2ENR) |= (1 << 12);
+	ACCESS(RCC_AHB1ENR) |= (1 << 22);
 
 	// See page 602 for details of configuring SPI1 Control Register
 	// Set Bit 0: The second clock transition is the first data capture edge
 	// Set Bit 1: CK to 1 when idle
 	// Set Bit 2: The STM32 is the master, the gyro is the slave
-	// Set Bits 3-5 to 010 for a baud rate of fPCLK/8
+	// Set Bits 3-5 to 011 for a baud rate of fPCLK/16: 6 MHz with the 96 MHz APB2, the L3GD20
+	// allows at most 10 MHz (page 11 of its datasheet)
 	// Set Bits 8-9: Software slave management enabled, Internal slave select to 1
-	ACCESS(SPI1_CR1) |= (1 | (1 << 1) | (1 << 2) | (2 << 3) | (1 << 8) | (1 << 9));
+	ACCESS(SPI1_CR1) |= (1 | (1 << 1) | (1 << 2) | (3 << 3) | (1 << 8) | (1 << 9));
 
 	// Set Bit 6: Enable SPI.  See page 603.
 	ACCESS(SPI1_CR1) |= (1 << 6);
@@ -143,22 +213,256 @@ void GyroInit()
 	// See page 31 of the L3GD20 datasheet.  Writing 0x0F to register 0x20 will power up
 	// the gyro and enables the X, Y, Z axes.
 	WriteToGyro(0x20, 0b11001111);
+
+	// Both DMA streams always point at the SPI data register.  After the command byte the
+	// gyro ignores what it receives.
+	ACCESS(DMA2_S0PAR) = SPI1_DR;
+	ACCESS(DMA2_S3PAR) = SPI1_DR;
+	for(int i = 0; i < GYRO_BURST_LENGTH; i++)
+	{
+		txBuffer[i] = 0xFF;
+	}
+
+	// Enable the DMA2 stream 0 interrupt (56) at the sensor bus priority.  See page 201 of
+	// RM0383 for the vector table.
+	ACCESS_BYTE(NVIC_IPR(56)) = IRQ_PRIORITY_SENSOR_BUS << 4;
+	ACCESS(NVIC_ISER1) = (1 << 24);
 }
 
-short GetAxisValue(unsigned char lowRegister, unsigned char highRegister)
+void GyroConfigure(GyroOdr odr, GyroBandwidth bandwidth, GyroRange range, unsigned char watermark)
 {
-	// See page 9 of L3GD20.  It shows the mechanical characteristics of the gyro.  Note
-	// that we leave the sensitivity as is (i.e. 0) so that it's 250 dps.  So, we read
-	// the value from the gyro and convert it to a +/- 360 degree value.
-	float scaler = 8.75 * 0.001;
-	short temp = (ReadFromGyro(lowRegister) | (ReadFromGyro(highRegister) << 8));
-	return (short)((float)temp * scaler);
+	// See page 31 of the L3GD20 datasheet.  CTRL_REG1: bits 6-7 output data rate, bits 4-5
+	// bandwidth, bit 3 power on and bits 0-2 enable the X, Y, Z axes.
+	WriteToGyro(0x20, (odr << 6) | (bandwidth << 4) | 0x0F);
+
+	// See page 32.  CTRL_REG3 bit 2: FIFO watermark on the DRDY/INT2 pin.
+	WriteToGyro(0x22, (1 << 2));
+
+	// See page 33.  CTRL_REG4 bit 7: block data update, so the burst never mixes the low and
+	// high bytes of two samples.  Bits 4-5: full scale.
+	WriteToGyro(0x23, (1 << 7) | (range << 4));
+
+	// See CTRL_REG5 and FIFO_CTRL_REG in the datasheet.  CTRL_REG5 bit 6 enables the FIFO.
+	// FIFO_CTRL_REG bits 5-7 = 010 selects stream mode, where the oldest samples are
+	// overwritten when it is full, and bits 0-4 are the watermark level.
+	WriteToGyro(0x24, (1 << 6));
+	WriteToGyro(0x2E, (2 << 5) | (watermark & 0x1F));
+
+	// See page 9 for the sensitivity of each full scale
+	static const float mdpsPerCount[] = {8.75f, 17.5f, 70.0f};
+	radPerCount = mdpsPerCount[range] * 0.001f * FASTMATH_DEG_TO_RAD;
+
+	static const float odrHz[] = {95.0f, 190.0f, 380.0f, 760.0f};
+	samplePeriod = 1.0f / odrHz[odr];
+}
+
+// Polled like GyroConfigure() with the interrupts off, so no watermark edge starts a burst
+// in the middle of the two bytes.  That holds the control tick back by a few microseconds.
+int GyroSetWatermark(unsigned char watermark)
+{
+	unsigned int primask = __get_PRIMASK();
+	__disable_irq();
+	if(state != GYRO_IDLE)
+	{
+		__set_PRIMASK(primask);
+		return 0;
+	}
+
+	// FIFO_CTRL_REG as in GyroConfigure(), still in stream mode
+	WriteToGyro(0x2E, (2 << 5) | (watermark & 0x1F));
+	__set_PRIMASK(primask);
+
+	return 1;
+}
+
+// Run one CS-framed SPI frame of length bytes through the DMA.  A stream that doesn't stop
+// leaves the frame unstarted, GyroCheckTimeout() will abandon the read.
+static void GyroTransfer(unsigned int length)
+{
+	// See page 190 of RM0383.  The streams must be disabled before they can be configured.
+	ACCESS(DMA2_S0CR) &= ~1;
+	ACCESS(DMA2_S3CR) &= ~1;
+	if(!GyroWait(DMA2_S0CR, 1, 0) || !GyroWait(DMA2_S3CR, 1, 0))
+	{
+		return;
+	}
+	ACCESS(DMA2_LIFCR) = (DMA_S0_FLAGS | DMA_S3_FLAGS);
+
+	// Channel 3 of both streams (page 170).  Byte transfers with memory increment (bit 10).
+	// The receive stream raises the completion: transfer complete (bit 4) and transfer error
+	// (bit 2) interrupts.  The transmit stream is memory to peripheral (bit 6).
+	ACCESS(DMA2_S0M0AR) = (uintptr_t)rxBuffer;
+	ACCESS(DMA2_S0NDTR) = length;
+	ACCESS(DMA2_S0CR) = ((3 << 25) | (2 << 16) | (1 << 10) | (1 << 4) | (1 << 2));
+	ACCESS(DMA2_S3M0AR) = (uintptr_t)txBuffer;
+	ACCESS(DMA2_S3NDTR) = length;
+	ACCESS(DMA2_S3CR) = ((3 << 25) | (2 << 16) | (1 << 10) | (1 << 6));
+	ACCESS(DMA2_S0CR) |= 1;
+	ACCESS(DMA2_S3CR) |= 1;
+
+	// Chip select low for the whole frame, then let the SPI request the transfers.  See
+	// page 604 of RM0383: bit 0 RXDMAEN, bit 1 TXDMAEN.
+	ACCESS(GPIOE_BSRR) = (1 << 19);
+	ACCESS(SPI1_CR2) |= ((1 << 0) | (1 << 1));
+}
+
+// Called from the control timer, the EXTI line and the completion interrupt, which all run
+// at different priorities, so the state is claimed with the interrupts off.
+int GyroStartRead()
+{
+	unsigned int primask = __get_PRIMASK();
+	__disable_irq();
+	if(state != GYRO_IDLE)
+	{
+		__set_PRIMASK(primask);
+		return 0;
+	}
+	state = GYRO_READ_LEVEL;
+
+	// In data-ready mode this is called from the watermark edge.  Set with the state so
+	// GyroCheckTimeout() never sees a read with the start time of the previous one.
+	readStart = Profiler_Micros();
+	__set_PRIMASK(primask);
+
+	txBuffer[0] = GYRO_READ | GYRO_FIFO_SRC;
+	GyroTransfer(2);
+
+	return 1;
+}
+
+// Average every sample drained from the FIFO.  Over one control period this is the exact
+// integral of the rate, and as a filter a moving average whose first zero is at the loop
+// rate, on top of the sensor's own low-pass.
+static void GyroPublish(unsigned int count)
+{
+	GyroSample* sample = &samples[active ^ 1];
+
+	// The first byte was clocked in while the command went out.  Each sample follows as
+	// OUT_X_L, OUT_X_H, OUT_Y_L, OUT_Y_H, OUT_Z_L, OUT_Z_H.
+	int sum[3] = {0, 0, 0};
+	for(unsigned int n = 0; n < count; n++)
+	{
+		const unsigned char* data = &rxBuffer[1 + 6 * n];
+		for(int i = 0; i < 3; i++)
+		{
+			sum[i] += (short)((data[2 * i + 1] << 8) | data[2 * i]);
+		}
+	}
+
+	for(int i = 0; i < 3; i++)
+	{
+		const float mean = (float)sum[i] / count;
+		sample->raw[i] = (short)(mean < 0 ? mean - 0.5f : mean + 0.5f);
+		sample->rate[i] = mean * radPerCount;
+	}
+	sample->count = count;
+	sample->dt = count * samplePeriod;
+
+	// The newest sample is about when the read started, the average sits half the window
+	// before it
+	sample->timestamp_us = readStart - (unsigned int)(0.5f * (count - 1) * samplePeriod * 1e6f);
+
+	// Written to the buffer the reader isn't using, then published by flipping the index
+	__DMB();
+	active ^= 1;
+}
+
+// Call periodically, the control tick does.  A read still running after GYRO_TIMEOUT_US is
+// abandoned by pending the completion interrupt (56, bit 24 of ISPR1) without a transfer
+// complete flag, so it is torn down where the rest of the read runs.
+void GyroCheckTimeout()
+{
+	if(state != GYRO_IDLE && Profiler_Micros() - readStart > GYRO_TIMEOUT_US)
+	{
+		ACCESS(NVIC_ISPR1) = (1 << 24);
+	}
+}
+
+// The last byte of a frame has been received, so the bus is idle
+void DMA2_Stream0_IRQHandler(void)
+{
+	unsigned int flags = ACCESS(DMA2_LISR);
+	ACCESS(DMA2_LIFCR) = (DMA_S0_FLAGS | DMA_S3_FLAGS);
+
+	if(state == GYRO_IDLE)
+	{
+		return;
+	}
+
+	const int ok = (flags & DMA_S0_TCIF) && !(flags & DMA_S0_TEIF);
+	if(!(flags & (DMA_S0_TCIF | DMA_S0_TEIF)))
+	{
+		// Pended by GyroCheckTimeout(): stop the receive stream too.  Disabling it sets its
+		// transfer complete flag, cleared again below.
+		timeoutCount++;
+		ACCESS(DMA2_S0CR) &= ~1;
+	}
+
+	// See page 605.  Wait for BSY before releasing the chip select.
+	GyroWait(SPI1_SR, (1 << 7), 0);
+	ACCESS(GPIOE_BSRR) = (1 << 3);
+	ACCESS(SPI1_CR2) &= ~((1 << 0) | (1 << 1));
+	ACCESS(DMA2_S3CR) &= ~1;
+	if(!ok)
+	{
+		ACCESS(DMA2_LIFCR) = (DMA_S0_FLAGS | DMA_S3_FLAGS);
+	}
+
+	if(ok && state == GYRO_READ_LEVEL)
+	{
+		// See FIFO_SRC_REG in the datasheet.  Bit 6 overrun (the FIFO is full), bits 0-4 the number
+		// of stored samples.
+		const unsigned char source = rxBuffer[1];
+		const unsigned int count = (source & (1 << 6)) ? GYRO_FIFO_DEPTH : (source & 0x1F);
+
+		if(count > 0)
+		{
+			// In FIFO mode the address wraps from OUT_Z_H back to OUT_X_L, so one frame
+			// drains all the samples
+			state = GYRO_READ_SAMPLES;
+			readCount = count;
+			txBuffer[0] = GYRO_READ | GYRO_INCREMENT | GYRO_OUT_X_L;
+			GyroTransfer(1 + 6 * count);
+			return;
+		}
+	}
+	else if(ok && state == GYRO_READ_SAMPLES)
+	{
+		GyroPublish(readCount);
+	}
+
+	state = GYRO_IDLE;
+
+	if(sampleCallback)
+	{
+		sampleCallback();
+	}
+}
+
+void GyroSetCallback(GyroCallback callback)
+{
+	sampleCallback = callback;
+}
+
+void GetGyroSample(GyroSample* sample)
+{
+	*sample = samples[active];
 }
 
 void GetGyroValues(short* x, short* y, short* z)
 {
-	// See page 36 of the L3GD20 datasheet.  It shows the hi/lo addresses of each of the axes.
-	*x = GetAxisValue(0x28, 0x29);
-	*y = GetAxisValue(0x2A, 0x2B);
-	*z = GetAxisValue(0x2C, 0x2D);
+	const GyroSample* sample = &samples[active];
+	*x = sample->raw[0];
+	*y = sample->raw[1];
+	*z = sample->raw[2];
+}
+
+float GyroSamplePeriod()
+{
+	return samplePeriod;
+}
+
+unsigned int GyroTimeoutCount()
+{
+	return timeoutCount;
 }
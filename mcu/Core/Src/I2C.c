@@ -1,4 +1,212 @@
+#include "stm32f4xx.h"
 #include "RegisterAddresses.h"
+#include "I2C.h"
+#include "main.h"
+#include "profiler.h"
+
+#define I2C_FAST_MODE_HZ 400000
+
+// Polled waits give up after this many reads of the register, a few milliseconds at most
+#define I2C_TIMEOUT_LOOPS 20000
+
+// A bus that has been busy for this long is stuck: the longest transfer, a full accelerometer
+// FIFO, takes under 5 ms at 400 kHz
+#define I2C_TIMEOUT_US 10000
+
+// SR1 bits of the errors reported to the callback: BERR, ARLO, AF, OVR, TIMEOUT
+#define I2C_SR1_ERRORS ((1 << 8) | (1 << 9) | (1 << 10) | (1 << 11) | (1 << 14))
+
+// DMA1 stream 0 bits in LISR/LIFCR: FEIF0, DMEIF0, TEIF0, HTIF0, TCIF0
+#define DMA_S0_FLAGS ((1 << 0) | (1 << 2) | (1 << 3) | (1 << 4) | (1 << 5))
+#define DMA_S0_TEIF  (1 << 3)
+#define DMA_S0_TCIF  (1 << 5)
+
+typedef enum
+{
+	I2C_IDLE,
+	I2C_SEND_REGISTER,
+	I2C_RECEIVE
+} I2CState;
+
+static volatile I2CState state = I2C_IDLE;
+static unsigned char transferAddress;
+static unsigned char transferRegister;
+static unsigned short transferLength;
+static I2CCallback transferCallback;
+
+static volatile int timeoutPending = 0;
+static unsigned int idleSince = 0;
+static unsigned int errorCount = 0;
+static unsigned int timeoutCount = 0;
+static unsigned int recoveryCount = 0;
+
+// Wait until the bits of mask in the register read value.  Returns 0 and counts a timeout if
+// they never do.
+static int I2CWait(uintptr_t address, unsigned int mask, unsigned int value)
+{
+	for(unsigned int i = 0; i < I2C_TIMEOUT_LOOPS; i++)
+	{
+		if((ACCESS(address) & mask) == value)
+		{
+			return 1;
+		}
+	}
+	timeoutCount++;
+	return 0;
+}
+
+// Half a period of the 100 kHz clock used to free the bus
+static void I2CBitDelay()
+{
+	const unsigned int start = DWT->CYCCNT;
+	while(DWT->CYCCNT - start < SystemCoreClock / 200000);
+}
+
+// APB1 clock feeding I2C1, from the prescaler actually programmed in RCC_CFGR
+static unsigned int I2CGetPclk1()
+{
+	// See page 107 of RM0383.  PPRE1 is bits 10-12: 0xx = /1, 100 = /2, 101 = /4,
+	// 110 = /8, 111 = /16.  SystemCoreClock is already HCLK.
+	unsigned int ppre1 = (ACCESS(RCC_CFGR) >> 10) & 0x7;
+	if(ppre1 < 4)
+	{
+		return SystemCoreClock;
+	}
+	return SystemCoreClock >> (ppre1 - 3);
+}
+
+// See page 33 of UM1842.  The LSM303DLHC (accelerometer and magnetometer) is connected to
+// the STM32F411 using the following pins for I2C communication:
+// SCL  --> PB6
+// SDA  --> PB9
+// Safe to call more than once, both sensors share the bus.
+static void I2CConfigure();
+static void I2CRecover();
+
+void I2CInit()
+{
+	static int initialized = 0;
+	if(initialized)
+	{
+		return;
+	}
+	initialized = 1;
+
+	// Give a clock to port B as pins PB6 and PB9 are connected to the accelerometer (pg 33 of UM1842) and
+	// page 116 of RM0383 for the RCC AHB register info.  Bit 21 clocks DMA1, used for the burst reads.
+	ACCESS(RCC_AHB1ENR) |= ((1 << 1) | (1 << 21));
+
+	// See page 156 of the datasheet.  We configure PB6 and PB9 to alternate function.
+	ACCESS(GPIOB_MODER) |= ((1 << 13) | (1 << 19));
+
+	// See pages 21 and 22 of the ST UM1842 document.  It shows the LSM303DLHC uses I2C1.  Then, looking at
+	// page 149 of ST RM0383 shows I2C1 is alternate function 4.  Then looking at pages 160 and 161 shows
+	// which bits to set of the AFRL and AFRH registers: Pin 6 = bits 24-27 of AFRL and pin 9 = bits 4-7 of
+	// AFRH.
+	ACCESS(GPIOB_AFRL) |= (4 << 24);
+	ACCESS(GPIOB_AFRH) |= (4 << 4);
+
+	// Set the pins to fast speed.  See pg 157 for more info on the register.  Pin 6 corresponds to
+	// bits 12/13, 9=18/19.
+	ACCESS(GPIOB_OSPEEDR) |= ((2 << 12) | (2 << 18));
+
+	// See page 117.  We give a clock to I2C1 by setting bit 21 of the RCC APB1 peripheral clock enable register.
+	ACCESS(RCC_APB1ENR) |= (1 << 21);
+
+	I2CConfigure();
+
+	// The receive DMA always reads from the I2C data register
+	ACCESS(DMA1_S0PAR) = I2C1_DR;
+
+	// Enable the I2C1 event (31), I2C1 error (32) and DMA1 stream 0 (11) interrupts.  See
+	// page 201 of RM0383 for the vector table.  They run at the sensor bus priority, the
+	// four implemented priority bits are the upper half of each byte (see main.h).
+	ACCESS_BYTE(NVIC_IPR(11)) = IRQ_PRIORITY_SENSOR_BUS << 4;
+	ACCESS_BYTE(NVIC_IPR(31)) = IRQ_PRIORITY_SENSOR_BUS << 4;
+	ACCESS_BYTE(NVIC_IPR(32)) = IRQ_PRIORITY_SENSOR_BUS << 4;
+	ACCESS(NVIC_ISER0) = ((1u << 11) | (1u << 31));
+	ACCESS(NVIC_ISER1) = (1 << 0);
+
+	// A reset in the middle of a read can leave the slave holding SDA low
+	if(ACCESS(I2C1_SR2) & (1 << 1))
+	{
+		I2CRecover();
+	}
+}
+
+// Timing and own address, also redone after a software reset of the peripheral
+static void I2CConfigure()
+{
+	// CCR and TRISE can only be written while the peripheral is disabled (page 503).
+	ACCESS(I2C1_CR1) &= ~1;
+
+	// See page 495 of the datasheet for info on CR2 peripheral clock frequency, in MHz.
+	unsigned int pclk1 = I2CGetPclk1();
+	unsigned int freq = pclk1 / 1000000;
+	ACCESS(I2C1_CR2) &= ~(0x3F);
+	ACCESS(I2C1_CR2) |= freq;
+
+	// See page 503 for info on the CCR (clock control register).  We use Fm mode (bit 15) with
+	// DUTY = 0, so Thigh = CCR * TPCLK1 and Tlow = 2 * CCR * TPCLK1.  Rounding CCR up keeps SCL at or
+	// below 400 kHz: with PCLK1 = 24 MHz this gives CCR = 20, exactly 400 kHz.
+	unsigned int ccr = (pclk1 + 3 * I2C_FAST_MODE_HZ - 1) / (3 * I2C_FAST_MODE_HZ);
+	ACCESS(I2C1_CCR) &= ~((1 << 15) | (1 << 14) | 0xFFF);
+	ACCESS(I2C1_CCR) |= ((1 << 15) | ccr);
+
+	// See page 503 for info on the TRISE (rise time) register.  In Fm mode the maximum allowed SCL rise
+	// time is 300 ns, so TRISE = 300 ns / TPCLK1 + 1.
+	ACCESS(I2C1_TRISE) &= ~(0x3F);
+	ACCESS(I2C1_TRISE) |= (freq * 300 / 1000 + 1);
+
+	// See page 496 for info on OAR1 (I2C Own address register 1).  We set the following:
+	//   Bit 1-7: Interface Address: 100001 = 0x21
+	//   Bit 14: b/c the datasheet says "bit 14 Should always be kept at 1 by software"
+	// Note that we're using 7 bit addressing mode so we leave bit 15 as zero
+	ACCESS(I2C1_OAR1) |= ((0x21 << 1) | (1 << 14));
+
+	// Enable I2C1.  See page 494 of the datasheet.
+	ACCESS(I2C1_CR1) |= 1;
+}
+
+// Free a bus held by a slave stuck in the middle of a byte, as in section 3.1.16 of the I2C
+// specification (UM10204): clock SCL until the slave lets SDA go, send a STOP by hand, then
+// reset the peripheral, whose BUSY flag would otherwise stay set.
+static void I2CRecover()
+{
+	recoveryCount++;
+	ACCESS(I2C1_CR1) &= ~1;
+
+	// PB6 (SCL) and PB9 (SDA) as outputs driven high, MODER 01.  They are open-drain already.
+	ACCESS(GPIOB_BSRR) = ((1 << 6) | (1 << 9));
+	ACCESS(GPIOB_MODER) = (ACCESS(GPIOB_MODER) & ~((3 << 12) | (3 << 18))) | ((1 << 12) | (1 << 18));
+	I2CBitDelay();
+
+	for(int i = 0; i < 9 && (ACCESS(GPIOB_IDR) & (1 << 9)) == 0; i++)
+	{
+		ACCESS(GPIOB_BSRR) = (1 << (6 + 16));
+		I2CBitDelay();
+		ACCESS(GPIOB_BSRR) = (1 << 6);
+		I2CBitDelay();
+	}
+
+	// STOP: SDA goes high while SCL is high
+	ACCESS(GPIOB_BSRR) = (1 << (6 + 16));
+	I2CBitDelay();
+	ACCESS(GPIOB_BSRR) = (1 << (9 + 16));
+	I2CBitDelay();
+	ACCESS(GPIOB_BSRR) = (1 << 6);
+	I2CBitDelay();
+	ACCESS(GPIOB_BSRR) = (1 << 9);
+	I2CBitDelay();
+
+	// Back to alternate function, MODER 10
+	ACCESS(GPIOB_MODER) = (ACCESS(GPIOB_MODER) & ~((3 << 12) | (3 << 18))) | ((2 << 12) | (2 << 18));
+
+	// See page 494.  SWRST (bit 15 of CR1) clears every register of the peripheral.
+	ACCESS(I2C1_CR1) |= (1 << 15);
+	ACCESS(I2C1_CR1) &= ~(1 << 15);
+	I2CConfigure();
+}
 
 void I2CStartRestart()
 {
@@ -32,13 +240,13 @@ void I2CDisableAcknowledge()
 void I2CSendSlaveAddress(unsigned short address)
 {
 	// See page 500.  We wait for the start bit to be generated.
-	while((ACCESS(I2C1_SR1) & 1) == 0);
+	I2CWait(I2C1_SR1, 1, 1);
 
 	// Write the address into the I2C data register.
 	ACCESS(I2C1_DR) = address;
 
 	// See page 500.  Wait until the end of transmission.
-	while((ACCESS(I2C1_SR1) & (1 << 1)) == 0);
+	I2CWait(I2C1_SR1, (1 << 1), (1 << 1));
 
 	// See page 500 of the datasheet, under bit 1 ADDR: "This bit is cleared by software
 	// reading SR1 register followed reading SR2"
@@ -49,19 +257,23 @@ void I2CSendSlaveAddress(unsigned short address)
 void I2CSendRegister(unsigned short registerAddress)
 {
 	// See page 499. We wait until the Tx data register is empty.
-	while((ACCESS(I2C1_SR1) & (1 << 7)) == 0);
+	I2CWait(I2C1_SR1, (1 << 7), (1 << 7));
 
 	// Put the register address into the data register
 	ACCESS(I2C1_DR) = registerAddress;
 
 	// Wait until the transfer is complete.
-	while((ACCESS(I2C1_SR1) & (1 << 7)) == 0);
+	I2CWait(I2C1_SR1, (1 << 7), (1 << 7));
 }
 
 void I2CWaitIfBusy()
 {
 	// See page 502 of the datasheet.  Bit 1 of SR2 will be set when the I2C bus is busy.
-	while((ACCESS(I2C1_SR2) & (1 << 1)) == (1 << 1));
+	// A bus that never gets free is recovered.
+	if(!I2CWait(I2C1_SR2, (1 << 1), 0))
+	{
+		I2CRecover();
+	}
 }
 
 void I2CWriteByte(unsigned char data)
@@ -70,15 +282,232 @@ void I2CWriteByte(unsigned char data)
 	ACCESS(I2C1_DR) = data;
 
 	// See page 500 of the datasheet.  Bit 2 will be set when the data transfer has succeeded.
-	while((ACCESS(I2C1_SR1) & (1 << 2)) == 0);
+	I2CWait(I2C1_SR1, (1 << 2), (1 << 2));
 }
 
 unsigned char I2CGetData()
 {
 	// See page 499 of the datasheet.  Bit 6 of SR1 will be set when receiver data exist the
 	// data register.
-	while((ACCESS(I2C1_SR1) & (1 << 6)) == 0) { }
+	I2CWait(I2C1_SR1, (1 << 6), (1 << 6));
 
 	// Return the data
 	return ACCESS(I2C1_DR);
 }
+
+
+int I2CIsBusy()
+{
+	return state != I2C_IDLE;
+}
+
+// Release the bus and report the end of the transfer
+static void I2CFinish(unsigned int error)
+{
+	// Stop if we are still master (MSL, bit 0 of SR2, page 501), a single byte read already
+	// asked for it.  Then wait for the stop condition to be on the bus, the bit is cleared by
+	// hardware (page 493), so the callback can start the next transfer right away.
+	if(ACCESS(I2C1_SR2) & 1)
+	{
+		I2CStop();
+	}
+	// A STOP that never goes out means the bus is held.
+	if(!I2CWait(I2C1_CR1, (1 << 9), 0))
+	{
+		I2CRecover();
+	}
+
+	// See page 495.  Bit 8 ITERREN, bit 9 ITEVTEN, bit 11 DMAEN, bit 12 LAST.
+	ACCESS(I2C1_CR2) &= ~((1 << 8) | (1 << 9) | (1 << 11) | (1 << 12));
+	ACCESS(DMA1_S0CR) &= ~1;
+
+	I2CCallback callback = transferCallback;
+	state = I2C_IDLE;
+	if(callback)
+	{
+		callback(error);
+	}
+}
+
+int I2CReadAsync(unsigned char writeAddress, unsigned char registerAddress,
+                 unsigned char* buffer, unsigned short length, I2CCallback callback)
+{
+	if(length == 0)
+	{
+		return 0;
+	}
+
+	unsigned int primask = __get_PRIMASK();
+	__disable_irq();
+	if(state != I2C_IDLE || (ACCESS(I2C1_SR2) & (1 << 1)))
+	{
+		__set_PRIMASK(primask);
+		return 0;
+	}
+	state = I2C_SEND_REGISTER;
+	idleSince = Profiler_Micros();
+	__set_PRIMASK(primask);
+
+	transferAddress = writeAddress;
+	transferRegister = registerAddress;
+	transferLength = length;
+	transferCallback = callback;
+
+	// See page 190 of RM0383.  The stream must be disabled before it can be configured.
+	ACCESS(DMA1_S0CR) &= ~1;
+	if(!I2CWait(DMA1_S0CR, 1, 0))
+	{
+		state = I2C_IDLE;
+		return 0;
+	}
+	ACCESS(DMA1_LIFCR) = DMA_S0_FLAGS;
+
+	// Stream 0 channel 1 is I2C1_RX (page 170).  Peripheral to memory, byte transfers, memory
+	// increment (bit 10), transfer error (bit 2) and transfer complete (bit 4) interrupts,
+	// high priority (bits 16-17).
+	ACCESS(DMA1_S0M0AR) = (uintptr_t)buffer;
+	ACCESS(DMA1_S0NDTR) = length;
+	ACCESS(DMA1_S0CR) = ((1 << 25) | (2 << 16) | (1 << 10) | (1 << 4) | (1 << 2));
+	ACCESS(DMA1_S0CR) |= 1;
+
+	// Event and error interrupts, then start.  The rest happens in the interrupt handlers.
+	ACCESS(I2C1_CR2) |= ((1 << 8) | (1 << 9));
+	I2CEnableAcknowledge();
+	I2CStartRestart();
+
+	return 1;
+}
+
+// Address phase and register write of the transfer, see the master receiver sequence on
+// page 481 of RM0383.
+void I2C1_EV_IRQHandler(void)
+{
+	unsigned int sr1 = ACCESS(I2C1_SR1);
+
+	if(sr1 & 1)
+	{
+		// Start sent (SB), cleared by reading SR1 then writing the address
+		ACCESS(I2C1_DR) = (state == I2C_RECEIVE) ? (transferAddress | 1) : transferAddress;
+	}
+	else if(sr1 & (1 << 1))
+	{
+		if(state == I2C_RECEIVE)
+		{
+			// Let the DMA take the bytes.  LAST makes it NACK the final byte on its own.  A single
+			// byte has to be NACKed before ADDR is cleared.
+			ACCESS(I2C1_CR2) &= ~(1 << 9);
+			if(transferLength == 1)
+			{
+				I2CDisableAcknowledge();
+			}
+			ACCESS(I2C1_CR2) |= ((1 << 11) | (1 << 12));
+		}
+
+		// Clear ADDR by reading SR1 followed by SR2
+		ACCESS(I2C1_SR1);
+		ACCESS(I2C1_SR2);
+
+		if(state == I2C_SEND_REGISTER)
+		{
+			ACCESS(I2C1_DR) = transferRegister;
+		}
+		else if(transferLength == 1)
+		{
+			I2CStop();
+		}
+	}
+	else if((sr1 & (1 << 2)) && state == I2C_SEND_REGISTER)
+	{
+		// Register sent (BTF), turn the bus around with a repeated start
+		state = I2C_RECEIVE;
+		I2CStartRestart();
+	}
+}
+
+// Call periodically, the control tick does.  The bus has to be seen idle and free at least
+// once every I2C_TIMEOUT_US, otherwise the error interrupt is pended to abandon the transfer
+// and recover the bus at its own priority, where nothing else can touch the peripheral.
+void I2CCheckTimeout()
+{
+	const unsigned int now = Profiler_Micros();
+	if(state == I2C_IDLE && !(ACCESS(I2C1_SR2) & (1 << 1)))
+	{
+		idleSince = now;
+		return;
+	}
+
+	if(!timeoutPending && now - idleSince > I2C_TIMEOUT_US)
+	{
+		timeoutPending = 1;
+		ACCESS(NVIC_ISPR1) = (1 << 0);
+	}
+}
+
+void I2C1_ER_IRQHandler(void)
+{
+	unsigned int error = ACCESS(I2C1_SR1) & I2C_SR1_ERRORS;
+	ACCESS(I2C1_SR1) &= ~I2C_SR1_ERRORS;
+
+	if(timeoutPending)
+	{
+		timeoutPending = 0;
+
+		// The transfer may have ended between the check and here
+		if(state == I2C_IDLE && !(ACCESS(I2C1_SR2) & (1 << 1)))
+		{
+			return;
+		}
+
+		timeoutCount++;
+		ACCESS(I2C1_CR2) &= ~((1 << 8) | (1 << 9) | (1 << 11) | (1 << 12));
+		ACCESS(DMA1_S0CR) &= ~1;
+		I2CRecover();
+		if(state != I2C_IDLE)
+		{
+			I2CFinish(I2C_ERROR_TIMEOUT);
+		}
+		return;
+	}
+
+	if(state != I2C_IDLE)
+	{
+		errorCount++;
+		I2CFinish(error);
+	}
+}
+
+void DMA1_Stream0_IRQHandler(void)
+{
+	unsigned int flags = ACCESS(DMA1_LISR) & DMA_S0_FLAGS;
+	ACCESS(DMA1_LIFCR) = flags;
+
+	if(state == I2C_IDLE)
+	{
+		return;
+	}
+
+	if(flags & DMA_S0_TEIF)
+	{
+		errorCount++;
+		I2CFinish(I2C_ERROR_DMA);
+	}
+	else if(flags & DMA_S0_TCIF)
+	{
+		I2CFinish(0);
+	}
+}
+
+unsigned int I2CErrorCount()
+{
+	return errorCount;
+}
+
+unsigned int I2CTimeoutCount()
+{
+	return timeoutCount;
+}
+
+unsigned int I2CRecoveryCount()
+{
+	return recoveryCount;
+}
@@ -1,4 +1,5 @@
 #include "PID.h"
+#include "fastmath.h"
 
 void PIDController_Init(PIDController *pid) {
 
@@ -76,3 +77,27 @@ float PIDController_Update(PIDController *pid, float setpoint, float measurement
     return pid->out;
 
 }
+
+void PIDController_BackCalculate(PIDController *pid, float shortfall) {
+
+	/*
+	* Anti-wind-up via back-calculation: shortfall is the applied output minus
+	* pid->out, the integrator bleeds it off with the integral time Kp / Ki
+	*/
+    if (pid->Kp > 0.0f) {
+
+        pid->integrator += pid->T * pid->Ki / pid->Kp * shortfall;
+
+    }
+
+    if (pid->integrator > pid->limMaxInt) {
+
+        pid->integrator = pid->limMaxInt;
+
+    } else if (pid->integrator < pid->limMinInt) {
+
+        pid->integrator = pid->limMinInt;
+
+    }
+
+}
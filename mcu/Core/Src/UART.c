@@ -24,137 +24,156 @@
  * THE SOFTWARE.
  */
 
-#include "RegisterAddresses.h"
+#include <string.h>
+#include "main.h"
+#include "UART.h"
 
-#define MAX_BUFFER_SIZE 2000
-unsigned char dmaBuffer[MAX_BUFFER_SIZE];
+#define TX_MASK (UART_TX_BUFFER_SIZE - 1)
 
-volatile int uartBusy = 0;
+extern UART_HandleTypeDef huart6;
 
-void DMA1_Stream6_IRQHandler(void)
+static unsigned char txBuffer[UART_TX_BUFFER_SIZE];
+
+// Free running byte counters, the ring positions are these masked with TX_MASK.
+// head - tail is the number of queued bytes, including the ones being sent.
+// Reserved bytes run from head to reserved, they join the queue once every
+// open reservation is committed.
+static volatile uint32_t txHead = 0;
+static volatile uint32_t txTail = 0;
+static volatile uint32_t txReserved = 0;
+
+// Reservations not committed yet.  A writer that preempts another one commits
+// before returning to it, so they close in the reverse order they were opened
+// and the queue always grows in reservation order.
+static volatile uint32_t txOpen = 0;
+
+// Number of bytes of the DMA transfer in progress, 0 when the UART is idle
+static volatile uint32_t txInFlight = 0;
+
+static volatile uint32_t txDropped = 0;
+
+// Start a DMA transfer of the queued bytes, up to the end of the buffer.  The
+// wrapped around part is sent by the next transfer.  Interrupts must be masked.
+static void UartStartTransfer()
 {
-	// See pg 187.  Bit 21 is the "Stream 6 transfer complete interrupt flag".  This bit
-	// will be set when the DMA transfer is complete.
-	if((ACCESS(DMA1_HISR) & (1 << 21)) != 0)
+	const uint32_t queued = txHead - txTail;
+	if (queued == 0)
 	{
-		// See pg 188.  Here we clear the transfer complete interrupt.
-		ACCESS(DMA1_HIFCR) |= (1 << 21);
-
-		// See pg 552.  Here we specify that we want an interrupt generated once the
-		// USART transmission is complete.
-		ACCESS(USART2_CR1) |= (1 << 6);
+		return;
 	}
-}
 
-void USART2_IRQHandler(void)
-{
-	// See pg 549.  Bit 6 of the status register will be set when the UART
-	// transmission has completed.
-	if((ACCESS(USART2_SR) & (1 << 6)) != 0)
+	const uint32_t start = txTail & TX_MASK;
+	uint32_t length = UART_TX_BUFFER_SIZE - start;
+	if (length > queued)
 	{
-		// Clear the interrupt. (...So that it doesn't continually trigger)
-		ACCESS(USART2_CR1) &= ~(1 << 6);
+		length = queued;
+	}
 
-		// Clear the busy flag to allow the next transmission.
-		uartBusy = 0;
+	// A transfer that can't start now (the UART isn't ready) is retried by the next write
+	if (HAL_UART_Transmit_DMA(&huart6, &txBuffer[start], length) == HAL_OK)
+	{
+		txInFlight = length;
 	}
 }
 
-void UartGpioInit()
+void UartInit()
 {
-	// Give a clock to port A as we'll be using one of its pins for transfer of data.
-	ACCESS(RCC_AHB1ENR) |= 1;
-
-	// See pg 19 of the ST UM1842 document.  We'll be using USART2.  USART2 TX occurs on
-	// PA2 and USART2 RX occurs on PA3 so we set this pin to alternate mode.
-	ACCESS(GPIOA_MODER) |= ((1 << 5) | (1 << 7));
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
 
-	// See pg 149 of ST RM0383 document.  USART2 is AF7.  And pg 160 of the same document
-	// shows alternate function for pins 2 and 3 are set using alternate function low register
-	// bits 8-thru-11.
-	ACCESS(GPIOA_AFRL) |= ((7 << 8) | (7 << 12));
+	txHead = 0;
+	txTail = 0;
+	txReserved = 0;
+	txOpen = 0;
+	txInFlight = 0;
+	txDropped = 0;
 
-	// Set PA2 and PA3 to high speed
-	ACCESS(GPIOA_OSPEEDR) |= ((3 << 4) | (3 << 6));
+	__set_PRIMASK(primask);
 }
 
-void UartDmaInit()
+// Reserve length bytes at the end of the queue, for UartCommit().  Returns 1
+// and the position of the reservation, or 0 if it didn't fit and was dropped.
+// Can be called from any context.
+int UartReserve(uint32_t length, uint32_t* position)
 {
-	// Enable a clock for DMA1
-	ACCESS(RCC_AHB1ENR) |= (1 << 21);
-
-	// See pg 189 for details of the DMA stream configuration register
-	// Setting bit 6 specifies memory-to-peripheral communication.
-	// Setting bit 10 specifies to increment the memory pointer after each data transfer.  This
-	// allows the DMA device to progressively step through the dmaBuffer array.
-	// Setting bit 27 specifies to use channel 4 of stream 6.
-	ACCESS(DMA1_S6CR) |= ((1 << 6) | (1 << 10) | (1 << 27));
-
-	// Enable interrupt for DMA1_Stream6
-	ACCESS(NVIC_ISER0) |= (1 << 17);
-}
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
 
-void UartInit()
-{
-	UartGpioInit();
-
-	UartDmaInit();
-
-	// Give a clock USART2.  See pg 117.
-	ACCESS(RCC_APB1ENR) |= (1 << 17);
-
-	// Here we set the baud rate.  This is explained on 519 of ST RM0383.  The peripheral
-	// clock is 16 MHz by default.  So, the calculation for the USARTDIV is:
-	// DesiredBaudRate = 16MHz / 16*USARTDIV
-	// Note that the fractional part of USARTDIV is represented with only 4 bits.  So
-	// if we use 9600 this will result in a small error of 0.02% (see pg 522).  Therefore
-	// the baud rate is actually 9,598.  Again, see pg 522.
-	ACCESS(USART2_BRR) |= 0x683;
-
-	// Enable USART2 for transmitting data.
-	ACCESS(USART2_CR1) |= ((1 << 3) | (1 << 13));
-
-	// See pg 200 of RM0383 ("STM32F411xC/E Reference Manual") for the interrupt
-	// vector table.  You'll see TIM3 is interrupt 29.
-	// See pg 209 of PM0214 ("STM32F4 Series Programming Manual") for info on "ISER"
-	// which is one of the "interrupt set-enable registers".  We enable interrupt
-	// number 29.
-	ACCESS(NVIC_ISER1) |= (1 << (38 - 32));
+	if (length > UART_TX_BUFFER_SIZE - (txReserved - txTail))
+	{
+		++txDropped;
+		__set_PRIMASK(primask);
+		return 0;
+	}
+
+	*position = txReserved;
+	txReserved += length;
+	++txOpen;
+
+	__set_PRIMASK(primask);
+	return 1;
 }
 
-void SendString(char* string)
+// Fill a reservation with its length bytes and queue it.  The copy runs with
+// the interrupts enabled, the reservation is only ours.
+void UartCommit(uint32_t position, const void* data, uint32_t length)
 {
-	// Here we block until the previous transfer completes.
-	while(uartBusy == 1);
-	uartBusy = 1;
+	const unsigned char* bytes = data;
 
-	// Copy the string into the DMA buffer and also calculate its length.
-	int lengthOfString = 0;
-	while(lengthOfString < MAX_BUFFER_SIZE && string[lengthOfString])
+	// Copy in at most two pieces, before and after the end of the buffer
+	const uint32_t start = position & TX_MASK;
+	uint32_t first = UART_TX_BUFFER_SIZE - start;
+	if (first > length)
 	{
-		dmaBuffer[lengthOfString] = string[lengthOfString];
-		++lengthOfString;
+		first = length;
 	}
+	memcpy(&txBuffer[start], bytes, first);
+	memcpy(txBuffer, bytes + first, length - first);
 
-	// See pg 192.  This register holds the number of data items to transfer.
-	ACCESS(DMA1_S6NDTR) = lengthOfString;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
 
-	// See pg 193.  This register holds the peripheral data register.  Since we're
-	// using USART2 we set it to its data register.
-	ACCESS(DMA1_S6PAR) = USART2_DR;
+	if (--txOpen == 0)
+	{
+		txHead = txReserved;
+		if (txInFlight == 0)
+		{
+			UartStartTransfer();
+		}
+	}
 
-	// See pg 193.  This register holds the memory address of the data we want to transfer.
-	ACCESS(DMA1_S6M0AR) = (unsigned int)dmaBuffer;
+	__set_PRIMASK(primask);
+}
 
-	// Enable interrupt to occur upon completion of transfer
-	ACCESS(DMA1_S6CR) |= (1 << 4);
+// Queue length bytes for transmission.  Returns 1 on success, 0 if the data
+// didn't fit and was dropped.  Can be called from any context.
+int UartWrite(const void* data, uint32_t length)
+{
+	uint32_t position;
+	if (!UartReserve(length, &position))
+	{
+		return 0;
+	}
+
+	UartCommit(position, data, length);
+	return 1;
+}
 
-	// Enable the stream
-	ACCESS(DMA1_S6CR) |= 1;
+// To be called from HAL_UART_TxCpltCallback: release the bytes that were just
+// sent and start on the next ones.
+void UartTxComplete()
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
 
-	// Clear the transfer complete flag in the UART SR
-	ACCESS(USART2_SR) &= ~(1 << 6);
+	txTail += txInFlight;
+	txInFlight = 0;
+	UartStartTransfer();
 
-	// Enable DMA transmission
-	ACCESS(USART2_CR3) |= (1 << 7);
+	__set_PRIMASK(primask);
+}
+
+uint32_t UartDroppedFrames()
+{
+	return txDropped;
 }
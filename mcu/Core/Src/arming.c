@@ -0,0 +1,56 @@
+#include "arming.h"
+#include "motor.h"
+
+static const uint32_t durations_us[] = {
+    [ARMING_CALIBRATE] = 3000000,
+    [ARMING_STOP] = 1000000,
+    [ARMING_SPIN_UP] = 1000000,
+};
+
+void Arming_Start(Arming *arming, int calibrate, uint32_t now_us)
+{
+    arming->state = calibrate ? ARMING_CALIBRATE : ARMING_STOP;
+    arming->since_us = now_us;
+    arming->calibrating = calibrate;
+    arming->calibrated = 0;
+}
+
+ArmingState Arming_Step(Arming *arming, uint32_t now_us, float *left, float *right)
+{
+    if (arming->state == ARMING_ARMED)
+        return arming->state;
+
+    if (now_us - arming->since_us >= durations_us[arming->state])
+    {
+        // The ESCs take the bottom of the range at the end of the stop
+        if (arming->state == ARMING_STOP && arming->calibrating)
+            arming->calibrated = 1;
+
+        arming->state++;
+        arming->since_us = now_us;
+        if (arming->state == ARMING_ARMED)
+            return arming->state;
+    }
+
+    const float command = arming->state == ARMING_CALIBRATE ? MOTOR_COMMAND_MAX
+                          : arming->state == ARMING_SPIN_UP ? ARMING_IDLE_COMMAND
+                                                            : 0.0f;
+    *left = command;
+    *right = command;
+    return arming->state;
+}
+
+void Arming_Hold(Arming *arming, uint32_t now_us)
+{
+    arming->since_us = now_us;
+}
+
+ArmingState Arming_State(const Arming *arming)
+{
+    return arming->state;
+}
+
+int Arming_Calibrated(const Arming *arming)
+{
+    return arming->calibrated;
+}
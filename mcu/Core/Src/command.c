@@ -0,0 +1,121 @@
+#include <stdint.h>
+#include "command.h"
+#include "fastmath.h"
+
+/* Digits past these don't change a float */
+#define COMMAND_MAX_DIGITS 9
+#define COMMAND_MAX_EXPONENT 60
+
+static int Command_IsDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// 10^exponent for exponent >= 0, by squaring
+static float Command_Power10(int exponent)
+{
+    float result = 1.0f;
+    float power = 10.0f;
+    while (exponent > 0)
+    {
+        if (exponent & 1)
+            result *= power;
+        power *= power;
+        exponent >>= 1;
+    }
+    return result;
+}
+
+int Command_Parse(const char *command, char *parameter, float *value)
+{
+    if (command[0] == 0 || command[1] != ':')
+        return 0;
+
+    const char *c = command + 2;
+    while (*c == ' ' || *c == '\t')
+        c++;
+
+    int negative = 0;
+    if (*c == '+' || *c == '-')
+        negative = *c++ == '-';
+
+    // The first significant digits go into an integer, the others only count
+    // toward the decimal exponent
+    uint32_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    int seen = 0;
+    for (; Command_IsDigit(*c); c++, seen = 1)
+    {
+        if (digits < COMMAND_MAX_DIGITS)
+        {
+            mantissa = mantissa * 10 + (uint32_t)(*c - '0');
+            digits += mantissa != 0;
+        }
+        else
+        {
+            exponent++;
+        }
+    }
+    if (*c == '.')
+    {
+        for (c++; Command_IsDigit(*c); c++, seen = 1)
+        {
+            if (digits < COMMAND_MAX_DIGITS)
+            {
+                mantissa = mantissa * 10 + (uint32_t)(*c - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
+    if (!seen)
+        return 0;
+
+    // An exponent without digits isn't part of the number, as for strtof()
+    if (*c == 'e' || *c == 'E')
+    {
+        const char *e = c + 1;
+        int exponent_negative = 0;
+        if (*e == '+' || *e == '-')
+            exponent_negative = *e++ == '-';
+        if (Command_IsDigit(*e))
+        {
+            int written = 0;
+            for (; Command_IsDigit(*e); e++)
+            {
+                if (written < 1000)
+                    written = written * 10 + (*e - '0');
+            }
+            exponent += exponent_negative ? -written : written;
+        }
+    }
+
+    // 10^-exponent alone would overflow for the smallest floats, the division
+    // goes in two steps then
+    float result = (float)mantissa;
+    if (mantissa != 0)
+    {
+        if (exponent > COMMAND_MAX_EXPONENT || exponent < -COMMAND_MAX_EXPONENT)
+            return 0;
+        if (exponent >= 0)
+        {
+            result *= Command_Power10(exponent);
+        }
+        else
+        {
+            if (exponent < -30)
+            {
+                result /= Command_Power10(30);
+                exponent += 30;
+            }
+            result /= Command_Power10(-exponent);
+        }
+        if (!isfinite(result))
+            return 0;
+    }
+
+    *parameter = command[0];
+    *value = negative ? -result : result;
+    return 1;
+}
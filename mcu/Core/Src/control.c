@@ -0,0 +1,81 @@
+#include "control.h"
+#include "model.h"
+#include "fastmath.h"
+
+/* Throttle of both motors, and the extra on the left one that holds the arm
+ * level against its own imbalance, in units of dF */
+#define BASE_THROTTLE 100.0f
+#define ARM_BIAS 90.0f
+
+void Control_Rate(Control *c, float rate, float dt)
+{
+    c->qf = rate;
+    c->theta += c->qf * dt;
+
+    if (c->law == CONTROL_CASCADE)
+        c->dF = (c->angle_term + c->qf) * c->cascade_b * J / L * 10;
+}
+
+void Control_Estimate(Control *c, short ax, short ay, short az, int fuse)
+{
+    // Compute angle using accelerometer
+    c->theta_acc = FastMath_Atan2f(ax, FastMath_Sqrtf((float)ay * ay + (float)az * az));
+
+    if (!fuse)
+        return;
+
+    const float32_t y[] = {c->theta_acc, c->qf};
+    const float32_t u[] = {c->qf, c->dF};
+
+    switch (c->filter)
+    {
+    case CONTROL_KALMAN:
+        c->theta = KalmanFilter_Update(c->kalman, y, u);
+        break;
+
+    case CONTROL_KALMAN_STEADY_STATE:
+        c->theta = KalmanFilter_UpdateSteadyState(c->kalman, y, u);
+        break;
+
+    default:
+        // Complementary filter, theta has been propagated with the gyro by the rate step
+        c->theta = c->theta * c->complementary_alpha + c->theta_acc * (1 - c->complementary_alpha);
+        break;
+    }
+}
+
+void Control_Law(Control *c)
+{
+    const float measurement = c->theta * FASTMATH_RAD_TO_DEG;
+
+    switch (c->law)
+    {
+    case CONTROL_CASCADE:
+        c->angle_term = (measurement - c->setpoint) * c->cascade_a;
+        break;
+
+    case CONTROL_LQR:
+    {
+        const float state[NUMBER_STATES] = {c->theta, c->qf};
+        // The gain is synthesized for a differential thrust in newtons
+        c->dF = -LQR_update(c->lqr, state) * (1.0f / CONTROL_THRUST_PER_UNIT);
+        break;
+    }
+
+    default:
+        // The PID output is -dF
+        PIDController_BackCalculate(c->pid, c->dF - c->dF_applied);
+        c->dF = -PIDController_Update(c->pid, c->setpoint, measurement);
+        break;
+    }
+}
+
+void Control_Mix(Control *c, float *left, float *right)
+{
+    // The arm bias is thrust of the left motor, the differential right minus left
+    const float collective = (BASE_THROTTLE + 0.5f * ARM_BIAS) * CONTROL_THRUST_PER_UNIT;
+    const float differential = (c->dF - ARM_BIAS) * CONTROL_THRUST_PER_UNIT;
+
+    const float applied = Mixer_Allocate(c->mixer, collective, differential, left, right);
+    c->dF_applied = applied * (1.0f / CONTROL_THRUST_PER_UNIT) + ARM_BIAS;
+}
@@ -0,0 +1,45 @@
+#include "main.h"
+#include "deferred.h"
+
+#define DEFERRED_QUEUE_LENGTH 8
+
+static DeferredFunction queue[DEFERRED_QUEUE_LENGTH];
+static volatile uint32_t head = 0;
+static volatile uint32_t tail = 0;
+static volatile uint32_t dropped = 0;
+
+int Deferred_Post(DeferredFunction function)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (head - tail == DEFERRED_QUEUE_LENGTH)
+    {
+        dropped++;
+        __set_PRIMASK(primask);
+        return 0;
+    }
+    queue[head % DEFERRED_QUEUE_LENGTH] = function;
+    head++;
+
+    __set_PRIMASK(primask);
+
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    return 1;
+}
+
+// Only PendSV consumes the queue, so tail needs no protection
+void Deferred_Run(void)
+{
+    while (tail != head)
+    {
+        const DeferredFunction function = queue[tail % DEFERRED_QUEUE_LENGTH];
+        tail++;
+        function();
+    }
+}
+
+uint32_t Deferred_Dropped(void)
+{
+    return dropped;
+}
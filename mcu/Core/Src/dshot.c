@@ -0,0 +1,117 @@
+#include "dshot.h"
+
+/* 5-bit GCR code to nibble, 0xFF for the codes that are never sent */
+static const uint8_t gcr_decode[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x9, 0xA, 0xB, 0xFF, 0xD, 0xE, 0xF,
+    0xFF, 0xFF, 0x2, 0x3, 0xFF, 0x5, 0x6, 0x7, 0xFF, 0x0, 0x8, 0x1, 0xFF, 0x4, 0xC, 0xFF};
+
+static uint32_t Dshot_Checksum(uint32_t value)
+{
+    return (value ^ (value >> 4) ^ (value >> 8)) & 0xF;
+}
+
+uint16_t Dshot_Throttle(float command, float command_max)
+{
+    if (!(command > 0.0f))
+        return 0;
+    command = command > command_max ? command_max : command;
+    const float steps_per_command = (float)(DSHOT_THROTTLE_MAX - DSHOT_THROTTLE_MIN) / command_max;
+    return (uint16_t)(DSHOT_THROTTLE_MIN + (uint32_t)(command * steps_per_command + 0.5f));
+}
+
+// One electrical revolution per period, poles / 2 of them per turn
+float Dshot_Rpm(uint32_t period_us, uint32_t poles)
+{
+    if (period_us == DSHOT_PERIOD_STOPPED)
+        return 0.0f;
+    return 60e6f / ((float)period_us * (float)(poles / 2));
+}
+
+uint16_t Dshot_Frame(uint16_t value, int telemetry, int inverted)
+{
+    const uint32_t data = ((uint32_t)(value & 0x7FF) << 1) | (telemetry ? 1 : 0);
+    uint32_t checksum = Dshot_Checksum(data);
+    if (inverted)
+        checksum = ~checksum & 0xF;
+    return (uint16_t)((data << 4) | checksum);
+}
+
+void Dshot_Encode(uint16_t frame, uint32_t one, uint32_t zero, uint32_t *slots, uint32_t stride)
+{
+    for (uint32_t i = 0; i < DSHOT_FRAME_BITS; i++)
+    {
+        slots[i * stride] = (frame & (0x8000 >> i)) ? one : zero;
+    }
+}
+
+int Dshot_Levels(const uint16_t *samples, uint32_t count, uint32_t start, uint32_t pin,
+                 uint32_t samples_per_bit_q8, uint32_t *levels)
+{
+    const uint16_t mask = (uint16_t)(1u << pin);
+
+    // The line idles high, the reply starts on its first falling edge
+    uint32_t i = start + 1;
+    while (i < count && !((samples[i - 1] & mask) && !(samples[i] & mask)))
+        i++;
+    if (i >= count)
+        return 0;
+
+    // Bits are the levels, 1 for low, most significant first
+    uint32_t value = 0;
+    uint32_t bits = 0;
+    uint32_t run_start = i;
+    uint32_t low = 1;
+    for (i++; i < count && bits < DSHOT_REPLY_BITS; i++)
+    {
+        const uint32_t sample_low = !(samples[i] & mask);
+        if (sample_low == low)
+            continue;
+
+        uint32_t run = (((i - run_start) << 8) + samples_per_bit_q8 / 2) / samples_per_bit_q8;
+        run = run ? run : 1;
+        run = run < DSHOT_REPLY_BITS - bits ? run : DSHOT_REPLY_BITS - bits;
+        value = (value << run) | (low ? (1u << run) - 1 : 0);
+        bits += run;
+        run_start = i;
+        low = sample_low;
+    }
+
+    // The last run lasts to the end of the reply, a low one never ended
+    if (bits < DSHOT_REPLY_BITS)
+    {
+        if (low)
+            return 0;
+        value <<= DSHOT_REPLY_BITS - bits;
+    }
+
+    *levels = value;
+    return 1;
+}
+
+int Dshot_DecodeReply(uint32_t levels, uint32_t *period_us)
+{
+    // A change of level between two bits is a 1 of the GCR word
+    const uint32_t gcr = (levels ^ (levels >> 1)) & 0xFFFFF;
+
+    uint32_t value = 0;
+    for (int shift = 15; shift >= 0; shift -= 5)
+    {
+        const uint8_t nibble = gcr_decode[(gcr >> shift) & 0x1F];
+        if (nibble == 0xFF)
+            return 0;
+        value = (value << 4) | nibble;
+    }
+
+    // The inverted checksum makes the XOR of all four nibbles 0xF
+    if ((Dshot_Checksum(value) ^ (value >> 12)) != 0xF)
+        return 0;
+
+    const uint32_t data = value >> 4;
+    if (data == 0xFFF)
+    {
+        *period_us = DSHOT_PERIOD_STOPPED;
+        return 1;
+    }
+    *period_us = (data & 0x1FF) << (data >> 9);
+    return 1;
+}
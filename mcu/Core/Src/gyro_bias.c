@@ -0,0 +1,85 @@
+#include <math.h>
+#include "gyro_bias.h"
+
+void GyroBias_Init(GyroBias *gb, const float bias[3])
+{
+    for (int i = 0; i < 3; i++)
+    {
+        gb->bias[i] = bias ? bias[i] : 0.0f;
+        gb->sum[i] = 0.0f;
+    }
+    gb->state = GYRO_BIAS_CALIBRATING;
+    gb->count = 0;
+    gb->restarts = 0;
+    gb->rest_s = 0.0f;
+}
+
+static int GyroBias_Calibrate(GyroBias *gb, const float rate[3], uint32_t count)
+{
+    if (gb->count > 0)
+    {
+        const float inv_count = 1.0f / gb->count;
+        for (int i = 0; i < 3; i++)
+        {
+            if (fabsf(rate[i] - gb->sum[i] * inv_count) > gb->motion_rate)
+            {
+                gb->sum[0] = gb->sum[1] = gb->sum[2] = 0.0f;
+                gb->count = 0;
+                gb->restarts++;
+                return 0;
+            }
+        }
+    }
+
+    // The rate is already an average, it weighs as the samples it holds
+    for (int i = 0; i < 3; i++)
+    {
+        gb->sum[i] += rate[i] * count;
+    }
+    gb->count += count;
+
+    if (gb->count < gb->samples)
+        return 0;
+
+    const float inv_count = 1.0f / gb->count;
+    for (int i = 0; i < 3; i++)
+    {
+        gb->bias[i] = gb->sum[i] * inv_count;
+    }
+    gb->state = GYRO_BIAS_TRACKING;
+    return 1;
+}
+
+static void GyroBias_Track(GyroBias *gb, const float rate[3], float dt)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        if (fabsf(rate[i] - gb->bias[i]) > gb->rest_rate)
+        {
+            gb->rest_s = 0.0f;
+            return;
+        }
+    }
+
+    gb->rest_s += dt;
+    if (gb->rest_s < gb->rest_time_s)
+        return;
+
+    const float k = dt / (gb->tracking_tau_s + dt);
+    for (int i = 0; i < 3; i++)
+    {
+        gb->bias[i] += (rate[i] - gb->bias[i]) * k;
+    }
+}
+
+int GyroBias_Update(GyroBias *gb, const float rate[3], uint32_t count, float dt)
+{
+    if (count == 0)
+        return 0;
+
+    if (gb->state == GYRO_BIAS_CALIBRATING)
+        return GyroBias_Calibrate(gb, rate, count);
+
+    GyroBias_Track(gb, rate, dt);
+    return 0;
+}
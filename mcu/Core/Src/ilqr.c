@@ -1,108 +1,101 @@
-#include <stdio.h>
-#include <math.h>
+#include "fastmath.h"
 #include "ilqr.h"
 #include "model.h"
 
-void LQR_init(LQR_Controller *lqr)
+// Solve the discrete-time algebraic Riccati equation
+//   P = Q + A' P A - A' P B (R + B' P B)^-1 B' P A
+// by fixed-point iteration for the zero-order-hold discretization of the arm
+//   A = [ 1  T ]    B = [ L/J * T^2 / 2 ]
+//       [ 0  1 ]        [ L/J * T       ]
+// and store K = (R + B' P B)^-1 B' P A into gain.  Returns the number of
+// iterations, or -1 if it did not converge, gain is left alone in that case.
+static int LQR_solve_dare(const LQR_Controller *lqr, float gain[NUMBER_STATES])
 {
-    // Linearize the system
-    lqr->A.pData[0] = 0.;
-    lqr->A.pData[1] = 1.;
-    lqr->A.pData[2] = 0.;
-    lqr->A.pData[3] = 0.;
+    const float T = lqr->T;
+    const float b0 = L / J * T * T / 2.0f;
+    const float b1 = L / J * T;
 
-    lqr->B.pData[0] = 0.;
-    lqr->B.pData[1] = L / J;
+    // Initialize P with Q
+    float p00 = lqr->q_angle;
+    float p01 = 0.0f;
+    float p11 = lqr->q_rate;
 
-    arm_matrix_instance_f32 Q, R;
+    float k0 = 0.0f;
+    float k1 = 0.0f;
 
-    static float32_t Q_data[] = {
-        1000, 0,
-        0, 1000};
-    static float32_t R_data[] = {
-        1};
+    for (int iter = 0; iter < MAX_ITER; ++iter)
+    {
+        // P * B
+        const float pb0 = p00 * b0 + p01 * b1;
+        const float pb1 = p01 * b0 + p11 * b1;
+
+        // s = R + B' * P * B
+        const float s = lqr->r + b0 * pb0 + b1 * pb1;
+
+        // B' * P * A
+        const float bpa0 = pb0;
+        const float bpa1 = pb0 * T + pb1;
+
+        // K = s^-1 * B' * P * A
+        k0 = bpa0 / s;
+        k1 = bpa1 / s;
+
+        // P_next = Q + A' * P * A - (B' * P * A)' * K
+        const float n00 = lqr->q_angle + p00 - bpa0 * k0;
+        const float n01 = p00 * T + p01 - bpa0 * k1;
+        const float n11 = lqr->q_rate + p00 * T * T + 2.0f * p01 * T + p11 - bpa1 * k1;
+
+        // Convergence check, relative to the size of P
+        const float diff = fabsf(n00 - p00) + 2.0f * fabsf(n01 - p01) + fabsf(n11 - p11);
+        const float norm = fabsf(n00) + 2.0f * fabsf(n01) + fabsf(n11);
+
+        p00 = n00;
+        p01 = n01;
+        p11 = n11;
+
+        if (diff <= EPSILON * norm)
+        {
+            gain[0] = k0;
+            gain[1] = k1;
+            return iter;
+        }
+    }
 
-    arm_mat_init_f32(&Q, NUMBER_STATES, NUMBER_STATES, Q_data);
-    arm_mat_init_f32(&R, NUMBER_CONTROLS, NUMBER_CONTROLS, R_data);
+    return -1;
 }
 
-// LQR controller function
-void LQR_update(LQR_Controller *lqr, float state[NUMBER_STATES], float control[NUMBER_CONTROLS])
+// The gain stays zero, and the controller silent, if the weights don't give
+// a solution
+int LQR_init(LQR_Controller *lqr)
 {
-	// Origin points
-	float z_origin[NUMBER_STATES] = {0};
-	float u_rest[NUMBER_CONTROLS] = {0};
-
-    int n = lqr->A.numRows;
-    arm_matrix_instance_f32 K, At, Bt, temp1, temp2, P, P_prev;
-
-    // Temporary matrices
-    float32_t K_data[NUMBER_CONTROLS * NUMBER_STATES];
-    float32_t At_data[n * n];
-    float32_t Bt_data[n * n];
-    float32_t temp1_data[n * n];
-    float32_t temp2_data[n * n];
-    float32_t P_data[NUMBER_STATES * NUMBER_STATES];
-    float32_t P_prev_data[NUMBER_STATES * NUMBER_STATES];
-
-    // Initialize temporary matrices
-    arm_mat_init_f32(&K, NUMBER_CONTROLS, NUMBER_STATES, K_data);
-    arm_mat_init_f32(&At, n, n, At_data);
-    arm_mat_init_f32(&Bt, n, n, Bt_data);
-    arm_mat_init_f32(&temp1, n, n, temp1_data);
-    arm_mat_init_f32(&temp2, n, n, temp2_data);
-    arm_mat_init_f32(&P, NUMBER_STATES, NUMBER_STATES, P_data);
-    arm_mat_init_f32(&P_prev, NUMBER_STATES, NUMBER_STATES, P_prev_data);
-
-    // Initialize P with Q
-    arm_mat_copy_f32(lqr->Q, P);
+    lqr->K[0][0] = 0.0f;
+    lqr->K[0][1] = 0.0f;
+    lqr->active = 0;
+    return LQR_solve_dare(lqr, lqr->K[0]);
+}
 
-    // Solve Algebraic Riccati Equation using Newton's Method
-    for (int iter = 0; iter < MAX_ITER; ++iter)
-    {
-        // Compute K = R^{-1} B^T P
-        arm_mat_trans_f32(&lqr->B, &Bt);      // Bt = B^T
-        arm_mat_mult_f32(&Bt, &P, &temp1);    // temp1 = B^T * P
-        arm_mat_inverse_f32(&lqr->R, &temp2); // temp2 = R^{-1}
-        arm_mat_mult_f32(&temp2, &temp1, &K); // K = R^{-1} * (B^T * P)
-
-        // Compute A_k = A - B * K
-        arm_mat_mult_f32(&lqr->B, &K, &temp1); // temp1 = B * K
-        arm_mat_sub_f32(&lqr->A, &temp1, &At); // At = A - B * K
-
-        // Solve Lyapunov Equation: At^T * P_next + P_next * At + Q + K^T * R * K = 0
-        arm_mat_trans_f32(&At, &Bt);              // Bt = At^T
-        arm_mat_mult_f32(&K, &lqr->R, &temp1);    // temp1 = K * R
-        arm_mat_mult_f32(&temp1, &K, &temp2);     // temp2 = K * R * K^T
-        arm_mat_add_f32(&lqr->Q, &temp2, &temp1); // temp1 = Q + K^T * R * K
-
-        arm_mat_mult_f32(&P, &Bt, &P_prev);   // P_prev = At^T * P
-        arm_mat_add_f32(&P_prev, &temp1, &P); // P = P_prev + temp1
-
-        // Convergence check
-        float32_t diff = 0.0f;
-        for (int i = 0; i < n * n; ++i)
-            diff += fabsf(P.pData[i] - P_prev.pData[i]);
-        if (diff < EPSILON)
-            break;
-    }
+// Re-solve the gain after the weights changed.  Must be called from the main
+// loop, never from the ISR: the new gain is written to the inactive buffer and
+// published with a single store, so a tick always sees a consistent pair.  If
+// the iteration does not converge nothing is published and the previous gain
+// stays in use.
+int LQR_synthesize(LQR_Controller *lqr)
+{
+    const uint32_t back = lqr->active ^ 1;
+    const int iterations = LQR_solve_dare(lqr, lqr->K[back]);
 
-    // Compute u_stabilize = K * (state - z_origin)
-    float32_t delta_state[NUMBER_STATES];
-    float32_t u_stabilize[NUMBER_CONTROLS];
-    for (int i = 0; i < NUMBER_STATES; i++)
+    if (iterations >= 0)
     {
-        delta_state[i] = state[i] - z_origin[i];
+        DSP_BARRIER();
+        lqr->active = back;
     }
-    arm_matrix_instance_f32 delta_state_mat, u_stabilize_mat;
-    arm_mat_init_f32(&delta_state_mat, NUMBER_STATES, 1, delta_state);
-    arm_mat_init_f32(&u_stabilize_mat, NUMBER_CONTROLS, 1, u_stabilize);
 
-    arm_mat_mult_f32(&K, &delta_state_mat, &u_stabilize_mat);
+    return iterations;
+}
 
-    // Compute u_original = u_stabilize + u_rest
-    for (int i = 0; i < NUMBER_CONTROLS; i++)
-    {
-        //u_original[i] = u_stabilize[i] + u_rest[i];
-    }
+// LQR controller function: u = -K * state
+float LQR_update(LQR_Controller *lqr, const float state[NUMBER_STATES])
+{
+    const float *K = lqr->K[lqr->active];
+    return -(K[0] * state[0] + K[1] * state[1]);
 }
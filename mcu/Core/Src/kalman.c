@@ -1,158 +1,257 @@
-#include <stdio.h>
-#include <math.h>
-#include <stdlib.h>
 #include "kalman.h"
 #include "model.h"
+#include "fastmath.h"
 
-// Function to initialize a matrix
-void initialize_matrix(float32_t *data, uint16_t rows, uint16_t cols, const float32_t *values)
+// Row-major index into a NUM_STATES x NUM_STATES matrix
+#define IDX(row, col) ((row) * NUM_STATES + (col))
+
+// Measurement update for a single scalar measurement z of state i.  Since R is
+// diagonal and each row of H selects one state, processing the measurements one
+// after the other is equivalent to the joint update and only needs a division
+// instead of the inversion of H * P * H' + R.
+static void KalmanFilter_UpdateScalar(float32_t x[NUM_STATES], float32_t P[NUM_STATES * NUM_STATES],
+                                      int i, float32_t z, float32_t r)
 {
-    for (int i = 0; i < rows * cols; i++)
+    // Copy of row i of P, it is overwritten while updating P below
+    const float32_t Pi[NUM_STATES] = {P[IDX(i, 0)], P[IDX(i, 1)], P[IDX(i, 2)]};
+
+    // Kalman Gain: K = P * H' / (H * P * H' + R)
+    const float32_t inv_s = 1.0f / (Pi[i] + r);
+    const float32_t K[NUM_STATES] = {Pi[0] * inv_s, Pi[1] * inv_s, Pi[2] * inv_s};
+
+    // Update State: x = x + K * (z - H * x)
+    const float32_t innovation = z - x[i];
+    x[0] += K[0] * innovation;
+    x[1] += K[1] * innovation;
+    x[2] += K[2] * innovation;
+
+    // Update Covariance: P = (I - K * H) * P = P - K * P(i, :)
+    for (int row = 0; row < NUM_STATES; row++)
     {
-        data[i] = values[i];
+        P[IDX(row, 0)] -= K[row] * Pi[0];
+        P[IDX(row, 1)] -= K[row] * Pi[1];
+        P[IDX(row, 2)] -= K[row] * Pi[2];
     }
 }
 
-float kalman_filter(float32_t y_data[NUM_MEASUREMENTS], float32_t u_data[NUM_INPUTS])
+// Time update of the covariance with the transition matrix
+//   phi = [ 1  0  -T ]
+//         [ 0  1   0 ]
+//         [ 0  0   1 ]
+// written out so that no temporary matrix is needed and nothing aliases.
+static void KalmanFilter_PredictCovariance(float32_t P[NUM_STATES * NUM_STATES], const KalmanModel *m)
 {
-    // System parameters
-    float32_t a = 0.1, b = 0.2, c = 0.3;
+    const float32_t T = m->T;
+    const float32_t *Q = m->Q;
 
-    // State vector [angle; velocity; gyro bias]
-    static float32_t x_data[NUM_STATES] = {0, 0, 0};
-    static arm_matrix_instance_f32 x;
-    arm_mat_init_f32(&x, NUM_STATES, 1, x_data);
+    // Predict Covariance: P = phi * P * phi' + Q
+    // Only the first row and column change, P is kept symmetric.
+    const float32_t p00 = P[IDX(0, 0)] - 2.0f * T * P[IDX(0, 2)] + T * T * P[IDX(2, 2)];
+    const float32_t p01 = P[IDX(0, 1)] - T * P[IDX(1, 2)];
+    const float32_t p02 = P[IDX(0, 2)] - T * P[IDX(2, 2)];
 
-    // Covariance matrix P
-    static float32_t P_data[NUM_STATES * NUM_STATES] = {
-        0, 0, 0,
-        0, 0, 0,
-        0, 0, 1e3};
-    static arm_matrix_instance_f32 P;
-    arm_mat_init_f32(&P, NUM_STATES, NUM_STATES, P_data);
+    P[IDX(0, 0)] = p00 + Q[IDX(0, 0)];
+    P[IDX(0, 1)] = P[IDX(1, 0)] = p01 + Q[IDX(0, 1)];
+    P[IDX(0, 2)] = P[IDX(2, 0)] = p02 + Q[IDX(0, 2)];
+    P[IDX(1, 1)] += Q[IDX(1, 1)];
+    P[IDX(1, 2)] = P[IDX(2, 1)] = P[IDX(1, 2)] + Q[IDX(1, 2)];
+    P[IDX(2, 2)] += Q[IDX(2, 2)];
+}
 
-    // Process noise covariance matrix Q
-    float32_t Q_data[NUM_STATES * NUM_STATES] = {
-        c * powf(Ts, 3) / 3 + a * Ts, 0, -c * powf(Ts, 2) / 2,
-        0, b * Ts, 0,
-        -c * powf(Ts, 2) / 2, 0, c * Ts};
-    arm_matrix_instance_f32 Q;
-    arm_mat_init_f32(&Q, NUM_STATES, NUM_STATES, Q_data);
-
-    // Transition matrix phi
-    float32_t phi_data[NUM_STATES * NUM_STATES] = {
-        1, 0, -Ts,
-        0, 1, 0,
-        0, 0, 1};
-    arm_matrix_instance_f32 phi;
-    arm_mat_init_f32(&phi, NUM_STATES, NUM_STATES, phi_data);
-
-    // Control input matrix G
-    float32_t G_data[NUM_STATES * NUM_INPUTS] = {
-        Ts, 0,
-        0, L / J * Ts,
-        0, 0};
-    arm_matrix_instance_f32 G;
-    arm_mat_init_f32(&G, NUM_STATES, NUM_INPUTS, G_data);
-
-    // Measurement matrix H
-    float32_t H_data[NUM_MEASUREMENTS * NUM_STATES] = {
-        1, 0, 0,
-        0, 1, 0};
-    arm_matrix_instance_f32 H;
-    arm_mat_init_f32(&H, NUM_MEASUREMENTS, NUM_STATES, H_data);
-
-    // Measurement noise covariance matrix R
-    float32_t R_data[NUM_MEASUREMENTS * NUM_MEASUREMENTS] = {
-        0.6, 0,
-        0, 0.2};
-    arm_matrix_instance_f32 R;
-    arm_mat_init_f32(&R, NUM_MEASUREMENTS, NUM_MEASUREMENTS, R_data);
-
-    // Temporary matrices
-    float32_t temp1_data[NUM_STATES * NUM_MEASUREMENTS];
-    arm_matrix_instance_f32 temp1;
-    arm_mat_init_f32(&temp1, NUM_STATES, NUM_MEASUREMENTS, temp1_data);
-
-    float32_t temp2_data[NUM_MEASUREMENTS * NUM_MEASUREMENTS];
-    arm_matrix_instance_f32 temp2;
-    arm_mat_init_f32(&temp2, NUM_MEASUREMENTS, NUM_MEASUREMENTS, temp2_data);
-
-    float32_t K_data[NUM_STATES * NUM_MEASUREMENTS];
-    arm_matrix_instance_f32 K;
-    arm_mat_init_f32(&K, NUM_STATES, NUM_MEASUREMENTS, K_data);
-
-    float32_t I_data[NUM_STATES * NUM_STATES] = {
-        1, 0, 0,
-        0, 1, 0,
-        0, 0, 1};
-    arm_matrix_instance_f32 I;
-    arm_mat_init_f32(&I, NUM_STATES, NUM_STATES, I_data);
-
-    float32_t estimate[NUM_MEASUREMENTS];
-    float32_t error_bound[NUM_STATES];
-
-    // Sensor measurements
-    arm_matrix_instance_f32 y;
-    arm_mat_init_f32(&y, NUM_MEASUREMENTS, 1, y_data);
-
-    // Control inputs
-    arm_matrix_instance_f32 u;
-    arm_mat_init_f32(&u, NUM_INPUTS, 1, u_data);
+// Predict State: x = phi * x + G * u
+static void KalmanFilter_PredictState(float32_t x[NUM_STATES], const KalmanModel *m, const float32_t u[NUM_INPUTS])
+{
+    x[0] = x[0] - m->T * x[2] + m->G_rate * u[0];
+    x[1] = x[1] + m->G_force * u[1];
+}
 
-    // Kalman Gain: K = P * H' / (H * P * H' + R)
-    arm_mat_trans_f32(&H, &temp1);        // H'
-    arm_mat_mult_f32(&P, &temp1, &temp1); // P * H'
-    arm_mat_mult_f32(&H, &temp1, &temp2); // H * P * H'
-    arm_mat_add_f32(&temp2, &R, &temp2);  // + R
-    arm_mat_inverse_f32(&temp2, &temp2);  // Invert
-    arm_mat_mult_f32(&temp1, &temp2, &K); // K = P * H' * inv(H * P * H' + R)
-
-    // Update State: x = x + K * (y - H * x)
-    float32_t y_est[NUM_MEASUREMENTS];
-    arm_mat_mult_f32(&H, &x, &temp2); // H * x
-    for (int i = 0; i < NUM_MEASUREMENTS; i++)
+// Derive the constant model terms from the tuning parameters
+static void KalmanModel_Derive(KalmanModel *m, const KalmanFilter *kf)
+{
+    const float32_t T = kf->T;
+    const float32_t T2 = T * T;
+    const float32_t T3 = T2 * T;
+
+    m->T = T;
+
+    // Process noise covariance matrix Q
+    //   [ c*T^3/3 + a*T   0      -c*T^2/2 ]
+    //   [ 0               b*T     0       ]
+    //   [ -c*T^2/2        0       c*T     ]
+    for (int i = 0; i < NUM_STATES * NUM_STATES; i++)
     {
-        y_est[i] = y_data[i] - temp2.pData[i]; // y - H * x
+        m->Q[i] = 0.0f;
     }
-    for (int i = 0; i < NUM_STATES; i++)
+    m->Q[IDX(0, 0)] = kf->c * T3 / 3.0f + kf->a * T;
+    m->Q[IDX(0, 2)] = -kf->c * T2 / 2.0f;
+    m->Q[IDX(1, 1)] = kf->b * T;
+    m->Q[IDX(2, 0)] = -kf->c * T2 / 2.0f;
+    m->Q[IDX(2, 2)] = kf->c * T;
+
+    // Measurement noise covariance matrix R (diagonal)
+    m->R[0] = kf->r_angle;
+    m->R[1] = kf->r_rate;
+
+    // Control input matrix G, only the two non-zero entries are kept
+    //   [ T  0       ]
+    //   [ 0  L/J * T ]
+    //   [ 0  0       ]
+    m->G_rate = T;
+    m->G_force = L / J * T;
+}
+
+// Iterate the Riccati recursion of the filter until the gain stops changing
+// and store it into m->K.  Returns the number of iterations, or -1 if it did
+// not converge, m->K is left alone in that case.
+static int KalmanModel_SolveGain(KalmanModel *m)
+{
+    float32_t P[NUM_STATES * NUM_STATES] = {
+        0, 0, 0,
+        0, 0, 0,
+        0, 0, 1e3f};
+    float32_t x[NUM_STATES] = {0};
+    float32_t K[NUM_STATES * NUM_MEASUREMENTS] = {0};
+
+    for (int iter = 0; iter < KALMAN_SS_MAX_ITER; iter++)
     {
-        for (int j = 0; j < NUM_MEASUREMENTS; j++)
+        // Joint gain on the a priori covariance: K = P * H' * inv(H * P * H' + R)
+        const float32_t s00 = P[IDX(0, 0)] + m->R[0];
+        const float32_t s01 = P[IDX(0, 1)];
+        const float32_t s11 = P[IDX(1, 1)] + m->R[1];
+        const float32_t inv_det = 1.0f / (s00 * s11 - s01 * s01);
+
+        float32_t diff = 0.0f;
+        for (int row = 0; row < NUM_STATES; row++)
+        {
+            const float32_t p0 = P[IDX(row, 0)];
+            const float32_t p1 = P[IDX(row, 1)];
+            const float32_t k0 = (p0 * s11 - p1 * s01) * inv_det;
+            const float32_t k1 = (p1 * s00 - p0 * s01) * inv_det;
+
+            diff += fabsf(k0 - K[row * NUM_MEASUREMENTS + 0]) + fabsf(k1 - K[row * NUM_MEASUREMENTS + 1]);
+            K[row * NUM_MEASUREMENTS + 0] = k0;
+            K[row * NUM_MEASUREMENTS + 1] = k1;
+        }
+
+        // The first pass has no previous gain to compare with
+        if (iter > 0 && diff < KALMAN_SS_EPSILON)
         {
-            x_data[i] += K.pData[i * NUM_MEASUREMENTS + j] * y_est[j];
+            for (int i = 0; i < NUM_STATES * NUM_MEASUREMENTS; i++)
+            {
+                m->K[i] = K[i];
+            }
+            return iter;
         }
+
+        // The covariance does not depend on the data, x is only a scratch vector
+        KalmanFilter_UpdateScalar(x, P, 0, 0.0f, m->R[0]);
+        KalmanFilter_UpdateScalar(x, P, 1, 0.0f, m->R[1]);
+        KalmanFilter_PredictCovariance(P, m);
     }
 
-    // Update Covariance: P = (I - K * H) * P
-    arm_mat_mult_f32(&K, &H, &temp1);    // K * H
-    arm_mat_sub_f32(&I, &temp1, &temp1); // I - K * H
-    arm_mat_mult_f32(&temp1, &P, &P);    // Update P
+    return -1;
+}
+
+// Returns the iterations of the steady-state gain, or -1 if it did not
+// converge: the gain is zero then, the steady-state mode only integrates the
+// gyro until a synthesis succeeds
+int KalmanFilter_Init(KalmanFilter *kf)
+{
+    KalmanModel_Derive(&kf->model[0], kf);
+    for (int i = 0; i < NUM_STATES * NUM_MEASUREMENTS; i++)
+    {
+        kf->model[0].K[i] = 0.0f;
+    }
+    const int iterations = KalmanModel_SolveGain(&kf->model[0]);
+    kf->active = 0;
 
-    // Store Estimates
-    estimate[0] = x_data[0];
-    estimate[1] = x_data[1];
+    // State vector [angle; velocity; gyro bias]
     for (int i = 0; i < NUM_STATES; i++)
     {
-        error_bound[i] = sqrtf(P.pData[i * NUM_STATES + i]);
+        kf->x[i] = 0.0f;
+    }
+
+    // Covariance matrix P, only the gyro bias is unknown at start
+    for (int i = 0; i < NUM_STATES * NUM_STATES; i++)
+    {
+        kf->P[i] = 0.0f;
     }
+    kf->P[IDX(2, 2)] = 1e3f;
+
+    return iterations;
+}
 
-    // Predict State: x = phi * x + G * u
-    arm_mat_mult_f32(&phi, &x, &temp1); // phi * x
-    arm_mat_mult_f32(&G, &u, &temp2);   // G * u
+// The gyro rate fed to the filter has just been corrected by a bias
+// calibration: what the bias state had learnt is gone from the input, what is
+// left is within the calibration's own error
+void KalmanFilter_ResetBias(KalmanFilter *kf, float32_t variance)
+{
+    kf->x[2] = 0.0f;
     for (int i = 0; i < NUM_STATES; i++)
     {
-        x_data[i] = temp1.pData[i] + temp2.pData[i];
+        kf->P[IDX(i, 2)] = 0.0f;
+        kf->P[IDX(2, i)] = 0.0f;
     }
+    kf->P[IDX(2, 2)] = variance;
+}
 
-    // Predict Covariance: P = phi * P * phi' + Q
-    arm_mat_mult_f32(&phi, &P, &temp1);
-    arm_mat_trans_f32(&phi, &temp2);
-    arm_mat_mult_f32(&temp1, &temp2, &P);
-    arm_mat_add_f32(&P, &Q, &P);
+// Re-derive the model and the steady-state gain after the tuning parameters
+// changed.  Must be called from the main loop, never from the ISR: the new
+// model is built in the inactive buffer and swapped in with a single store, so
+// the next tick picks it up as a whole.  If the gain does not converge nothing
+// is published and the previous model stays in use.
+int KalmanFilter_Synthesize(KalmanFilter *kf)
+{
+    const uint32_t back = kf->active ^ 1;
+    KalmanModel *m = &kf->model[back];
+
+    KalmanModel_Derive(m, kf);
+    const int iterations = KalmanModel_SolveGain(m);
+
+    if (iterations >= 0)
+    {
+        DSP_BARRIER();
+        kf->active = back;
+    }
+
+    return iterations;
+}
+
+float KalmanFilter_Update(KalmanFilter *kf, const float32_t y[NUM_MEASUREMENTS], const float32_t u[NUM_INPUTS])
+{
+    const KalmanModel *m = &kf->model[kf->active];
+
+    // Sequential measurement updates: accelerometer angle, then gyro rate
+    KalmanFilter_UpdateScalar(kf->x, kf->P, 0, y[0], m->R[0]);
+    KalmanFilter_UpdateScalar(kf->x, kf->P, 1, y[1], m->R[1]);
+
+    // Store Estimate
+    const float32_t estimate = kf->x[0];
+
+    KalmanFilter_PredictState(kf->x, m, u);
+    KalmanFilter_PredictCovariance(kf->P, m);
+
+    return estimate;
+}
+
+// Same estimator with the converged gain: no covariance propagation at all,
+// just x = x + K * (y - H * x) followed by the state prediction.
+float KalmanFilter_UpdateSteadyState(KalmanFilter *kf, const float32_t y[NUM_MEASUREMENTS], const float32_t u[NUM_INPUTS])
+{
+    const KalmanModel *m = &kf->model[kf->active];
+    const float32_t *K = m->K;
+    float32_t *x = kf->x;
+
+    const float32_t e0 = y[0] - x[0];
+    const float32_t e1 = y[1] - x[1];
+    x[0] += K[0] * e0 + K[1] * e1;
+    x[1] += K[2] * e0 + K[3] * e1;
+    x[2] += K[4] * e0 + K[5] * e1;
+
+    // Store Estimate
+    const float32_t estimate = x[0];
 
-    // Print Results
-    /* printf("Angle Estimate: %.2f, Velocity Estimate: %.2f, Error Bounds: [%.2f, %.2f, %.2f]\n",
-           estimate[0], estimate[1], error_bound[0], error_bound[1], error_bound[2]);*/
+    KalmanFilter_PredictState(x, m, u);
 
-    return estimate[0];
+    return estimate;
 }
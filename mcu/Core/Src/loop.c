@@ -0,0 +1,76 @@
+#include "loop.h"
+#include "kalman.h"
+#include "fastmath.h"
+
+// A motor cut overrides every other command
+static void Loop_Cut(Loop *loop, SafetyMode mode)
+{
+    if (mode == SAFETY_MOTOR_CUT)
+    {
+        loop->left = 0.0f;
+        loop->right = 0.0f;
+    }
+}
+
+uint32_t Loop_Rate(Loop *loop, const SensorSet *set, SafetyMode mode)
+{
+    uint32_t events = 0;
+
+    // Integration step: the time covered by the gyro samples averaged into the
+    // rate, or hold the last rate over the nominal period if no new ones came in
+    float dt = set->gyro.dt;
+    uint32_t count = set->gyro.count;
+    if (set->gyro.timestamp_us == loop->last_gyro_us || count == 0)
+    {
+        dt = loop->tick_period_s;
+        count = 0;
+    }
+    loop->last_gyro_us = set->gyro.timestamp_us;
+
+    // The Kalman filter learnt the bias of the raw rate, the corrected one
+    // starts with the next step
+    if (GyroBias_Update(loop->gyro_bias, set->gyro.rate, count, dt))
+    {
+        KalmanFilter_ResetBias(loop->control->kalman, loop->gyro_bias_residual_variance);
+        events |= LOOP_GYRO_BIAS_CALIBRATED;
+    }
+
+    // Pitch rate, rad/s
+    Control_Rate(loop->control, set->gyro.rate[1] - loop->gyro_bias->bias[1], dt);
+
+    Control_Mix(loop->control, &loop->left, &loop->right);
+    Loop_Cut(loop, mode);
+    if (Arming_State(loop->arming) == ARMING_ARMED)
+        events |= LOOP_WRITE_MOTORS;
+
+    return events;
+}
+
+// Drives the motors until the ESCs are armed, the rate step takes them over
+// from the next tick on
+uint32_t Loop_Arming(Loop *loop, uint32_t now_us, SafetyMode mode)
+{
+    if (Arming_State(loop->arming) == ARMING_ARMED)
+        return 0;
+
+    if (Arming_Step(loop->arming, now_us, &loop->left, &loop->right) == ARMING_ARMED)
+        return LOOP_ARMED;
+
+    Loop_Cut(loop, mode);
+    return LOOP_WRITE_MOTORS;
+}
+
+// Without fresh accelerometer samples theta is the gyro integral of the rate
+// step alone
+void Loop_Estimate(Loop *loop, const SensorSet *set, SafetyMode mode)
+{
+    Control_Estimate(loop->control, set->accelerometer.x, set->accelerometer.y, set->accelerometer.z,
+                     mode != SAFETY_GYRO_ONLY);
+}
+
+// The controller starts with the motors, nothing to integrate before
+void Loop_Law(Loop *loop)
+{
+    if (Arming_State(loop->arming) == ARMING_ARMED)
+        Control_Law(loop->control);
+}
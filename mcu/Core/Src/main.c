@@ -24,15 +24,31 @@
 #include "Accelerometer.h"
 #include "Magnetometer.h"
 #include "Gyro.h"
-#include "math.h"
 #include "stdint.h"
 #include "motor.h"
 #include "PID.h"
 #include "kalman.h"
 #include "ilqr.h"
+#include "control.h"
+#include "tuning.h"
 #include "model.h"
 #include "DisplayData.h"
+#include "profiler.h"
+#include "UART.h"
+#include "telemetry.h"
+#include "sensors.h"
 #include <stdio.h>
+#include <string.h>
+#include "scheduler.h"
+#include "deferred.h"
+#include "I2C.h"
+#include "safety.h"
+#include "fastmath.h"
+#include "settings.h"
+#include "arming.h"
+#include "gyro_bias.h"
+#include "command.h"
+#include "loop.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -44,25 +60,69 @@
 /* USER CODE BEGIN PD */
 #define UART_RX_BUFFER_SIZE 64
 
-#define M_G 9.81
-#define RAD_TO_DEG 180 / M_PI
-#define DEG_TO_RAD M_PI / 180
-
-#define ARM_BIAS 90
-
-#define PID_KP 1.4f
-#define PID_KI 0.4f
-#define PID_KD 8.2f
-
-#define PID_TAU 0.02f
-
-#define PID_LIM_MIN -400.0f
-#define PID_LIM_MAX 400.0f
-
-#define PID_LIM_MIN_INT -50.0f
-#define PID_LIM_MAX_INT 50.0f
-
-#define SAMPLE_TIME_S 0.01f
+/* Received commands waiting to be parsed at the PendSV priority */
+#define COMMAND_QUEUE_LENGTH 4
+
+#define M_G 9.81f
+
+/* Control loop rate at boot, the rate of the scheduler tick and of the inner
+ * rate loop.  Everything that depends on the loop period (the TIM2 period, the
+ * sensor lead, the task periods and the PID, Kalman and LQR discretizations) is
+ * derived from it by ControlRate_Apply(), which also runs when a new rate
+ * arrives as "f:<Hz>", within CONTROL_RATE_MIN_HZ and CONTROL_RATE_MAX_HZ. */
+#define CONTROL_RATE_HZ 1000
+
+/* TIM2 counts at 1 MHz (48 MHz / 48), the loop period has a 1 us resolution */
+#define TIM2_COUNTS_PER_S 1000000
+
+/* ESC protocol on TIM4.  DShot300 sends every command of the control tick as
+ * a digital frame and, bidirectional, reads the motor speeds back.
+ * MOTOR_ONESHOT125 and MOTOR_PWM are there for ESCs without DShot. */
+#define MOTOR_PROTOCOL MOTOR_DSHOT300
+#define MOTOR_BIDIRECTIONAL 1
+
+/* Sensor setup.  Both sensors run well above the loop rate into their FIFOs
+ * and every read drains and averages all the stored samples.  In data-ready
+ * acquisition the gyro FIFO watermark paces the control step, it follows the
+ * control rate: 760 Hz / 8 = 95 Hz for 100 Hz. */
+#define GYRO_ODR GYRO_ODR_760HZ
+#define GYRO_ODR_HZ 760
+#define GYRO_BANDWIDTH GYRO_BANDWIDTH_0 // 30 Hz cut-off at 760 Hz
+#define GYRO_RANGE GYRO_RANGE_250DPS
+#define GYRO_FIFO_WATERMARK_MAX 31
+
+/* Gyro bias calibration, see gyro_bias.h */
+#define GYRO_BIAS_SAMPLES ((uint32_t)(GYRO_ODR_HZ * GYRO_BIAS_CALIBRATION_S))
+
+#define ACCELEROMETER_ODR ACCELEROMETER_ODR_400HZ
+#define ACCELEROMETER_RANGE ACCELEROMETER_RANGE_2G
+#define ACCELEROMETER_FIFO_WATERMARK 4
+
+/* In timer mode TIM2 channel 1 starts the sensor reads this long before the
+ * update event, so the set lands just before the tick that consumes it.  The
+ * SPI burst takes ~15 us and the I2C one ~250 us.  Above 1 kHz the lead is cut
+ * to half the period. */
+#define SENSOR_LEAD_US 500
+
+/* Rates of the slower tasks, they run every CONTROL_RATE_HZ / rate ticks.  The
+ * angle task runs the estimator and the outer loop of every controller. */
+#define ANGLE_RATE_HZ 200
+#define TELEMETRY_RATE_HZ 50
+#define MAGNETOMETER_RATE_HZ 10
+#define HEALTH_RATE_HZ 2
+
+#define ANGLE_PERIOD_TICKS (CONTROL_RATE_HZ / ANGLE_RATE_HZ)
+#define TELEMETRY_PERIOD_TICKS (CONTROL_RATE_HZ / TELEMETRY_RATE_HZ)
+#define MAGNETOMETER_PERIOD_TICKS (CONTROL_RATE_HZ / MAGNETOMETER_RATE_HZ)
+#define HEALTH_PERIOD_TICKS (CONTROL_RATE_HZ / HEALTH_RATE_HZ)
+
+/* Worst case execution time allowed to each task, in us */
+#define RATE_TASK_BUDGET_US 50
+#define ARMING_TASK_BUDGET_US 10
+#define ANGLE_TASK_BUDGET_US 100
+#define TELEMETRY_TASK_BUDGET_US 200
+#define MAGNETOMETER_TASK_BUDGET_US 20
+#define HEALTH_TASK_BUDGET_US 100
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -76,31 +136,110 @@ TIM_HandleTypeDef htim4;
 
 UART_HandleTypeDef huart6;
 DMA_HandleTypeDef hdma_usart6_rx;
+DMA_HandleTypeDef hdma_usart6_tx;
 
 /* USER CODE BEGIN PV */
 uint8_t UART_RxBuffer[UART_RX_BUFFER_SIZE] = {0};
 
-enum Controller
-{
-  Cascade,
-  PID,
-  LQR
-};
-enum Filter
-{
-  Complementary,
-  Kalman
-};
-static enum Controller controller = PID;
-static enum Filter filter = Complementary;
+/* Filled by the UART interrupt, emptied by Command_Run() */
+static char command_queue[COMMAND_QUEUE_LENGTH][UART_RX_BUFFER_SIZE + 1];
+static volatile uint32_t command_head = 0;
+static volatile uint32_t command_tail = 0;
+static volatile uint32_t commands_dropped = 0;
 
 static PIDController pid = {PID_KP, PID_KI, PID_KD,
                             PID_TAU,
                             PID_LIM_MIN, PID_LIM_MAX,
                             PID_LIM_MIN_INT, PID_LIM_MAX_INT,
-                            SAMPLE_TIME_S};
+                            (float)ANGLE_PERIOD_TICKS / CONTROL_RATE_HZ};
+
+static KalmanFilter kalman = {KALMAN_Q_ANGLE, KALMAN_Q_VELOCITY, KALMAN_Q_BIAS,
+                              KALMAN_R_ANGLE, KALMAN_R_RATE,
+                              (float)ANGLE_PERIOD_TICKS / CONTROL_RATE_HZ};
+
+static LQR_Controller lqr = {LQR_Q_ANGLE, LQR_Q_RATE, LQR_R,
+                             (float)ANGLE_PERIOD_TICKS / CONTROL_RATE_HZ};
+
+/* Thrust stand fits of the left and right motors, see mixer.h.  Until the
+ * motors are measured both are the linear thrust the gains were tuned with. */
+static const MixerCalibration motor_calibration[2] = {{CONTROL_THRUST_PER_UNIT, 0.0f},
+                                                      {CONTROL_THRUST_PER_UNIT, 0.0f}};
+static Mixer mixer;
+
+static GyroBias gyro_bias = {GYRO_BIAS_SAMPLES, GYRO_BIAS_MOTION_RAD_S,
+                             GYRO_BIAS_REST_RAD_S, GYRO_BIAS_REST_S, GYRO_BIAS_TRACKING_TAU_S};
+
+static Arming arming;
+
+static void RateTask(void);
+static void ArmingTask(void);
+static void AngleTask(void);
+static void MagnetometerTask(void);
+static void TelemetryTask(void);
+static void HealthTask(void);
+
+/* In priority order */
+enum
+{
+  TASK_RATE,
+  TASK_ARMING,
+  TASK_ANGLE,
+  TASK_MAGNETOMETER,
+  TASK_TELEMETRY,
+  TASK_HEALTH,
+  NUM_TASKS
+};
+static SchedulerTask tasks[NUM_TASKS] = {
+    [TASK_RATE] = {"rate", RateTask, SCHEDULER_TICK, 1, 0, RATE_TASK_BUDGET_US},
+    [TASK_ARMING] = {"arming", ArmingTask, SCHEDULER_TICK, 1, 0, ARMING_TASK_BUDGET_US},
+    [TASK_ANGLE] = {"angle", AngleTask, SCHEDULER_TICK, ANGLE_PERIOD_TICKS, 0, ANGLE_TASK_BUDGET_US},
+    [TASK_MAGNETOMETER] = {"magnetometer", MagnetometerTask, SCHEDULER_TICK, MAGNETOMETER_PERIOD_TICKS, 1, MAGNETOMETER_TASK_BUDGET_US},
+    [TASK_TELEMETRY] = {"telemetry", TelemetryTask, SCHEDULER_BACKGROUND, TELEMETRY_PERIOD_TICKS, 0, TELEMETRY_TASK_BUDGET_US},
+    [TASK_HEALTH] = {"health", HealthTask, SCHEDULER_BACKGROUND, HEALTH_PERIOD_TICKS, 1, HEALTH_TASK_BUDGET_US}};
+
+/* Estimator and controller state shared by the rate and angle tasks, both run
+ * in the tick.  The filter coefficient is derived for the angle period by
+ * ControlRate_Apply(). */
+static Control control = {CONTROL_PID, CONTROL_COMPLEMENTARY, 0.0f,
+                          CASCADE_A, CASCADE_B,
+                          COMPLEMENTARY_TAU_S / (COMPLEMENTARY_TAU_S + (float)ANGLE_PERIOD_TICKS / CONTROL_RATE_HZ),
+                          &pid, &kalman, &lqr, &mixer};
+
+/* Body of the rate, arming and angle tasks, see loop.h.  The tick period is
+ * the one the rate task was derived for, only ControlRate_Apply() writes it. */
+static Loop loop = {&control, &gyro_bias, &arming, GYRO_BIAS_RESIDUAL_VARIANCE, 1.0f / CONTROL_RATE_HZ};
+
+/* Most recent complete sensor set, read by the rate task for both tasks */
+static SensorSet sensors;
+
+/* Last outputs, copied by the telemetry task with the interrupts off */
+static TelemetrySample telemetry_latest;
+
+/* Requested loop rate, applied in the main loop when control_rate_dirty is set */
+static volatile uint32_t control_rate_hz = CONTROL_RATE_HZ;
+static volatile int control_rate_dirty = 0;
 
-static LQR_Controller lqr = {};
+/* Set when a rate out of range was requested, reported from the main loop */
+static volatile int control_rate_rejected = 0;
+
+/* Set when new Kalman noise parameters arrived, the gain is re-solved in the main loop */
+static volatile int kalman_dirty = 0;
+
+/* Set when new LQR weights arrived, the gain is re-solved in the main loop */
+static volatile int lqr_dirty = 0;
+
+/* Set when the timing report was requested, it is printed from the main loop */
+static volatile int profiler_report = 0;
+
+/* Set by "E": the ESC range is calibrated again at the next power up */
+static volatile int esc_calibration_request = 0;
+
+/* The calibration of this boot has been stored */
+static int esc_calibration_saved = 0;
+
+/* Set by the rate task when the gyro bias calibration completes, it is stored
+ * from the main loop */
+static volatile int gyro_bias_dirty = 0;
 
 /* USER CODE END PV */
 
@@ -112,7 +251,13 @@ static void MX_TIM4_Init(void);
 static void MX_USART6_UART_Init(void);
 static void MX_TIM2_Init(void);
 /* USER CODE BEGIN PFP */
-#define PUTCHAR_PROTOTYPE int __io_putchar(int ch)
+static void ControlTick(void);
+static void SensorSetReady(void);
+static void ControlRate_SetTimer(uint32_t rate_hz);
+static uint32_t ControlRate_Watermark(uint32_t rate_hz);
+static void ControlRate_SetSafety(float tick_s, uint32_t watermark);
+static void ControlRate_Apply(uint32_t rate_hz);
+static void Command_Run(void);
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
@@ -144,6 +289,9 @@ int main(void)
   SystemClock_Config();
 
   /* USER CODE BEGIN SysInit */
+  // The boot phases and the bus timeouts and recovery count on the cycle
+  // counter
+  Profiler_Init();
 
   /* USER CODE END SysInit */
 
@@ -154,16 +302,37 @@ int main(void)
   MX_USART6_UART_Init();
   MX_TIM2_Init();
   /* USER CODE BEGIN 2 */
+  Profiler_BootMark(BOOT_PERIPHERALS);
+
   HAL_UARTEx_ReceiveToIdle_DMA(&huart6, UART_RxBuffer, UART_RX_BUFFER_SIZE);
   __HAL_DMA_DISABLE_IT(&hdma_usart6_rx, DMA_IT_HT);
 
   UartInit();
+
+  Safety_Init();
+
   GyroInit();
   AccelerometerInit();
   MagnetometerInit();
 
+  GyroConfigure(GYRO_ODR, GYRO_BANDWIDTH, GYRO_RANGE, ControlRate_Watermark(CONTROL_RATE_HZ));
+  AccelerometerConfigure(ACCELEROMETER_ODR, ACCELEROMETER_RANGE, ACCELEROMETER_FIFO_WATERMARK);
+  Sensors_Init(SensorSetReady);
+  Sensors_StartRound();
+  Profiler_BootMark(BOOT_SENSORS);
+
+  Scheduler_Init(tasks, NUM_TASKS, TIM2_COUNTS_PER_S / CONTROL_RATE_HZ);
+  ControlRate_SetSafety(1.0f / CONTROL_RATE_HZ, ControlRate_Watermark(CONTROL_RATE_HZ));
   PIDController_Init(&pid);
-  LQR_init(&lqr);
+  if (KalmanFilter_Init(&kalman) < 0)
+  {
+    printf("Kalman did not converge, no steady-state gain\r\n");
+  }
+  if (LQR_init(&lqr) < 0)
+  {
+    printf("LQR did not converge, no angle feedback\r\n");
+  }
+  Mixer_Init(&mixer, motor_calibration);
 
   if (HAL_TIM_PWM_Start(&htim4, TIM_CHANNEL_1) != HAL_OK)
   {
@@ -175,17 +344,22 @@ int main(void)
     Error_Handler();
   }
 
-  l_motor(1000);
-  r_motor(1000);
-  HAL_Delay(3000);
-  l_motor(0);
-  r_motor(0);
-  HAL_Delay(1000);
-  l_motor(100);
-  r_motor(100);
-  HAL_Delay(1000);
-
+  // The ESCs arm in the control tick, see ArmingTask().  Their throttle range
+  // is calibrated if it was asked for or never was, but never after a watchdog
+  // reset: they were armed before it.  DShot has no range to calibrate.
+  Settings_Init();
+  const Settings *stored = Settings_Get();
+  GyroBias_Init(&gyro_bias, (stored->flags & SETTINGS_GYRO_BIAS) ? stored->gyro_bias : NULL);
+  const int calibrate = !Motor_Digital() && !Safety_WatchdogReset() &&
+                        !(Settings_Get()->flags & SETTINGS_ESC_CALIBRATED);
+  Arming_Start(&arming, calibrate, Profiler_Micros());
+
+  Safety_Start();
+  HAL_NVIC_SetPriority(CONTROL_TICK_IRQn, IRQ_PRIORITY_CONTROL, 0);
+  HAL_NVIC_EnableIRQ(CONTROL_TICK_IRQn);
   HAL_TIM_Base_Start_IT(&htim2);
+  HAL_TIM_OC_Start_IT(&htim2, TIM_CHANNEL_1);
+  Profiler_BootMark(BOOT_CONTROL);
 
   /* USER CODE END 2 */
 
@@ -196,6 +370,101 @@ int main(void)
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
+    Scheduler_RunPending();
+
+    if (kalman_dirty)
+    {
+      kalman_dirty = 0;
+      if (KalmanFilter_Synthesize(&kalman) < 0)
+      {
+        printf("Kalman did not converge, gain kept\r\n");
+      }
+    }
+
+    if (lqr_dirty)
+    {
+      lqr_dirty = 0;
+      if (LQR_synthesize(&lqr) < 0)
+      {
+        printf("LQR did not converge, gain kept\r\n");
+      }
+    }
+
+    if (control_rate_dirty)
+    {
+      control_rate_dirty = 0;
+      ControlRate_Apply(control_rate_hz);
+    }
+
+    if (control_rate_rejected)
+    {
+      control_rate_rejected = 0;
+      printf("control rate out of range, %d to %d Hz\r\n", CONTROL_RATE_MIN_HZ, CONTROL_RATE_MAX_HZ);
+    }
+
+    // A full settings log is erased here rather than at boot.  The erase
+    // stalls every fetch from the flash, the tick included, for a second or
+    // two: it waits for the stop of the arming sequence, when the motors are
+    // stopped anyway, the watchdog is stretched over it and the stop starts
+    // over after it, so the ESCs see all of it.
+    if (Settings_Full())
+    {
+      const uint32_t primask = __get_PRIMASK();
+      __disable_irq();
+      if (Arming_State(&arming) == ARMING_STOP)
+      {
+        Safety_Suspend(SETTINGS_ERASE_MAX_MS);
+        if (!Settings_Compact())
+        {
+          printf("settings erase failed\r\n");
+        }
+        Safety_Resume();
+        Arming_Hold(&arming, Profiler_Micros());
+        Profiler_BootMark(BOOT_SETTINGS_ERASED);
+      }
+      __set_PRIMASK(primask);
+    }
+
+    // Flash programming stalls the code fetches, it stays out of the tick
+    if (Arming_Calibrated(&arming) && !esc_calibration_saved)
+    {
+      esc_calibration_saved = 1;
+      Settings settings = *Settings_Get();
+      settings.flags |= SETTINGS_ESC_CALIBRATED;
+      Settings_Save(&settings);
+    }
+
+    if (gyro_bias_dirty)
+    {
+      gyro_bias_dirty = 0;
+      Settings settings = *Settings_Get();
+      const uint32_t primask = __get_PRIMASK();
+      __disable_irq();
+      memcpy(settings.gyro_bias, gyro_bias.bias, sizeof(settings.gyro_bias));
+      __set_PRIMASK(primask);
+      settings.flags |= SETTINGS_GYRO_BIAS;
+      Settings_Save(&settings);
+    }
+
+    if (esc_calibration_request)
+    {
+      esc_calibration_request = 0;
+      Settings settings = *Settings_Get();
+      settings.flags &= ~SETTINGS_ESC_CALIBRATED;
+      if (Settings_Save(&settings))
+      {
+        printf("ESC calibration at the next power up\r\n");
+      }
+    }
+
+    if (profiler_report)
+    {
+      profiler_report = 0;
+      Profiler_Report();
+      Scheduler_Report();
+      printf("tx dropped %lu\r\n", (unsigned long)UartDroppedFrames());
+      printf("commands dropped %lu\r\n", (unsigned long)(commands_dropped + Deferred_Dropped()));
+    }
   }
   /* USER CODE END 3 */
 }
@@ -258,14 +527,15 @@ static void MX_TIM2_Init(void)
 
   TIM_ClockConfigTypeDef sClockSourceConfig = {0};
   TIM_MasterConfigTypeDef sMasterConfig = {0};
+  TIM_OC_InitTypeDef sConfigOC = {0};
 
   /* USER CODE BEGIN TIM2_Init 1 */
 
   /* USER CODE END TIM2_Init 1 */
   htim2.Instance = TIM2;
-  htim2.Init.Prescaler = 1000 - 1;
+  htim2.Init.Prescaler = 48 - 1;
   htim2.Init.CounterMode = TIM_COUNTERMODE_UP;
-  htim2.Init.Period = 480 - 1;
+  htim2.Init.Period = 10000 - 1;
   htim2.Init.ClockDivision = TIM_CLOCKDIVISION_DIV1;
   htim2.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
   if (HAL_TIM_Base_Init(&htim2) != HAL_OK)
@@ -277,13 +547,26 @@ static void MX_TIM2_Init(void)
   {
     Error_Handler();
   }
+  if (HAL_TIM_OC_Init(&htim2) != HAL_OK)
+  {
+    Error_Handler();
+  }
   sMasterConfig.MasterOutputTrigger = TIM_TRGO_RESET;
   sMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
   if (HAL_TIMEx_MasterConfigSynchronization(&htim2, &sMasterConfig) != HAL_OK)
   {
     Error_Handler();
   }
+  sConfigOC.OCMode = TIM_OCMODE_TIMING;
+  sConfigOC.Pulse = 10000 - 500 - 1;
+  sConfigOC.OCPolarity = TIM_OCPOLARITY_HIGH;
+  sConfigOC.OCFastMode = TIM_OCFAST_DISABLE;
+  if (HAL_TIM_OC_ConfigChannel(&htim2, &sConfigOC, TIM_CHANNEL_1) != HAL_OK)
+  {
+    Error_Handler();
+  }
   /* USER CODE BEGIN TIM2_Init 2 */
+  ControlRate_SetTimer(CONTROL_RATE_HZ);
 
   /* USER CODE END TIM2_Init 2 */
 }
@@ -335,6 +618,7 @@ static void MX_TIM4_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN TIM4_Init 2 */
+  Motor_Init(MOTOR_PROTOCOL, MOTOR_BIDIRECTIONAL);
 
   /* USER CODE END TIM4_Init 2 */
   HAL_TIM_MspPostInit(&htim4);
@@ -383,8 +667,11 @@ static void MX_DMA_Init(void)
 
   /* DMA interrupt init */
   /* DMA2_Stream1_IRQn interrupt configuration */
-  HAL_NVIC_SetPriority(DMA2_Stream1_IRQn, 0, 0);
+  HAL_NVIC_SetPriority(DMA2_Stream1_IRQn, 2, 0);
   HAL_NVIC_EnableIRQ(DMA2_Stream1_IRQn);
+  /* DMA2_Stream6_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA2_Stream6_IRQn, 2, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream6_IRQn);
 }
 
 /**
@@ -428,12 +715,18 @@ static void MX_GPIO_Init(void)
   GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
   HAL_GPIO_Init(CS_I2C_SPI_GPIO_Port, &GPIO_InitStruct);
 
-  /*Configure GPIO pins : INT1_Pin INT2_Pin MEMS_INT2_Pin */
-  GPIO_InitStruct.Pin = INT1_Pin | INT2_Pin | MEMS_INT2_Pin;
-  GPIO_InitStruct.Mode = GPIO_MODE_EVT_RISING;
+  /*Configure GPIO pins : INT1_Pin MEMS_INT2_Pin */
+  GPIO_InitStruct.Pin = INT1_Pin | MEMS_INT2_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING;
   GPIO_InitStruct.Pull = GPIO_NOPULL;
   HAL_GPIO_Init(GPIOE, &GPIO_InitStruct);
 
+  /*Configure GPIO pin : INT2_Pin */
+  GPIO_InitStruct.Pin = INT2_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_EVT_RISING;
+  GPIO_InitStruct.Pull = GPIO_NOPULL;
+  HAL_GPIO_Init(INT2_GPIO_Port, &GPIO_InitStruct);
+
   /*Configure GPIO pin : OTG_FS_PowerSwitchOn_Pin */
   GPIO_InitStruct.Pin = OTG_FS_PowerSwitchOn_Pin;
   GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
@@ -522,169 +815,329 @@ static void MX_GPIO_Init(void)
   GPIO_InitStruct.Alternate = GPIO_AF4_I2C1;
   HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
 
+  /* EXTI interrupt init*/
+  HAL_NVIC_SetPriority(EXTI1_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(EXTI1_IRQn);
+
+  HAL_NVIC_SetPriority(EXTI4_IRQn, 1, 0);
+  HAL_NVIC_EnableIRQ(EXTI4_IRQn);
+
   /* USER CODE BEGIN MX_GPIO_Init_2 */
   /* USER CODE END MX_GPIO_Init_2 */
 }
 
 /* USER CODE BEGIN 4 */
-/**
- * @brief  Retargets the C library printf function to the USART.
- *   None
- * @retval None
- */
-PUTCHAR_PROTOTYPE
+// The timer keeps running in data-ready mode, so the bus and sensor
+// supervision always runs at the top priority
+void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
 {
-  /* Place your implementation of fputc here */
-  /* e.g. write a character to the USART1 and Loop until the end of transmission */
-  HAL_UART_Transmit(&huart6, (uint8_t *)&ch, 1, 0xFFFF);
+  Sensors_CheckBuses();
+  Safety_CheckSensors();
 
-  // HAL_UART_Transmit_DMA(&huart6, TxData, 10240);
+  if (Sensors_GetMode() == SENSORS_TIMER)
+  {
+    ControlTick();
+  }
+}
 
-  return ch;
+void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim)
+{
+  if (htim->Instance == TIM2 && htim->Channel == HAL_TIM_ACTIVE_CHANNEL_1)
+  {
+    Sensors_StartRound();
+  }
 }
 
-void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
+// TIM2 period and sensor lead for rate_hz.  The counter is 32 bits, so it is
+// restarted if it is already past the new period rather than left to wrap.
+static void ControlRate_SetTimer(uint32_t rate_hz)
 {
-  static float setpoint = 0.0f;
-  static float theta = 0.0f;
-  static float dF = 0;
+  // One TIM2 count per microsecond
+  const uint32_t period = TIM2_COUNTS_PER_S / rate_hz;
+  const uint32_t lead = period / 2 < SENSOR_LEAD_US ? period / 2 : SENSOR_LEAD_US;
 
-  // Get acceleromer, gyrometer and magnetometer values
-  short aX, aY, aZ, p, q, r;
-  GetAccelerometerValues(&aX, &aY, &aZ);
-  GetGyroValues(&p, &q, &r);
+  __HAL_TIM_SET_AUTORELOAD(&htim2, period - 1);
+  __HAL_TIM_SET_COMPARE(&htim2, TIM_CHANNEL_1, period - 1 - lead);
+  if (__HAL_TIM_GET_COUNTER(&htim2) >= period - 1)
+  {
+    __HAL_TIM_SET_COUNTER(&htim2, 0);
+  }
+}
 
-  // Conversion to radians, also remove gyro bias
-  float qf = q * DEG_TO_RAD + 0.04;
+// Gyro samples per data-ready tick closest to the period of rate_hz
+static uint32_t ControlRate_Watermark(uint32_t rate_hz)
+{
+  const uint32_t watermark = (GYRO_ODR_HZ + rate_hz / 2) / rate_hz;
+  return watermark < 1 ? 1 : watermark > GYRO_FIFO_WATERMARK_MAX ? GYRO_FIFO_WATERMARK_MAX : watermark;
+}
 
-  // Clamping
-  float t = aX / 16384.;
-  t = t > 1 ? 1 : t;
-  t = t < -1 ? -1 : t;
+// Deadline and sensor staleness limits of the supervision for a tick of
+// tick_s, with the gyro FIFO at watermark.  The sensors must be configured.
+static void ControlRate_SetSafety(float tick_s, uint32_t watermark)
+{
+  const float gyro_window_s = watermark * GyroSamplePeriod();
+  const float accelerometer_window_s = ACCELEROMETER_FIFO_WATERMARK * AccelerometerSamplePeriod();
+  Safety_SetTickPeriod((uint32_t)(tick_s * 1e6f + 0.5f), (uint32_t)(gyro_window_s * 1e6f + 0.5f),
+                       (uint32_t)(accelerometer_window_s * 1e6f + 0.5f));
+}
 
-  // Compute angle using accelerometer
-  float theta_acc = atan2(aX, sqrt(aY * aY + aZ * aZ));
+// Number of ticks of tick_s closest to the period of a task_hz task
+static uint32_t ControlRate_Ticks(float tick_s, uint32_t task_hz)
+{
+  const uint32_t ticks = (uint32_t)(1.0f / (tick_s * task_hz) + 0.5f);
+  return ticks > 0 ? ticks : 1;
+}
 
-  // Compute angle using gyrometer
-  float theta_gyro = theta + qf * SAMPLE_TIME_S;
+// Switch the loop to rate_hz and re-derive everything that depends on its
+// period.  Runs in the main loop: the Kalman and LQR gains are solved first,
+// each published through its own double buffer, then the timer, the task
+// periods and the PID period change together between two ticks.  In data-ready
+// mode the tick is paced by the gyro FIFO, so its period is the one of the
+// nearest watermark, which is reprogrammed right after.  Both the timer and the
+// watermark take the new rate whatever the mode, ready for a switch.
+static void ControlRate_Apply(uint32_t rate_hz)
+{
+  rate_hz = rate_hz < CONTROL_RATE_MIN_HZ ? CONTROL_RATE_MIN_HZ : rate_hz;
+  rate_hz = rate_hz > CONTROL_RATE_MAX_HZ ? CONTROL_RATE_MAX_HZ : rate_hz;
 
-  switch (filter)
+  const uint32_t watermark = ControlRate_Watermark(rate_hz);
+  float tick_s = (float)(TIM2_COUNTS_PER_S / rate_hz) / TIM2_COUNTS_PER_S;
+  if (Sensors_GetMode() == SENSORS_DATA_READY)
   {
-  case Kalman:
-    float32_t y_data[] = {
-        theta_acc, qf};
-    float32_t u_data[] = {
-        qf, dF};
-    theta = kalman_filter(y_data, u_data);
-    break;
-
-  default:
-    // Complementary filter
-    const float alpha = 0.99;
-    theta = theta_gyro * alpha + theta_acc * (1 - alpha);
-    break;
+    tick_s = watermark * GyroSamplePeriod();
   }
 
-  const float measurement = theta * RAD_TO_DEG;
+  // The estimator and every controller run in the angle task
+  const uint32_t angle_ticks = ControlRate_Ticks(tick_s, ANGLE_RATE_HZ);
+  const float angle_s = angle_ticks * tick_s;
 
-  switch (controller)
+  kalman.T = angle_s;
+  if (KalmanFilter_Synthesize(&kalman) < 0)
   {
-  case Cascade:
-    float a = 1;
-    float b = 2.8;
-    dF = ((measurement - setpoint) * a + qf) * b * J / L * 10;
-    break;
-
-  case LQR:
-    // float state[NUMBER_STATES] = {0};
-    // out = LQR_update(&lqr, state, );
+    printf("Kalman did not converge, gain of the old rate kept\r\n");
+  }
+  lqr.T = angle_s;
+  if (LQR_synthesize(&lqr) < 0)
+  {
+    printf("LQR did not converge, gain of the old rate kept\r\n");
+  }
 
-    /*float32_t K_data[4] = {
-            0.7063, 1.0978,
-            -0.7063, -1.0978};*/
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  ControlRate_SetTimer(rate_hz);
+  Scheduler_SetTickPeriod((uint32_t)(tick_s * 1e6f + 0.5f));
+  ControlRate_SetSafety(tick_s, watermark);
+  Scheduler_SetPeriod(&tasks[TASK_ANGLE], angle_ticks);
+  Scheduler_SetPeriod(&tasks[TASK_MAGNETOMETER], ControlRate_Ticks(tick_s, MAGNETOMETER_RATE_HZ));
+  Scheduler_SetPeriod(&tasks[TASK_TELEMETRY], ControlRate_Ticks(tick_s, TELEMETRY_RATE_HZ));
+  Scheduler_SetPeriod(&tasks[TASK_HEALTH], ControlRate_Ticks(tick_s, HEALTH_RATE_HZ));
+  pid.T = angle_s;
+  loop.tick_period_s = tick_s;
+  control.complementary_alpha = COMPLEMENTARY_TAU_S / (COMPLEMENTARY_TAU_S + angle_s);
+  __set_PRIMASK(primask);
+
+  // Waits for the gyro read in flight, so not in the masked section.  The
+  // samples already in the FIFO go out with the next read, its dt covers them.
+  Sensors_SetGyroWatermark(watermark);
+}
 
-    float32_t K_data[2] = {
-        1.4, 8.2};
-    arm_matrix_instance_f32 K;
-    arm_mat_init_f32(&K, 1, 2, K_data);
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+  Sensors_DataReady(GPIO_Pin);
+}
 
-    float32_t S_data[2] = {
-        measurement,
-        qf};
-    arm_matrix_instance_f32 S;
-    arm_mat_init_f32(&S, 2, 1, S_data);
+// Runs for every published sensor set.  In data-ready mode this is what paces
+// the loop.
+// The set is published from the gyro completion, at the sensor bus level.  In
+// data-ready mode the tick is pended at the control level rather than run from
+// there, so it keeps its priority over the buses in both modes.
+static void SensorSetReady(void)
+{
+  if (Sensors_GetMode() == SENSORS_DATA_READY)
+  {
+    NVIC_SetPendingIRQ(CONTROL_TICK_IRQn);
+  }
+}
 
-    /*float32_t R_data[2];
-    arm_matrix_instance_f32 R;
-    arm_mat_init_f32(&R, 2, 1, R_data);
-    arm_mat_mult_f32(&K, &S, &R);*/
+void CONTROL_TICK_IRQHandler(void)
+{
+  ControlTick();
+}
 
-    float32_t R_data[1];
-    arm_matrix_instance_f32 R;
-    arm_mat_init_f32(&R, 1, 1, R_data);
-    arm_mat_mult_f32(&K, &S, &R);
+static void ControlTick(void)
+{
+  const uint32_t start = DWT->CYCCNT;
+  Profiler_TickStart();
+  Scheduler_Tick();
+  // The DShot frame goes out once all the tasks of the tick have run: the end
+  // of frame interrupt, at the level of the tick, turns the lines around for
+  // the speed replies and can't wait for the angle task
+  Motor_Send();
+  Profiler_TickEnd();
+  Safety_TickEnd(DWT->CYCCNT - start);
+}
 
-    dF = R_data[0] * 10;
-    printf("%f\r\n", dF);
+// Inner loop, every tick: fresh gyro rate, angle propagation, cascade rate loop
+// and motor outputs.  The other controllers' command is held between two angle
+// steps.
+static void RateTask(void)
+{
+  // Most recent complete set of accelerometer and gyrometer values
+  Sensors_Latest(&sensors);
 
-    break;
+  Profiler_Mark(PROFILE_SENSORS);
 
-  default:
-    dF = -PIDController_Update(&pid, setpoint, measurement);
-    break;
+  const uint32_t events = Loop_Rate(&loop, &sensors, Safety_Mode());
+  if (events & LOOP_GYRO_BIAS_CALIBRATED)
+  {
+    gyro_bias_dirty = 1;
   }
-
-  static int pt = 0;
-  if (pt == 10)
+  if (events & LOOP_WRITE_MOTORS)
   {
-    // printf("%f %f\r\n", measurement, dF);
-    printf("%f\n", measurement);
-    pt = 0;
+    Motor_Write(loop.left, loop.right);
   }
-  ++pt;
+  Motor_Rpm(control.motor_rpm);
+
+  Profiler_Mark(PROFILE_MOTORS);
+  Profiler_Latency(sensors.timestamp_us);
 
-  const int base_throatle = 100;
-  if (dF < 0)
+  telemetry_latest = (TelemetrySample){control.theta_acc, control.qf, control.theta, control.dF, loop.left, loop.right,
+                                       control.motor_rpm[0], control.motor_rpm[1]};
+}
+
+// Drives the motors until the ESCs are armed, the rate task takes them over
+// from the next tick on
+static void ArmingTask(void)
+{
+  const uint32_t events = Loop_Arming(&loop, Profiler_Micros(), Safety_Mode());
+  if (events & LOOP_ARMED)
   {
-    l_motor(base_throatle + ARM_BIAS - dF);
-    r_motor(base_throatle);
+    Profiler_BootMark(BOOT_ARMED);
   }
-  else
+  if (events & LOOP_WRITE_MOTORS)
   {
-    l_motor(base_throatle + ARM_BIAS);
-    r_motor(base_throatle + dF);
+    Motor_Write(loop.left, loop.right);
   }
 }
 
+// Outer loop: accelerometer angle, estimator and controller
+static void AngleTask(void)
+{
+  Loop_Estimate(&loop, &sensors, Safety_Mode());
+
+  Profiler_Mark(PROFILE_FILTER);
+
+  Loop_Law(&loop);
+
+  Profiler_Mark(PROFILE_CONTROLLER);
+}
+
+// Keeps the magnetometer sample fresh, the read shares the I2C bus with the
+// accelerometer and is skipped if the bus is busy
+static void MagnetometerTask(void)
+{
+  MagnetometerStartRead();
+}
+
+static void TelemetryTask(void)
+{
+  const uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  const TelemetrySample sample = telemetry_latest;
+  __set_PRIMASK(primask);
+
+  Telemetry_SendSample(&sample);
+}
+
+static void HealthTask(void)
+{
+  SafetyCounters counters;
+  Safety_Counters(&counters);
+  MotorCounters motor;
+  Motor_Counters(&motor);
+
+  const TelemetryHealth health = {
+      (uint8_t)Safety_Mode(), counters.watchdog_reset,
+      counters.tick_overruns, counters.gyro_only_entries,
+      GyroTimeoutCount(),
+      I2CErrorCount(), I2CTimeoutCount(), I2CRecoveryCount(),
+      motor.errors, motor.skipped,
+      (uint8_t)gyro_bias.state, gyro_bias.restarts,
+      {gyro_bias.bias[0], gyro_bias.bias[1], gyro_bias.bias[2]}};
+  Telemetry_SendHealth(&health);
+}
+
+// Only queues the command: it is parsed and applied by Command_Run() at the
+// PendSV priority, so the control tick never sees a parameter half way through
+// its update and the UART interrupt stays short.
 void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
 {
-  // printf("YO!%d", Size);
+  if (command_head - command_tail < COMMAND_QUEUE_LENGTH)
+  {
+    char *command = command_queue[command_head % COMMAND_QUEUE_LENGTH];
+    memcpy(command, UART_RxBuffer, Size);
+    command[Size] = 0;
+    command_head++;
+    Deferred_Post(Command_Run);
+  }
+  else
+  {
+    commands_dropped++;
+  }
+
+  memset(UART_RxBuffer, 0, sizeof(UART_RxBuffer));
   HAL_UARTEx_ReceiveToIdle_DMA(&huart6, UART_RxBuffer, UART_RX_BUFFER_SIZE);
   __HAL_DMA_DISABLE_IT(&hdma_usart6_rx, DMA_IT_HT);
+}
 
-  switch (UART_RxBuffer[0])
+static void Command_Apply(const char *command)
+{
+  switch (command[0])
   {
   case 'C':
-    controller = Cascade;
+    control.law = CONTROL_CASCADE;
     break;
   case 'P':
-    controller = PID;
+    control.law = CONTROL_PID;
     break;
   case 'L':
-    controller = LQR;
+    control.law = CONTROL_LQR;
     break;
 
   case 'K':
-    controller = Kalman;
+    control.filter = CONTROL_KALMAN;
+    break;
+  case 'S':
+    control.filter = CONTROL_KALMAN_STEADY_STATE;
     break;
   case 'k':
-    controller = Complementary;
+    control.filter = CONTROL_COMPLEMENTARY;
+    break;
+
+  case 'T':
+    profiler_report = 1;
+    break;
+
+  case 'E':
+    esc_calibration_request = 1;
+    break;
+
+  case 'D':
+    Sensors_SetMode(SENSORS_DATA_READY);
+    control_rate_dirty = 1;
+    break;
+  case 'H':
+    Sensors_SetMode(SENSORS_TIMER);
+    control_rate_dirty = 1;
     break;
 
   default:
     char parameter;
     float value;
-    sscanf(UART_RxBuffer, "%c:%f", &parameter, &value);
+    if (!Command_Parse(command, &parameter, &value))
+    {
+      break;
+    }
 
     switch (parameter)
     {
@@ -698,17 +1151,92 @@ void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
       pid.Kd = value;
       break;
 
+    // A spectral density is positive, the gain does not converge otherwise
+    case 'x':
+      if (value > 0.0f)
+      {
+        kalman.a = value;
+        kalman_dirty = 1;
+      }
+      break;
+    case 'y':
+      if (value > 0.0f)
+      {
+        kalman.b = value;
+        kalman_dirty = 1;
+      }
+      break;
+    case 'z':
+      if (value > 0.0f)
+      {
+        kalman.c = value;
+        kalman_dirty = 1;
+      }
+      break;
+
+    // Q has to be positive semi-definite and R positive definite, otherwise
+    // the Riccati iteration can settle on a gain that doesn't stabilize
+    case 'q':
+      if (value >= 0.0f)
+      {
+        lqr.q_angle = value;
+        lqr_dirty = 1;
+      }
+      break;
+    case 'w':
+      if (value >= 0.0f)
+      {
+        lqr.q_rate = value;
+        lqr_dirty = 1;
+      }
+      break;
+    case 'r':
+      if (value > 0.0f)
+      {
+        lqr.r = value;
+        lqr_dirty = 1;
+      }
+      break;
+
+    // Checked as a float, converting one past the range of uint32_t is
+    // undefined.  NaN fails both comparisons.
+    case 'f':
+      if (value >= CONTROL_RATE_MIN_HZ && value <= CONTROL_RATE_MAX_HZ)
+      {
+        control_rate_hz = (uint32_t)value;
+        control_rate_dirty = 1;
+      }
+      else
+      {
+        control_rate_rejected = 1;
+      }
+      break;
+
     default:
       break;
     }
     break;
   }
+}
 
-  memset(UART_RxBuffer, 0, sizeof(UART_RxBuffer));
+// Runs at the PendSV priority: the control tick and the bus interrupts preempt
+// it, but it never runs in the middle of one of them.  It does preempt the main
+// loop, printf() included, so nothing in here may use the C library stdio.
+static void Command_Run(void)
+{
+  while (command_tail != command_head)
+  {
+    Command_Apply(command_queue[command_tail % COMMAND_QUEUE_LENGTH]);
+    command_tail++;
+  }
 }
 
 void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
 {
+  if (huart == &huart6)
+  {
+    UartTxComplete();
+  }
 }
 /* USER CODE END 4 */
 
@@ -0,0 +1,66 @@
+#include <math.h>
+#include "mixer.h"
+#include "control.h"
+
+void Mixer_Init(Mixer *m, const MixerCalibration calibration[2])
+{
+    for (int i = 0; i < 2; i++)
+    {
+        const float a = calibration[i].quadratic;
+        const float b = calibration[i].linear;
+        m->max_thrust[i] = (a * CONTROL_MOTOR_MAX + b) * CONTROL_MOTOR_MAX;
+        m->points_per_newton[i] = (MIXER_TABLE_POINTS - 1) / m->max_thrust[i];
+
+        // Root of a c^2 + b c = thrust, written so that it holds for a = 0
+        for (int k = 0; k < MIXER_TABLE_POINTS; k++)
+        {
+            const float thrust = k * m->max_thrust[i] / (MIXER_TABLE_POINTS - 1);
+            m->command[i][k] = 2.0f * thrust / (b + sqrtf(b * b + 4.0f * a * thrust));
+        }
+    }
+}
+
+static float Mixer_Command(const Mixer *m, int motor, float thrust)
+{
+    const float x = thrust * m->points_per_newton[motor];
+    if (!(x > 0.0f))
+        return 0.0f;
+    if (x >= MIXER_TABLE_POINTS - 1)
+        return CONTROL_MOTOR_MAX;
+
+    const int k = (int)x;
+    const float *table = m->command[motor];
+    return table[k] + (x - k) * (table[k + 1] - table[k]);
+}
+
+float Mixer_Allocate(const Mixer *m, float collective, float differential, float *left, float *right)
+{
+    // The differential the motors can make at all, one stopped and the other
+    // at full thrust
+    if (differential > m->max_thrust[1])
+        differential = m->max_thrust[1];
+    else if (differential < -m->max_thrust[0])
+        differential = -m->max_thrust[0];
+
+    float l = collective - 0.5f * differential;
+    float r = collective + 0.5f * differential;
+
+    // Shift both motors back into range, first off the bottom then off the
+    // top: the clipped differential always leaves room for both
+    const float low = l < r ? l : r;
+    if (low < 0.0f)
+    {
+        l -= low;
+        r -= low;
+    }
+    const float high = fmaxf(l - m->max_thrust[0], r - m->max_thrust[1]);
+    if (high > 0.0f)
+    {
+        l -= high;
+        r -= high;
+    }
+
+    *left = Mixer_Command(m, 0, l);
+    *right = Mixer_Command(m, 1, r);
+    return r - l;
+}
@@ -6,27 +6,344 @@
  */
 #include "motor.h"
 #include "main.h"
-
-#define MAX_VALUE 1000
+#include "dshot.h"
 
 extern TIM_HandleTypeDef htim4;
 
-void l_motor(uint32_t power)
+/* Pulse widths of each analog protocol, us */
+typedef struct
+{
+    float min_us;
+    float max_us;
+} MotorPulse;
+
+static const MotorPulse pulses[] = {
+    [MOTOR_PWM] = {1000.0f, 2000.0f},
+    [MOTOR_ONESHOT125] = {125.0f, 250.0f},
+    [MOTOR_MULTISHOT] = {5.0f, 25.0f},
+};
+
+static const uint32_t dshot_bit_rates[] = {
+    [MOTOR_DSHOT150] = 150000,
+    [MOTOR_DSHOT300] = 300000,
+    [MOTOR_DSHOT600] = 600000,
+};
+
+// TIM4 channel 1 on PD12 drives the right motor, channel 2 on PD13 the left one
+#define MOTOR_RIGHT_PIN 12
+#define MOTOR_LEFT_PIN 13
+#define MOTOR_PINS_MODER ((3u << (2 * MOTOR_RIGHT_PIN)) | (3u << (2 * MOTOR_LEFT_PIN)))
+#define MOTOR_PINS_AF ((2u << (2 * MOTOR_RIGHT_PIN)) | (2u << (2 * MOTOR_LEFT_PIN)))
+#define MOTOR_PINS_PULL_UP ((1u << (2 * MOTOR_RIGHT_PIN)) | (1u << (2 * MOTOR_LEFT_PIN)))
+
+// A frame and two bits at 0, which leave the outputs idle once it is out.  The
+// compares of channels 1 and 2 of each bit follow each other, the order of the
+// burst.
+#define DSHOT_SLOTS (DSHOT_FRAME_BITS + 2)
+
+// Reply sampling window, in frame bits from the launch: the ESCs answer about
+// 30 us after the frame, the buffer covers 68 bits of it at 3.75 samples each.
+// Decoding starts 19 bits in, past the frame and the first update it waits for.
+#define REPLY_SAMPLES 256
+#define REPLY_SAMPLES_PER_BIT 3
+#define REPLY_START_BITS 19
+
+// DMA1 stream 6 bits in HISR/HIFCR: FEIF6, DMEIF6, TEIF6, HTIF6, TCIF6, and
+// the same for DMA2 stream 5
+#define DMA_S6_FLAGS (DMA_HISR_FEIF6 | DMA_HISR_DMEIF6 | DMA_HISR_TEIF6 | DMA_HISR_HTIF6 | DMA_HISR_TCIF6)
+#define DMA_S5_FLAGS (DMA_HISR_FEIF5 | DMA_HISR_DMEIF5 | DMA_HISR_TEIF5 | DMA_HISR_HTIF5 | DMA_HISR_TCIF5)
+
+static MotorProtocol protocol = MOTOR_PWM;
+static float min_counts;
+static float counts_per_command;
+static uint32_t max_counts;
+
+static int bidirectional;
+static uint32_t bit_one;
+static uint32_t bit_zero;
+static uint16_t throttle[2];
+static uint32_t dshot_buffer[2 * DSHOT_SLOTS];
+static volatile int frame_pending;
+
+static uint16_t reply_samples[REPLY_SAMPLES];
+static uint32_t reply_start;
+static uint32_t reply_samples_per_bit_q8;
+static volatile float rpm[2];
+static volatile MotorCounters counters;
+
+// Timers run from their APB clock, twice the APB clock when it is divided (see
+// the clock tree of RM0383)
+static uint32_t Motor_Apb1TimerClock(void)
+{
+    const uint32_t pclk1 = HAL_RCC_GetPCLK1Freq();
+    return (RCC->CFGR & RCC_CFGR_PPRE1) == RCC_CFGR_PPRE1_DIV1 ? pclk1 : 2 * pclk1;
+}
+
+static uint32_t Motor_Apb2TimerClock(void)
+{
+    const uint32_t pclk2 = HAL_RCC_GetPCLK2Freq();
+    return (RCC->CFGR & RCC_CFGR_PPRE2) == RCC_CFGR_PPRE2_DIV1 ? pclk2 : 2 * pclk2;
+}
+
+static void Motor_InitAnalog(void)
+{
+    const MotorPulse *pulse = &pulses[protocol];
+    const uint32_t clock = Motor_Apb1TimerClock();
+
+    // The counter is 16 bits.  PWM needs its whole frame in it, the OneShot
+    // protocols only their longest pulse: the counter is left to run up to
+    // 0xFFFF and restarted by each write.
+    const float span_us = protocol == MOTOR_PWM ? 1e6f / MOTOR_PWM_FRAME_HZ : pulse->max_us;
+    uint32_t prescaler = 1;
+    while (span_us * clock / (prescaler * 1e6f) > 65535.0f)
+    {
+        prescaler++;
+    }
+    const float counts_per_us = (float)clock / (prescaler * 1e6f);
+
+    min_counts = pulse->min_us * counts_per_us;
+    counts_per_command = (pulse->max_us - pulse->min_us) * counts_per_us / MOTOR_COMMAND_MAX;
+    max_counts = (uint32_t)(pulse->max_us * counts_per_us + 0.5f);
+
+    TIM_TypeDef *tim = htim4.Instance;
+    tim->CR1 &= ~TIM_CR1_CEN;
+    tim->PSC = prescaler - 1;
+    tim->ARR = protocol == MOTOR_PWM ? (uint32_t)(span_us * counts_per_us + 0.5f) - 1 : 0xFFFF;
+    tim->CCR1 = (uint32_t)(min_counts + 0.5f);
+    tim->CCR2 = (uint32_t)(min_counts + 0.5f);
+
+    // Preload the period and both compares, then load them into the shadow
+    // registers with an update
+    tim->CCMR1 |= TIM_CCMR1_OC1PE | TIM_CCMR1_OC2PE;
+    tim->CR1 |= TIM_CR1_ARPE;
+    tim->EGR = TIM_EGR_UG;
+}
+
+static void Motor_InitDshot(void)
+{
+    const uint32_t bit_rate = dshot_bit_rates[protocol];
+    const uint32_t clock = Motor_Apb1TimerClock();
+    const uint32_t bit_counts = (clock + bit_rate / 2) / bit_rate;
+
+    // A 1 is high for 3/4 of the bit, a 0 for 3/8
+    bit_one = (3 * bit_counts + 2) / 4;
+    bit_zero = (3 * bit_counts + 4) / 8;
+    counts_per_command = (DSHOT_THROTTLE_MAX - DSHOT_THROTTLE_MIN) / MOTOR_COMMAND_MAX;
+
+    // One update per bit, compares at 0 until the first frame.  Bidirectional
+    // frames are sent inverted, the line idles high.
+    TIM_TypeDef *tim = htim4.Instance;
+    tim->CR1 &= ~TIM_CR1_CEN;
+    tim->PSC = 0;
+    tim->ARR = bit_counts - 1;
+    tim->CCR1 = 0;
+    tim->CCR2 = 0;
+    tim->CCMR1 |= TIM_CCMR1_OC1PE | TIM_CCMR1_OC2PE;
+    tim->CR1 |= TIM_CR1_ARPE;
+    if (bidirectional)
+    {
+        tim->CCER |= TIM_CCER_CC1P | TIM_CCER_CC2P;
+    }
+    tim->EGR = TIM_EGR_UG;
+
+    // Each update request writes two words through DMAR, from CCR1 (register
+    // 13) on, see the DMA burst mode section of the TIM4 chapter of RM0383
+    tim->DCR = (1 << TIM_DCR_DBL_Pos) | (13 << TIM_DCR_DBA_Pos);
+
+    // TIM4_UP is channel 2 of DMA1 stream 6: memory to peripheral, words
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    DMA1_Stream6->CR = 0;
+    DMA1_Stream6->PAR = (uint32_t)&tim->DMAR;
+    DMA1_Stream6->M0AR = (uint32_t)dshot_buffer;
+    DMA1_Stream6->CR = (2 << DMA_SxCR_CHSEL_Pos) | (2 << DMA_SxCR_MSIZE_Pos) | (2 << DMA_SxCR_PSIZE_Pos) |
+                       DMA_SxCR_MINC | DMA_SxCR_DIR_0 | DMA_SxCR_TEIE | DMA_SxCR_TCIE;
+    HAL_NVIC_SetPriority(DMA1_Stream6_IRQn, IRQ_PRIORITY_CONTROL, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Stream6_IRQn);
+
+    if (!bidirectional)
+        return;
+
+    // The replies come at 5/4 of the frame bit rate.  TIM1 paces the samples,
+    // its update requests are channel 6 of DMA2 stream 5: peripheral to
+    // memory, half words.  DMA1 has no access to the GPIO ports.
+    const uint32_t reply_rate = bit_rate * 5 / 4;
+    const uint32_t sample_clock = Motor_Apb2TimerClock();
+    const uint32_t sample_period = (sample_clock + REPLY_SAMPLES_PER_BIT * reply_rate / 2) /
+                                   (REPLY_SAMPLES_PER_BIT * reply_rate);
+    reply_samples_per_bit_q8 = (uint32_t)(((uint64_t)sample_clock << 8) / ((uint64_t)sample_period * reply_rate));
+    reply_start = (uint32_t)((uint64_t)REPLY_START_BITS * sample_clock / ((uint64_t)sample_period * bit_rate));
+
+    __HAL_RCC_TIM1_CLK_ENABLE();
+    TIM1->CR1 = 0;
+    TIM1->PSC = 0;
+    TIM1->ARR = sample_period - 1;
+    TIM1->DIER = TIM_DIER_UDE;
+
+    __HAL_RCC_DMA2_CLK_ENABLE();
+    DMA2_Stream5->CR = 0;
+    DMA2_Stream5->PAR = (uint32_t)&GPIOD->IDR;
+    DMA2_Stream5->M0AR = (uint32_t)reply_samples;
+    DMA2_Stream5->CR = (6 << DMA_SxCR_CHSEL_Pos) | (1 << DMA_SxCR_MSIZE_Pos) | (1 << DMA_SxCR_PSIZE_Pos) |
+                       DMA_SxCR_MINC | DMA_SxCR_TEIE | DMA_SxCR_TCIE;
+    HAL_NVIC_SetPriority(DMA2_Stream5_IRQn, IRQ_PRIORITY_SENSOR_BUS, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream5_IRQn);
+}
+
+void Motor_Init(MotorProtocol new_protocol, int new_bidirectional)
+{
+    protocol = new_protocol;
+    bidirectional = Motor_Digital() && new_bidirectional;
+    if (Motor_Digital())
+    {
+        Motor_InitDshot();
+    }
+    else
+    {
+        Motor_InitAnalog();
+    }
+}
+
+static uint32_t Motor_Counts(float command)
+{
+    command = command < 0.0f ? 0.0f : command;
+    command = command > MOTOR_COMMAND_MAX ? MOTOR_COMMAND_MAX : command;
+    return (uint32_t)(min_counts + command * counts_per_command + 0.5f);
+}
+
+void Motor_Write(float left, float right)
+{
+    if (Motor_Digital())
+    {
+        throttle[0] = Dshot_Throttle(left, MOTOR_COMMAND_MAX);
+        throttle[1] = Dshot_Throttle(right, MOTOR_COMMAND_MAX);
+        return;
+    }
+
+    TIM_TypeDef *tim = htim4.Instance;
+    tim->CCR2 = Motor_Counts(left);
+    tim->CCR1 = Motor_Counts(right);
+
+    // Start the next pulse now, unless one may still be going out: it ends by
+    // max_counts, the new compares then wait for the next write or wrap
+    if (protocol != MOTOR_PWM && tim->CNT > max_counts)
+    {
+        tim->EGR = TIM_EGR_UG;
+    }
+}
+
+void Motor_Send(void)
+{
+    if (!Motor_Digital())
+        return;
+
+    if (frame_pending)
+    {
+        counters.skipped++;
+        return;
+    }
+    frame_pending = 1;
+
+    Dshot_Encode(Dshot_Frame(throttle[1], 0, bidirectional), bit_one, bit_zero, &dshot_buffer[0], 2);
+    Dshot_Encode(Dshot_Frame(throttle[0], 0, bidirectional), bit_one, bit_zero, &dshot_buffer[1], 2);
+
+    if (bidirectional)
+    {
+        GPIOD->MODER = (GPIOD->MODER & ~MOTOR_PINS_MODER) | MOTOR_PINS_AF;
+
+        DMA2->HIFCR = DMA_S5_FLAGS;
+        DMA2_Stream5->NDTR = REPLY_SAMPLES;
+        DMA2_Stream5->CR |= DMA_SxCR_EN;
+        TIM1->CNT = 0;
+        TIM1->CR1 |= TIM_CR1_CEN;
+    }
+
+    DMA1->HIFCR = DMA_S6_FLAGS;
+    DMA1_Stream6->NDTR = 2 * DSHOT_SLOTS;
+    DMA1_Stream6->CR |= DMA_SxCR_EN;
+    htim4.Instance->DIER |= TIM_DIER_UDE;
+    counters.frames++;
+}
+
+// End of the frame: the ESCs answer within tens of microseconds, the pins
+// have to let go of the lines by then
+void DMA1_Stream6_IRQHandler(void)
+{
+    const uint32_t flags = DMA1->HISR & DMA_S6_FLAGS;
+    DMA1->HIFCR = flags;
+    htim4.Instance->DIER &= ~TIM_DIER_UDE;
+
+    if (flags & DMA_HISR_TEIF6)
+    {
+        counters.errors++;
+    }
+
+    if (bidirectional)
+    {
+        GPIOD->PUPDR = (GPIOD->PUPDR & ~MOTOR_PINS_MODER) | MOTOR_PINS_PULL_UP;
+        GPIOD->MODER &= ~MOTOR_PINS_MODER;
+    }
+    else
+    {
+        frame_pending = 0;
+    }
+}
+
+static void Motor_DecodeReply(int motor, uint32_t pin)
+{
+    uint32_t levels;
+    uint32_t period_us;
+    if (!Dshot_Levels(reply_samples, REPLY_SAMPLES, reply_start, pin, reply_samples_per_bit_q8, &levels) ||
+        !Dshot_DecodeReply(levels, &period_us))
+    {
+        counters.errors++;
+        return;
+    }
+
+    rpm[motor] = Dshot_Rpm(period_us, MOTOR_POLES);
+    counters.replies++;
+}
+
+// End of the sampling window
+void DMA2_Stream5_IRQHandler(void)
+{
+    const uint32_t flags = DMA2->HISR & DMA_S5_FLAGS;
+    DMA2->HIFCR = flags;
+    TIM1->CR1 &= ~TIM_CR1_CEN;
+
+    if (flags & DMA_HISR_TEIF5)
+    {
+        counters.errors++;
+    }
+    else
+    {
+        Motor_DecodeReply(0, MOTOR_LEFT_PIN);
+        Motor_DecodeReply(1, MOTOR_RIGHT_PIN);
+    }
+    frame_pending = 0;
+}
+
+MotorProtocol Motor_Protocol(void)
+{
+    return protocol;
+}
+
+int Motor_Digital(void)
+{
+    return protocol >= MOTOR_DSHOT150;
+}
+
+float Motor_CountsPerCommand(void)
+{
+    return counts_per_command;
+}
+
+void Motor_Rpm(float out[2])
 {
-   if (power > MAX_VALUE)
-      power = MAX_VALUE;
-   uint32_t minPulseWidth = 1000; // 1ms pulse width at a 1MHz clock
-   uint32_t maxPulseWidth = 2000; // 2ms pulse width
-   uint32_t pulse = ((power * (maxPulseWidth - minPulseWidth)) / MAX_VALUE) + minPulseWidth;
-   __HAL_TIM_SET_COMPARE(&htim4, TIM_CHANNEL_2, pulse); // Changed to TIM2, Channel 1
+    out[0] = rpm[0];
+    out[1] = rpm[1];
 }
 
-void r_motor(uint32_t power)
+void Motor_Counters(MotorCounters *out)
 {
-   if (power > MAX_VALUE)
-      power = MAX_VALUE;
-   uint32_t minPulseWidth = 1000; // 1ms pulse width at a 1MHz clock
-   uint32_t maxPulseWidth = 2000; // 2ms pulse width
-   uint32_t pulse = ((power * (maxPulseWidth - minPulseWidth)) / MAX_VALUE) + minPulseWidth;
-   __HAL_TIM_SET_COMPARE(&htim4, TIM_CHANNEL_1, pulse); // Changed to TIM2, Channel 1
+    *out = counters;
 }
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "profiler.h"
+
+static const char *const stage_names[PROFILE_NUM_STAGES] = {
+    "sensors",
+    "motors",
+    "filter",
+    "controller",
+    "total",
+    "period",
+    "latency"};
+
+static const char *const boot_names[BOOT_NUM_PHASES] = {
+    "peripherals",
+    "sensors",
+    "control",
+    "first_tick",
+    "settings_erased",
+    "armed"};
+
+static ProfileStat stats[PROFILE_NUM_STAGES];
+
+static uint32_t boot_us[BOOT_NUM_PHASES];
+static volatile uint32_t boot_marked = 0;
+
+static uint32_t tick_start = 0;
+static uint32_t last_mark = 0;
+static uint32_t last_tick_start = 0;
+static int has_last_tick = 0;
+
+static uint32_t micros = 0;
+static uint32_t micros_last_cycles = 0;
+static uint32_t micros_remainder = 0;
+
+static uint32_t Profiler_Bin(uint32_t cycles)
+{
+    if (cycles < PROFILE_SUB_BINS)
+        return cycles;
+
+    const uint32_t msb = 31 - __CLZ(cycles);
+    const uint32_t sub = (cycles >> (msb - PROFILE_SUB_BITS)) & (PROFILE_SUB_BINS - 1);
+    return (msb - PROFILE_SUB_BITS + 1) * PROFILE_SUB_BINS + sub;
+}
+
+// Largest cycle count that falls into the given bin
+static uint32_t Profiler_BinUpperBound(uint32_t bin)
+{
+    if (bin < PROFILE_SUB_BINS)
+        return bin;
+
+    const uint32_t msb = bin / PROFILE_SUB_BINS - 1 + PROFILE_SUB_BITS;
+    const uint32_t sub = bin % PROFILE_SUB_BINS;
+    const uint32_t width = 1u << (msb - PROFILE_SUB_BITS);
+    return ((PROFILE_SUB_BINS + sub) << (msb - PROFILE_SUB_BITS)) + (width - 1);
+}
+
+static void Profiler_Record(ProfileStage stage, uint32_t cycles)
+{
+    ProfileStat *s = &stats[stage];
+
+    if (cycles < s->min)
+        s->min = cycles;
+    if (cycles > s->max)
+        s->max = cycles;
+    s->sum += cycles;
+    s->count++;
+    s->hist[Profiler_Bin(cycles)]++;
+}
+
+// Enable the Cortex-M4 DWT cycle counter, see the ARMv7-M architecture
+// reference manual, section C1.8 "Data Watchpoint and Trace unit"
+void Profiler_Init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    Profiler_Reset();
+}
+
+void Profiler_Reset(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    memset(stats, 0, sizeof(stats));
+    for (int i = 0; i < PROFILE_NUM_STAGES; i++)
+        stats[i].min = UINT32_MAX;
+    has_last_tick = 0;
+
+    __set_PRIMASK(primask);
+}
+
+// Call first thing in the ISR
+void Profiler_TickStart(void)
+{
+    const uint32_t now = DWT->CYCCNT;
+
+    if (has_last_tick)
+        Profiler_Record(PROFILE_PERIOD, now - last_tick_start);
+    has_last_tick = 1;
+
+    last_tick_start = now;
+    tick_start = now;
+    last_mark = now;
+
+    if (!(boot_marked & (1u << BOOT_FIRST_TICK)))
+        Profiler_BootMark(BOOT_FIRST_TICK);
+}
+
+// Call at the end of each stage, records the cycles since the previous mark
+void Profiler_Mark(ProfileStage stage)
+{
+    const uint32_t now = DWT->CYCCNT;
+    Profiler_Record(stage, now - last_mark);
+    last_mark = now;
+}
+
+// Call last thing in the ISR
+void Profiler_TickEnd(void)
+{
+    Profiler_Record(PROFILE_TOTAL, DWT->CYCCNT - tick_start);
+}
+
+// Call once the outputs are written, with the timestamp of the oldest sensor
+// sample they were computed from
+void Profiler_Latency(uint32_t sample_us)
+{
+    const uint32_t cycles_per_us = SystemCoreClock / 1000000;
+    Profiler_Record(PROFILE_LATENCY, (Profiler_Micros() - sample_us) * cycles_per_us);
+}
+
+// Print the statistics of every stage and start a new measurement window.
+// Must be called from the main loop: it prints, which is slow.
+void Profiler_Report(void)
+{
+    static ProfileStat snapshot;
+    const uint32_t cycles_per_us = SystemCoreClock / 1000000;
+
+    printf("stage min avg max p99 (cycles @ %lu MHz)\r\n", (unsigned long)cycles_per_us);
+
+    for (int i = 0; i < PROFILE_NUM_STAGES; i++)
+    {
+        // Copy and clear with interrupts off so the ISR can't tear the stat
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        snapshot = stats[i];
+        memset(&stats[i], 0, sizeof(stats[i]));
+        stats[i].min = UINT32_MAX;
+        __set_PRIMASK(primask);
+
+        if (snapshot.count == 0)
+        {
+            printf("%s - - - -\r\n", stage_names[i]);
+            continue;
+        }
+
+        // 99th percentile: upper bound of the bin holding the 99% sample
+        const uint32_t rank = snapshot.count - snapshot.count / 100;
+        uint32_t seen = 0;
+        uint32_t p99 = snapshot.max;
+        for (uint32_t bin = 0; bin < PROFILE_NUM_BINS; bin++)
+        {
+            seen += snapshot.hist[bin];
+            if (seen >= rank)
+            {
+                p99 = Profiler_BinUpperBound(bin);
+                break;
+            }
+        }
+        if (p99 > snapshot.max)
+            p99 = snapshot.max;
+
+        printf("%s %lu %lu %lu %lu\r\n",
+               stage_names[i],
+               (unsigned long)snapshot.min,
+               (unsigned long)(snapshot.sum / snapshot.count),
+               (unsigned long)snapshot.max,
+               (unsigned long)p99);
+
+        if (i == PROFILE_PERIOD)
+            printf("jitter %lu\r\n", (unsigned long)(snapshot.max - snapshot.min));
+    }
+
+    // The ISR period is measured between two ticks of the same window
+    has_last_tick = 0;
+
+    printf("boot (us)\r\n");
+    for (int i = 0; i < BOOT_NUM_PHASES; i++)
+    {
+        if (boot_marked & (1u << i))
+            printf("%s %lu\r\n", boot_names[i], (unsigned long)boot_us[i]);
+        else
+            printf("%s -\r\n", boot_names[i]);
+    }
+    if ((boot_marked & (1u << BOOT_FIRST_TICK)) && boot_us[BOOT_FIRST_TICK] > BOOT_FIRST_TICK_TARGET_US)
+        printf("first_tick over its %lu us target\r\n", (unsigned long)BOOT_FIRST_TICK_TARGET_US);
+}
+
+void Profiler_BootMark(BootPhase phase)
+{
+    if (boot_marked & (1u << phase))
+        return;
+    boot_us[phase] = Profiler_Micros();
+    boot_marked |= 1u << phase;
+}
+
+// Free-running microsecond time base extended from the cycle counter.  It wraps
+// after 71 minutes instead of the 44 s of CYCCNT at 96 MHz, as long as it is
+// called at least once per CYCCNT period.
+uint32_t Profiler_Micros(void)
+{
+    const uint32_t cycles_per_us = SystemCoreClock / 1000000;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    const uint32_t now = DWT->CYCCNT;
+    const uint32_t elapsed = (now - micros_last_cycles) + micros_remainder;
+    micros += elapsed / cycles_per_us;
+    micros_remainder = elapsed % cycles_per_us;
+    micros_last_cycles = now;
+    const uint32_t result = micros;
+
+    __set_PRIMASK(primask);
+    return result;
+}
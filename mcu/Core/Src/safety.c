@@ -0,0 +1,183 @@
+#include "main.h"
+#include "safety.h"
+#include "profiler.h"
+#include "motor.h"
+#include "Gyro.h"
+#include "Accelerometer.h"
+
+/* Longest time without a new sample before the sensor is considered lost.
+ * A sample is dated at the middle of the FIFO window it drained, so it is up
+ * to 1.5 read intervals old before the next one lands, and the check runs at
+ * any phase of the tick: the limit is twice the longer of the tick and the
+ * watermark window, plus a margin for the bus and a sample period.  It never
+ * goes below the fixed floors, which leave room for a few failed reads at the
+ * fast rates. */
+#define SAFETY_GYRO_STALE_MIN_US 20000
+#define SAFETY_ACCELEROMETER_STALE_MIN_US 50000
+#define SAFETY_STALE_MARGIN_US 5000
+
+/* The watchdog runs from the ~32 kHz LSI, divided by 32 here: one count per
+ * millisecond.  250 ms is above the longest tick, 100 ms at CONTROL_RATE_MIN_HZ,
+ * even with the LSI at the top of its 17 to 47 kHz range. */
+#define SAFETY_IWDG_PRESCALER 3 /* PR = 011, /32 */
+#define SAFETY_IWDG_RELOAD 249
+
+/* Stretched watchdog of Safety_Suspend(), /256: one count per 5.4 ms with
+ * the LSI at the top of its range */
+#define SAFETY_IWDG_SUSPEND_PRESCALER 6 /* PR = 110, /256 */
+#define SAFETY_IWDG_SUSPEND_COUNT_US 5447
+#define SAFETY_IWDG_RELOAD_MAX 4095
+
+/* IWDG_KR keys, see the IWDG section of RM0383 */
+#define IWDG_KEY_RELOAD 0xAAAA
+#define IWDG_KEY_ENABLE 0xCCCC
+#define IWDG_KEY_WRITE_ACCESS 0x5555
+
+static volatile SafetyMode mode = SAFETY_NORMAL;
+static int started = 0;
+static uint32_t start_us = 0;
+static uint32_t tick_cycles = 0;
+static uint32_t gyro_stale_us = SAFETY_GYRO_STALE_MIN_US;
+static uint32_t accelerometer_stale_us = SAFETY_ACCELEROMETER_STALE_MIN_US;
+static uint32_t consecutive_overruns = 0;
+static SafetyCounters counters;
+
+static void Safety_CutMotors(void)
+{
+    mode = SAFETY_MOTOR_CUT;
+    Motor_Write(0.0f, 0.0f);
+}
+
+/* Microseconds since the sample, counted from Safety_Start() at most */
+static uint32_t Safety_Age(uint32_t now, uint32_t timestamp_us)
+{
+    if ((int32_t)(timestamp_us - start_us) < 0)
+        timestamp_us = start_us;
+    return now - timestamp_us;
+}
+
+void Safety_Init(void)
+{
+    counters.watchdog_reset = (RCC->CSR & RCC_CSR_IWDGRSTF) ? 1 : 0;
+    RCC->CSR |= RCC_CSR_RMVF;
+}
+
+static void Safety_SetWatchdog(uint32_t prescaler, uint32_t reload)
+{
+    IWDG->KR = IWDG_KEY_WRITE_ACCESS;
+    IWDG->PR = prescaler;
+    IWDG->RLR = reload;
+    while (IWDG->SR & (IWDG_SR_PVU | IWDG_SR_RVU))
+    {
+        // Takes a few LSI periods, the watchdog itself bounds it
+    }
+    IWDG->KR = IWDG_KEY_RELOAD;
+}
+
+void Safety_Start(void)
+{
+    // Stop the watchdog while the core is halted by the debugger
+    DBGMCU->APB1FZ |= DBGMCU_APB1_FZ_DBG_IWDG_STOP;
+
+    IWDG->KR = IWDG_KEY_ENABLE;
+    Safety_SetWatchdog(SAFETY_IWDG_PRESCALER, SAFETY_IWDG_RELOAD);
+
+    start_us = Profiler_Micros();
+    started = 1;
+}
+
+void Safety_Suspend(uint32_t hold_ms)
+{
+    if (!started)
+        return;
+
+    uint32_t reload = (hold_ms * 1000u + SAFETY_IWDG_SUSPEND_COUNT_US - 1) / SAFETY_IWDG_SUSPEND_COUNT_US;
+    reload = reload < SAFETY_IWDG_RELOAD_MAX ? reload : SAFETY_IWDG_RELOAD_MAX;
+    Safety_SetWatchdog(SAFETY_IWDG_SUSPEND_PRESCALER, reload);
+}
+
+void Safety_Resume(void)
+{
+    if (!started)
+        return;
+
+    Safety_SetWatchdog(SAFETY_IWDG_PRESCALER, SAFETY_IWDG_RELOAD);
+    start_us = Profiler_Micros();
+    consecutive_overruns = 0;
+}
+
+static uint32_t Safety_StaleLimit(uint32_t tick_us, uint32_t window_us, uint32_t floor_us)
+{
+    const uint32_t interval_us = window_us > tick_us ? window_us : tick_us;
+    const uint32_t limit_us = 2 * interval_us + SAFETY_STALE_MARGIN_US;
+    return limit_us > floor_us ? limit_us : floor_us;
+}
+
+void Safety_SetTickPeriod(uint32_t tick_us, uint32_t gyro_window_us, uint32_t accelerometer_window_us)
+{
+    tick_cycles = tick_us * (SystemCoreClock / 1000000);
+    gyro_stale_us = Safety_StaleLimit(tick_us, gyro_window_us, SAFETY_GYRO_STALE_MIN_US);
+    accelerometer_stale_us = Safety_StaleLimit(tick_us, accelerometer_window_us, SAFETY_ACCELEROMETER_STALE_MIN_US);
+}
+
+void Safety_CheckSensors(void)
+{
+    if (!started || mode == SAFETY_MOTOR_CUT)
+        return;
+
+    GyroSample gyro;
+    AccelerometerSample accelerometer;
+    GetGyroSample(&gyro);
+    GetAccelerometerSample(&accelerometer);
+
+    const uint32_t now = Profiler_Micros();
+    if (Safety_Age(now, gyro.timestamp_us) > gyro_stale_us)
+    {
+        Safety_CutMotors();
+        return;
+    }
+
+    const int accelerometer_stale = Safety_Age(now, accelerometer.timestamp_us) > accelerometer_stale_us;
+    if (accelerometer_stale && mode == SAFETY_NORMAL)
+    {
+        mode = SAFETY_GYRO_ONLY;
+        counters.gyro_only_entries++;
+    }
+    else if (!accelerometer_stale && mode == SAFETY_GYRO_ONLY)
+    {
+        mode = SAFETY_NORMAL;
+    }
+}
+
+void Safety_TickEnd(uint32_t cycles)
+{
+    if (cycles > tick_cycles)
+    {
+        counters.tick_overruns++;
+        if (++consecutive_overruns >= SAFETY_MAX_CONSECUTIVE_OVERRUNS && mode != SAFETY_MOTOR_CUT)
+            Safety_CutMotors();
+        return;
+    }
+
+    consecutive_overruns = 0;
+    if (started)
+        IWDG->KR = IWDG_KEY_RELOAD;
+}
+
+SafetyMode Safety_Mode(void)
+{
+    return mode;
+}
+
+int Safety_WatchdogReset(void)
+{
+    return counters.watchdog_reset;
+}
+
+void Safety_Counters(SafetyCounters *out)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    *out = counters;
+    __set_PRIMASK(primask);
+}
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include "main.h"
+#include "scheduler.h"
+
+static SchedulerTask *tasks = 0;
+static uint32_t num_tasks = 0;
+
+static volatile uint32_t tick = 0;
+static uint32_t tick_cycles = 0;
+
+static uint32_t Scheduler_CyclesPerMicro(void)
+{
+    return SystemCoreClock / 1000000;
+}
+
+static void Scheduler_Run(SchedulerTask *task)
+{
+    const uint32_t start = DWT->CYCCNT;
+    task->running = 1;
+    task->run();
+    task->running = 0;
+    const uint32_t cycles = DWT->CYCCNT - start;
+
+    task->runs++;
+    if (cycles > task->max_cycles)
+        task->max_cycles = cycles;
+    if (cycles > task->budget_cycles)
+        task->overruns++;
+}
+
+// The cycle counter must be running, see Profiler_Init()
+void Scheduler_Init(SchedulerTask *table, uint32_t count, uint32_t tick_us)
+{
+    tasks = table;
+    num_tasks = count;
+    tick = 0;
+
+    const uint32_t cycles_per_us = Scheduler_CyclesPerMicro();
+    for (uint32_t i = 0; i < num_tasks; i++)
+    {
+        SchedulerTask *task = &tasks[i];
+        task->budget_cycles = task->budget_us * cycles_per_us;
+        task->pending = 0;
+        task->running = 0;
+        task->runs = task->misses = task->overruns = task->max_cycles = 0;
+    }
+
+    Scheduler_SetTickPeriod(tick_us);
+}
+
+void Scheduler_SetTickPeriod(uint32_t tick_us)
+{
+    tick_cycles = tick_us * Scheduler_CyclesPerMicro();
+}
+
+// The offset is kept if it still fits in the new period
+void Scheduler_SetPeriod(SchedulerTask *task, uint32_t period)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    task->period = period > 0 ? period : 1;
+    if (task->offset >= task->period)
+        task->offset = 0;
+
+    __set_PRIMASK(primask);
+}
+
+// Call from the interrupt that paces the control loop
+void Scheduler_Tick(void)
+{
+    const uint32_t start = DWT->CYCCNT;
+    const uint32_t now = tick++;
+
+    for (uint32_t i = 0; i < num_tasks; i++)
+    {
+        SchedulerTask *task = &tasks[i];
+        if (now % task->period != task->offset)
+            continue;
+
+        if (task->context == SCHEDULER_BACKGROUND)
+        {
+            if (task->pending || task->running)
+                task->misses++;
+            task->pending = 1;
+            continue;
+        }
+
+        Scheduler_Run(task);
+        if (DWT->CYCCNT - start > task->period * tick_cycles)
+            task->misses++;
+    }
+}
+
+// Call from the main loop.  Runs the highest pending background task, if any,
+// and returns so the caller can look after its own work between two tasks.
+void Scheduler_RunPending(void)
+{
+    for (uint32_t i = 0; i < num_tasks; i++)
+    {
+        SchedulerTask *task = &tasks[i];
+        if (task->context != SCHEDULER_BACKGROUND || !task->pending)
+            continue;
+
+        task->pending = 0;
+        Scheduler_Run(task);
+        return;
+    }
+}
+
+// Print the counters of every task and clear them.  Must be called from the
+// main loop: it prints, which is slow.
+void Scheduler_Report(void)
+{
+    printf("task period runs max_us budget_us misses overruns\r\n");
+
+    const uint32_t cycles_per_us = Scheduler_CyclesPerMicro();
+    for (uint32_t i = 0; i < num_tasks; i++)
+    {
+        SchedulerTask *task = &tasks[i];
+
+        // Copy and clear with interrupts off so the tick can't tear the counters
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        const SchedulerTask snapshot = *task;
+        task->runs = task->misses = task->overruns = task->max_cycles = 0;
+        __set_PRIMASK(primask);
+
+        printf("%s %lu %lu %lu %lu %lu %lu\r\n",
+               snapshot.name,
+               (unsigned long)snapshot.period,
+               (unsigned long)snapshot.runs,
+               (unsigned long)(snapshot.max_cycles / cycles_per_us),
+               (unsigned long)snapshot.budget_us,
+               (unsigned long)snapshot.misses,
+               (unsigned long)snapshot.overruns);
+    }
+}
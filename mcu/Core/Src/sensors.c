@@ -0,0 +1,183 @@
+#include "main.h"
+#include "sensors.h"
+#include "I2C.h"
+
+#define SENSOR_GYRO (1 << 0)
+#define SENSOR_ACCELEROMETER (1 << 1)
+
+static SensorSet sets[2];
+static volatile uint32_t active = 0;
+static uint32_t next_seq = 0;
+
+static volatile SensorsMode mode = SENSORS_TIMER;
+static SensorsCallback set_callback = 0;
+
+/* Bursts started for the current round and the ones that landed */
+static volatile uint32_t round_started = 0;
+static volatile uint32_t round_done = 0;
+
+static void Sensors_Publish(void)
+{
+    SensorSet *set = &sets[active ^ 1];
+
+    GetGyroSample(&set->gyro);
+    GetAccelerometerSample(&set->accelerometer);
+
+    const int32_t age = (int32_t)(set->gyro.timestamp_us - set->accelerometer.timestamp_us);
+    set->timestamp_us = age > 0 ? set->accelerometer.timestamp_us : set->gyro.timestamp_us;
+    set->seq = next_seq++;
+
+    /* Written to the buffer the reader isn't using, then published by flipping the index */
+    __DMB();
+    active ^= 1;
+
+    if (set_callback)
+        set_callback();
+}
+
+/* A round is complete once every burst it started has landed.  done may also
+ * hold the late completion of a burst of the previous round, which was still
+ * on its bus and so not started in this one: only the bits of the round count. */
+static int Sensors_RoundComplete(uint32_t started, uint32_t done)
+{
+    return started != 0 && (done & started) == started;
+}
+
+/* Both completions run at the same interrupt priority, so they can't interleave */
+static void Sensors_Landed(uint32_t sensor)
+{
+    round_done |= sensor;
+    if (Sensors_RoundComplete(round_started, round_done))
+    {
+        round_started = 0;
+        Sensors_Publish();
+    }
+}
+
+static void Sensors_GyroDone(void)
+{
+    if (mode != SENSORS_DATA_READY)
+    {
+        Sensors_Landed(SENSOR_GYRO);
+        return;
+    }
+
+    /* The watermark line stays high until the FIFO is drained below it, so if
+     * samples came in during the read there was no edge: read again now or the
+     * line would stay stuck high */
+    if (HAL_GPIO_ReadPin(MEMS_INT2_GPIO_Port, MEMS_INT2_Pin) == GPIO_PIN_SET)
+        GyroStartRead();
+
+    Sensors_Publish();
+}
+
+static void Sensors_AccelerometerDone(void)
+{
+    if (mode != SENSORS_DATA_READY)
+    {
+        Sensors_Landed(SENSOR_ACCELEROMETER);
+        return;
+    }
+
+    if (HAL_GPIO_ReadPin(INT1_GPIO_Port, INT1_Pin) == GPIO_PIN_SET)
+        AccelerometerStartRead();
+}
+
+/* The sensors must be initialized and configured */
+void Sensors_Init(SensorsCallback callback)
+{
+    set_callback = callback;
+    GyroSetCallback(Sensors_GyroDone);
+    AccelerometerSetCallback(Sensors_AccelerometerDone);
+}
+
+void Sensors_SetMode(SensorsMode new_mode)
+{
+    mode = new_mode;
+    round_started = 0;
+
+    /* The watermark lines may already be high, in which case no edge would come */
+    if (mode == SENSORS_DATA_READY)
+    {
+        GyroStartRead();
+        AccelerometerStartRead();
+    }
+}
+
+/* The gyro watermark is the period of data-ready mode.  Waits for the read in
+ * flight, which is never longer than the bus timeout: main loop only. */
+void Sensors_SetGyroWatermark(uint32_t watermark)
+{
+    while (!GyroSetWatermark((unsigned char)watermark))
+        ;
+
+    /* The FIFO may already be above the new level, in which case no edge would
+     * come */
+    if (mode == SENSORS_DATA_READY)
+        GyroStartRead();
+}
+
+SensorsMode Sensors_GetMode(void)
+{
+    return mode;
+}
+
+/* Timer mode: start the bursts of the next set.  A round that is still running
+ * is abandoned: a burst of it still on its bus can't be started again, its
+ * late completion is published with the new round but doesn't complete it.
+ *
+ * Only the switch to the new round is done with the interrupts off.  Starting
+ * a burst can wait on the SPI and DMA registers, so the starts run unmasked: a
+ * completion that lands before round_started is set is kept in round_done, and
+ * if both landed already the set is published here. */
+void Sensors_StartRound(void)
+{
+    if (mode != SENSORS_TIMER)
+        return;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    round_started = 0;
+    round_done = 0;
+    __set_PRIMASK(primask);
+
+    uint32_t started = 0;
+    if (GyroStartRead())
+        started |= SENSOR_GYRO;
+    if (AccelerometerStartRead())
+        started |= SENSOR_ACCELEROMETER;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    const int landed = Sensors_RoundComplete(started, round_done);
+    round_started = landed ? 0 : started;
+    __set_PRIMASK(primask);
+
+    if (landed)
+        Sensors_Publish();
+}
+
+/* Data-ready mode: call from the EXTI callback */
+void Sensors_DataReady(uint16_t pin)
+{
+    if (mode != SENSORS_DATA_READY)
+        return;
+
+    if (pin == MEMS_INT2_Pin)
+        GyroStartRead();
+    else if (pin == INT1_Pin)
+        AccelerometerStartRead();
+}
+
+/* Call from the TIM2 update in both modes: a read stuck on its bus is abandoned,
+ * its completion runs with an error and the next round or edge starts afresh */
+void Sensors_CheckBuses(void)
+{
+    GyroCheckTimeout();
+    I2CCheckTimeout();
+}
+
+void Sensors_Latest(SensorSet *set)
+{
+    *set = sets[active];
+}
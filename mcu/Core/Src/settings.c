@@ -0,0 +1,145 @@
+#include <stddef.h>
+#include <string.h>
+#include "main.h"
+#include "settings.h"
+
+#define SETTINGS_ADDRESS 0x08060000u
+#define SETTINGS_SIZE 0x20000u
+#define SETTINGS_SECTOR FLASH_SECTOR_7
+
+typedef struct
+{
+    uint32_t magic;
+    Settings settings;
+    uint32_t crc;
+} SettingsRecord;
+
+/* Tag in the upper half, length of the record in bytes in the lower half */
+#define SETTINGS_TAG 0x53450000u
+#define SETTINGS_TAG_MASK 0xFFFF0000u
+#define SETTINGS_MAGIC (SETTINGS_TAG | sizeof(SettingsRecord))
+#define SETTINGS_ERASED 0xFFFFFFFFu
+
+/* Magic and CRC around the settings */
+#define SETTINGS_OVERHEAD (2 * sizeof(uint32_t))
+
+static const Settings defaults = {0};
+
+static Settings current;
+static uint32_t next_offset;
+
+// CRC-32 (poly 0xEDB88320 reflected, init and final XOR 0xFFFFFFFF)
+static uint32_t Settings_Crc(const void *data, uint32_t length)
+{
+    const uint8_t *bytes = data;
+    uint32_t crc = 0xFFFFFFFFu;
+    while (length--)
+    {
+        crc ^= *bytes++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static const uint32_t *Settings_Word(uint32_t offset)
+{
+    return (const uint32_t *)(uintptr_t)(SETTINGS_ADDRESS + offset);
+}
+
+static int Settings_Program(uint32_t offset, const Settings *settings)
+{
+    SettingsRecord record = {SETTINGS_MAGIC, *settings, 0};
+    record.crc = Settings_Crc(&record, offsetof(SettingsRecord, crc));
+
+    const uint32_t *words = (const uint32_t *)&record;
+    const uint32_t address = SETTINGS_ADDRESS + offset;
+
+    HAL_FLASH_Unlock();
+    HAL_StatusTypeDef status = HAL_OK;
+    for (uint32_t i = 0; i < sizeof(record) / 4 && status == HAL_OK; i++)
+    {
+        status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address + 4 * i, words[i]);
+    }
+    HAL_FLASH_Lock();
+    return status == HAL_OK;
+}
+
+void Settings_Init(void)
+{
+    // The last valid record wins.  The magic is programmed first, so the log
+    // ends at the first erased word and a record cut short still has its
+    // length.  Anything else that isn't a record can't be stepped over: the
+    // sector is taken as full, until Settings_Compact() erases it.
+    current = defaults;
+    next_offset = 0;
+    while (next_offset + sizeof(SettingsRecord) <= SETTINGS_SIZE)
+    {
+        const uint32_t *record = Settings_Word(next_offset);
+        const uint32_t magic = record[0];
+        if (magic == SETTINGS_ERASED)
+            break;
+
+        const uint32_t length = magic & ~SETTINGS_TAG_MASK;
+        if ((magic & SETTINGS_TAG_MASK) != SETTINGS_TAG || length < SETTINGS_OVERHEAD || length % 4 != 0 ||
+            next_offset + length > SETTINGS_SIZE)
+        {
+            next_offset = SETTINGS_SIZE;
+            break;
+        }
+
+        // Shorter records are older layouts, longer ones newer: the fields
+        // both know are kept
+        if (record[length / 4 - 1] == Settings_Crc(record, length - sizeof(uint32_t)))
+        {
+            const uint32_t stored = length - SETTINGS_OVERHEAD;
+            current = defaults;
+            memcpy(&current, &record[1], stored < sizeof(current) ? stored : sizeof(current));
+        }
+        next_offset += length;
+    }
+}
+
+int Settings_Full(void)
+{
+    return next_offset + sizeof(SettingsRecord) > SETTINGS_SIZE;
+}
+
+int Settings_Compact(void)
+{
+    FLASH_EraseInitTypeDef erase = {0};
+    erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+    erase.Sector = SETTINGS_SECTOR;
+    erase.NbSectors = 1;
+    erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+    uint32_t error;
+
+    HAL_FLASH_Unlock();
+    const HAL_StatusTypeDef status = HAL_FLASHEx_Erase(&erase, &error);
+    HAL_FLASH_Lock();
+    if (status != HAL_OK)
+        return 0;
+
+    // Nothing to write for the defaults, an empty log loads them
+    next_offset = 0;
+    if (memcmp(&current, &defaults, sizeof(current)) == 0)
+        return 1;
+    return Settings_Save(&current);
+}
+
+const Settings *Settings_Get(void)
+{
+    return &current;
+}
+
+int Settings_Save(const Settings *settings)
+{
+    if (next_offset + sizeof(SettingsRecord) > SETTINGS_SIZE)
+        return 0;
+
+    const int saved = Settings_Program(next_offset, settings);
+    next_offset += sizeof(SettingsRecord);
+    if (saved)
+        current = *settings;
+    return saved;
+}
@@ -0,0 +1,131 @@
+#include <string.h>
+#include "main.h"
+#include "telemetry.h"
+#include "profiler.h"
+#include "UART.h"
+
+#define TELEMETRY_MAX_RAW (sizeof(TelemetryHeader) + TELEMETRY_MAX_PAYLOAD + 2)
+
+/* COBS adds one byte per 254 and the delimiter */
+#define TELEMETRY_MAX_FRAME (TELEMETRY_MAX_RAW + TELEMETRY_MAX_RAW / 254 + 2)
+
+/* Below 254 bytes COBS adds exactly one code byte, whatever the data, so the
+ * frame length is known before the header it covers is written */
+#define TELEMETRY_FRAME_LENGTH(raw) ((raw) + 2)
+_Static_assert(TELEMETRY_MAX_RAW < 254, "telemetry frames must stay in one COBS block");
+
+static uint16_t next_seq = 0;
+
+// CRC-16/CCITT-FALSE, byte-wise without a table
+static uint16_t Telemetry_Crc16(const uint8_t *data, uint32_t length)
+{
+    uint16_t crc = 0xFFFF;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        uint8_t x = (crc >> 8) ^ data[i];
+        x ^= x >> 4;
+        crc = (crc << 8) ^ ((uint16_t)x << 12) ^ ((uint16_t)x << 5) ^ x;
+    }
+    return crc;
+}
+
+// Consistent Overhead Byte Stuffing of in into out, followed by the 0x00
+// delimiter.  Returns the number of bytes written to out.
+static uint32_t Telemetry_CobsEncode(const uint8_t *in, uint32_t length, uint8_t *out)
+{
+    uint32_t code_index = 0;
+    uint32_t out_index = 1;
+    uint8_t code = 1;
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        if (in[i] == 0)
+        {
+            out[code_index] = code;
+            code = 1;
+            code_index = out_index++;
+        }
+        else
+        {
+            out[out_index++] = in[i];
+            if (++code == 0xFF)
+            {
+                out[code_index] = code;
+                code = 1;
+                code_index = out_index++;
+            }
+        }
+    }
+
+    out[code_index] = code;
+    out[out_index++] = 0;
+    return out_index;
+}
+
+// Frame and queue one message.  Can be called from the ISR and the main loop.
+// The sequence number is taken and the frame's space in the UART ring reserved
+// together with the interrupts off, so frames leave in seq order and a gap on
+// the link is always a lost frame.  The CRC and the COBS pass run after, with
+// the interrupts enabled, and the frame is committed to its reservation.
+static void Telemetry_Send(uint8_t type, const void *payload, uint32_t length)
+{
+    uint8_t raw[TELEMETRY_MAX_RAW];
+    uint8_t frame[TELEMETRY_MAX_FRAME];
+    TelemetryHeader header;
+
+    header.type = type;
+    memcpy(raw + sizeof(header), payload, length);
+    length += sizeof(header);
+    const uint32_t frame_length = TELEMETRY_FRAME_LENGTH(length + 2);
+
+    uint32_t position;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    header.seq = next_seq++;
+    header.timestamp_us = Profiler_Micros();
+    const int reserved = UartReserve(frame_length, &position);
+    __set_PRIMASK(primask);
+
+    if (!reserved)
+    {
+        return;
+    }
+
+    memcpy(raw, &header, sizeof(header));
+    const uint16_t crc = Telemetry_Crc16(raw, length);
+    raw[length++] = crc & 0xFF;
+    raw[length++] = crc >> 8;
+
+    UartCommit(position, frame, Telemetry_CobsEncode(raw, length, frame));
+}
+
+void Telemetry_SendSample(const TelemetrySample *sample)
+{
+    Telemetry_Send(TELEMETRY_SAMPLE, sample, sizeof(*sample));
+}
+
+void Telemetry_SendHealth(const TelemetryHealth *health)
+{
+    Telemetry_Send(TELEMETRY_HEALTH, health, sizeof(*health));
+}
+
+void Telemetry_SendText(const char *text, uint32_t length)
+{
+    while (length > 0)
+    {
+        const uint32_t chunk = length > TELEMETRY_MAX_PAYLOAD ? TELEMETRY_MAX_PAYLOAD : length;
+        Telemetry_Send(TELEMETRY_TEXT, text, chunk);
+        text += chunk;
+        length -= chunk;
+    }
+}
+
+// Route the C library output (printf and friends) through text frames so it
+// can share the link with the binary samples.  stdout is line buffered, so this
+// is one frame per line.
+int _write(int file, char *ptr, int len)
+{
+    (void)file;
+    Telemetry_SendText(ptr, len);
+    return len;
+}
@@ -0,0 +1,143 @@
+/*
+ * Bus cost of the sensor driver calls, measured on the register-level
+ * peripheral emulator: I2C.c, Gyro.c, Accelerometer.c and Magnetometer.c
+ * run unmodified against emulated I2C1, SPI1, DMA, an LSM303DLHC and an
+ * L3GD20.  The output is deterministic, so two runs can be diffed to see
+ * what a driver change did to the buses.  The bus_cost test diffs the default
+ * report against sim/bus_cost.expected, which the bus_cost_expected target
+ * regenerates.
+ *
+ * Built by the host build of the top-level CMakeLists.txt, from the firmware
+ * sources.
+ *
+ * Usage: bus_cost [-p period_us]
+ *     period_us  time the FIFOs fill between two reads, the control period (1000)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "emulator.h"
+#include "I2C.h"
+#include "Gyro.h"
+#include "Accelerometer.h"
+#include "Magnetometer.h"
+
+/* Longest a call and the transfers it starts may take */
+#define SETTLE_TIMEOUT_US 50000
+
+static const double gyro_rate[3] = {0.10, -0.20, 0.50};           /* rad/s */
+static const double acceleration[3] = {0.05, -0.10, 0.99};       /* g */
+static const double field[3] = {0.21, -0.05, 0.42};              /* gauss */
+
+static void BusCost_Constant(double t, double value[3], void *context)
+{
+    (void)t;
+    const double *constant = context;
+    for (int i = 0; i < 3; i++)
+        value[i] = constant[i];
+}
+
+static void BusCost_Header(void)
+{
+    printf("%-24s %6s %6s %9s %6s %6s %9s %8s %6s %10s\n", "call", "i2c_tx", "i2c_b", "i2c_us",
+           "spi_tx", "spi_b", "spi_us", "accesses", "irqs", "elapsed_us");
+}
+
+static void BusCost_Print(const char *name, int idle)
+{
+    EmulatorStats s;
+    Emulator_GetStats(&s);
+
+    const double cycles_per_us = EMULATOR_CORE_CLOCK_HZ / 1e6;
+    printf("%-24s %6u %6u %9.1f %6u %6u %9.1f %8u %6u %10.1f%s\n", name,
+           (unsigned)s.i2c.transactions, (unsigned)s.i2c.bytes, s.i2c.busy_cycles / cycles_per_us,
+           (unsigned)s.spi.transactions, (unsigned)s.spi.bytes, s.spi.busy_cycles / cycles_per_us,
+           (unsigned)s.accesses, (unsigned)s.interrupts, s.cycles / cycles_per_us,
+           idle ? "" : "  (still busy)");
+}
+
+/* Cost of one call and of the transfers it leaves running */
+#define MEASURE(name, call)                                        \
+    do                                                             \
+    {                                                              \
+        Emulator_ResetStats();                                     \
+        call;                                                      \
+        BusCost_Print(name, Emulator_RunUntilIdle(SETTLE_TIMEOUT_US)); \
+    } while (0)
+
+int main(int argc, char **argv)
+{
+    uint32_t period_us = 1000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            period_us = (uint32_t)strtoul(optarg, 0, 10);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p period_us]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    Emulator_SetGyroSource(BusCost_Constant, (void *)gyro_rate);
+    Emulator_SetAccelerometerSource(BusCost_Constant, (void *)acceleration);
+    Emulator_SetMagnetometerSource(BusCost_Constant, (void *)field);
+    Emulator_Init();
+
+    BusCost_Header();
+
+    /* Boot sequence, as in main() */
+    MEASURE("GyroInit", GyroInit());
+    MEASURE("AccelerometerInit", AccelerometerInit());
+    MEASURE("MagnetometerInit", MagnetometerInit());
+    MEASURE("GyroConfigure", GyroConfigure(GYRO_ODR_760HZ, GYRO_BANDWIDTH_0, GYRO_RANGE_250DPS, 1));
+    MEASURE("AccelerometerConfigure", AccelerometerConfigure(ACCELEROMETER_ODR_400HZ, ACCELEROMETER_RANGE_2G, 4));
+
+    /* Steady state: one period of samples in each FIFO.  The two IMU reads
+     * share nothing but the CPU, the magnetometer waits for the I2C bus. */
+    Emulator_Run(period_us);
+    MEASURE("GyroStartRead", GyroStartRead());
+    Emulator_Run(period_us);
+    MEASURE("AccelerometerStartRead", AccelerometerStartRead());
+    Emulator_Run(period_us);
+    MEASURE("MagnetometerStartRead", MagnetometerStartRead());
+
+    /* A slave left holding SDA: refused reads until the timeout check frees
+     * the bus, then normal reads.  By then the magnetometer, at 75 Hz, has a
+     * first conversion to give. */
+    Emulator_HoldSda(5);
+    Emulator_ResetStats();
+    for (uint32_t us = 0; us < 20000; us += period_us)
+    {
+        AccelerometerStartRead();
+        I2CCheckTimeout();
+        Emulator_Run(period_us);
+    }
+    BusCost_Print("stuck SDA, 20 ms", Emulator_RunUntilIdle(SETTLE_TIMEOUT_US));
+    MEASURE("AccelerometerStartRead", AccelerometerStartRead());
+    MEASURE("MagnetometerStartRead", MagnetometerStartRead());
+
+    /* What the drivers decoded, against what the devices were given */
+    GyroSample gyro;
+    AccelerometerSample accelerometer;
+    short mx, my, mz;
+    GetGyroSample(&gyro);
+    GetAccelerometerSample(&accelerometer);
+    GetMagnetometerValues(&mx, &my, &mz);
+
+    printf("\ngyro rad/s       %8.4f %8.4f %8.4f  (%u samples)\n", gyro.rate[0], gyro.rate[1], gyro.rate[2],
+           gyro.count);
+    printf("accelerometer g  %8.4f %8.4f %8.4f  (%u samples)\n", accelerometer.x / 16000.0,
+           accelerometer.y / 16000.0, accelerometer.z / 16000.0, accelerometer.count);
+    /* Magnetometer.c has always returned the device Y axis as x and X as y */
+    printf("magnetometer G   %8.4f %8.4f %8.4f  (x and y swapped by the driver)\n", mx / 1100.0, my / 1100.0,
+           mz / 980.0);
+    printf("i2c errors %u timeouts %u recoveries %u, gyro timeouts %u\n", I2CErrorCount(), I2CTimeoutCount(),
+           I2CRecoveryCount(), GyroTimeoutCount());
+    return 0;
+}
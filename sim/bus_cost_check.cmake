@@ -0,0 +1,19 @@
+# Runs bus_cost and compares its report to the checked-in one.
+#
+#     cmake -DBUS_COST=<bus_cost> -DEXPECTED=<report> -DACTUAL=<output> -P bus_cost_check.cmake
+#
+# A driver change that moves the bus cost fails the test with the diff; once
+# the change is meant, regenerate the report with the bus_cost_expected target.
+
+execute_process(COMMAND ${BUS_COST} OUTPUT_VARIABLE actual RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "bus_cost failed: ${result}")
+endif()
+file(WRITE ${ACTUAL} "${actual}")
+
+file(READ ${EXPECTED} expected)
+if(NOT actual STREQUAL expected)
+    execute_process(COMMAND diff -u ${EXPECTED} ${ACTUAL})
+    message(FATAL_ERROR "the bus cost differs from ${EXPECTED}, regenerate it with the bus_cost_expected target if the change is meant")
+endif()
+message("bus cost matches ${EXPECTED}")
@@ -0,0 +1,279 @@
+#include <math.h>
+#include "closed_loop.h"
+#include "esc.h"
+#include "dshot.h"
+#include "loop.h"
+#include "motor.h"
+#include "tuning.h"
+
+/* Integration step of the plant, well below every period of the loop */
+#define CLOSED_LOOP_STEP_S 25e-6
+
+/* Settling band: 2 % of the step, but never tighter than the sensor noise */
+#define CLOSED_LOOP_SETTLING_FRACTION 0.02
+#define CLOSED_LOOP_SETTLING_MIN_DEG 0.5
+
+#define RAD_TO_DEG (180.0 / 3.14159265358979323846)
+
+void ClosedLoop_DefaultConfig(ClosedLoopConfig *c)
+{
+    *c = (ClosedLoopConfig){0};
+    c->law = CONTROL_PID;
+    c->filter = CONTROL_COMPLEMENTARY;
+    c->tuning = (ClosedLoopTuning){PID_KP, PID_KI, PID_KD,
+                                   CASCADE_A, CASCADE_B,
+                                   COMPLEMENTARY_TAU_S,
+                                   KALMAN_Q_ANGLE, KALMAN_Q_VELOCITY, KALMAN_Q_BIAS,
+                                   KALMAN_R_ANGLE, KALMAN_R_RATE,
+                                   LQR_Q_ANGLE, LQR_Q_RATE, LQR_R};
+
+    // CONTROL_RATE_HZ, ANGLE_RATE_HZ and SENSOR_LEAD_US of main.c
+    c->rate_hz = 1000;
+    c->angle_rate_hz = 200;
+    c->sensor_lead_us = 500;
+
+    // The step once the arm has lifted off the stop
+    c->initial_angle_deg = -45.0f;
+    c->duration_s = 14.0;
+    c->step_time_s = 5.0;
+    c->step_deg = 10.0f;
+    c->disturbance_time_s = 10.0;
+    c->disturbance_length_s = 0.1;
+    c->disturbance_nm = 0.2f;
+}
+
+// The firmware objects of one lane: the control module, the tick body and
+// the motor driver state, what Motor_Write() and Motor_Rpm() keep
+typedef struct
+{
+    PIDController pid;
+    KalmanFilter kalman;
+    LQR_Controller lqr;
+    Mixer mixer;
+    Control control;
+    GyroBias gyro_bias;
+    Arming arming;
+    Loop loop;
+    SensorSet sensors;
+    float written[2];
+    float rpm[2];
+} ClosedLoopLane;
+
+// The mixer is calibrated with the thrust curve of the lane's motors
+static void ClosedLoop_InitLane(ClosedLoopLane *lane, const ClosedLoopConfig *config, const ClosedLoopTuning *g,
+                                const PlantParams *plant_params, float tick_s, float angle_s)
+{
+    lane->pid = (PIDController){g->pid_kp, g->pid_ki, g->pid_kd,
+                                PID_TAU,
+                                PID_LIM_MIN, PID_LIM_MAX,
+                                PID_LIM_MIN_INT, PID_LIM_MAX_INT,
+                                angle_s};
+    lane->kalman = (KalmanFilter){g->kalman_q_angle, g->kalman_q_velocity, g->kalman_q_bias,
+                                  g->kalman_r_angle, g->kalman_r_rate,
+                                  angle_s};
+    lane->lqr = (LQR_Controller){g->lqr_q_angle, g->lqr_q_rate, g->lqr_r, angle_s};
+    PIDController_Init(&lane->pid);
+    KalmanFilter_Init(&lane->kalman);
+    LQR_init(&lane->lqr);
+    const MixerCalibration calibration = {plant_params->thrust_per_command, plant_params->thrust_quadratic};
+    Mixer_Init(&lane->mixer, (const MixerCalibration[2]){calibration, calibration});
+
+    lane->control = (Control){config->law, config->filter, 0.0f,
+                              g->cascade_a, g->cascade_b,
+                              g->complementary_tau_s / (g->complementary_tau_s + angle_s),
+                              &lane->pid, &lane->kalman, &lane->lqr, &lane->mixer};
+
+    // No stored bias and no ESC range calibration, as the first boot of a
+    // DShot board
+    lane->gyro_bias = (GyroBias){(uint32_t)(plant_params->gyro_odr_hz * GYRO_BIAS_CALIBRATION_S),
+                                 GYRO_BIAS_MOTION_RAD_S, GYRO_BIAS_REST_RAD_S, GYRO_BIAS_REST_S,
+                                 GYRO_BIAS_TRACKING_TAU_S};
+    GyroBias_Init(&lane->gyro_bias, 0);
+    Arming_Start(&lane->arming, 0, 0);
+    lane->loop = (Loop){&lane->control, &lane->gyro_bias, &lane->arming, GYRO_BIAS_RESIDUAL_VARIANCE, tick_s};
+    lane->sensors = (SensorSet){0};
+    lane->written[0] = lane->written[1] = 0.0f;
+    lane->rpm[0] = lane->rpm[1] = 0.0f;
+}
+
+// The sensor round as Sensors_Latest() returns it, pitch on the gyro y axis.
+// A sensor without new samples keeps its last ones.
+static void ClosedLoop_Sensors(SensorSet *set, const PlantReading *reading, uint32_t now_us)
+{
+    set->gyro.count = reading->gyro_count;
+    if (reading->gyro_count)
+    {
+        set->gyro.rate[1] = reading->gyro_rate;
+        set->gyro.dt = reading->gyro_dt;
+        set->gyro.timestamp_us = now_us;
+    }
+    set->accelerometer.count = reading->accelerometer_count;
+    if (reading->accelerometer_count)
+    {
+        set->accelerometer.x = reading->accelerometer[0];
+        set->accelerometer.y = reading->accelerometer[1];
+        set->accelerometer.z = reading->accelerometer[2];
+        set->accelerometer.timestamp_us = now_us;
+    }
+    set->timestamp_us = now_us;
+    set->seq++;
+}
+
+// Motor_Send(): the inverted DShot frames of the written commands, and the
+// eRPM replies of the ESCs to them, for Motor_Rpm() at the next tick
+static void ClosedLoop_Send(ClosedLoopLane *lane, Plant *plant, uint32_t k)
+{
+    float command[2];
+    for (int i = 0; i < 2; i++)
+    {
+        const uint16_t frame = Dshot_Frame(Dshot_Throttle(lane->written[i], MOTOR_COMMAND_MAX), 0, 1);
+        if (!Esc_Command(frame, 1, MOTOR_COMMAND_MAX, &command[i]))
+            command[i] = plant->command[i][k];
+
+        uint32_t period_us;
+        if (Dshot_DecodeReply(Esc_Reply(Esc_Period(Plant_Rpm(plant, k, i), MOTOR_POLES)), &period_us))
+            lane->rpm[i] = Dshot_Rpm(period_us, MOTOR_POLES);
+    }
+    Plant_SetCommand(plant, k, command[0], command[1]);
+}
+
+// The trace, when given, follows lane 0
+static void ClosedLoop_RunLanes(const ClosedLoopConfig *config, const ClosedLoopTuning *tunings,
+                                const PlantParams *plant_params, uint32_t lanes, ClosedLoopResult *results,
+                                ClosedLoopTrace trace, void *context)
+{
+    lanes = lanes < PLANT_LANES ? lanes : PLANT_LANES;
+
+    // Periods as ControlRate_Apply() derives them, with the 1 us resolution of TIM2
+    const uint32_t period_us = 1000000 / config->rate_hz;
+    const float tick_s = period_us / 1e6f;
+    uint32_t angle_ticks = (uint32_t)(1.0f / (tick_s * config->angle_rate_hz) + 0.5f);
+    angle_ticks = angle_ticks > 0 ? angle_ticks : 1;
+    const float angle_s = angle_ticks * tick_s;
+    const uint32_t lead_us = period_us / 2 < config->sensor_lead_us ? period_us / 2 : config->sensor_lead_us;
+
+    // The arms start at rest with the motors stopped, the board boots
+    ClosedLoopLane lane[PLANT_LANES];
+    const float stopped[PLANT_LANES] = {0};
+    for (uint32_t k = 0; k < lanes; k++)
+    {
+        ClosedLoop_InitLane(&lane[k], config, &tunings[k], &plant_params[k], tick_s, angle_s);
+        results[k] = (ClosedLoopResult){0};
+    }
+    Plant plant;
+    Plant_Init(&plant, plant_params, lanes, (float)(config->initial_angle_deg / RAD_TO_DEG), stopped, stopped);
+
+    PlantReading reading[PLANT_LANES] = {0};
+    const double step_band = fmax(fabs(config->step_deg) * CLOSED_LOOP_SETTLING_FRACTION, CLOSED_LOOP_SETTLING_MIN_DEG);
+    const uint64_t ticks = (uint64_t)(config->duration_s / tick_s + 0.5);
+
+    // Every lane arms on the same tick, the sequence only depends on the time
+    uint64_t armed_tick = 0;
+    for (uint64_t tick = 1; !armed_tick || tick <= armed_tick + ticks; tick++)
+    {
+        const double now = tick * (double)tick_s;
+        const double t = armed_tick ? (tick - armed_tick) * (double)tick_s : -1.0;
+
+        // Disturbance torque pulse
+        const int disturbed = t > config->disturbance_time_s &&
+                              t <= config->disturbance_time_s + config->disturbance_length_s;
+        for (uint32_t k = 0; k < lanes; k++)
+            plant.disturbance_nm[k] = disturbed ? config->disturbance_nm : 0.0f;
+
+        // Sensor round, then the tick
+        Plant_Advance(&plant, now - lead_us * 1e-6, CLOSED_LOOP_STEP_S);
+        Plant_Read(&plant, reading);
+        Plant_Advance(&plant, now, CLOSED_LOOP_STEP_S);
+
+        const uint32_t now_us = (uint32_t)(now * 1e6 + 0.5);
+        const float setpoint = t >= config->step_time_s ? config->step_deg : 0.0f;
+        const int angle_step = tick % angle_ticks == 0;
+        const int measured = t >= config->step_time_s &&
+                             (config->disturbance_nm == 0.0f || t < config->disturbance_time_s);
+
+        int armed = 0;
+        for (uint32_t k = 0; k < lanes; k++)
+        {
+            ClosedLoopLane *l = &lane[k];
+            Control *control = &l->control;
+            control->setpoint = setpoint;
+            ClosedLoop_Sensors(&l->sensors, &reading[k], now_us - lead_us);
+
+            // The tasks in the order of the scheduler table, as RateTask(),
+            // ArmingTask() and AngleTask() run them
+            if (Loop_Rate(&l->loop, &l->sensors, SAFETY_NORMAL) & LOOP_WRITE_MOTORS)
+            {
+                l->written[0] = l->loop.left;
+                l->written[1] = l->loop.right;
+            }
+            control->motor_rpm[0] = l->rpm[0];
+            control->motor_rpm[1] = l->rpm[1];
+
+            const uint32_t events = Loop_Arming(&l->loop, now_us, SAFETY_NORMAL);
+            armed |= (events & LOOP_ARMED) != 0;
+            if (events & LOOP_WRITE_MOTORS)
+            {
+                l->written[0] = l->loop.left;
+                l->written[1] = l->loop.right;
+            }
+
+            if (angle_step)
+            {
+                Loop_Estimate(&l->loop, &l->sensors, SAFETY_NORMAL);
+                Loop_Law(&l->loop);
+            }
+
+            ClosedLoop_Send(l, &plant, k);
+
+            if (t < 0.0)
+                continue;
+
+            // Metrics on the true angle
+            ClosedLoopResult *result = &results[k];
+            const double angle = plant.theta[k] * RAD_TO_DEG;
+            const double error = control->setpoint - angle;
+            result->ise += error * error * tick_s;
+            result->effort += (double)control->dF * control->dF * tick_s;
+            if (t >= config->step_time_s)
+                result->max_angle_deg = fmax(result->max_angle_deg, fabs(angle));
+            if (measured)
+            {
+                const double beyond = config->step_deg >= 0.0f ? angle - config->step_deg : config->step_deg - angle;
+                const double overshoot = config->step_deg != 0.0f ? 100.0 * beyond / fabs(config->step_deg) : beyond;
+                result->overshoot = fmax(result->overshoot, overshoot);
+                if (fabs(error) > step_band)
+                    result->settling_s = t - config->step_time_s;
+            }
+        }
+        if (armed && !armed_tick)
+            armed_tick = tick;
+
+        if (trace && t >= 0.0)
+        {
+            const Control *control = &lane[0].control;
+            const ClosedLoopSample sample = {t, control->setpoint, (float)(plant.theta[0] * RAD_TO_DEG),
+                                             (float)(control->theta * RAD_TO_DEG), control->qf,
+                                             control->dF, lane[0].written[0], lane[0].written[1]};
+            trace(&sample, context);
+        }
+    }
+
+    for (uint32_t k = 0; k < lanes; k++)
+        results[k].ticks = ticks;
+}
+
+void ClosedLoop_Run(const ClosedLoopConfig *config, const PlantParams *plant_params,
+                    ClosedLoopResult *result, ClosedLoopTrace trace, void *context)
+{
+    ClosedLoop_RunLanes(config, &config->tuning, plant_params, 1, result, trace, context);
+}
+
+void ClosedLoop_RunBatch(const ClosedLoopConfig *config, const ClosedLoopTuning *tunings,
+                         const PlantParams *plant_params, uint32_t count, ClosedLoopResult *results)
+{
+    for (uint32_t first = 0; first < count; first += PLANT_LANES)
+    {
+        const uint32_t lanes = count - first < PLANT_LANES ? count - first : PLANT_LANES;
+        ClosedLoop_RunLanes(config, &tunings[first], &plant_params[first], lanes, &results[first], 0, 0);
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef CLOSED_LOOP_H
+#define CLOSED_LOOP_H
+
+#include "plant.h"
+#include "control.h"
+
+/*
+ * The firmware control loop around the simulated plant, in virtual time.
+ *
+ * Each tick does what the firmware tick does in timer mode: the sensor round
+ * drains the FIFOs SENSOR_LEAD_US before the tick, then the rate and arming
+ * tasks run, every angle period the angle task too, and the DShot frame goes
+ * out.  The tasks are the ones of main.c, through the shared tick body of
+ * loop.c, so the gyro bias calibration, the arming sequence and the motor
+ * gating run as on the board, and the periods are derived from the rate as
+ * ControlRate_Apply() does.  The frames go through the ESC model of esc.c to
+ * the plant, and its eRPM replies come back through the decoder of dshot.c.
+ *
+ * The board boots with the arm on its lower stop and the motors stopped.  The
+ * scenario times and the metrics start when the ESCs arm, so the run lasts
+ * the arming sequence plus duration_s.
+ */
+
+typedef struct
+{
+    float pid_kp, pid_ki, pid_kd;
+    float cascade_a, cascade_b;
+    float complementary_tau_s;
+    float kalman_q_angle, kalman_q_velocity, kalman_q_bias;
+    float kalman_r_angle, kalman_r_rate;
+    float lqr_q_angle, lqr_q_rate, lqr_r;
+} ClosedLoopTuning;
+
+typedef struct
+{
+    ControlLaw law;
+    ControlFilter filter;
+    ClosedLoopTuning tuning;
+
+    uint32_t rate_hz;       /* control tick */
+    uint32_t angle_rate_hz; /* estimator and controller step */
+    uint32_t sensor_lead_us;
+
+    /* From the end of the arming sequence */
+    double duration_s;
+    double step_time_s;         /* setpoint step from 0 to step_deg */
+    float step_deg;
+    double disturbance_time_s;  /* torque pulse of disturbance_nm */
+    double disturbance_length_s;
+    float disturbance_nm;
+    float initial_angle_deg;
+} ClosedLoopConfig;
+
+/* Measured on the true angle of the arm.  The overshoot and the settling time
+ * only look at the step response, up to the disturbance if there is one, and
+ * the largest angle at what follows the lift-off, from the step on. */
+typedef struct
+{
+    double ise;          /* integral of the squared error, deg^2 s */
+    double overshoot;    /* past the setpoint, in % of the step, or deg without a step */
+    double settling_s;   /* after the step, to stay within 2 % of it or 0.5 deg */
+    double effort;       /* integral of dF^2, s */
+    double max_angle_deg;
+    uint64_t ticks;
+} ClosedLoopResult;
+
+typedef struct
+{
+    double t; /* since the ESCs armed */
+    float setpoint_deg;
+    float angle_deg;    /* true angle */
+    float estimate_deg; /* firmware estimate */
+    float rate;         /* measured, rad/s */
+    float control;      /* dF */
+    float left, right;  /* motor commands */
+} ClosedLoopSample;
+
+/* Called once per tick from the arming on when given to ClosedLoop_Run() */
+typedef void (*ClosedLoopTrace)(const ClosedLoopSample *sample, void *context);
+
+/* Firmware boot defaults: tuning.h, 1 kHz tick and 200 Hz angle step, and the
+ * arm on the lower stop of Plant_DefaultParams() */
+void ClosedLoop_DefaultConfig(ClosedLoopConfig *config);
+
+void ClosedLoop_Run(const ClosedLoopConfig *config, const PlantParams *plant_params,
+                    ClosedLoopResult *result, ClosedLoopTrace trace, void *context);
+
+/* count runs of the same scenario, the i-th with tunings[i] on plant_params[i].
+ * config->tuning is not used.  The runs go through the plant PLANT_LANES at a
+ * time, so their sensor and ESC rates are those of the first of each group. */
+void ClosedLoop_RunBatch(const ClosedLoopConfig *config, const ClosedLoopTuning *tunings,
+                         const PlantParams *plant_params, uint32_t count, ClosedLoopResult *results);
+
+#endif
@@ -0,0 +1,190 @@
+#include "RegisterAddresses.h"
+#include "emulator_internal.h"
+
+/* The DMA streams the drivers use, byte transfers in direct mode (RM0383
+ * section 9): each request of the peripheral moves one byte, NDTR counts
+ * down, the half and full transfer flags land in LISR/HISR and raise the
+ * stream interrupt when enabled. */
+
+#define CR_EN (1u << 0)
+#define CR_TEIE (1u << 2)
+#define CR_HTIE (1u << 3)
+#define CR_TCIE (1u << 4)
+#define CR_DIR_SHIFT 6
+#define CR_MINC (1u << 10)
+#define CR_CHSEL_SHIFT 25
+
+#define DIR_MEMORY_TO_PERIPHERAL 1
+
+/* Flag bits of a stream, shifted to its place in LISR/HISR */
+#define FLAG_TEIF (1u << 3)
+#define FLAG_HTIF (1u << 4)
+#define FLAG_TCIF (1u << 5)
+
+typedef struct
+{
+    uintptr_t base;     /* controller */
+    uint32_t stream;
+    uint32_t channel;
+    uint32_t irq;
+    uint8_t (*read)(void);
+    void (*write)(uint8_t byte);
+
+    EmulatorRegister *cr;
+    EmulatorRegister *ndtr;
+    EmulatorRegister *m0ar;
+    EmulatorRegister *isr;
+    uint32_t total;
+    uint8_t *memory;
+} Stream;
+
+static Stream streams[DMA_NUM_REQUESTS] = {
+    [DMA_I2C1_RX] = {DMA1_BASE_ADDRESS, 0, 1, 11, I2CModel_DmaRead, 0},
+    [DMA_SPI1_RX] = {DMA2_BASE_ADDRESS, 0, 3, 56, SpiModel_DmaRead, 0},
+    [DMA_SPI1_TX] = {DMA2_BASE_ADDRESS, 3, 3, 59, 0, SpiModel_DmaWrite},
+};
+
+static uint32_t DmaModel_FlagShift(const Stream *s)
+{
+    static const uint32_t shifts[4] = {0, 6, 16, 22};
+    return shifts[s->stream % 4];
+}
+
+static void DmaModel_UpdateIrq(const Stream *s)
+{
+    const uint32_t flags = s->isr->value >> DmaModel_FlagShift(s);
+    const uint32_t control = s->cr->value;
+    const int level = ((control & CR_TCIE) && (flags & FLAG_TCIF)) ||
+                      ((control & CR_HTIE) && (flags & FLAG_HTIF)) ||
+                      ((control & CR_TEIE) && (flags & FLAG_TEIF));
+    Emulator_SetIrqLine(s->irq, level);
+}
+
+static void DmaModel_Flag(Stream *s, uint32_t flag)
+{
+    s->isr->value |= flag << DmaModel_FlagShift(s);
+    DmaModel_UpdateIrq(s);
+}
+
+static Stream *DmaModel_Find(const EmulatorRegister *reg)
+{
+    for (int i = 0; i < DMA_NUM_REQUESTS; i++)
+    {
+        if (streams[i].cr == reg)
+            return &streams[i];
+    }
+    return 0;
+}
+
+static void DmaModel_CrWrite(EmulatorRegister *reg, uint32_t previous)
+{
+    Stream *s = DmaModel_Find(reg);
+
+    if ((reg->value & CR_EN) && !(previous & CR_EN))
+    {
+        s->total = s->ndtr->value & 0xFFFF;
+        s->memory = Emulator_HostPointer(s->m0ar->value);
+        if (s->total == 0)
+            reg->value &= ~CR_EN;
+    }
+    else if (!(reg->value & CR_EN) && (previous & CR_EN))
+    {
+        /* Disabled before the end: the transfer is over, TCIF says so */
+        DmaModel_Flag(s, FLAG_TCIF);
+    }
+    DmaModel_UpdateIrq(s);
+
+    /* The peripheral may already be asking */
+    I2CModel_ServiceDma();
+    SpiModel_ServiceDma();
+}
+
+/* Write 1 to clear, reads as 0 */
+static void DmaModel_IfcrWrite(EmulatorRegister *reg, uint32_t previous)
+{
+    (void)previous;
+    const uintptr_t base = reg->address & ~(uintptr_t)0xFF;
+    const uintptr_t isr = base + (reg->address - base - 0x08);
+
+    for (int i = 0; i < DMA_NUM_REQUESTS; i++)
+    {
+        Stream *s = &streams[i];
+        if (s->isr->address == isr)
+        {
+            s->isr->value &= ~reg->value;
+            DmaModel_UpdateIrq(s);
+        }
+    }
+    reg->value = 0;
+}
+
+static void DmaModel_ReadOnly(EmulatorRegister *reg, uint32_t previous)
+{
+    reg->value = previous;
+}
+
+void DmaModel_Init(void)
+{
+    const uintptr_t controllers[] = {DMA1_BASE_ADDRESS, DMA2_BASE_ADDRESS};
+    for (int i = 0; i < 2; i++)
+    {
+        Emulator_Map(controllers[i] + 0x00, 0, DmaModel_ReadOnly);
+        Emulator_Map(controllers[i] + 0x04, 0, DmaModel_ReadOnly);
+        Emulator_Map(controllers[i] + 0x08, 0, DmaModel_IfcrWrite);
+        Emulator_Map(controllers[i] + 0x0C, 0, DmaModel_IfcrWrite);
+    }
+
+    for (int i = 0; i < DMA_NUM_REQUESTS; i++)
+    {
+        Stream *s = &streams[i];
+        const uintptr_t stream = s->base + 0x10 + 0x18 * s->stream;
+        s->cr = Emulator_Map(stream + 0x00, 0, DmaModel_CrWrite);
+        s->ndtr = Emulator_Map(stream + 0x04, 0, 0);
+        s->m0ar = Emulator_Map(stream + 0x0C, 0, 0);
+        s->isr = Emulator_Map(s->base + (s->stream < 4 ? 0x00 : 0x04), 0, DmaModel_ReadOnly);
+        s->total = 0;
+        s->memory = 0;
+    }
+}
+
+int DmaModel_Request(DmaRequest request)
+{
+    Stream *s = &streams[request];
+    const uint32_t control = s->cr->value;
+    const uint32_t remaining = s->ndtr->value & 0xFFFF;
+    if (!(control & CR_EN) || ((control >> CR_CHSEL_SHIFT) & 0x7) != s->channel || remaining == 0)
+        return 0;
+
+    uint8_t *memory = s->memory;
+    if (control & CR_MINC)
+        memory += s->total - remaining;
+
+    if (((control >> CR_DIR_SHIFT) & 0x3) == DIR_MEMORY_TO_PERIPHERAL)
+    {
+        if (!s->write)
+            return 0;
+        s->write(*memory);
+    }
+    else
+    {
+        if (!s->read)
+            return 0;
+        *memory = s->read();
+    }
+
+    s->ndtr->value = remaining - 1;
+    if (remaining - 1 == s->total / 2)
+        DmaModel_Flag(s, FLAG_HTIF);
+    if (remaining - 1 == 0)
+    {
+        s->cr->value &= ~CR_EN;
+        DmaModel_Flag(s, FLAG_TCIF);
+    }
+    return 1;
+}
+
+uint32_t DmaModel_Remaining(DmaRequest request)
+{
+    const Stream *s = &streams[request];
+    return (s->cr->value & CR_EN) ? (s->ndtr->value & 0xFFFF) : 0;
+}
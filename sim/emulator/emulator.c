@@ -0,0 +1,464 @@
+#include <stdlib.h>
+#include <string.h>
+#include "stm32f4xx.h"
+#include "RegisterAddresses.h"
+#include "profiler.h"
+#include "emulator_internal.h"
+
+/* Open addressing, sized well above the number of registers the drivers touch */
+#define TABLE_SIZE 512
+
+#define NUM_IRQS 96
+#define THREAD_PRIORITY 256
+
+#define NVIC_ISER(n) (NVIC_BASE_ADDRESS + 0x000 + 4 * (n))
+#define NVIC_ICER(n) (NVIC_BASE_ADDRESS + 0x080 + 4 * (n))
+#define NVIC_ISPR(n) (NVIC_BASE_ADDRESS + 0x100 + 4 * (n))
+#define NVIC_ICPR(n) (NVIC_BASE_ADDRESS + 0x180 + 4 * (n))
+
+/* Reset value of RCC_CFGR once SystemClock_Config() has run: PLL as the
+ * system clock (SW and SWS), APB1 /4 (PPRE1 = 101), APB2 /1 */
+#define RCC_CFGR_CONFIGURED ((5 << 10) | (2 << 2) | 2)
+
+/* The handlers come from the drivers linked in, the ones that aren't are
+ * never called */
+extern void DMA1_Stream0_IRQHandler(void) __attribute__((weak));
+extern void I2C1_EV_IRQHandler(void) __attribute__((weak));
+extern void I2C1_ER_IRQHandler(void) __attribute__((weak));
+extern void DMA2_Stream0_IRQHandler(void) __attribute__((weak));
+
+typedef struct
+{
+    uint32_t irq;
+    void (*handler)(void);
+} Vector;
+
+static const Vector vectors[] = {
+    {11, DMA1_Stream0_IRQHandler},
+    {31, I2C1_EV_IRQHandler},
+    {32, I2C1_ER_IRQHandler},
+    {56, DMA2_Stream0_IRQHandler},
+};
+
+uint32_t SystemCoreClock = EMULATOR_CORE_CLOCK_HZ;
+
+static EmulatorRegister table[TABLE_SIZE];
+static uint32_t table_used = 0;
+
+static uint64_t now = 0;
+static uint64_t stats_start = 0;
+static EmulatorStats stats;
+
+/* Last register handed to the CPU, settled at the next access */
+static EmulatorRegister *pending = 0;
+static uint32_t pending_value = 0;
+
+static uint32_t primask = 0;
+static uint32_t active_priority = THREAD_PRIORITY;
+static uint32_t enabled[NUM_IRQS / 32];
+static uint32_t soft_pending[NUM_IRQS / 32];
+static uint32_t lines[NUM_IRQS / 32];
+
+static DWT_Type dwt;
+
+static EmulatorRegister *gpiob_moder;
+static EmulatorRegister *gpiob_idr;
+static EmulatorRegister *gpiob_odr;
+static EmulatorRegister *gpioe_moder;
+static EmulatorRegister *gpioe_odr;
+static int gyro_selected = 0;
+
+static EmulatorRegister *Emulator_Find(uintptr_t address)
+{
+    uint32_t i = (uint32_t)((address >> 2) * 2654435761u) % TABLE_SIZE;
+    while (table[i].address != 0 && table[i].address != address)
+        i = (i + 1) % TABLE_SIZE;
+
+    if (table[i].address == 0)
+    {
+        /* Running out means a driver wanders over the address space */
+        if (++table_used >= TABLE_SIZE)
+            abort();
+        table[i].address = address;
+    }
+    return &table[i];
+}
+
+EmulatorRegister *Emulator_Map(uintptr_t address, EmulatorRead on_read, EmulatorWrite on_write)
+{
+    EmulatorRegister *reg = Emulator_Find(address);
+    reg->on_read = on_read;
+    reg->on_write = on_write;
+    return reg;
+}
+
+uint64_t Emulator_Now(void)
+{
+    return now;
+}
+
+EmulatorStats *Emulator_Counters(void)
+{
+    return &stats;
+}
+
+void *Emulator_HostPointer(uint32_t address)
+{
+    static const char anchor = 0;
+    return (void *)(((uintptr_t)&anchor & ~(uintptr_t)UINT32_MAX) | address);
+}
+
+/* Apply the side effects of the access handed out last */
+static void Emulator_Settle(void)
+{
+    EmulatorRegister *reg = pending;
+    if (!reg)
+        return;
+
+    pending = 0;
+    if (reg->value != pending_value)
+    {
+        if (reg->on_write)
+            reg->on_write(reg, pending_value);
+    }
+    else if (reg->on_read)
+    {
+        reg->on_read(reg);
+    }
+}
+
+static uint64_t Emulator_NextEvent(void)
+{
+    const uint64_t i2c = I2CModel_Due();
+    const uint64_t spi = SpiModel_Due();
+    return i2c < spi ? i2c : spi;
+}
+
+/* Move time on by cycles, running the bus events that fall inside */
+static void Emulator_Elapse(uint64_t cycles)
+{
+    const uint64_t target = now + cycles;
+    for (;;)
+    {
+        const uint64_t due = Emulator_NextEvent();
+        if (due > target)
+            break;
+        if (due > now)
+            now = due;
+        I2CModel_Advance(now);
+        SpiModel_Advance(now);
+    }
+    now = target;
+}
+
+static uint32_t Emulator_Priority(uint32_t irq)
+{
+    const uint32_t word = Emulator_Find(NVIC_IPR(irq & ~3u))->value;
+    return ((word >> (8 * (irq & 3))) & 0xFF) >> 4;
+}
+
+static int Emulator_IrqPending(uint32_t irq)
+{
+    const uint32_t bit = 1u << (irq % 32);
+    return (enabled[irq / 32] & bit) && ((lines[irq / 32] | soft_pending[irq / 32]) & bit);
+}
+
+/* Enter the handlers of the pending interrupts that preempt the code running
+ * now, highest priority first, as the NVIC would between two instructions */
+static void Emulator_TakeInterrupts(void)
+{
+    while (!primask)
+    {
+        const Vector *best = 0;
+        uint32_t best_priority = active_priority;
+        for (uint32_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+        {
+            const Vector *v = &vectors[i];
+            if (!v->handler || !Emulator_IrqPending(v->irq))
+                continue;
+
+            const uint32_t priority = Emulator_Priority(v->irq);
+            if (priority < best_priority)
+            {
+                best = v;
+                best_priority = priority;
+            }
+        }
+        if (!best)
+            return;
+
+        soft_pending[best->irq / 32] &= ~(1u << (best->irq % 32));
+        Emulator_Find(NVIC_ISPR(best->irq / 32))->value = soft_pending[best->irq / 32];
+        const uint32_t preempted = active_priority;
+        active_priority = best_priority;
+        stats.interrupts++;
+
+        best->handler();
+        Emulator_Settle();
+
+        active_priority = preempted;
+    }
+}
+
+/* An instruction boundary: the previous access takes effect, time moves on
+ * and interrupts can come in */
+static void Emulator_Step(void)
+{
+    Emulator_Settle();
+    Emulator_Elapse(EMULATOR_ACCESS_CYCLES);
+    Emulator_TakeInterrupts();
+}
+
+volatile unsigned int *Emulator_Register(uintptr_t address)
+{
+    Emulator_Step();
+
+    EmulatorRegister *reg = Emulator_Find(address);
+    pending = reg;
+    pending_value = reg->value;
+    stats.accesses++;
+    return &reg->value;
+}
+
+volatile unsigned char *Emulator_RegisterByte(uintptr_t address)
+{
+    volatile unsigned int *word = Emulator_Register(address & ~(uintptr_t)3);
+    return (volatile unsigned char *)word + (address & 3);
+}
+
+DWT_Type *Emulator_Dwt(void)
+{
+    Emulator_Step();
+    dwt.CYCCNT = (uint32_t)now;
+    return &dwt;
+}
+
+uint32_t Emulator_GetPrimask(void)
+{
+    return primask;
+}
+
+void Emulator_SetPrimask(uint32_t value)
+{
+    Emulator_Settle();
+    primask = value & 1;
+    Emulator_TakeInterrupts();
+}
+
+/* Stands in for profiler.c, whose clock is the cycle counter */
+uint32_t Profiler_Micros(void)
+{
+    return (uint32_t)(now / (SystemCoreClock / 1000000));
+}
+
+void Emulator_SetIrqLine(uint32_t irq, int level)
+{
+    if (level)
+        lines[irq / 32] |= 1u << (irq % 32);
+    else
+        lines[irq / 32] &= ~(1u << (irq % 32));
+}
+
+/* --- NVIC: the set and clear registers act on bits written as 1.  The set
+ * registers read back the state.  The clear registers read as 0 here, so
+ * clearing a bit that reads back as set is still seen as a write. --- */
+
+static void Emulator_NvicWrite(EmulatorRegister *reg, uint32_t previous)
+{
+    (void)previous;
+    const uint32_t offset = (uint32_t)(reg->address - NVIC_BASE_ADDRESS);
+    const uint32_t n = (offset & 0x7F) / 4;
+    const uint32_t value = reg->value;
+
+    switch (offset & ~0x7Fu)
+    {
+    case 0x000:
+        enabled[n] |= value;
+        break;
+    case 0x080:
+        enabled[n] &= ~value;
+        break;
+    case 0x100:
+        soft_pending[n] |= value;
+        break;
+    case 0x180:
+        soft_pending[n] &= ~value;
+        break;
+    }
+
+    Emulator_Find(NVIC_ISER(n))->value = enabled[n];
+    Emulator_Find(NVIC_ICER(n))->value = 0;
+    Emulator_Find(NVIC_ISPR(n))->value = soft_pending[n];
+    Emulator_Find(NVIC_ICPR(n))->value = 0;
+}
+
+/* --- GPIO --- */
+
+static int Emulator_PinIsOutput(const EmulatorRegister *moder, uint32_t pin)
+{
+    return ((moder->value >> (2 * pin)) & 3) == 1;
+}
+
+void Emulator_UpdatePins(void)
+{
+    /* PB6 is SCL and PB9 SDA, open-drain: high unless driven low as a GPIO
+     * output or held by a slave */
+    uint32_t idr = gpiob_odr->value & ~((1u << 6) | (1u << 9));
+    if (!Emulator_PinIsOutput(gpiob_moder, 6) || (gpiob_odr->value & (1 << 6)))
+        idr |= 1 << 6;
+    if (!I2CModel_SdaLow() && (!Emulator_PinIsOutput(gpiob_moder, 9) || (gpiob_odr->value & (1 << 9))))
+        idr |= 1 << 9;
+    gpiob_idr->value = idr;
+
+    /* PE3 is the gyro chip select, active low once it is an output */
+    const int selected = Emulator_PinIsOutput(gpioe_moder, 3) && !(gpioe_odr->value & (1 << 3));
+    if (selected != gyro_selected)
+    {
+        gyro_selected = selected;
+        SpiModel_Select(selected);
+    }
+}
+
+static void Emulator_BsrrWrite(EmulatorRegister *reg, uint32_t previous)
+{
+    (void)previous;
+    EmulatorRegister *odr = Emulator_Find(reg->address - 0x18 + 0x14);
+    const uint32_t before = odr->value;
+
+    /* Set wins over reset when both bits are written, see BSRR in RM0383 */
+    odr->value = (before & ~(reg->value >> 16)) | (reg->value & 0xFFFF);
+    reg->value = 0;
+
+    /* A rising edge on SCL driven by hand clocks a stuck slave */
+    if (odr == gpiob_odr && Emulator_PinIsOutput(gpiob_moder, 6) &&
+        !(before & (1 << 6)) && (odr->value & (1 << 6)))
+    {
+        I2CModel_SclPulse();
+    }
+
+    Emulator_UpdatePins();
+}
+
+static void Emulator_ModerWrite(EmulatorRegister *reg, uint32_t previous)
+{
+    (void)reg;
+    (void)previous;
+    Emulator_UpdatePins();
+}
+
+/* --- Harness interface --- */
+
+void Emulator_Init(void)
+{
+    memset(table, 0, sizeof(table));
+    table_used = 0;
+    now = 0;
+    stats_start = 0;
+    memset(&stats, 0, sizeof(stats));
+    pending = 0;
+    primask = 0;
+    active_priority = THREAD_PRIORITY;
+    memset(enabled, 0, sizeof(enabled));
+    memset(soft_pending, 0, sizeof(soft_pending));
+    memset(lines, 0, sizeof(lines));
+    memset(&dwt, 0, sizeof(dwt));
+    gyro_selected = 0;
+
+    for (uint32_t n = 0; n < NUM_IRQS / 32; n++)
+    {
+        Emulator_Map(NVIC_ISER(n), 0, Emulator_NvicWrite);
+        Emulator_Map(NVIC_ICER(n), 0, Emulator_NvicWrite);
+        Emulator_Map(NVIC_ISPR(n), 0, Emulator_NvicWrite);
+        Emulator_Map(NVIC_ICPR(n), 0, Emulator_NvicWrite);
+    }
+
+    Emulator_Find(RCC_CFGR)->value = RCC_CFGR_CONFIGURED;
+
+    gpiob_moder = Emulator_Map(GPIOB_MODER, 0, Emulator_ModerWrite);
+    gpiob_idr = Emulator_Find(GPIOB_IDR);
+    gpiob_odr = Emulator_Find(GPIOB_ODR);
+    gpioe_moder = Emulator_Map(GPIOE_MODER, 0, Emulator_ModerWrite);
+    gpioe_odr = Emulator_Find(GPIOE_ODR);
+    Emulator_Map(GPIOB_BSRR, 0, Emulator_BsrrWrite);
+    Emulator_Map(GPIOE_BSRR, 0, Emulator_BsrrWrite);
+
+    DmaModel_Init();
+    I2CModel_Init();
+    SpiModel_Init();
+    Lsm303Model_Init();
+    L3gd20Model_Init();
+
+    Emulator_UpdatePins();
+}
+
+void Emulator_Run(uint32_t us)
+{
+    Emulator_Settle();
+    const uint64_t target = now + (uint64_t)us * (SystemCoreClock / 1000000);
+
+    Emulator_TakeInterrupts();
+    while (now < target)
+    {
+        uint64_t due = Emulator_NextEvent();
+        if (due > target)
+            due = target;
+        Emulator_Elapse(due > now ? due - now : 0);
+        Emulator_TakeInterrupts();
+    }
+}
+
+static int Emulator_Idle(void)
+{
+    if (I2CModel_Busy() || SpiModel_Busy())
+        return 0;
+
+    for (uint32_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++)
+    {
+        if (vectors[i].handler && Emulator_IrqPending(vectors[i].irq))
+            return 0;
+    }
+    return 1;
+}
+
+int Emulator_RunUntilIdle(uint32_t timeout_us)
+{
+    for (uint32_t us = 0; us < timeout_us; us++)
+    {
+        Emulator_Settle();
+        if (Emulator_Idle())
+            return 1;
+        Emulator_Run(1);
+    }
+    return Emulator_Idle();
+}
+
+uint64_t Emulator_Cycles(void)
+{
+    return now;
+}
+
+double Emulator_Seconds(void)
+{
+    return (double)now / SystemCoreClock;
+}
+
+void Emulator_ResetStats(void)
+{
+    Emulator_Settle();
+    memset(&stats, 0, sizeof(stats));
+    stats_start = now;
+}
+
+void Emulator_GetStats(EmulatorStats *out)
+{
+    Emulator_Settle();
+    *out = stats;
+    out->cycles = now - stats_start;
+}
+
+void Emulator_HoldSda(uint32_t pulses)
+{
+    Emulator_Settle();
+    I2CModel_HoldSda(pulses);
+    Emulator_UpdatePins();
+}
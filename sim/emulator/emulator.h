@@ -0,0 +1,81 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+/*
+ * Register-level model of the peripherals the sensor drivers use, so
+ * I2C.c, Gyro.c, Accelerometer.c and Magnetometer.c run unmodified on the
+ * host.  Built with PERIPHERAL_EMULATOR, ACCESS() in RegisterAddresses.h
+ * lands here instead of on the bus.
+ *
+ * Modelled: I2C1 master (SR1/SR2/DR state machine, timing from CCR and the
+ * APB1 prescaler), SPI1 master (timing from the baud rate prescaler), DMA1
+ * stream 0 and DMA2 streams 0 and 3, GPIOB/GPIOE BSRR and IDR, the NVIC
+ * (enables, priorities, ISPR), DWT->CYCCNT and PRIMASK.  Behind them sit an
+ * LSM303DLHC (accelerometer and magnetometer) and an L3GD20, with their
+ * FIFOs, output data rates and full scales.
+ *
+ * Time only moves when the code touches a register or the cycle counter, or
+ * when the harness calls Emulator_Run(), so a run is deterministic.  Every
+ * access costs EMULATOR_ACCESS_CYCLES of CPU time.  Interrupts are taken at
+ * those points, by priority, with the handlers of the drivers.
+ *
+ * Typical use, to cost one driver call:
+ *     Emulator_ResetStats();
+ *     GyroStartRead();
+ *     Emulator_RunUntilIdle(10000);
+ *     Emulator_GetStats(&stats);
+ */
+
+#include <stdint.h>
+
+#define EMULATOR_CORE_CLOCK_HZ 96000000u
+
+/* CPU cycles charged for each register access or cycle counter read */
+#define EMULATOR_ACCESS_CYCLES 4
+
+typedef struct
+{
+    uint32_t transactions; /* START to STOP on I2C, chip select low to high on SPI */
+    uint32_t bytes;        /* on the wire, addresses and commands included */
+    uint64_t busy_cycles;  /* CPU cycles spent inside those transactions */
+} EmulatorBusStats;
+
+typedef struct
+{
+    EmulatorBusStats i2c;
+    EmulatorBusStats spi;
+    uint32_t accesses;   /* register accesses by the CPU */
+    uint32_t interrupts; /* handlers entered */
+    uint64_t cycles;     /* CPU cycles elapsed */
+} EmulatorStats;
+
+/* Physical quantities seen by a sensor at time t (s): rad/s for the gyro, g
+ * for the accelerometer, gauss for the magnetometer */
+typedef void (*EmulatorSource)(double t, double value[3], void *context);
+
+/* Back to reset: every register, device and counter, time 0.  The clock tree
+ * is as SystemClock_Config() leaves it: 96 MHz, APB1 /4, APB2 /1. */
+void Emulator_Init(void);
+
+void Emulator_SetGyroSource(EmulatorSource source, void *context);
+void Emulator_SetAccelerometerSource(EmulatorSource source, void *context);
+void Emulator_SetMagnetometerSource(EmulatorSource source, void *context);
+
+/* Let time pass with the CPU idle, taking interrupts as they come */
+void Emulator_Run(uint32_t us);
+
+/* Run until no transfer is in progress on either bus and no interrupt is
+ * pending, or until timeout_us.  Returns 1 if idle was reached. */
+int Emulator_RunUntilIdle(uint32_t timeout_us);
+
+uint64_t Emulator_Cycles(void);
+double Emulator_Seconds(void);
+
+void Emulator_ResetStats(void);
+void Emulator_GetStats(EmulatorStats *stats);
+
+/* Fault injection: a slave starts holding SDA low, as after a reset in the
+ * middle of a read, until it has seen this many SCL pulses */
+void Emulator_HoldSda(uint32_t pulses);
+
+#endif
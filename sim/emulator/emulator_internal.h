@@ -0,0 +1,106 @@
+#ifndef EMULATOR_INTERNAL_H
+#define EMULATOR_INTERNAL_H
+
+/* Shared between the register core (emulator.c) and the peripheral and
+ * device models, not for the harness. */
+
+#include <stdint.h>
+#include "emulator.h"
+
+#define EMULATOR_NEVER UINT64_MAX
+
+/* Read value of a data register with no received byte in it.  No byte the
+ * driver writes can equal it, so rewriting the previous byte is still seen
+ * as a write.  Truncated to a byte it reads as 0. */
+#define EMULATOR_DR_EMPTY 0xFFFF0000u
+
+typedef struct EmulatorRegister EmulatorRegister;
+
+/* The CPU read the register, or wrote value over previous.  A read-modify-
+ * write that leaves the value unchanged counts as a read only, which is what
+ * every register the drivers use needs: the write would have no effect. */
+typedef void (*EmulatorRead)(EmulatorRegister *reg);
+typedef void (*EmulatorWrite)(EmulatorRegister *reg, uint32_t previous);
+
+struct EmulatorRegister
+{
+    uintptr_t address;
+    volatile unsigned int value;
+    EmulatorRead on_read;
+    EmulatorWrite on_write;
+};
+
+/* Register with side effects.  Addresses that are never mapped are plain
+ * storage, created on first access. */
+EmulatorRegister *Emulator_Map(uintptr_t address, EmulatorRead on_read, EmulatorWrite on_write);
+
+uint64_t Emulator_Now(void);
+EmulatorStats *Emulator_Counters(void);
+
+/* Level of a peripheral interrupt line, see the vector table in RM0383 */
+void Emulator_SetIrqLine(uint32_t irq, int level);
+
+/* Host pointer from the 32 bits the driver stored in a DMA address register.
+ * The buffers are static, in the same 4 GB window as this file's data. */
+void *Emulator_HostPointer(uint32_t address);
+
+/* Recompute the pins the devices see after a line changed: SDA and SCL of
+ * I2C1 in GPIOB_IDR, the gyro chip select */
+void Emulator_UpdatePins(void);
+
+/* --- I2C1, i2c_model.c --- */
+void I2CModel_Init(void);
+uint64_t I2CModel_Due(void);
+void I2CModel_Advance(uint64_t now);
+int I2CModel_Busy(void);
+uint8_t I2CModel_DmaRead(void);
+void I2CModel_ServiceDma(void);
+int I2CModel_SdaLow(void);
+void I2CModel_SclPulse(void);
+void I2CModel_HoldSda(uint32_t pulses);
+
+/* Slave side of the bus, implemented by the device models */
+typedef struct
+{
+    uint8_t address; /* 7 bit */
+    void (*start)(int read);
+    void (*write)(uint8_t byte);
+    uint8_t (*read)(void);
+} I2CSlave;
+
+/* --- SPI1, spi_model.c --- */
+void SpiModel_Init(void);
+uint64_t SpiModel_Due(void);
+void SpiModel_Advance(uint64_t now);
+int SpiModel_Busy(void);
+void SpiModel_Select(int selected);
+uint8_t SpiModel_DmaRead(void);
+void SpiModel_DmaWrite(uint8_t byte);
+void SpiModel_ServiceDma(void);
+
+/* --- DMA streams, dma_model.c --- */
+typedef enum
+{
+    DMA_I2C1_RX, /* DMA1 stream 0 channel 1 */
+    DMA_SPI1_RX, /* DMA2 stream 0 channel 3 */
+    DMA_SPI1_TX, /* DMA2 stream 3 channel 3 */
+    DMA_NUM_REQUESTS
+} DmaRequest;
+
+void DmaModel_Init(void);
+
+/* The peripheral asks for one transfer.  Returns 1 if a stream took it. */
+int DmaModel_Request(DmaRequest request);
+
+/* Transfers left on the stream serving the request, 0 if it is disabled */
+uint32_t DmaModel_Remaining(DmaRequest request);
+
+/* --- Devices --- */
+void Lsm303Model_Init(void);
+const I2CSlave *Lsm303Model_Slave(uint8_t address);
+
+void L3gd20Model_Init(void);
+void L3gd20Model_Select(int selected);
+uint8_t L3gd20Model_Exchange(uint8_t mosi);
+
+#endif
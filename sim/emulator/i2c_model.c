@@ -0,0 +1,523 @@
+#include "RegisterAddresses.h"
+#include "emulator_internal.h"
+
+/* I2C1 in master mode, as RM0383 describes it (section 18): the flags of
+ * SR1/SR2 and how reading and writing the registers clears them, SCL
+ * stretched while the software or the DMA is behind, START and STOP after
+ * the current byte.  Only 7-bit addressing, no slave mode, no PEC. */
+
+#define CR1_PE (1u << 0)
+#define CR1_START (1u << 8)
+#define CR1_STOP (1u << 9)
+#define CR1_ACK (1u << 10)
+#define CR1_SWRST (1u << 15)
+
+#define CR2_ITERREN (1u << 8)
+#define CR2_ITEVTEN (1u << 9)
+#define CR2_ITBUFEN (1u << 10)
+#define CR2_DMAEN (1u << 11)
+#define CR2_LAST (1u << 12)
+
+#define SR1_SB (1u << 0)
+#define SR1_ADDR (1u << 1)
+#define SR1_BTF (1u << 2)
+#define SR1_RXNE (1u << 6)
+#define SR1_TXE (1u << 7)
+#define SR1_AF (1u << 10)
+#define SR1_ERRORS 0xDF00u
+
+#define SR2_MSL (1u << 0)
+#define SR2_BUSY (1u << 1)
+#define SR2_TRA (1u << 2)
+
+#define CCR_FS (1u << 15)
+#define CCR_DUTY (1u << 14)
+
+#define IRQ_EVENT 31
+#define IRQ_ERROR 32
+
+/* Clock periods of a byte with its acknowledge bit, and of a START or STOP */
+#define BYTE_BITS 9
+#define CONDITION_BITS 1
+
+typedef enum
+{
+    PHASE_IDLE,          /* no transfer, or a START waiting for a free bus */
+    PHASE_START,         /* START or repeated START going out */
+    PHASE_SB,            /* SB set, waiting for the address in DR */
+    PHASE_ADDRESS,       /* address byte going out */
+    PHASE_ADDRESSED,     /* ADDR set, SCL stretched until it is cleared */
+    PHASE_TRANSMIT,      /* data byte going out */
+    PHASE_TRANSMIT_WAIT, /* nothing left to send, SCL stretched */
+    PHASE_RECEIVE,       /* data byte coming in */
+    PHASE_RECEIVE_FULL,  /* byte in while DR is still full, SCL stretched */
+    PHASE_NACKED,        /* no acknowledge, waiting for STOP or START */
+    PHASE_STOP           /* STOP going out */
+} Phase;
+
+static EmulatorRegister *cr1;
+static EmulatorRegister *cr2;
+static EmulatorRegister *oar1;
+static EmulatorRegister *dr;
+static EmulatorRegister *sr1;
+static EmulatorRegister *sr2;
+static EmulatorRegister *ccr;
+static EmulatorRegister *trise;
+static EmulatorRegister *rcc_cfgr;
+
+static Phase phase;
+static uint64_t due;
+static const I2CSlave *slave;
+static int reading;
+static uint8_t shift;
+static uint8_t queued;
+static uint8_t held;
+static int held_ack;
+
+/* SR1 was read while SB or ADDR was set, the first half of clearing them */
+static int sb_seen;
+static int addr_seen;
+
+static int transaction_open;
+static uint64_t transaction_start;
+static uint32_t hold_pulses;
+
+/* SCL period in CPU cycles, from CCR and the APB1 prescaler as I2CConfigure()
+ * programs them: Fm Thigh + Tlow = 3 CCR (DUTY 0) or 25 CCR (DUTY 1), Sm
+ * 2 CCR, in PCLK1 periods */
+static uint64_t I2CModel_BitCycles(void)
+{
+    const uint32_t ppre1 = (rcc_cfgr->value >> 10) & 0x7;
+    const uint32_t apb1_divider = ppre1 < 4 ? 1 : 1u << (ppre1 - 3);
+
+    uint32_t c = ccr->value & 0xFFF;
+    if (c == 0)
+        c = 1;
+
+    uint32_t pclk1_periods = 2 * c;
+    if (ccr->value & CCR_FS)
+        pclk1_periods = (ccr->value & CCR_DUTY) ? 25 * c : 3 * c;
+
+    return (uint64_t)pclk1_periods * apb1_divider;
+}
+
+static void I2CModel_After(uint32_t bits)
+{
+    due = Emulator_Now() + bits * I2CModel_BitCycles();
+}
+
+static void I2CModel_Open(void)
+{
+    if (transaction_open)
+        return;
+    transaction_open = 1;
+    transaction_start = Emulator_Now();
+    Emulator_Counters()->i2c.transactions++;
+}
+
+static void I2CModel_Close(void)
+{
+    if (!transaction_open)
+        return;
+    transaction_open = 0;
+    Emulator_Counters()->i2c.busy_cycles += Emulator_Now() - transaction_start;
+}
+
+static void I2CModel_Shift(uint8_t byte)
+{
+    shift = byte;
+    Emulator_Counters()->i2c.bytes++;
+    I2CModel_After(BYTE_BITS);
+}
+
+/* BUSY and the interrupt lines follow the flags */
+static void I2CModel_Update(void)
+{
+    if (transaction_open || hold_pulses)
+        sr2->value |= SR2_BUSY;
+    else
+        sr2->value &= ~SR2_BUSY;
+
+    const uint32_t flags = sr1->value;
+    const uint32_t control = cr2->value;
+    const int event = (control & CR2_ITEVTEN) &&
+                      ((flags & (SR1_SB | SR1_ADDR | SR1_BTF)) ||
+                       ((control & CR2_ITBUFEN) && (flags & (SR1_TXE | SR1_RXNE))));
+    const int error = (control & CR2_ITERREN) && (flags & SR1_ERRORS);
+    Emulator_SetIrqLine(IRQ_EVENT, event);
+    Emulator_SetIrqLine(IRQ_ERROR, error);
+}
+
+/* Between two bytes, with SCL low: a requested STOP goes out first, then a
+ * requested START.  Returns 1 if one did. */
+static int I2CModel_Condition(void)
+{
+    if (cr1->value & CR1_STOP)
+    {
+        phase = PHASE_STOP;
+        I2CModel_After(CONDITION_BITS);
+        return 1;
+    }
+    if (cr1->value & CR1_START)
+    {
+        phase = PHASE_START;
+        I2CModel_After(CONDITION_BITS);
+        return 1;
+    }
+    return 0;
+}
+
+/* START and STOP requests that can go out right away */
+static void I2CModel_Kick(void)
+{
+    switch (phase)
+    {
+    case PHASE_IDLE:
+        if ((cr1->value & CR1_START) && !hold_pulses)
+        {
+            phase = PHASE_START;
+            I2CModel_After(CONDITION_BITS);
+        }
+        else if (cr1->value & CR1_STOP)
+        {
+            cr1->value &= ~CR1_STOP;
+        }
+        break;
+    case PHASE_SB:
+    case PHASE_TRANSMIT_WAIT:
+    case PHASE_NACKED:
+        I2CModel_Condition();
+        break;
+    default:
+        /* After the byte on the bus */
+        break;
+    }
+}
+
+/* A received byte is in: the slave goes on if it was acknowledged */
+static void I2CModel_Received(int ack)
+{
+    if (!ack)
+    {
+        phase = PHASE_NACKED;
+        I2CModel_Condition();
+    }
+    else if (!I2CModel_Condition())
+    {
+        phase = PHASE_RECEIVE;
+        I2CModel_After(BYTE_BITS);
+        Emulator_Counters()->i2c.bytes++;
+    }
+}
+
+/* Second half of clearing RXNE, by the CPU or the DMA reading DR */
+static void I2CModel_DataTaken(void)
+{
+    if (!(sr1->value & SR1_RXNE))
+        return;
+
+    sr1->value &= ~(SR1_RXNE | SR1_BTF);
+    dr->value = EMULATOR_DR_EMPTY;
+    if (phase == PHASE_RECEIVE_FULL)
+    {
+        dr->value = held;
+        sr1->value |= SR1_RXNE;
+        I2CModel_Received(held_ack);
+    }
+}
+
+static void I2CModel_Reset(void)
+{
+    I2CModel_Close();
+    phase = PHASE_IDLE;
+    due = EMULATOR_NEVER;
+    slave = 0;
+    sb_seen = 0;
+    addr_seen = 0;
+    sr1->value = 0;
+    sr2->value = 0;
+    dr->value = EMULATOR_DR_EMPTY;
+}
+
+void I2CModel_Advance(uint64_t now)
+{
+    if (now < due)
+        return;
+    due = EMULATOR_NEVER;
+
+    switch (phase)
+    {
+    case PHASE_START:
+        I2CModel_Open();
+        cr1->value &= ~CR1_START;
+        sr1->value &= ~(SR1_BTF | SR1_TXE);
+        sr1->value |= SR1_SB;
+        sr2->value |= SR2_MSL;
+        sb_seen = 0;
+        phase = PHASE_SB;
+        break;
+
+    case PHASE_ADDRESS:
+        if (slave)
+        {
+            slave->start(reading);
+            sr1->value |= SR1_ADDR;
+            if (reading)
+                sr2->value &= ~SR2_TRA;
+            else
+                sr2->value |= SR2_TRA;
+            addr_seen = 0;
+            phase = PHASE_ADDRESSED;
+        }
+        else
+        {
+            sr1->value |= SR1_AF;
+            phase = PHASE_NACKED;
+            I2CModel_Condition();
+        }
+        break;
+
+    case PHASE_TRANSMIT:
+        slave->write(shift);
+        if (!(sr1->value & SR1_TXE) && !(cr1->value & (CR1_START | CR1_STOP)))
+        {
+            sr1->value |= SR1_TXE;
+            I2CModel_Shift(queued);
+        }
+        else if (!I2CModel_Condition())
+        {
+            sr1->value |= SR1_BTF;
+            phase = PHASE_TRANSMIT_WAIT;
+        }
+        break;
+
+    case PHASE_RECEIVE:
+    {
+        const uint8_t byte = slave->read();
+
+        /* With DMA and LAST the byte of the last transfer is not acknowledged */
+        const int last = (cr2->value & CR2_DMAEN) && (cr2->value & CR2_LAST) &&
+                         DmaModel_Remaining(DMA_I2C1_RX) == 1;
+        const int ack = (cr1->value & CR1_ACK) && !last;
+
+        if (sr1->value & SR1_RXNE)
+        {
+            held = byte;
+            held_ack = ack;
+            sr1->value |= SR1_BTF;
+            phase = PHASE_RECEIVE_FULL;
+            break;
+        }
+
+        dr->value = byte;
+        sr1->value |= SR1_RXNE;
+        I2CModel_Received(ack);
+        I2CModel_ServiceDma();
+        break;
+    }
+
+    case PHASE_STOP:
+        cr1->value &= ~CR1_STOP;
+        sr1->value &= ~(SR1_SB | SR1_ADDR | SR1_BTF | SR1_TXE);
+        sr2->value &= ~(SR2_MSL | SR2_TRA);
+        slave = 0;
+        phase = PHASE_IDLE;
+        I2CModel_Close();
+        I2CModel_Kick();
+        break;
+
+    default:
+        break;
+    }
+
+    I2CModel_Update();
+}
+
+static void I2CModel_Cr1Write(EmulatorRegister *reg, uint32_t previous)
+{
+    const uint32_t value = reg->value;
+
+    /* See SWRST: every register back to its reset value */
+    if (value & CR1_SWRST)
+    {
+        if (!(previous & CR1_SWRST))
+        {
+            I2CModel_Reset();
+            cr1->value = CR1_SWRST;
+            cr2->value = 0;
+            oar1->value = 0;
+            ccr->value = 0;
+            trise->value = 2;
+        }
+    }
+    else if (!(value & CR1_PE))
+    {
+        /* Disabled in the middle of a transfer: it is abandoned */
+        if (previous & CR1_PE)
+            I2CModel_Reset();
+        cr1->value &= ~(CR1_START | CR1_STOP);
+    }
+    else
+    {
+        I2CModel_Kick();
+    }
+
+    I2CModel_Update();
+}
+
+static void I2CModel_Cr2Write(EmulatorRegister *reg, uint32_t previous)
+{
+    (void)reg;
+    (void)previous;
+    I2CModel_ServiceDma();
+    I2CModel_Update();
+}
+
+static void I2CModel_Sr1Read(EmulatorRegister *reg)
+{
+    if (reg->value & SR1_SB)
+        sb_seen = 1;
+    if (reg->value & SR1_ADDR)
+        addr_seen = 1;
+}
+
+/* The error flags are rc_w0: writing 0 clears them, the others are read only */
+static void I2CModel_Sr1Write(EmulatorRegister *reg, uint32_t previous)
+{
+    const uint32_t cleared = previous & ~reg->value & SR1_ERRORS;
+    reg->value = previous & ~cleared;
+    I2CModel_Sr1Read(reg);
+    I2CModel_Update();
+}
+
+/* Reading SR2 after SR1 clears ADDR and lets the transfer go on */
+static void I2CModel_Sr2Read(EmulatorRegister *reg)
+{
+    (void)reg;
+    if (!(sr1->value & SR1_ADDR) || !addr_seen)
+        return;
+
+    sr1->value &= ~SR1_ADDR;
+    addr_seen = 0;
+    if (sr2->value & SR2_TRA)
+    {
+        sr1->value |= SR1_TXE;
+        phase = PHASE_TRANSMIT_WAIT;
+    }
+    else
+    {
+        phase = PHASE_RECEIVE;
+        I2CModel_After(BYTE_BITS);
+        Emulator_Counters()->i2c.bytes++;
+    }
+    I2CModel_Update();
+}
+
+static void I2CModel_Sr2Write(EmulatorRegister *reg, uint32_t previous)
+{
+    /* Read only */
+    reg->value = previous;
+}
+
+static void I2CModel_DrRead(EmulatorRegister *reg)
+{
+    (void)reg;
+    I2CModel_DataTaken();
+    I2CModel_Update();
+}
+
+static void I2CModel_DrWrite(EmulatorRegister *reg, uint32_t previous)
+{
+    (void)previous;
+    const uint8_t byte = (uint8_t)reg->value;
+
+    if ((sr1->value & SR1_SB) && sb_seen)
+    {
+        /* SB is cleared by reading SR1 then writing the address */
+        sr1->value &= ~SR1_SB;
+        sb_seen = 0;
+        slave = Lsm303Model_Slave(byte >> 1);
+        reading = byte & 1;
+        phase = PHASE_ADDRESS;
+        I2CModel_Shift(byte);
+    }
+    else if (phase == PHASE_TRANSMIT_WAIT && (sr1->value & SR1_TXE))
+    {
+        /* Straight into the shift register, DR is empty again */
+        sr1->value &= ~SR1_BTF;
+        phase = PHASE_TRANSMIT;
+        I2CModel_Shift(byte);
+    }
+    else if (phase == PHASE_TRANSMIT && (sr1->value & SR1_TXE))
+    {
+        queued = byte;
+        sr1->value &= ~SR1_TXE;
+    }
+
+    reg->value = EMULATOR_DR_EMPTY;
+    I2CModel_Update();
+}
+
+void I2CModel_Init(void)
+{
+    cr1 = Emulator_Map(I2C1_CR1, 0, I2CModel_Cr1Write);
+    cr2 = Emulator_Map(I2C1_CR2, 0, I2CModel_Cr2Write);
+    oar1 = Emulator_Map(I2C1_OAR1, 0, 0);
+    dr = Emulator_Map(I2C1_DR, I2CModel_DrRead, I2CModel_DrWrite);
+    sr1 = Emulator_Map(I2C1_SR1, I2CModel_Sr1Read, I2CModel_Sr1Write);
+    sr2 = Emulator_Map(I2C1_SR2, I2CModel_Sr2Read, I2CModel_Sr2Write);
+    ccr = Emulator_Map(I2C1_CCR, 0, 0);
+    trise = Emulator_Map(I2C1_TRISE, 0, 0);
+    rcc_cfgr = Emulator_Map(RCC_CFGR, 0, 0);
+
+    transaction_open = 0;
+    hold_pulses = 0;
+    I2CModel_Reset();
+    trise->value = 2;
+    I2CModel_Update();
+}
+
+uint64_t I2CModel_Due(void)
+{
+    return due;
+}
+
+int I2CModel_Busy(void)
+{
+    return phase != PHASE_IDLE || transaction_open || hold_pulses;
+}
+
+uint8_t I2CModel_DmaRead(void)
+{
+    const uint8_t byte = (uint8_t)dr->value;
+    I2CModel_DataTaken();
+    I2CModel_Update();
+    return byte;
+}
+
+void I2CModel_ServiceDma(void)
+{
+    while ((cr2->value & CR2_DMAEN) && (sr1->value & SR1_RXNE) && DmaModel_Request(DMA_I2C1_RX))
+    {
+    }
+}
+
+int I2CModel_SdaLow(void)
+{
+    return hold_pulses != 0;
+}
+
+void I2CModel_SclPulse(void)
+{
+    if (hold_pulses && --hold_pulses == 0)
+    {
+        I2CModel_Kick();
+        I2CModel_Update();
+    }
+}
+
+void I2CModel_HoldSda(uint32_t pulses)
+{
+    hold_pulses = pulses;
+    I2CModel_Update();
+}
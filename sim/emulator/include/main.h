@@ -0,0 +1,15 @@
+#ifndef __MAIN_H
+#define __MAIN_H
+
+/* Host stand-in for Core/Inc/main.h: the drivers only take the interrupt
+ * priorities from it.  Keep them in step with the plan there. */
+
+#include "stm32f4xx.h"
+
+#define IRQ_PRIORITY_CONTROL 0
+#define IRQ_PRIORITY_SENSOR_BUS 1
+#define IRQ_PRIORITY_UART 2
+#define IRQ_PRIORITY_SYSTICK 3
+#define IRQ_PRIORITY_DEFERRED 15
+
+#endif
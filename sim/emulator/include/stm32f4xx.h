@@ -0,0 +1,49 @@
+#ifndef STM32F4XX_H
+#define STM32F4XX_H
+
+/*
+ * Host stand-in for the CMSIS device header, for the drivers built with
+ * PERIPHERAL_EMULATOR.  Only what they use: the cycle counter, PRIMASK, the
+ * barrier and SystemCoreClock, all backed by the emulator's clock and NVIC.
+ */
+
+#include <stdint.h>
+
+typedef struct
+{
+    volatile uint32_t CTRL;
+    volatile uint32_t CYCCNT;
+} DWT_Type;
+
+extern uint32_t SystemCoreClock;
+
+/* Every read of DWT->CYCCNT lets EMULATOR_ACCESS_CYCLES go by */
+DWT_Type *Emulator_Dwt(void);
+#define DWT (Emulator_Dwt())
+
+uint32_t Emulator_GetPrimask(void);
+void Emulator_SetPrimask(uint32_t primask);
+
+static inline uint32_t __get_PRIMASK(void)
+{
+    return Emulator_GetPrimask();
+}
+
+static inline void __set_PRIMASK(uint32_t primask)
+{
+    Emulator_SetPrimask(primask);
+}
+
+static inline void __disable_irq(void)
+{
+    Emulator_SetPrimask(1);
+}
+
+static inline void __enable_irq(void)
+{
+    Emulator_SetPrimask(0);
+}
+
+#define __DMB() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#endif
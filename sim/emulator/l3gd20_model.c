@@ -0,0 +1,200 @@
+#include <math.h>
+#include <string.h>
+#include "emulator_internal.h"
+
+/* L3GD20 behind SPI1: register map, SPI framing (R/W and MS bits of the
+ * first byte), the 32-sample FIFO and the full scales of its datasheet.
+ * Samples come from the source at the programmed output data rate. */
+
+#define WHO_AM_I 0x0F
+#define CTRL_REG1 0x20
+#define CTRL_REG4 0x23
+#define CTRL_REG5 0x24
+#define OUT_X_L 0x28
+#define OUT_Z_H 0x2D
+#define FIFO_CTRL_REG 0x2E
+#define FIFO_SRC_REG 0x2F
+
+#define COMMAND_READ 0x80
+#define COMMAND_INCREMENT 0x40
+
+#define FIFO_DEPTH 32
+
+static uint8_t regs[0x40];
+static int selected;
+static uint32_t frame_bytes;
+static uint8_t pointer;
+static int reading;
+static int increment;
+
+static int16_t fifo[FIFO_DEPTH][3];
+static uint32_t fifo_head;
+static uint32_t fifo_count;
+static int16_t latest[3];
+static uint64_t next_sample;
+
+static EmulatorSource source;
+static void *source_context;
+
+static void L3gd20Model_DefaultRate(double t, double value[3], void *context)
+{
+    (void)t;
+    (void)context;
+    value[0] = 0.0;
+    value[1] = 0.0;
+    value[2] = 0.0;
+}
+
+static int L3gd20Model_FifoEnabled(void)
+{
+    /* FIFO_EN, and a mode other than bypass */
+    return (regs[CTRL_REG5] & (1 << 6)) && (regs[FIFO_CTRL_REG] >> 5) != 0;
+}
+
+static void L3gd20Model_Update(void)
+{
+    /* Normal mode: PD set and at least one axis */
+    if (!(regs[CTRL_REG1] & (1 << 3)) || (regs[CTRL_REG1] & 0x07) == 0)
+    {
+        next_sample = EMULATOR_NEVER;
+        return;
+    }
+
+    static const double rates[] = {95.0, 190.0, 380.0, 760.0};
+    static const double mdps_per_count[] = {8.75, 17.5, 70.0, 70.0};
+    const uint64_t step = (uint64_t)(EMULATOR_CORE_CLOCK_HZ / rates[regs[CTRL_REG1] >> 6]);
+    const double counts_per_rad = 180.0 / M_PI * 1000.0 / mdps_per_count[(regs[CTRL_REG4] >> 4) & 3];
+
+    const uint64_t now = Emulator_Now();
+    if (next_sample == EMULATOR_NEVER)
+        next_sample = now + step;
+
+    while (next_sample <= now)
+    {
+        double rate[3];
+        source((double)next_sample / EMULATOR_CORE_CLOCK_HZ, rate, source_context);
+        for (int i = 0; i < 3; i++)
+        {
+            const double counts = floor(rate[i] * counts_per_rad + 0.5);
+            latest[i] = (int16_t)(counts > 32767.0 ? 32767.0 : counts < -32768.0 ? -32768.0 : counts);
+        }
+        next_sample += step;
+
+        if (!L3gd20Model_FifoEnabled())
+            continue;
+
+        /* Stream mode drops the oldest sample when full, FIFO mode stops */
+        if (fifo_count == FIFO_DEPTH)
+        {
+            if ((regs[FIFO_CTRL_REG] >> 5) != 2)
+                continue;
+            fifo_head = (fifo_head + 1) % FIFO_DEPTH;
+            fifo_count--;
+        }
+        memcpy(fifo[(fifo_head + fifo_count) % FIFO_DEPTH], latest, sizeof(latest));
+        fifo_count++;
+    }
+}
+
+static uint8_t L3gd20Model_Register(uint8_t reg)
+{
+    if (reg >= OUT_X_L && reg <= OUT_Z_H)
+    {
+        const int16_t *sample = latest;
+        if (L3gd20Model_FifoEnabled())
+            sample = fifo_count ? fifo[fifo_head] : latest;
+
+        const uint16_t value = (uint16_t)sample[(reg - OUT_X_L) / 2];
+        const uint8_t byte = (reg & 1) ? (uint8_t)(value >> 8) : (uint8_t)value;
+
+        /* Reading OUT_Z_H pops the sample */
+        if (reg == OUT_Z_H && L3gd20Model_FifoEnabled() && fifo_count)
+        {
+            fifo_head = (fifo_head + 1) % FIFO_DEPTH;
+            fifo_count--;
+        }
+        return byte;
+    }
+
+    if (reg == FIFO_SRC_REG)
+    {
+        /* WTM, OVRN (full), EMPTY, then the number of unread samples */
+        const uint8_t threshold = regs[FIFO_CTRL_REG] & 0x1F;
+        uint8_t value = fifo_count >= FIFO_DEPTH ? (FIFO_DEPTH - 1) : (uint8_t)fifo_count;
+        if (fifo_count > threshold)
+            value |= 1 << 7;
+        if (fifo_count >= FIFO_DEPTH)
+            value |= 1 << 6;
+        if (fifo_count == 0)
+            value |= 1 << 5;
+        return value;
+    }
+
+    return regs[reg];
+}
+
+void L3gd20Model_Select(int select)
+{
+    selected = select;
+    frame_bytes = 0;
+}
+
+/* One byte each way.  The first of a frame is the command, the device
+ * drives nothing back during it. */
+uint8_t L3gd20Model_Exchange(uint8_t mosi)
+{
+    if (!selected)
+        return 0xFF;
+
+    L3gd20Model_Update();
+    if (frame_bytes++ == 0)
+    {
+        reading = (mosi & COMMAND_READ) != 0;
+        increment = (mosi & COMMAND_INCREMENT) != 0;
+        pointer = mosi & 0x3F;
+        return 0xFF;
+    }
+
+    const uint8_t reg = pointer;
+    uint8_t miso = 0xFF;
+    if (reading)
+    {
+        miso = L3gd20Model_Register(reg);
+    }
+    else if (reg >= CTRL_REG1 && reg <= FIFO_CTRL_REG)
+    {
+        regs[reg] = mosi;
+        if (reg == CTRL_REG1)
+            next_sample = EMULATOR_NEVER;
+        if ((reg == CTRL_REG5 || reg == FIFO_CTRL_REG) && !L3gd20Model_FifoEnabled())
+            fifo_count = 0;
+    }
+
+    /* In FIFO mode the address wraps from OUT_Z_H back to OUT_X_L */
+    if (increment)
+        pointer = (reg == OUT_Z_H && L3gd20Model_FifoEnabled()) ? OUT_X_L : (reg + 1) & 0x3F;
+    return miso;
+}
+
+void L3gd20Model_Init(void)
+{
+    memset(regs, 0, sizeof(regs));
+    regs[WHO_AM_I] = 0xD4;
+    regs[CTRL_REG1] = 0x07;
+
+    selected = 0;
+    frame_bytes = 0;
+    fifo_head = 0;
+    fifo_count = 0;
+    memset(latest, 0, sizeof(latest));
+    next_sample = EMULATOR_NEVER;
+
+    if (!source)
+        source = L3gd20Model_DefaultRate;
+}
+
+void Emulator_SetGyroSource(EmulatorSource rate, void *context)
+{
+    source = rate ? rate : L3gd20Model_DefaultRate;
+    source_context = context;
+}
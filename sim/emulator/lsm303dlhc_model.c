@@ -0,0 +1,370 @@
+#include <math.h>
+#include <string.h>
+#include "emulator_internal.h"
+
+/* LSM303DLHC behind I2C1: the accelerometer with its 32-sample FIFO, and the
+ * magnetometer.  Register map and scales from the LSM303DLHC datasheet.
+ * Samples come from the sources at the programmed output data rate, the
+ * device is read as of the time of the access. */
+
+#define ACCELEROMETER_ADDRESS 0x19
+#define MAGNETOMETER_ADDRESS 0x1E
+
+/* Accelerometer registers */
+#define WHO_AM_I_A 0x0F
+#define CTRL_REG1_A 0x20
+#define CTRL_REG4_A 0x23
+#define CTRL_REG5_A 0x24
+#define OUT_X_L_A 0x28
+#define OUT_Z_H_A 0x2D
+#define FIFO_CTRL_REG_A 0x2E
+#define FIFO_SRC_REG_A 0x2F
+
+/* Magnetometer registers */
+#define CRA_REG_M 0x00
+#define CRB_REG_M 0x01
+#define MR_REG_M 0x02
+#define OUT_X_H_M 0x03
+#define OUT_Y_L_M 0x08
+#define IRA_REG_M 0x0A
+
+#define FIFO_DEPTH 32
+
+typedef struct
+{
+    uint8_t regs[0x40];
+    uint8_t pointer;
+    int increment;
+    int expect_pointer;
+} Device;
+
+static Device accelerometer;
+static Device magnetometer;
+
+static int16_t fifo[FIFO_DEPTH][3];
+static uint32_t fifo_head;
+static uint32_t fifo_count;
+static int16_t latest[3];
+static uint64_t accelerometer_next;
+static uint64_t magnetometer_next;
+
+static EmulatorSource accelerometer_source;
+static void *accelerometer_context;
+static EmulatorSource magnetometer_source;
+static void *magnetometer_context;
+
+static void Lsm303Model_DefaultAcceleration(double t, double value[3], void *context)
+{
+    (void)t;
+    (void)context;
+    value[0] = 0.0;
+    value[1] = 0.0;
+    value[2] = 1.0;
+}
+
+static void Lsm303Model_DefaultField(double t, double value[3], void *context)
+{
+    (void)t;
+    (void)context;
+    value[0] = 0.2;
+    value[1] = 0.0;
+    value[2] = 0.4;
+}
+
+static int16_t Lsm303Model_Quantize(double counts, double limit)
+{
+    const double rounded = floor(counts + 0.5);
+    return (int16_t)(rounded > limit - 1 ? limit - 1 : rounded < -limit ? -limit : rounded);
+}
+
+static double Lsm303Model_Period(const double *rates, uint32_t count, uint32_t index)
+{
+    if (index >= count || rates[index] == 0.0)
+        return 0.0;
+    return 1.0 / rates[index];
+}
+
+/* --- Accelerometer --- */
+
+/* CTRL_REG1_A ODR bits, Hz */
+static const double accelerometer_rates[] = {0, 1, 10, 25, 50, 100, 200, 400, 1620, 1344};
+
+static double Lsm303Model_AccelerometerPeriod(void)
+{
+    return Lsm303Model_Period(accelerometer_rates, 10, accelerometer.regs[CTRL_REG1_A] >> 4);
+}
+
+/* Left-justified 12 bits in high resolution mode, 10 bits otherwise, at
+ * 1/2/4/12 mg per 12-bit digit for +-2/4/8/16 g */
+static void Lsm303Model_AccelerometerConvert(const double g[3], int16_t out[3])
+{
+    static const double mg_per_digit[] = {1.0, 2.0, 4.0, 12.0};
+    const uint8_t ctrl4 = accelerometer.regs[CTRL_REG4_A];
+    const int high_resolution = (ctrl4 >> 3) & 1;
+    const int bits = high_resolution ? 12 : 10;
+    const double digit = mg_per_digit[(ctrl4 >> 4) & 3] * (high_resolution ? 1.0 : 4.0);
+
+    for (int i = 0; i < 3; i++)
+    {
+        const int16_t value = Lsm303Model_Quantize(g[i] * 1000.0 / digit, (double)(1 << (bits - 1)));
+        out[i] = (int16_t)(value * (1 << (16 - bits)));
+    }
+}
+
+static int Lsm303Model_FifoEnabled(void)
+{
+    /* FIFO_EN, and a mode other than bypass */
+    return (accelerometer.regs[CTRL_REG5_A] & (1 << 6)) && (accelerometer.regs[FIFO_CTRL_REG_A] >> 6) != 0;
+}
+
+static void Lsm303Model_AccelerometerUpdate(void)
+{
+    const double period = Lsm303Model_AccelerometerPeriod();
+    if (period == 0.0 || (accelerometer.regs[CTRL_REG1_A] & 0x07) == 0)
+    {
+        accelerometer_next = EMULATOR_NEVER;
+        return;
+    }
+
+    const uint64_t now = Emulator_Now();
+    const uint64_t step = (uint64_t)(period * EMULATOR_CORE_CLOCK_HZ);
+    if (accelerometer_next == EMULATOR_NEVER)
+        accelerometer_next = now + step;
+
+    while (accelerometer_next <= now)
+    {
+        double g[3];
+        accelerometer_source((double)accelerometer_next / EMULATOR_CORE_CLOCK_HZ, g, accelerometer_context);
+        Lsm303Model_AccelerometerConvert(g, latest);
+        accelerometer_next += step;
+
+        if (!Lsm303Model_FifoEnabled())
+            continue;
+
+        /* Stream mode drops the oldest sample when full, FIFO mode stops */
+        if (fifo_count == FIFO_DEPTH)
+        {
+            if ((accelerometer.regs[FIFO_CTRL_REG_A] >> 6) != 2)
+                continue;
+            fifo_head = (fifo_head + 1) % FIFO_DEPTH;
+            fifo_count--;
+        }
+        memcpy(fifo[(fifo_head + fifo_count) % FIFO_DEPTH], latest, sizeof(latest));
+        fifo_count++;
+    }
+}
+
+static uint8_t Lsm303Model_AccelerometerRegister(uint8_t reg)
+{
+    if (reg >= OUT_X_L_A && reg <= OUT_Z_H_A)
+    {
+        const int16_t *sample = latest;
+        if (Lsm303Model_FifoEnabled())
+            sample = fifo_count ? fifo[fifo_head] : latest;
+
+        const uint16_t value = (uint16_t)sample[(reg - OUT_X_L_A) / 2];
+        const uint8_t byte = (reg & 1) ? (uint8_t)(value >> 8) : (uint8_t)value;
+
+        /* Reading OUT_Z_H_A pops the sample */
+        if (reg == OUT_Z_H_A && Lsm303Model_FifoEnabled() && fifo_count)
+        {
+            fifo_head = (fifo_head + 1) % FIFO_DEPTH;
+            fifo_count--;
+        }
+        return byte;
+    }
+
+    if (reg == FIFO_SRC_REG_A)
+    {
+        /* WTM, OVRN (full), EMPTY, then the number of unread samples */
+        const uint8_t threshold = accelerometer.regs[FIFO_CTRL_REG_A] & 0x1F;
+        uint8_t source = fifo_count >= FIFO_DEPTH ? (FIFO_DEPTH - 1) : (uint8_t)fifo_count;
+        if (fifo_count > threshold)
+            source |= 1 << 7;
+        if (fifo_count >= FIFO_DEPTH)
+            source |= 1 << 6;
+        if (fifo_count == 0)
+            source |= 1 << 5;
+        return source;
+    }
+
+    return accelerometer.regs[reg & 0x3F];
+}
+
+static void Lsm303Model_AccelerometerStart(int read)
+{
+    Lsm303Model_AccelerometerUpdate();
+    accelerometer.expect_pointer = !read;
+}
+
+/* The first byte written is the sub-address, its MSB asks for auto-increment */
+static void Lsm303Model_AccelerometerWrite(uint8_t byte)
+{
+    Lsm303Model_AccelerometerUpdate();
+    if (accelerometer.expect_pointer)
+    {
+        accelerometer.pointer = byte & 0x7F;
+        accelerometer.increment = byte >> 7;
+        accelerometer.expect_pointer = 0;
+        return;
+    }
+
+    const uint8_t reg = accelerometer.pointer & 0x3F;
+    if (reg >= CTRL_REG1_A && reg <= FIFO_CTRL_REG_A)
+    {
+        accelerometer.regs[reg] = byte;
+        if (reg == CTRL_REG1_A)
+            accelerometer_next = EMULATOR_NEVER;
+        if ((reg == CTRL_REG5_A || reg == FIFO_CTRL_REG_A) && !Lsm303Model_FifoEnabled())
+            fifo_count = 0;
+    }
+    if (accelerometer.increment)
+        accelerometer.pointer++;
+}
+
+static uint8_t Lsm303Model_AccelerometerRead(void)
+{
+    Lsm303Model_AccelerometerUpdate();
+    const uint8_t reg = accelerometer.pointer & 0x3F;
+    const uint8_t byte = Lsm303Model_AccelerometerRegister(reg);
+
+    /* In FIFO mode the address wraps from OUT_Z_H_A back to OUT_X_L_A */
+    if (accelerometer.increment)
+        accelerometer.pointer = (reg == OUT_Z_H_A && Lsm303Model_FifoEnabled()) ? OUT_X_L_A : reg + 1;
+    return byte;
+}
+
+/* --- Magnetometer --- */
+
+/* CRA_REG_M DO bits, Hz */
+static const double magnetometer_rates[] = {0.75, 1.5, 3.0, 7.5, 15.0, 30.0, 75.0, 220.0};
+
+static void Lsm303Model_MagnetometerUpdate(void)
+{
+    /* Continuous conversion only */
+    if ((magnetometer.regs[MR_REG_M] & 0x03) != 0)
+    {
+        magnetometer_next = EMULATOR_NEVER;
+        return;
+    }
+
+    const uint64_t now = Emulator_Now();
+    const double period = Lsm303Model_Period(magnetometer_rates, 8, (magnetometer.regs[CRA_REG_M] >> 2) & 0x7);
+    const uint64_t step = (uint64_t)(period * EMULATOR_CORE_CLOCK_HZ);
+    if (magnetometer_next == EMULATOR_NEVER)
+        magnetometer_next = now + step;
+    if (magnetometer_next > now)
+        return;
+
+    /* Only the newest conversion is kept */
+    magnetometer_next += (now - magnetometer_next) / step * step;
+    double gauss[3];
+    magnetometer_source((double)magnetometer_next / EMULATOR_CORE_CLOCK_HZ, gauss, magnetometer_context);
+    magnetometer_next += step;
+
+    /* LSB per gauss for GN 1 to 7, X/Y then Z */
+    static const double xy_gain[] = {1100, 1100, 855, 670, 450, 400, 330, 230};
+    static const double z_gain[] = {980, 980, 760, 600, 400, 355, 295, 205};
+    const uint32_t gain = magnetometer.regs[CRB_REG_M] >> 5;
+    const int16_t x = Lsm303Model_Quantize(gauss[0] * xy_gain[gain], 2048.0);
+    const int16_t y = Lsm303Model_Quantize(gauss[1] * xy_gain[gain], 2048.0);
+    const int16_t z = Lsm303Model_Quantize(gauss[2] * z_gain[gain], 2048.0);
+
+    /* OUT_X_H_M, OUT_X_L_M, OUT_Z_H_M, OUT_Z_L_M, OUT_Y_H_M, OUT_Y_L_M, big-endian */
+    const int16_t order[3] = {x, z, y};
+    for (int i = 0; i < 3; i++)
+    {
+        magnetometer.regs[OUT_X_H_M + 2 * i] = (uint8_t)((uint16_t)order[i] >> 8);
+        magnetometer.regs[OUT_X_H_M + 2 * i + 1] = (uint8_t)order[i];
+    }
+}
+
+static void Lsm303Model_MagnetometerStart(int read)
+{
+    Lsm303Model_MagnetometerUpdate();
+    magnetometer.expect_pointer = !read;
+}
+
+/* The magnetometer always increments its address */
+static void Lsm303Model_MagnetometerWrite(uint8_t byte)
+{
+    if (magnetometer.expect_pointer)
+    {
+        magnetometer.pointer = byte;
+        magnetometer.expect_pointer = 0;
+        return;
+    }
+
+    if (magnetometer.pointer <= MR_REG_M)
+    {
+        magnetometer.regs[magnetometer.pointer] = byte;
+        magnetometer_next = EMULATOR_NEVER;
+    }
+    magnetometer.pointer++;
+}
+
+static uint8_t Lsm303Model_MagnetometerRead(void)
+{
+    const uint8_t reg = magnetometer.pointer;
+    const uint8_t byte = reg < sizeof(magnetometer.regs) ? magnetometer.regs[reg] : 0;
+    magnetometer.pointer = (reg == OUT_Y_L_M) ? OUT_X_H_M : reg + 1;
+    return byte;
+}
+
+static const I2CSlave slaves[] = {
+    {ACCELEROMETER_ADDRESS, Lsm303Model_AccelerometerStart, Lsm303Model_AccelerometerWrite,
+     Lsm303Model_AccelerometerRead},
+    {MAGNETOMETER_ADDRESS, Lsm303Model_MagnetometerStart, Lsm303Model_MagnetometerWrite,
+     Lsm303Model_MagnetometerRead},
+};
+
+const I2CSlave *Lsm303Model_Slave(uint8_t address)
+{
+    for (uint32_t i = 0; i < sizeof(slaves) / sizeof(slaves[0]); i++)
+    {
+        if (slaves[i].address == address)
+            return &slaves[i];
+    }
+    return 0;
+}
+
+void Lsm303Model_Init(void)
+{
+    memset(&accelerometer, 0, sizeof(accelerometer));
+    memset(&magnetometer, 0, sizeof(magnetometer));
+
+    /* Not in the LSM303DLHC datasheet, but the part answers 0x33 like the
+     * LSM303D's WHO_AM_I, and the driver checks for it */
+    accelerometer.regs[WHO_AM_I_A] = 0x33;
+    accelerometer.regs[CTRL_REG1_A] = 0x07;
+
+    magnetometer.regs[CRA_REG_M] = 0x10;
+    magnetometer.regs[CRB_REG_M] = 0x20;
+    magnetometer.regs[MR_REG_M] = 0x03;
+    magnetometer.regs[IRA_REG_M] = 'H';
+    magnetometer.regs[IRA_REG_M + 1] = '4';
+    magnetometer.regs[IRA_REG_M + 2] = '3';
+
+    fifo_head = 0;
+    fifo_count = 0;
+    memset(latest, 0, sizeof(latest));
+    accelerometer_next = EMULATOR_NEVER;
+    magnetometer_next = EMULATOR_NEVER;
+
+    if (!accelerometer_source)
+        accelerometer_source = Lsm303Model_DefaultAcceleration;
+    if (!magnetometer_source)
+        magnetometer_source = Lsm303Model_DefaultField;
+}
+
+void Emulator_SetAccelerometerSource(EmulatorSource source, void *context)
+{
+    accelerometer_source = source ? source : Lsm303Model_DefaultAcceleration;
+    accelerometer_context = context;
+}
+
+void Emulator_SetMagnetometerSource(EmulatorSource source, void *context)
+{
+    magnetometer_source = source ? source : Lsm303Model_DefaultField;
+    magnetometer_context = context;
+}
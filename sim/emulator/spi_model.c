@@ -0,0 +1,208 @@
+#include "RegisterAddresses.h"
+#include "emulator_internal.h"
+
+/* SPI1 in full-duplex master mode, 8-bit frames (RM0383 section 20): one
+ * byte in the shift register and one waiting in DR, RXNE/TXE/BSY/OVR, and
+ * the DMA requests of CR2.  The device on the other end is the L3GD20,
+ * selected by PE3. */
+
+#define CR1_BR_SHIFT 3
+#define CR1_SPE (1u << 6)
+
+#define CR2_RXDMAEN (1u << 0)
+#define CR2_TXDMAEN (1u << 1)
+
+#define SR_RXNE (1u << 0)
+#define SR_TXE (1u << 1)
+#define SR_OVR (1u << 6)
+#define SR_BSY (1u << 7)
+
+static EmulatorRegister *cr1;
+static EmulatorRegister *cr2;
+static EmulatorRegister *sr;
+static EmulatorRegister *dr;
+static EmulatorRegister *rcc_cfgr;
+
+static uint64_t due;
+static int shifting;
+static uint8_t shift;
+static uint8_t queued;
+
+static int selected;
+static uint64_t select_start;
+
+/* A byte is 8 SCK periods of 2^(BR + 1) PCLK2 periods */
+static uint64_t SpiModel_ByteCycles(void)
+{
+    const uint32_t ppre2 = (rcc_cfgr->value >> 13) & 0x7;
+    const uint32_t apb2_divider = ppre2 < 4 ? 1 : 1u << (ppre2 - 3);
+    const uint32_t baud_divider = 2u << ((cr1->value >> CR1_BR_SHIFT) & 0x7);
+    return 8ull * baud_divider * apb2_divider;
+}
+
+static void SpiModel_Start(uint8_t byte)
+{
+    shifting = 1;
+    shift = byte;
+    sr->value |= SR_BSY;
+    due = Emulator_Now() + SpiModel_ByteCycles();
+    Emulator_Counters()->spi.bytes++;
+}
+
+static void SpiModel_Transmit(uint8_t byte)
+{
+    if (!(cr1->value & CR1_SPE) || !(sr->value & SR_TXE))
+        return;
+
+    if (!shifting)
+    {
+        SpiModel_Start(byte);
+    }
+    else
+    {
+        queued = byte;
+        sr->value &= ~SR_TXE;
+    }
+}
+
+static void SpiModel_Received(void)
+{
+    sr->value &= ~SR_RXNE;
+    dr->value = EMULATOR_DR_EMPTY;
+}
+
+void SpiModel_ServiceDma(void)
+{
+    for (;;)
+    {
+        if ((cr2->value & CR2_RXDMAEN) && (sr->value & SR_RXNE) && DmaModel_Request(DMA_SPI1_RX))
+            continue;
+        if ((cr2->value & CR2_TXDMAEN) && (sr->value & SR_TXE) && DmaModel_Request(DMA_SPI1_TX))
+            continue;
+        break;
+    }
+}
+
+void SpiModel_Advance(uint64_t now)
+{
+    if (!shifting || now < due)
+        return;
+
+    const uint8_t miso = selected ? L3gd20Model_Exchange(shift) : 0xFF;
+
+    /* A byte that arrives with RXNE still set is lost */
+    if (sr->value & SR_RXNE)
+    {
+        sr->value |= SR_OVR;
+    }
+    else
+    {
+        dr->value = miso;
+        sr->value |= SR_RXNE;
+    }
+
+    shifting = 0;
+    due = EMULATOR_NEVER;
+    sr->value &= ~SR_BSY;
+    if (!(sr->value & SR_TXE))
+    {
+        sr->value |= SR_TXE;
+        SpiModel_Start(queued);
+    }
+
+    SpiModel_ServiceDma();
+}
+
+static void SpiModel_Cr1Write(EmulatorRegister *reg, uint32_t previous)
+{
+    (void)previous;
+    if (!(reg->value & CR1_SPE))
+    {
+        shifting = 0;
+        due = EMULATOR_NEVER;
+        sr->value = (sr->value | SR_TXE) & ~SR_BSY;
+    }
+}
+
+static void SpiModel_Cr2Write(EmulatorRegister *reg, uint32_t previous)
+{
+    (void)reg;
+    (void)previous;
+    SpiModel_ServiceDma();
+}
+
+static void SpiModel_SrWrite(EmulatorRegister *reg, uint32_t previous)
+{
+    /* Read only */
+    reg->value = previous;
+}
+
+static void SpiModel_DrRead(EmulatorRegister *reg)
+{
+    (void)reg;
+    if (sr->value & SR_RXNE)
+        SpiModel_Received();
+}
+
+static void SpiModel_DrWrite(EmulatorRegister *reg, uint32_t previous)
+{
+    (void)previous;
+    const uint8_t byte = (uint8_t)reg->value;
+    reg->value = (sr->value & SR_RXNE) ? previous : EMULATOR_DR_EMPTY;
+    SpiModel_Transmit(byte);
+}
+
+void SpiModel_Init(void)
+{
+    cr1 = Emulator_Map(SPI1_CR1, 0, SpiModel_Cr1Write);
+    cr2 = Emulator_Map(SPI1_CR2, 0, SpiModel_Cr2Write);
+    sr = Emulator_Map(SPI1_SR, 0, SpiModel_SrWrite);
+    dr = Emulator_Map(SPI1_DR, SpiModel_DrRead, SpiModel_DrWrite);
+    rcc_cfgr = Emulator_Map(RCC_CFGR, 0, 0);
+
+    sr->value = SR_TXE;
+    dr->value = EMULATOR_DR_EMPTY;
+    due = EMULATOR_NEVER;
+    shifting = 0;
+    selected = 0;
+}
+
+uint64_t SpiModel_Due(void)
+{
+    return shifting ? due : EMULATOR_NEVER;
+}
+
+int SpiModel_Busy(void)
+{
+    return shifting || selected;
+}
+
+/* A transaction is one chip select low to high */
+void SpiModel_Select(int select)
+{
+    EmulatorBusStats *bus = &Emulator_Counters()->spi;
+    if (select && !selected)
+    {
+        select_start = Emulator_Now();
+        bus->transactions++;
+    }
+    else if (!select && selected)
+    {
+        bus->busy_cycles += Emulator_Now() - select_start;
+    }
+
+    selected = select;
+    L3gd20Model_Select(select);
+}
+
+uint8_t SpiModel_DmaRead(void)
+{
+    const uint8_t byte = (uint8_t)dr->value;
+    SpiModel_Received();
+    return byte;
+}
+
+void SpiModel_DmaWrite(uint8_t byte)
+{
+    SpiModel_Transmit(byte);
+}
@@ -0,0 +1,69 @@
+#include "esc.h"
+#include "dshot.h"
+
+/* 5-bit code of every nibble, no more than two zeros in a row */
+static const uint8_t gcr_encode[16] = {
+    0x19, 0x1B, 0x12, 0x13, 0x1D, 0x15, 0x16, 0x17, 0x1A, 0x09, 0x0A, 0x0B, 0x1E, 0x0D, 0x0E, 0x0F};
+
+/* Longest period of the reply: a 9-bit mantissa shifted by up to 7 */
+#define ESC_PERIOD_MAX (0x1FFu << 7)
+
+static uint32_t Esc_Checksum(uint32_t value)
+{
+    return (value ^ (value >> 4) ^ (value >> 8)) & 0xF;
+}
+
+int Esc_Command(uint16_t frame, int inverted, float command_max, float *command)
+{
+    const uint32_t data = frame >> 4;
+    const uint32_t checksum = inverted ? ~Esc_Checksum(data) & 0xF : Esc_Checksum(data);
+    if ((frame & 0xF) != checksum)
+        return 0;
+
+    const uint32_t value = data >> 1;
+    *command = value < DSHOT_THROTTLE_MIN
+                   ? 0.0f
+                   : (float)(value - DSHOT_THROTTLE_MIN) * command_max / (float)(DSHOT_THROTTLE_MAX - DSHOT_THROTTLE_MIN);
+    return 1;
+}
+
+// One electrical revolution per period, poles / 2 of them per turn
+uint32_t Esc_Period(float rpm, uint32_t poles)
+{
+    if (!(rpm > 0.0f))
+        return DSHOT_PERIOD_STOPPED;
+    const float period_us = 60e6f / (rpm * (float)(poles / 2));
+    if (period_us >= (float)ESC_PERIOD_MAX)
+        return DSHOT_PERIOD_STOPPED;
+    return (uint32_t)(period_us + 0.5f);
+}
+
+uint32_t Esc_Reply(uint32_t period_us)
+{
+    // Smallest exponent that fits the period in the mantissa, all ones for a
+    // stopped motor
+    uint32_t data = 0xFFF;
+    if (period_us <= ESC_PERIOD_MAX)
+    {
+        uint32_t exponent = 0;
+        while ((period_us >> exponent) > 0x1FF)
+            exponent++;
+        data = (exponent << 9) | (period_us >> exponent);
+    }
+    const uint32_t value = (data << 4) | (~Esc_Checksum(data) & 0xF);
+
+    uint32_t gcr = 0;
+    for (int shift = 12; shift >= 0; shift -= 4)
+        gcr = (gcr << 5) | gcr_encode[(value >> shift) & 0xF];
+
+    // The reply starts low, every 1 of the GCR word changes the level of the
+    // next bit
+    uint32_t levels = 1u << (DSHOT_REPLY_BITS - 1);
+    uint32_t level = 1;
+    for (int bit = DSHOT_REPLY_BITS - 2; bit >= 0; bit--)
+    {
+        level ^= (gcr >> bit) & 1;
+        levels |= level << bit;
+    }
+    return levels;
+}
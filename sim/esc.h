@@ -0,0 +1,26 @@
+#ifndef ESC_H
+#define ESC_H
+
+#include <stdint.h>
+
+/*
+ * The ESC end of a bidirectional DShot link, for the simulator and the tests
+ * of dshot.c: the decoding of the frames the firmware sends and the encoding
+ * of the eRPM replies it reads back, bit for bit as an ESC does them.
+ */
+
+/* Motor command of a frame, in [0, command_max] like the one given to
+ * Dshot_Throttle().  The values below DSHOT_THROTTLE_MIN, stop and ESC
+ * commands, leave the motor stopped.  Returns 0, and an ESC ignores the
+ * frame, if the checksum is wrong. */
+int Esc_Command(uint16_t frame, int inverted, float command_max, float *command);
+
+/* Electrical period in us of a motor at rpm, DSHOT_PERIOD_STOPPED when it is
+ * too slow for the reply to carry */
+uint32_t Esc_Period(float rpm, uint32_t poles);
+
+/* The 21 levels of the reply for an electrical period, 1 for low, first one
+ * most significant: the value Dshot_Levels() reads off the line */
+uint32_t Esc_Reply(uint32_t period_us);
+
+#endif
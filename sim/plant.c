@@ -0,0 +1,288 @@
+#include <math.h>
+#include "plant.h"
+#include "model.h"
+
+#define STANDARD_GRAVITY 9.81f
+
+/* The FIFOs of both sensors hold 32 samples, the oldest ones are overwritten
+ * in stream mode */
+#define FIFO_DEPTH 32
+
+#define MOTOR_COMMAND_MAX 1000.0f
+
+void Plant_DefaultParams(PlantParams *p)
+{
+    p->length_m = L;
+    p->inertia = J;
+    p->damping = 0.01f;
+
+    // 10 N of thrust over the command range, the imbalance is what ARM_BIAS
+    // (control.c) holds level
+    p->thrust_per_command = 0.01f;
+    p->thrust_quadratic = 0.0f;
+    p->imbalance_nm = 90.0f * p->thrust_per_command * L;
+    p->stop_deg = 45.0f;
+    p->motor_tau_s = 0.03f;
+    p->rpm_per_sqrt_n = 6000.0f;
+    p->esc_rate_hz = 1000.0f; // DShot, one frame per control tick
+
+    // L3GD20 at 760 Hz and 250 dps, 8.75 mdps per count
+    p->gyro_odr_hz = 760.0f;
+    p->gyro_bandwidth_hz = 30.0f;
+    p->gyro_noise = 0.003f;
+    p->gyro_bias = 0.01f;
+    p->gyro_lsb = 0.00875f * 3.14159265f / 180.0f;
+
+    // LSM303DLHC at 400 Hz and 2 g: 1 mg per 12 bit count, left aligned
+    p->accelerometer_odr_hz = 400.0f;
+    p->accelerometer_noise = 0.005f;
+    p->accelerometer_bias = 0.01f;
+    p->accelerometer_counts_per_g = 16000.0f;
+    p->accelerometer_radius_m = 0.05f;
+
+    p->seed = 1;
+}
+
+// xorshift64*
+static uint64_t Plant_Random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// Standard normal deviate, Box-Muller
+static float Plant_Gaussian(uint64_t *state)
+{
+    const double u1 = ((Plant_Random(state) >> 11) + 1.0) / 9007199254740993.0;
+    const double u2 = (Plant_Random(state) >> 11) / 9007199254740992.0;
+    return (float)(sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2));
+}
+
+static short Plant_Quantize(float value)
+{
+    const float counts = roundf(value);
+    if (counts > 32767.0f)
+        return 32767;
+    if (counts < -32768.0f)
+        return -32768;
+    return (short)counts;
+}
+
+// As Motor_Write(): the command is clamped to the range, the pulse width
+// resolution of the timer is well below the noise of the thrust
+void Plant_SetCommand(Plant *plant, uint32_t lane, float left, float right)
+{
+    const float commands[2] = {left, right};
+    for (int i = 0; i < 2; i++)
+    {
+        float command = commands[i];
+        command = command < 0.0f ? 0.0f : command;
+        plant->command[i][lane] = command > MOTOR_COMMAND_MAX ? MOTOR_COMMAND_MAX : command;
+    }
+}
+
+void Plant_Init(Plant *plant, const PlantParams *params, uint32_t lanes, float theta,
+                const float *left, const float *right)
+{
+    *plant = (Plant){0};
+    plant->lanes = lanes < PLANT_LANES ? lanes : PLANT_LANES;
+
+    for (uint32_t k = 0; k < plant->lanes; k++)
+    {
+        const PlantParams *p = &params[k];
+        plant->p[k] = *p;
+        plant->length_m[k] = p->length_m;
+        plant->inverse_inertia[k] = 1.0f / p->inertia;
+        plant->damping[k] = p->damping;
+        plant->imbalance_nm[k] = p->imbalance_nm;
+        plant->stop_rad[k] = p->stop_deg * (3.14159265f / 180.0f);
+        plant->thrust_per_command[k] = p->thrust_per_command;
+        plant->thrust_quadratic[k] = p->thrust_quadratic;
+        plant->motor_tau_s[k] = p->motor_tau_s;
+        plant->gyro_wc[k] = 2.0f * 3.14159265f * p->gyro_bandwidth_hz;
+
+        plant->theta[k] = theta;
+        plant->rng[k] = p->seed ? p->seed : 1;
+
+        Plant_SetCommand(plant, k, left[k], right[k]);
+        for (int i = 0; i < 2; i++)
+        {
+            plant->latched[i][k] = plant->command[i][k];
+            plant->thrust[i][k] = plant->command[i][k] * (p->thrust_per_command + p->thrust_quadratic * plant->command[i][k]);
+        }
+    }
+
+    plant->next_gyro = 1.0 / params[0].gyro_odr_hz;
+    plant->next_accelerometer = 1.0 / params[0].accelerometer_odr_hz;
+}
+
+static void Plant_SampleGyro(Plant *plant)
+{
+    if (plant->gyro_count == FIFO_DEPTH)
+    {
+        // Overwrite the oldest sample, approximated by one of the average
+        for (uint32_t k = 0; k < plant->lanes; k++)
+            plant->gyro_sum[k] -= plant->gyro_sum[k] / FIFO_DEPTH;
+        plant->gyro_count--;
+    }
+
+    for (uint32_t k = 0; k < plant->lanes; k++)
+    {
+        const PlantParams *p = &plant->p[k];
+        const float rate = plant->gyro_filtered[k] + p->gyro_bias + p->gyro_noise * Plant_Gaussian(&plant->rng[k]);
+        plant->gyro_sum[k] += Plant_Quantize(rate / p->gyro_lsb);
+    }
+    plant->gyro_count++;
+}
+
+static void Plant_SampleAccelerometer(Plant *plant)
+{
+    if (plant->accelerometer_count == FIFO_DEPTH)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            for (uint32_t k = 0; k < plant->lanes; k++)
+                plant->accelerometer_sum[i][k] -= plant->accelerometer_sum[i][k] / FIFO_DEPTH;
+        }
+        plant->accelerometer_count--;
+    }
+
+    for (uint32_t k = 0; k < plant->lanes; k++)
+    {
+        const PlantParams *p = &plant->p[k];
+        const float r = p->accelerometer_radius_m;
+
+        // Specific force in the sensor frame, x along the arm and z up when level.
+        // Gravity gives theta = atan2(x, z), the arm rotation adds the centripetal
+        // (toward the pivot) and tangential accelerations of the sensor.
+        float f[3];
+        f[0] = sinf(plant->theta[k]) + (-r * plant->omega[k] * plant->omega[k]) / STANDARD_GRAVITY;
+        f[1] = 0.0f;
+        f[2] = cosf(plant->theta[k]) + (r * plant->alpha[k]) / STANDARD_GRAVITY;
+        f[0] += p->accelerometer_bias;
+
+        for (int i = 0; i < 3; i++)
+        {
+            const float g = f[i] + p->accelerometer_noise * Plant_Gaussian(&plant->rng[k]);
+            plant->accelerometer_sum[i][k] += Plant_Quantize(g * p->accelerometer_counts_per_g);
+        }
+    }
+    plant->accelerometer_count++;
+}
+
+// Semi-implicit Euler step of the arms, the motors and the gyro low-pass, one
+// lane after the other in each loop so the compiler can vectorize them
+static void Plant_Step(Plant *plant, float dt)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        for (uint32_t k = 0; k < plant->lanes; k++)
+        {
+            const float command = plant->latched[i][k];
+            const float target = command * (plant->thrust_per_command[k] + plant->thrust_quadratic[k] * command);
+            plant->thrust[i][k] += (target - plant->thrust[i][k]) * (dt / (plant->motor_tau_s[k] + dt));
+        }
+    }
+
+    for (uint32_t k = 0; k < plant->lanes; k++)
+    {
+        const float torque = plant->length_m[k] * (plant->thrust[0][k] - plant->thrust[1][k]) -
+                             plant->damping[k] * plant->omega[k] -
+                             plant->imbalance_nm[k] * cosf(plant->theta[k]) +
+                             plant->disturbance_nm[k];
+        plant->alpha[k] = torque * plant->inverse_inertia[k];
+        plant->omega[k] += plant->alpha[k] * dt;
+        plant->theta[k] += plant->omega[k] * dt;
+
+        // A stop takes all the momentum toward it and holds the arm while the
+        // torque pushes on it
+        const float stop = plant->stop_rad[k];
+        const int on_stop = (plant->theta[k] >= stop && plant->omega[k] >= 0.0f) ||
+                            (plant->theta[k] <= -stop && plant->omega[k] <= 0.0f);
+        plant->theta[k] = plant->theta[k] > stop ? stop : plant->theta[k] < -stop ? -stop : plant->theta[k];
+        plant->omega[k] = on_stop ? 0.0f : plant->omega[k];
+        plant->alpha[k] = on_stop ? 0.0f : plant->alpha[k];
+
+        const float wc = plant->gyro_wc[k];
+        plant->gyro_filtered[k] += (plant->omega[k] - plant->gyro_filtered[k]) * (wc * dt / (1.0f + wc * dt));
+    }
+}
+
+void Plant_Advance(Plant *plant, double t, double step_s)
+{
+    const PlantParams *p = &plant->p[0];
+
+    while (plant->t < t)
+    {
+        // Stop at the next event so every sample and frame lands on its time
+        double next = plant->t + step_s;
+        next = next < t ? next : t;
+        next = next < plant->next_esc ? next : plant->next_esc;
+        next = next < plant->next_gyro ? next : plant->next_gyro;
+        next = next < plant->next_accelerometer ? next : plant->next_accelerometer;
+        if (next > plant->t)
+        {
+            Plant_Step(plant, (float)(next - plant->t));
+            plant->t = next;
+        }
+
+        if (plant->t >= plant->next_esc)
+        {
+            for (int i = 0; i < 2; i++)
+            {
+                for (uint32_t k = 0; k < plant->lanes; k++)
+                    plant->latched[i][k] = plant->command[i][k];
+            }
+            plant->next_esc += 1.0 / p->esc_rate_hz;
+        }
+        if (plant->t >= plant->next_gyro)
+        {
+            Plant_SampleGyro(plant);
+            plant->next_gyro += 1.0 / p->gyro_odr_hz;
+        }
+        if (plant->t >= plant->next_accelerometer)
+        {
+            Plant_SampleAccelerometer(plant);
+            plant->next_accelerometer += 1.0 / p->accelerometer_odr_hz;
+        }
+    }
+}
+
+float Plant_Rpm(const Plant *plant, uint32_t lane, int motor)
+{
+    const float thrust = plant->thrust[motor][lane];
+    return thrust > 0.0f ? plant->p[lane].rpm_per_sqrt_n * sqrtf(thrust) : 0.0f;
+}
+
+void Plant_Read(Plant *plant, PlantReading *readings)
+{
+    // Like the firmware the rounded count average is kept for the accelerometer
+    // and the exact one, in rad/s, for the gyro
+    for (uint32_t k = 0; k < plant->lanes; k++)
+    {
+        const PlantParams *p = &plant->p[k];
+        PlantReading *reading = &readings[k];
+
+        reading->gyro_count = plant->gyro_count;
+        if (plant->gyro_count)
+        {
+            reading->gyro_rate = (float)plant->gyro_sum[k] / plant->gyro_count * p->gyro_lsb;
+            reading->gyro_dt = plant->gyro_count / plant->p[0].gyro_odr_hz;
+            plant->gyro_sum[k] = 0;
+        }
+
+        reading->accelerometer_count = plant->accelerometer_count;
+        if (plant->accelerometer_count)
+        {
+            for (int i = 0; i < 3; i++)
+            {
+                reading->accelerometer[i] = Plant_Quantize((float)plant->accelerometer_sum[i][k] / plant->accelerometer_count);
+                plant->accelerometer_sum[i][k] = 0;
+            }
+        }
+    }
+    plant->gyro_count = 0;
+    plant->accelerometer_count = 0;
+}
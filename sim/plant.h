@@ -0,0 +1,142 @@
+#ifndef PLANT_H
+#define PLANT_H
+
+#include <stdint.h>
+
+/*
+ * Prop arm on a pivot, its two motors and ESCs, and the two IMU sensors, in
+ * virtual time.
+ *
+ * The arm turns about the pivot under the thrust of the motors, at L from it
+ * on each side, a viscous friction and its own imbalance:
+ *     J theta'' = L (F_left - F_right) - damping theta' - imbalance cos(theta) + disturbance
+ * The arm rests on a mechanical stop stop_deg either side of level, which
+ * stops it dead.  A motor thrust, a second order polynomial of its command,
+ * follows it through a first order lag, and the ESC only takes a new command
+ * at the start of each DShot frame.  The speed of a motor goes with the square
+ * root of its thrust.
+ *
+ * The sensors sample the true state at their output data rate into FIFOs that
+ * the read drains and averages, like the firmware drivers do.  Every sample
+ * gets white noise and a constant bias and is quantized to int16 counts.  The
+ * gyro has a first order low-pass at its bandwidth.  The accelerometer sits
+ * accelerometer_radius_m from the pivot along the arm, so it also measures
+ * the centripetal and tangential accelerations of the arm.
+ */
+
+typedef struct
+{
+    /* Arm */
+    float length_m;     /* pivot to each motor */
+    float inertia;      /* kg m^2 */
+    float damping;      /* N m s/rad */
+    float imbalance_nm; /* gravity torque of the arm when level, toward negative angles */
+    float stop_deg;     /* mechanical stops at +-stop_deg */
+
+    /* Motors and ESCs */
+    float thrust_per_command; /* N per unit of motor command */
+    float thrust_quadratic;   /* N per squared unit of motor command */
+    float motor_tau_s;
+    float rpm_per_sqrt_n;     /* motor speed, RPM per square root of N of thrust */
+    float esc_rate_hz;
+
+    /* Gyro, pitch axis only */
+    float gyro_odr_hz;
+    float gyro_bandwidth_hz;
+    float gyro_noise;  /* rad/s rms per sample */
+    float gyro_bias;   /* rad/s */
+    float gyro_lsb;    /* rad/s per count */
+
+    /* Accelerometer */
+    float accelerometer_odr_hz;
+    float accelerometer_noise;      /* g rms per sample and axis */
+    float accelerometer_bias;       /* g, on the axis along the arm */
+    float accelerometer_counts_per_g;
+    float accelerometer_radius_m;
+
+    uint64_t seed;
+} PlantParams;
+
+/* Averages of the samples drained from the FIFOs by one read.  A sensor with
+ * no new sample leaves its fields as they were, only its count is 0. */
+typedef struct
+{
+    float gyro_rate;      /* rad/s */
+    uint32_t gyro_count;
+    float gyro_dt;        /* s, time covered by the gyro samples */
+    short accelerometer[3];
+    uint32_t accelerometer_count;
+} PlantReading;
+
+/* Arms simulated side by side, one per lane */
+#define PLANT_LANES 8
+
+/*
+ * Up to PLANT_LANES arms stepped together, each state a structure of arrays
+ * so the integration vectorizes across the lanes.  Every lane has its own
+ * arm, motors, sensor errors and noise, but the rates of the ESCs and the
+ * sensors are those of the first lane's parameters: their frames and samples
+ * land at the same times in all the lanes.
+ */
+typedef struct
+{
+    uint32_t lanes;
+    PlantParams p[PLANT_LANES];
+    double t;
+
+    /* Per lane coefficients of the integration step */
+    float length_m[PLANT_LANES];
+    float inverse_inertia[PLANT_LANES];
+    float damping[PLANT_LANES];
+    float imbalance_nm[PLANT_LANES];
+    float stop_rad[PLANT_LANES];
+    float thrust_per_command[PLANT_LANES];
+    float thrust_quadratic[PLANT_LANES];
+    float motor_tau_s[PLANT_LANES];
+    float gyro_wc[PLANT_LANES];
+
+    float theta[PLANT_LANES]; /* rad */
+    float omega[PLANT_LANES]; /* rad/s */
+    float alpha[PLANT_LANES]; /* rad/s^2 */
+    float disturbance_nm[PLANT_LANES];
+
+    float command[2][PLANT_LANES]; /* written by the controller: left, right */
+    float latched[2][PLANT_LANES]; /* taken by the ESCs at the last frame */
+    float thrust[2][PLANT_LANES];  /* N */
+
+    float gyro_filtered[PLANT_LANES];
+    double next_esc;
+    double next_gyro;
+    double next_accelerometer;
+
+    /* FIFO contents, as sums of the stored samples */
+    int64_t gyro_sum[PLANT_LANES];
+    uint32_t gyro_count;
+    int64_t accelerometer_sum[3][PLANT_LANES];
+    uint32_t accelerometer_count;
+
+    uint64_t rng[PLANT_LANES];
+} Plant;
+
+/* The arm and sensors of the rig, with L and J from model.h */
+void Plant_DefaultParams(PlantParams *params);
+
+/* params, left and right hold one entry per lane.  Every arm starts at rest
+ * at theta, with its motors settled at the given commands. */
+void Plant_Init(Plant *plant, const PlantParams *params, uint32_t lanes, float theta,
+                const float *left, const float *right);
+
+/* Advance to time t, in steps of at most step_s */
+void Plant_Advance(Plant *plant, double t, double step_s);
+
+/* Motor commands of a lane, in the range of Motor_Write() */
+void Plant_SetCommand(Plant *plant, uint32_t lane, float left, float right);
+
+/* Speed of the left (0) or right (1) motor of a lane, RPM */
+float Plant_Rpm(const Plant *plant, uint32_t lane, int motor);
+
+/* Drain both FIFOs of every lane, as one sensor round of the firmware.  readings
+ * holds one entry per lane. */
+void Plant_Read(Plant *plant, PlantReading *readings);
+
+#endif
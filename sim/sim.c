@@ -0,0 +1,147 @@
+/*
+ * Closed-loop simulation of the arm with the firmware control code, faster
+ * than real time.
+ *
+ * Built by the host build of the top-level CMakeLists.txt, from the firmware
+ * sources.
+ *
+ * Usage: sim [-t seconds] [-r rate_hz] [-a angle_rate_hz] [-c pid|cascade|lqr]
+ *            [-f complementary|kalman|steady] [-s step_deg] [-d disturbance_nm]
+ *            [-i initial_deg] [-S seed] [-o trace.csv] [-k decimation]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "closed_loop.h"
+
+typedef struct
+{
+    FILE *file;
+    uint32_t decimation;
+    uint64_t count;
+} Trace;
+
+static void Sim_Trace(const ClosedLoopSample *s, void *context)
+{
+    Trace *trace = context;
+    if (trace->count++ % trace->decimation != 0)
+        return;
+
+    fprintf(trace->file, "%.6f,%.3f,%.4f,%.4f,%.5f,%.3f,%.1f,%.1f\n",
+            s->t, s->setpoint_deg, s->angle_deg, s->estimate_deg, s->rate, s->control, s->left, s->right);
+}
+
+static int Sim_Usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-t seconds] [-r rate_hz] [-a angle_rate_hz] [-c pid|cascade|lqr]\n"
+            "          [-f complementary|kalman|steady] [-s step_deg] [-d disturbance_nm]\n"
+            "          [-i initial_deg] [-S seed] [-o trace.csv] [-k decimation]\n",
+            name);
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    ClosedLoopConfig config;
+    ClosedLoop_DefaultConfig(&config);
+    PlantParams params;
+    Plant_DefaultParams(&params);
+
+    const char *trace_path = 0;
+    Trace trace = {0, 1, 0};
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-' || argv[i][1] == 0 || argv[i][2] != 0 || i + 1 >= argc)
+            return Sim_Usage(argv[0]);
+
+        const char *value = argv[++i];
+        switch (argv[i - 1][1])
+        {
+        case 't':
+            config.duration_s = atof(value);
+            break;
+        case 'r':
+            config.rate_hz = (uint32_t)atoi(value);
+            break;
+        case 'a':
+            config.angle_rate_hz = (uint32_t)atoi(value);
+            break;
+        case 'c':
+            if (strcmp(value, "pid") == 0)
+                config.law = CONTROL_PID;
+            else if (strcmp(value, "cascade") == 0)
+                config.law = CONTROL_CASCADE;
+            else if (strcmp(value, "lqr") == 0)
+                config.law = CONTROL_LQR;
+            else
+                return Sim_Usage(argv[0]);
+            break;
+        case 'f':
+            if (strcmp(value, "complementary") == 0)
+                config.filter = CONTROL_COMPLEMENTARY;
+            else if (strcmp(value, "kalman") == 0)
+                config.filter = CONTROL_KALMAN;
+            else if (strcmp(value, "steady") == 0)
+                config.filter = CONTROL_KALMAN_STEADY_STATE;
+            else
+                return Sim_Usage(argv[0]);
+            break;
+        case 's':
+            config.step_deg = (float)atof(value);
+            break;
+        case 'd':
+            config.disturbance_nm = (float)atof(value);
+            break;
+        case 'i':
+            config.initial_angle_deg = (float)atof(value);
+            break;
+        case 'S':
+            params.seed = strtoull(value, 0, 0);
+            break;
+        case 'o':
+            trace_path = value;
+            break;
+        case 'k':
+            trace.decimation = (uint32_t)atoi(value);
+            break;
+        default:
+            return Sim_Usage(argv[0]);
+        }
+    }
+
+    if (config.rate_hz == 0 || config.rate_hz > 1000000 || config.angle_rate_hz == 0 || trace.decimation == 0)
+        return Sim_Usage(argv[0]);
+
+    if (trace_path)
+    {
+        trace.file = fopen(trace_path, "w");
+        if (!trace.file)
+        {
+            perror(trace_path);
+            return 1;
+        }
+        fprintf(trace.file, "t,setpoint_deg,angle_deg,estimate_deg,rate,control,left,right\n");
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    ClosedLoopResult result;
+    ClosedLoop_Run(&config, &params, &result, trace.file ? Sim_Trace : 0, &trace);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    if (trace.file)
+        fclose(trace.file);
+
+    printf("simulated %.1f s (%llu ticks) in %.3f s, %.0fx real time\n",
+           config.duration_s, (unsigned long long)result.ticks, elapsed, config.duration_s / elapsed);
+    printf("ise %.4f deg^2 s  overshoot %.2f %%  settling %.3f s  effort %.2f  max angle %.2f deg\n",
+           result.ise, result.overshoot, result.settling_s, result.effort, result.max_angle_deg);
+    return 0;
+}
@@ -0,0 +1,678 @@
+/*
+ * Gain sweep of the controllers over a Monte Carlo set of plants, on every
+ * core.
+ *
+ * Each candidate of the grid runs the closed loop of closed_loop.c on the
+ * same draws of the plant: the nominal arm, then arms with the length, the
+ * inertia and the motor time constant off by up to the relative spread and
+ * with random gyro and accelerometer biases.  The candidates are ranked on
+ * their mean ISE, worst overshoot, worst settling time and mean effort, each
+ * relative to the boot tuning of tuning.h on the same draws.  A candidate
+ * that lets any draw get past the arm limit is dropped.
+ *
+ * The runs are split into items of one candidate and up to PLANT_LANES draws,
+ * simulated side by side.  Every thread starts on its own share of the items
+ * and steals from the back of the others' once it is done.
+ *
+ * Built by the host build of the top-level CMakeLists.txt, from the firmware
+ * sources.
+ *
+ * Usage: tune [-c pid|cascade|lqr] [-f complementary|kalman|steady]
+ *             [-p name=min:max:count[:log]]... [-n draws] [-u spread] [-b gyro_bias]
+ *             [-g accelerometer_bias] [-t seconds] [-j threads] [-k top] [-S seed]
+ *             [-o header]
+ *     name is a field of ClosedLoopTuning, pid_kp for example.  Without -p the
+ *     gains of the chosen law are swept around their boot values.  -o writes
+ *     tuning.h with the winner in place of the boot values of the swept fields.
+ */
+
+#include <ctype.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "closed_loop.h"
+#include "tuning.h"
+
+#define TUNE_MAX_AXES 8
+#define TUNE_MAX_THREADS 256
+
+/* The stops of the arm, deg: a candidate that takes it there is unstable */
+#define TUNE_ANGLE_LIMIT_DEG 45.0
+
+/* Relative weight of the effort in the score, the other metrics count 1 */
+#define TUNE_EFFORT_WEIGHT 0.25
+
+typedef struct
+{
+    const char *name;
+    size_t offset;
+} TuneField;
+
+static const TuneField tune_fields[] = {
+    {"pid_kp", offsetof(ClosedLoopTuning, pid_kp)},
+    {"pid_ki", offsetof(ClosedLoopTuning, pid_ki)},
+    {"pid_kd", offsetof(ClosedLoopTuning, pid_kd)},
+    {"cascade_a", offsetof(ClosedLoopTuning, cascade_a)},
+    {"cascade_b", offsetof(ClosedLoopTuning, cascade_b)},
+    {"complementary_tau_s", offsetof(ClosedLoopTuning, complementary_tau_s)},
+    {"kalman_q_angle", offsetof(ClosedLoopTuning, kalman_q_angle)},
+    {"kalman_q_velocity", offsetof(ClosedLoopTuning, kalman_q_velocity)},
+    {"kalman_q_bias", offsetof(ClosedLoopTuning, kalman_q_bias)},
+    {"kalman_r_angle", offsetof(ClosedLoopTuning, kalman_r_angle)},
+    {"kalman_r_rate", offsetof(ClosedLoopTuning, kalman_r_rate)},
+    {"lqr_q_angle", offsetof(ClosedLoopTuning, lqr_q_angle)},
+    {"lqr_q_rate", offsetof(ClosedLoopTuning, lqr_q_rate)},
+    {"lqr_r", offsetof(ClosedLoopTuning, lqr_r)},
+};
+
+#define TUNE_NUM_FIELDS (sizeof(tune_fields) / sizeof(tune_fields[0]))
+
+typedef struct
+{
+    size_t offset;
+    const char *name;
+    float min, max;
+    uint32_t count;
+    int logarithmic;
+} TuneAxis;
+
+/* Metrics of one candidate over all the draws */
+typedef struct
+{
+    ClosedLoopTuning tuning;
+    double ise;       /* mean */
+    double overshoot; /* worst */
+    double settling;  /* worst */
+    double effort;    /* mean */
+    double max_angle; /* worst */
+    double score;
+} TuneCandidate;
+
+/* Items still to run of one thread, next in the low half and end in the high
+ * half so both ends move with one compare and swap.  Aligned so the threads
+ * don't share a cache line. */
+typedef struct
+{
+    _Alignas(64) _Atomic uint64_t range;
+} TuneQueue;
+
+typedef struct
+{
+    const ClosedLoopConfig *config;
+    const PlantParams *draws;
+    uint32_t num_draws;
+    uint32_t groups; /* items per candidate */
+    const TuneCandidate *candidates;
+    ClosedLoopResult *results; /* num_draws per candidate */
+
+    TuneQueue queues[TUNE_MAX_THREADS];
+    uint32_t threads;
+} TunePool;
+
+typedef struct
+{
+    TunePool *pool;
+    uint32_t index;
+} TuneWorker;
+
+static uint64_t Tune_Range(uint32_t next, uint32_t end)
+{
+    return ((uint64_t)end << 32) | next;
+}
+
+// The owner takes from the front of its range
+static int Tune_Take(TuneQueue *queue, uint32_t *item)
+{
+    uint64_t range = atomic_load(&queue->range);
+    for (;;)
+    {
+        const uint32_t next = (uint32_t)range;
+        const uint32_t end = (uint32_t)(range >> 32);
+        if (next >= end)
+            return 0;
+        if (atomic_compare_exchange_weak(&queue->range, &range, Tune_Range(next + 1, end)))
+        {
+            *item = next;
+            return 1;
+        }
+    }
+}
+
+// A thief takes from the back of the first range that has something left
+static int Tune_Steal(TunePool *pool, uint32_t thief, uint32_t *item)
+{
+    for (uint32_t i = 1; i < pool->threads; i++)
+    {
+        TuneQueue *queue = &pool->queues[(thief + i) % pool->threads];
+        uint64_t range = atomic_load(&queue->range);
+        for (;;)
+        {
+            const uint32_t next = (uint32_t)range;
+            const uint32_t end = (uint32_t)(range >> 32);
+            if (next >= end)
+                break;
+            if (atomic_compare_exchange_weak(&queue->range, &range, Tune_Range(next, end - 1)))
+            {
+                *item = end - 1;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void Tune_RunItem(TunePool *pool, uint32_t item)
+{
+    const uint32_t candidate = item / pool->groups;
+    const uint32_t first = (item % pool->groups) * PLANT_LANES;
+    const uint32_t count = pool->num_draws - first < PLANT_LANES ? pool->num_draws - first : PLANT_LANES;
+
+    ClosedLoopTuning tunings[PLANT_LANES];
+    for (uint32_t k = 0; k < count; k++)
+        tunings[k] = pool->candidates[candidate].tuning;
+
+    ClosedLoop_RunBatch(pool->config, tunings, &pool->draws[first], count,
+                        &pool->results[(size_t)candidate * pool->num_draws + first]);
+}
+
+static void *Tune_Worker(void *argument)
+{
+    TuneWorker *worker = argument;
+    uint32_t item;
+    while (Tune_Take(&worker->pool->queues[worker->index], &item) ||
+           Tune_Steal(worker->pool, worker->index, &item))
+    {
+        Tune_RunItem(worker->pool, item);
+    }
+    return 0;
+}
+
+// Every candidate on every draw, results[candidate * num_draws + draw]
+static void Tune_RunAll(const ClosedLoopConfig *config, const PlantParams *draws, uint32_t num_draws,
+                        const TuneCandidate *candidates, uint32_t num_candidates, uint32_t threads,
+                        ClosedLoopResult *results)
+{
+    static TunePool pool;
+    pool.config = config;
+    pool.draws = draws;
+    pool.num_draws = num_draws;
+    pool.groups = (num_draws + PLANT_LANES - 1) / PLANT_LANES;
+    pool.candidates = candidates;
+    pool.results = results;
+
+    const uint32_t items = num_candidates * pool.groups;
+    pool.threads = threads < items ? threads : (items ? items : 1);
+    for (uint32_t i = 0; i < pool.threads; i++)
+    {
+        const uint32_t first = (uint32_t)((uint64_t)items * i / pool.threads);
+        const uint32_t end = (uint32_t)((uint64_t)items * (i + 1) / pool.threads);
+        atomic_store(&pool.queues[i].range, Tune_Range(first, end));
+    }
+
+    pthread_t ids[TUNE_MAX_THREADS];
+    TuneWorker workers[TUNE_MAX_THREADS];
+    for (uint32_t i = 1; i < pool.threads; i++)
+    {
+        workers[i] = (TuneWorker){&pool, i};
+        pthread_create(&ids[i], 0, Tune_Worker, &workers[i]);
+    }
+    workers[0] = (TuneWorker){&pool, 0};
+    Tune_Worker(&workers[0]);
+    for (uint32_t i = 1; i < pool.threads; i++)
+        pthread_join(ids[i], 0);
+}
+
+// xorshift64*, uniform in [-1, 1)
+static double Tune_Uniform(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return ((*state * 0x2545F4914F6CDD1DULL) >> 11) / 4503599627370496.0 - 1.0;
+}
+
+// The nominal plant first, then the perturbed ones.  All the candidates see
+// the same draws, so their differences are not noise.
+static void Tune_Draw(PlantParams *draws, uint32_t count, double spread, double gyro_bias,
+                      double accelerometer_bias, uint64_t seed)
+{
+    PlantParams nominal;
+    Plant_DefaultParams(&nominal);
+    uint64_t state = seed ? seed : 1;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        PlantParams *p = &draws[i];
+        *p = nominal;
+        p->seed = seed + i;
+        if (i == 0)
+            continue;
+
+        p->length_m *= (float)(1.0 + spread * Tune_Uniform(&state));
+        p->inertia *= (float)(1.0 + spread * Tune_Uniform(&state));
+        p->motor_tau_s *= (float)(1.0 + spread * Tune_Uniform(&state));
+        p->gyro_bias = (float)(gyro_bias * Tune_Uniform(&state));
+        p->accelerometer_bias = (float)(accelerometer_bias * Tune_Uniform(&state));
+    }
+}
+
+static void Tune_Aggregate(TuneCandidate *c, const ClosedLoopResult *results, uint32_t count)
+{
+    c->ise = c->overshoot = c->settling = c->effort = c->max_angle = 0.0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const ClosedLoopResult *r = &results[i];
+        c->ise += r->ise / count;
+        c->effort += r->effort / count;
+        c->overshoot = fmax(c->overshoot, r->overshoot);
+        c->settling = fmax(c->settling, r->settling_s);
+        // fmax would drop a NaN
+        c->max_angle = r->max_angle_deg > c->max_angle || isnan(r->max_angle_deg) ? r->max_angle_deg : c->max_angle;
+    }
+}
+
+// Each metric relative to the reference, lower is better
+static void Tune_Score(TuneCandidate *c, const TuneCandidate *reference)
+{
+    if (!(c->max_angle < TUNE_ANGLE_LIMIT_DEG))
+    {
+        c->score = INFINITY;
+        return;
+    }
+    c->score = c->ise / fmax(reference->ise, 1e-9) +
+               c->overshoot / fmax(reference->overshoot, 1.0) +
+               c->settling / fmax(reference->settling, 0.1) +
+               TUNE_EFFORT_WEIGHT * c->effort / fmax(reference->effort, 1e-9);
+}
+
+static int Tune_Compare(const void *a, const void *b)
+{
+    const double sa = ((const TuneCandidate *)a)->score;
+    const double sb = ((const TuneCandidate *)b)->score;
+    return (sa > sb) - (sa < sb);
+}
+
+static float *Tune_Field(ClosedLoopTuning *tuning, size_t offset)
+{
+    return (float *)((char *)tuning + offset);
+}
+
+static float Tune_AxisValue(const TuneAxis *axis, uint32_t index)
+{
+    if (axis->count < 2)
+        return axis->min;
+    const double f = (double)index / (axis->count - 1);
+    if (axis->logarithmic)
+        return (float)(axis->min * pow(axis->max / axis->min, f));
+    return (float)(axis->min + (axis->max - axis->min) * f);
+}
+
+// name=min:max:count[:log]
+static int Tune_ParseAxis(const char *text, TuneAxis *axis)
+{
+    const char *equals = strchr(text, '=');
+    if (!equals)
+        return 0;
+
+    axis->name = 0;
+    for (size_t i = 0; i < TUNE_NUM_FIELDS; i++)
+    {
+        if (strlen(tune_fields[i].name) == (size_t)(equals - text) &&
+            strncmp(tune_fields[i].name, text, equals - text) == 0)
+        {
+            axis->name = tune_fields[i].name;
+            axis->offset = tune_fields[i].offset;
+        }
+    }
+
+    char mode[8] = "";
+    unsigned count = 0;
+    const int fields = sscanf(equals + 1, "%f:%f:%u:%7s", &axis->min, &axis->max, &count, mode);
+    axis->count = count;
+    axis->logarithmic = fields == 4 && strcmp(mode, "log") == 0;
+    return axis->name && fields >= 3 && (fields == 3 || axis->logarithmic) && count > 0 &&
+           (!axis->logarithmic || (axis->min > 0.0f && axis->max > 0.0f));
+}
+
+// Around the boot values of the gains of the law
+static uint32_t Tune_DefaultAxes(ControlLaw law, TuneAxis *axes)
+{
+    switch (law)
+    {
+    case CONTROL_PID:
+        axes[0] = (TuneAxis){offsetof(ClosedLoopTuning, pid_kp), "pid_kp", 0.5f * PID_KP, 2.0f * PID_KP, 7, 1};
+        axes[1] = (TuneAxis){offsetof(ClosedLoopTuning, pid_ki), "pid_ki", 0.0f, 2.0f * PID_KI, 5, 0};
+        axes[2] = (TuneAxis){offsetof(ClosedLoopTuning, pid_kd), "pid_kd", 0.5f * PID_KD, 2.0f * PID_KD, 7, 1};
+        return 3;
+    case CONTROL_CASCADE:
+        axes[0] = (TuneAxis){offsetof(ClosedLoopTuning, cascade_a), "cascade_a", 0.25f * CASCADE_A, 4.0f * CASCADE_A, 9, 1};
+        axes[1] = (TuneAxis){offsetof(ClosedLoopTuning, cascade_b), "cascade_b", 0.25f * CASCADE_B, 4.0f * CASCADE_B, 9, 1};
+        return 2;
+    case CONTROL_LQR:
+    default:
+        axes[0] = (TuneAxis){offsetof(ClosedLoopTuning, lqr_q_angle), "lqr_q_angle", 0.1f * LQR_Q_ANGLE, 10.0f * LQR_Q_ANGLE, 7, 1};
+        axes[1] = (TuneAxis){offsetof(ClosedLoopTuning, lqr_q_rate), "lqr_q_rate", 0.1f * LQR_Q_RATE, 10.0f * LQR_Q_RATE, 7, 1};
+        axes[2] = (TuneAxis){offsetof(ClosedLoopTuning, lqr_r), "lqr_r", 0.1f * LQR_R, 10.0f * LQR_R, 5, 1};
+        return 3;
+    }
+}
+
+// A float literal, with the decimal point C wants before the suffix
+static const char *Tune_Literal(float value, char *buffer, size_t size)
+{
+    snprintf(buffer, size, "%.6g", value);
+    if (!strpbrk(buffer, ".einf"))
+        strncat(buffer, ".0", size - strlen(buffer) - 1);
+    strncat(buffer, "f", size - strlen(buffer) - 1);
+    return buffer;
+}
+
+/* Lines of tuning.h the header is written from */
+#define TUNE_HEADER_LINES 256
+#define TUNE_HEADER_LINE 256
+
+/* First line of the note tune adds to the comment at the top of tuning.h */
+#define TUNE_HEADER_NOTE " * Written by sim/tune, "
+
+// The macro of a field of ClosedLoopTuning is its name in capitals
+static int Tune_IsMacro(const char *line, const char *name)
+{
+    static const char define[] = "#define ";
+    if (strncmp(line, define, sizeof(define) - 1) != 0)
+        return 0;
+
+    line += sizeof(define) - 1;
+    for (; *name; name++, line++)
+    {
+        if (*line != toupper((unsigned char)*name))
+            return 0;
+    }
+    return *line == ' ';
+}
+
+// A copy of tuning.h with the winner in place of the boot values of the swept
+// fields, and a note of the sweep at the end of the comment at the top, in
+// place of the one of an earlier run.  Everything else is copied as is, so the
+// header can replace tuning.h.
+static int Tune_WriteHeader(const char *path, const TuneCandidate *best, const TuneCandidate *reference,
+                            const char *scenario, const TuneAxis *axes, uint32_t num_axes)
+{
+    // Read whole first, path may be tuning.h itself
+    static char lines[TUNE_HEADER_LINES][TUNE_HEADER_LINE];
+    uint32_t num_lines = 0;
+    FILE *file = fopen(TUNE_TUNING_H, "r");
+    if (!file)
+    {
+        perror(TUNE_TUNING_H);
+        return 0;
+    }
+    while (num_lines < TUNE_HEADER_LINES && fgets(lines[num_lines], TUNE_HEADER_LINE, file))
+        num_lines++;
+    const int complete = feof(file);
+    fclose(file);
+    if (!complete)
+    {
+        fprintf(stderr, "%s: too long to copy\n", TUNE_TUNING_H);
+        return 0;
+    }
+
+    file = fopen(path, "w");
+    if (!file)
+    {
+        perror(path);
+        return 0;
+    }
+
+    int in_note = 0;
+    int noted = 0;
+    for (uint32_t l = 0; l < num_lines; l++)
+    {
+        const char *line = lines[l];
+
+        if (!noted && strncmp(line, TUNE_HEADER_NOTE, sizeof(TUNE_HEADER_NOTE) - 1) == 0)
+            in_note = 1;
+        // The blank comment line before the note goes with it
+        if (!noted && !in_note && strcmp(line, " *\n") == 0 && l + 1 < num_lines &&
+            strncmp(lines[l + 1], TUNE_HEADER_NOTE, sizeof(TUNE_HEADER_NOTE) - 1) == 0)
+            continue;
+
+        if (!noted && strcmp(line, " */\n") == 0)
+        {
+            fprintf(file,
+                    " *\n"
+                    TUNE_HEADER_NOTE "%s.\n"
+                    " * Score %.3f against %.3f, mean ISE %.3f deg^2 s, worst overshoot %.2f %%,\n"
+                    " * worst settling %.3f s, mean effort %.2f.\n",
+                    scenario, best->score, reference->score, best->ise, best->overshoot, best->settling,
+                    best->effort);
+            in_note = 0;
+            noted = 1;
+        }
+        if (in_note)
+            continue;
+
+        const TuneAxis *axis = 0;
+        for (uint32_t a = 0; a < num_axes; a++)
+        {
+            if (Tune_IsMacro(line, axes[a].name))
+                axis = &axes[a];
+        }
+        if (!axis)
+        {
+            fputs(line, file);
+            continue;
+        }
+
+        char macro[TUNE_HEADER_LINE];
+        char literal[32];
+        sscanf(line, "#define %255s", macro);
+        const float value = *(const float *)((const char *)&best->tuning + axis->offset);
+        fprintf(file, "#define %s %s\n", macro, Tune_Literal(value, literal, sizeof(literal)));
+    }
+
+    fclose(file);
+    return 1;
+}
+
+static void Tune_Print(const char *label, const TuneCandidate *c, const TuneAxis *axes, uint32_t num_axes)
+{
+    printf("%-9s", label);
+    for (uint32_t a = 0; a < num_axes; a++)
+        printf(" %12.5g", *Tune_Field((ClosedLoopTuning *)&c->tuning, axes[a].offset));
+    printf(" %9.3f %10.3f %9.2f %8.3f %9.2f %8.2f\n", c->score, c->ise, c->overshoot, c->settling, c->effort,
+           c->max_angle);
+}
+
+static int Tune_Usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-c pid|cascade|lqr] [-f complementary|kalman|steady]\n"
+            "          [-p name=min:max:count[:log]]... [-n draws] [-u spread] [-b gyro_bias]\n"
+            "          [-g accelerometer_bias] [-t seconds] [-j threads] [-k top] [-S seed]\n"
+            "          [-o header]\n",
+            name);
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    ClosedLoopConfig config;
+    ClosedLoop_DefaultConfig(&config);
+
+    TuneAxis axes[TUNE_MAX_AXES];
+    uint32_t num_axes = 0;
+    uint32_t num_draws = 16;
+    double spread = 0.2;
+    double gyro_bias = 0.02;
+    double accelerometer_bias = 0.02;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t top = 10;
+    uint64_t seed = 1;
+    const char *header_path = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '-' || argv[i][1] == 0 || argv[i][2] != 0 || i + 1 >= argc)
+            return Tune_Usage(argv[0]);
+
+        const char *value = argv[++i];
+        switch (argv[i - 1][1])
+        {
+        case 'c':
+            if (strcmp(value, "pid") == 0)
+                config.law = CONTROL_PID;
+            else if (strcmp(value, "cascade") == 0)
+                config.law = CONTROL_CASCADE;
+            else if (strcmp(value, "lqr") == 0)
+                config.law = CONTROL_LQR;
+            else
+                return Tune_Usage(argv[0]);
+            break;
+        case 'f':
+            if (strcmp(value, "complementary") == 0)
+                config.filter = CONTROL_COMPLEMENTARY;
+            else if (strcmp(value, "kalman") == 0)
+                config.filter = CONTROL_KALMAN;
+            else if (strcmp(value, "steady") == 0)
+                config.filter = CONTROL_KALMAN_STEADY_STATE;
+            else
+                return Tune_Usage(argv[0]);
+            break;
+        case 'p':
+            if (num_axes == TUNE_MAX_AXES || !Tune_ParseAxis(value, &axes[num_axes++]))
+                return Tune_Usage(argv[0]);
+            break;
+        case 'n':
+            num_draws = (uint32_t)atoi(value);
+            break;
+        case 'u':
+            spread = atof(value);
+            break;
+        case 'b':
+            gyro_bias = atof(value);
+            break;
+        case 'g':
+            accelerometer_bias = atof(value);
+            break;
+        case 't':
+            config.duration_s = atof(value);
+            break;
+        case 'j':
+            threads = atol(value);
+            break;
+        case 'k':
+            top = (uint32_t)atoi(value);
+            break;
+        case 'S':
+            seed = strtoull(value, 0, 0);
+            break;
+        case 'o':
+            header_path = value;
+            break;
+        default:
+            return Tune_Usage(argv[0]);
+        }
+    }
+
+    if (num_draws == 0 || threads < 1 || threads > TUNE_MAX_THREADS || spread < 0.0 || spread >= 1.0)
+        return Tune_Usage(argv[0]);
+    if (num_axes == 0)
+        num_axes = Tune_DefaultAxes(config.law, axes);
+
+    // The grid, the boot tuning first as the reference
+    uint64_t grid = 1;
+    for (uint32_t a = 0; a < num_axes; a++)
+        grid *= axes[a].count;
+    if (grid + 1 > UINT32_MAX / ((num_draws + PLANT_LANES - 1) / PLANT_LANES))
+        return Tune_Usage(argv[0]);
+
+    const uint32_t num_candidates = (uint32_t)grid + 1;
+    TuneCandidate *candidates = calloc(num_candidates, sizeof(TuneCandidate));
+    ClosedLoopResult *results = calloc((size_t)num_candidates * num_draws, sizeof(ClosedLoopResult));
+    PlantParams *draws = calloc(num_draws, sizeof(PlantParams));
+    if (!candidates || !results || !draws)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    candidates[0].tuning = config.tuning;
+    for (uint32_t c = 1; c < num_candidates; c++)
+    {
+        candidates[c].tuning = config.tuning;
+        uint32_t index = c - 1;
+        for (uint32_t a = 0; a < num_axes; a++)
+        {
+            *Tune_Field(&candidates[c].tuning, axes[a].offset) = Tune_AxisValue(&axes[a], index % axes[a].count);
+            index /= axes[a].count;
+        }
+    }
+
+    Tune_Draw(draws, num_draws, spread, gyro_bias, accelerometer_bias, seed);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Tune_RunAll(&config, draws, num_draws, candidates, num_candidates, (uint32_t)threads, results);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    for (uint32_t c = 0; c < num_candidates; c++)
+        Tune_Aggregate(&candidates[c], &results[(size_t)c * num_draws], num_draws);
+    TuneCandidate reference = candidates[0];
+    for (uint32_t c = 0; c < num_candidates; c++)
+        Tune_Score(&candidates[c], &reference);
+    reference.score = candidates[0].score;
+    qsort(candidates + 1, num_candidates - 1, sizeof(TuneCandidate), Tune_Compare);
+
+    uint32_t stable = 0;
+    for (uint32_t c = 1; c < num_candidates; c++)
+        stable += isfinite(candidates[c].score);
+
+    const uint64_t runs = (uint64_t)num_candidates * num_draws;
+    printf("%u candidates x %u plants, %llu runs of %.1f s in %.2f s on %ld threads, %.0fx real time\n",
+           num_candidates, num_draws, (unsigned long long)runs, config.duration_s, elapsed, threads,
+           runs * config.duration_s / elapsed);
+    printf("%u candidates stay within %.0f deg on every plant\n\n", stable, TUNE_ANGLE_LIMIT_DEG);
+
+    printf("%-9s", "");
+    for (uint32_t a = 0; a < num_axes; a++)
+        printf(" %12s", axes[a].name);
+    printf(" %9s %10s %9s %8s %9s %8s\n", "score", "ise", "overshoot", "settling", "effort", "max_deg");
+    Tune_Print("boot", &reference, axes, num_axes);
+    for (uint32_t c = 1; c < num_candidates && c <= top && isfinite(candidates[c].score); c++)
+    {
+        char label[16];
+        snprintf(label, sizeof(label), "#%u", c);
+        Tune_Print(label, &candidates[c], axes, num_axes);
+    }
+
+    int status = 0;
+    if (header_path)
+    {
+        if (stable == 0)
+        {
+            fprintf(stderr, "no stable candidate, %s not written\n", header_path);
+            status = 1;
+        }
+        else
+        {
+            static const char *laws[] = {"cascade", "pid", "lqr"};
+            static const char *filters[] = {"complementary", "kalman", "steady"};
+            char scenario[160];
+            snprintf(scenario, sizeof(scenario), "%s law with the %s filter over %u plants, spread %.2f",
+                     laws[config.law], filters[config.filter], num_draws, spread);
+            status = Tune_WriteHeader(header_path, &candidates[1], &reference, scenario, axes, num_axes) ? 0 : 1;
+        }
+    }
+
+    free(draws);
+    free(results);
+    free(candidates);
+    return status;
+}
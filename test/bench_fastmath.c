@@ -0,0 +1,154 @@
+/*
+ * Cost of one call of the fastmath.h kernels against the libm functions they
+ * replace in the control path: atan2f(), asinf() and sqrtf().
+ *
+ * On the host libm has its own vectorised or table-driven versions, so the
+ * ratio is not the one of the Cortex-M4, where the library goes through
+ * soft-float range reduction.  It still shows a kernel that got slower.
+ *
+ * Prints the time and, on x86, the TSC cycles of one call.  Fails if a kernel
+ * doesn't agree with libm on the inputs, the timings are for reading only.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "fastmath.h"
+#include "test.h"
+
+#define BENCH_CALLS 1000000
+#define BENCH_RUNS 5
+
+/* The bound documented in fastmath.h plus the rounding of the libm float
+ * functions themselves */
+#define BENCH_TOLERANCE 4.0e-6 /* rad */
+
+typedef enum
+{
+    BENCH_ATAN2F,
+    BENCH_FAST_ATAN2F,
+    BENCH_ASINF,
+    BENCH_FAST_ASINF,
+    BENCH_SQRTF,
+    BENCH_FAST_SQRTF,
+    BENCH_VARIANTS
+} BenchVariant;
+
+static const char *const names[BENCH_VARIANTS] = {
+    "atan2f", "FastMath_Atan2f", "asinf", "FastMath_Asinf", "sqrtf", "FastMath_Sqrtf"};
+
+/* Accelerometer readings of an arm swinging through its range: the two axes of
+ * atan2, the normalised one of asin and the squared norm of sqrt */
+static float inputs[BENCH_CALLS][4];
+
+static void Bench_Inputs(void)
+{
+    uint64_t rng = 1;
+    for (int i = 0; i < BENCH_CALLS; i++)
+    {
+        rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+        const double noise = (double)(rng >> 40) / (double)(1 << 24) - 0.5;
+        const double theta = 2.0 * M_PI * i / BENCH_CALLS - M_PI;
+        const double y = 9.81 * sin(theta) + 0.2 * noise;
+        const double x = 9.81 * cos(theta) - 0.1 * noise;
+        inputs[i][0] = (float)y;
+        inputs[i][1] = (float)x;
+        inputs[i][2] = (float)(y / sqrt(x * x + y * y));
+        inputs[i][3] = (float)(x * x + y * y);
+    }
+}
+
+static uint64_t Bench_Cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static double Bench_Seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+// Best of BENCH_RUNS passes over the inputs, per call.  The variant is picked
+// once per pass so that the loop only holds the call, results gets the last
+// pass.
+static void Bench_Run(BenchVariant variant, double *seconds, double *cycles, float *results)
+{
+    *seconds = INFINITY;
+    *cycles = INFINITY;
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        const double start = Bench_Seconds();
+        const uint64_t start_cycles = Bench_Cycles();
+        switch (variant)
+        {
+        case BENCH_ATAN2F:
+            for (int i = 0; i < BENCH_CALLS; i++)
+                results[i] = atan2f(inputs[i][0], inputs[i][1]);
+            break;
+        case BENCH_FAST_ATAN2F:
+            for (int i = 0; i < BENCH_CALLS; i++)
+                results[i] = FastMath_Atan2f(inputs[i][0], inputs[i][1]);
+            break;
+        case BENCH_ASINF:
+            for (int i = 0; i < BENCH_CALLS; i++)
+                results[i] = asinf(inputs[i][2]);
+            break;
+        case BENCH_FAST_ASINF:
+            for (int i = 0; i < BENCH_CALLS; i++)
+                results[i] = FastMath_Asinf(inputs[i][2]);
+            break;
+        case BENCH_SQRTF:
+            for (int i = 0; i < BENCH_CALLS; i++)
+                results[i] = sqrtf(inputs[i][3]);
+            break;
+        default:
+            for (int i = 0; i < BENCH_CALLS; i++)
+                results[i] = FastMath_Sqrtf(inputs[i][3]);
+            break;
+        }
+        const uint64_t end_cycles = Bench_Cycles();
+        const double end = Bench_Seconds();
+
+        *seconds = fmin(*seconds, (end - start) / BENCH_CALLS);
+        *cycles = fmin(*cycles, (double)(end_cycles - start_cycles) / BENCH_CALLS);
+    }
+}
+
+static float results[BENCH_VARIANTS][BENCH_CALLS];
+
+int main(void)
+{
+    Bench_Inputs();
+
+    for (int v = 0; v < BENCH_VARIANTS; v++)
+    {
+        double seconds;
+        double cycles;
+        Bench_Run(v, &seconds, &cycles, results[v]);
+        printf("%-32s %8.1f ns %8.1f cycles per call\n", names[v], seconds * 1e9, cycles);
+    }
+
+    // Each kernel against the libm function before it
+    double atan2_worst = 0.0;
+    double asin_worst = 0.0;
+    int sqrt_exact = 1;
+    for (int i = 0; i < BENCH_CALLS; i++)
+    {
+        atan2_worst = fmax(atan2_worst, fabs((double)results[BENCH_FAST_ATAN2F][i] - (double)results[BENCH_ATAN2F][i]));
+        asin_worst = fmax(asin_worst, fabs((double)results[BENCH_FAST_ASINF][i] - (double)results[BENCH_ASINF][i]));
+        sqrt_exact &= results[BENCH_FAST_SQRTF][i] == results[BENCH_SQRTF][i];
+    }
+    TEST_NEAR(atan2_worst, 0.0, BENCH_TOLERANCE);
+    TEST_NEAR(asin_worst, 0.0, BENCH_TOLERANCE);
+    TEST_CHECK(sqrt_exact);
+    return TEST_RESULT();
+}
@@ -0,0 +1,271 @@
+/*
+ * Cost of one update of the Kalman filter: the engine of kalman.c, full and
+ * steady state, against the filter it replaced.
+ *
+ * The old kalman_filter() rebuilt Q (three powf), phi, G, H, R and I on the
+ * stack and went through generic arm_mat_*_f32 products and a Gauss-Jordan
+ * inverse on every call.  LegacyKalman below does the same work with plain
+ * loops in their place, minus the aliased products, which gave wrong results.
+ *
+ * Prints the time and, on x86, the TSC cycles of one update.  Fails if the
+ * three don't agree on the estimates, the timings are for reading only: wall
+ * clock comparisons are not reliable on a shared or instrumented host.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "kalman.h"
+#include "model.h"
+#include "tuning.h"
+#include "test.h"
+
+#define BENCH_T 0.005f
+#define BENCH_UPDATES 200000
+#define BENCH_RUNS 5
+
+#define N NUM_STATES
+#define M NUM_MEASUREMENTS
+
+typedef struct
+{
+    float x[N];
+    float P[N * N];
+} LegacyKalman;
+
+static void Legacy_Multiply(const float *a, const float *b, float *c, int rows, int inner, int cols)
+{
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            float sum = 0.0f;
+            for (int k = 0; k < inner; k++)
+                sum += a[i * inner + k] * b[k * cols + j];
+            c[i * cols + j] = sum;
+        }
+    }
+}
+
+static void Legacy_Transpose(const float *a, float *t, int rows, int cols)
+{
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+            t[j * rows + i] = a[i * cols + j];
+    }
+}
+
+// Gauss-Jordan with partial pivoting, as arm_mat_inverse_f32
+static void Legacy_Inverse(float *a, float *inverse, int n)
+{
+    for (int i = 0; i < n * n; i++)
+        inverse[i] = i % (n + 1) == 0 ? 1.0f : 0.0f;
+
+    for (int col = 0; col < n; col++)
+    {
+        int pivot = col;
+        for (int row = col + 1; row < n; row++)
+        {
+            if (fabsf(a[row * n + col]) > fabsf(a[pivot * n + col]))
+                pivot = row;
+        }
+        for (int k = 0; k < n; k++)
+        {
+            float t = a[col * n + k];
+            a[col * n + k] = a[pivot * n + k];
+            a[pivot * n + k] = t;
+            t = inverse[col * n + k];
+            inverse[col * n + k] = inverse[pivot * n + k];
+            inverse[pivot * n + k] = t;
+        }
+
+        const float scale = 1.0f / a[col * n + col];
+        for (int k = 0; k < n; k++)
+        {
+            a[col * n + k] *= scale;
+            inverse[col * n + k] *= scale;
+        }
+        for (int row = 0; row < n; row++)
+        {
+            if (row == col)
+                continue;
+            const float factor = a[row * n + col];
+            for (int k = 0; k < n; k++)
+            {
+                a[row * n + k] -= factor * a[col * n + k];
+                inverse[row * n + k] -= factor * inverse[col * n + k];
+            }
+        }
+    }
+}
+
+static float Legacy_Update(LegacyKalman *kf, const float y[M], const float u[NUM_INPUTS])
+{
+    const float a = KALMAN_Q_ANGLE, b = KALMAN_Q_VELOCITY, c = KALMAN_Q_BIAS;
+    const float T = BENCH_T;
+
+    const float Q[N * N] = {
+        c * powf(T, 3) / 3 + a * T, 0, -c * powf(T, 2) / 2,
+        0, b * T, 0,
+        -c * powf(T, 2) / 2, 0, c * T};
+    const float phi[N * N] = {1, 0, -T, 0, 1, 0, 0, 0, 1};
+    const float G[N * NUM_INPUTS] = {T, 0, 0, L / J * T, 0, 0};
+    const float H[M * N] = {1, 0, 0, 0, 1, 0};
+    const float R[M * M] = {KALMAN_R_ANGLE, 0, 0, KALMAN_R_RATE};
+    const float I[N * N] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+
+    float Ht[N * M], PHt[N * M], S[M * M], Sinv[M * M], K[N * M];
+    Legacy_Transpose(H, Ht, M, N);
+    Legacy_Multiply(kf->P, Ht, PHt, N, N, M);
+    Legacy_Multiply(H, PHt, S, M, N, M);
+    for (int i = 0; i < M * M; i++)
+        S[i] += R[i];
+    Legacy_Inverse(S, Sinv, M);
+    Legacy_Multiply(PHt, Sinv, K, N, M, M);
+
+    float Hx[M], innovation[M], correction[N];
+    Legacy_Multiply(H, kf->x, Hx, M, N, 1);
+    for (int i = 0; i < M; i++)
+        innovation[i] = y[i] - Hx[i];
+    Legacy_Multiply(K, innovation, correction, N, M, 1);
+    for (int i = 0; i < N; i++)
+        kf->x[i] += correction[i];
+
+    float KH[N * N], IKH[N * N], P[N * N];
+    Legacy_Multiply(K, H, KH, N, M, N);
+    for (int i = 0; i < N * N; i++)
+        IKH[i] = I[i] - KH[i];
+    Legacy_Multiply(IKH, kf->P, P, N, N, N);
+
+    const float estimate = kf->x[0];
+
+    float phix[N], Gu[N];
+    Legacy_Multiply(phi, kf->x, phix, N, N, 1);
+    Legacy_Multiply(G, u, Gu, N, NUM_INPUTS, 1);
+    for (int i = 0; i < N; i++)
+        kf->x[i] = phix[i] + Gu[i];
+
+    float phit[N * N], phiP[N * N];
+    Legacy_Transpose(phi, phit, N, N);
+    Legacy_Multiply(phi, P, phiP, N, N, N);
+    Legacy_Multiply(phiP, phit, kf->P, N, N, N);
+    for (int i = 0; i < N * N; i++)
+        kf->P[i] += Q[i];
+
+    return estimate;
+}
+
+typedef enum
+{
+    BENCH_LEGACY,
+    BENCH_FULL,
+    BENCH_STEADY_STATE,
+    BENCH_VARIANTS
+} BenchVariant;
+
+static const char *const names[BENCH_VARIANTS] = {"legacy kalman_filter", "KalmanFilter_Update", "KalmanFilter_UpdateSteadyState"};
+
+static float inputs[BENCH_UPDATES][M + NUM_INPUTS];
+
+static void Bench_Inputs(void)
+{
+    uint64_t rng = 1;
+    for (int i = 0; i < BENCH_UPDATES; i++)
+    {
+        const double t = i * (double)BENCH_T;
+        rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+        const double noise = (double)(rng >> 40) / (double)(1 << 24) - 0.5;
+        inputs[i][0] = (float)(0.3 * sin(3.0 * t) + 0.02 * noise);
+        inputs[i][1] = (float)(0.9 * cos(3.0 * t) + 0.02);
+        inputs[i][2] = inputs[i][1];
+        inputs[i][3] = (float)(-0.27 * sin(3.0 * t));
+    }
+}
+
+static uint64_t Bench_Cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static double Bench_Seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Best of BENCH_RUNS passes over the inputs, per update.  estimates gets the
+// last pass.
+static void Bench_Run(BenchVariant variant, double *seconds, double *cycles, float *estimates)
+{
+    *seconds = INFINITY;
+    *cycles = INFINITY;
+    for (int run = 0; run < BENCH_RUNS; run++)
+    {
+        LegacyKalman legacy = {{0}, {0, 0, 0, 0, 0, 0, 0, 0, 1e3f}};
+        KalmanFilter kf = {KALMAN_Q_ANGLE, KALMAN_Q_VELOCITY, KALMAN_Q_BIAS, KALMAN_R_ANGLE, KALMAN_R_RATE, BENCH_T};
+        KalmanFilter_Init(&kf);
+
+        const double start = Bench_Seconds();
+        const uint64_t start_cycles = Bench_Cycles();
+        for (int i = 0; i < BENCH_UPDATES; i++)
+        {
+            const float *y = inputs[i];
+            const float *u = inputs[i] + M;
+            switch (variant)
+            {
+            case BENCH_LEGACY:
+                estimates[i] = Legacy_Update(&legacy, y, u);
+                break;
+            case BENCH_FULL:
+                estimates[i] = KalmanFilter_Update(&kf, y, u);
+                break;
+            default:
+                estimates[i] = KalmanFilter_UpdateSteadyState(&kf, y, u);
+                break;
+            }
+        }
+        const uint64_t end_cycles = Bench_Cycles();
+        const double end = Bench_Seconds();
+
+        *seconds = fmin(*seconds, (end - start) / BENCH_UPDATES);
+        *cycles = fmin(*cycles, (double)(end_cycles - start_cycles) / BENCH_UPDATES);
+    }
+}
+
+static float estimates[BENCH_VARIANTS][BENCH_UPDATES];
+
+int main(void)
+{
+    Bench_Inputs();
+
+    double seconds[BENCH_VARIANTS];
+    double cycles[BENCH_VARIANTS];
+    for (int v = 0; v < BENCH_VARIANTS; v++)
+    {
+        Bench_Run(v, &seconds[v], &cycles[v], estimates[v]);
+        printf("%-32s %8.1f ns %8.1f cycles per update\n", names[v], seconds[v] * 1e9, cycles[v]);
+    }
+
+    // The full filter does the legacy one's arithmetic in another order, the
+    // steady-state one only agrees once the gain has converged
+    double full = 0.0;
+    double steady = 0.0;
+    for (int i = 0; i < BENCH_UPDATES; i++)
+    {
+        full = fmax(full, fabs((double)estimates[BENCH_FULL][i] - estimates[BENCH_LEGACY][i]));
+        if (i >= BENCH_UPDATES / 2)
+            steady = fmax(steady, fabs((double)estimates[BENCH_STEADY_STATE][i] - estimates[BENCH_LEGACY][i]));
+    }
+    TEST_NEAR(full, 0.0, 1e-4);
+    TEST_NEAR(steady, 0.0, 1e-3);
+    return TEST_RESULT();
+}
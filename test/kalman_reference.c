@@ -0,0 +1,112 @@
+#include <math.h>
+#include <string.h>
+#include "kalman_reference.h"
+#include "model.h"
+
+#define N NUM_STATES
+#define M NUM_MEASUREMENTS
+
+// c = a * b, a is rows x inner and b inner x cols, c must not alias them
+static void Reference_Multiply(const double *a, const double *b, double *c, int rows, int inner, int cols)
+{
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            double sum = 0.0;
+            for (int k = 0; k < inner; k++)
+                sum += a[i * inner + k] * b[k * cols + j];
+            c[i * cols + j] = sum;
+        }
+    }
+}
+
+static void Reference_Transpose(const double *a, double *t, int rows, int cols)
+{
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+            t[j * rows + i] = a[i * cols + j];
+    }
+}
+
+void KalmanReference_Init(KalmanReference *ref, const KalmanFilter *kf)
+{
+    memset(ref, 0, sizeof(*ref));
+    ref->a = kf->a;
+    ref->b = kf->b;
+    ref->c = kf->c;
+    ref->r_angle = kf->r_angle;
+    ref->r_rate = kf->r_rate;
+    ref->T = kf->T;
+    ref->P[N * N - 1] = 1e3;
+}
+
+double KalmanReference_Update(KalmanReference *ref, const double y[M], const double u[NUM_INPUTS])
+{
+    const double T = ref->T;
+    const double Q[N * N] = {
+        ref->c * pow(T, 3) / 3 + ref->a * T, 0, -ref->c * pow(T, 2) / 2,
+        0, ref->b * T, 0,
+        -ref->c * pow(T, 2) / 2, 0, ref->c * T};
+    const double phi[N * N] = {
+        1, 0, -T,
+        0, 1, 0,
+        0, 0, 1};
+    const double G[N * NUM_INPUTS] = {
+        T, 0,
+        0, (double)L / (double)J * T,
+        0, 0};
+    const double H[M * N] = {
+        1, 0, 0,
+        0, 1, 0};
+    const double R[M * M] = {
+        ref->r_angle, 0,
+        0, ref->r_rate};
+
+    // K = P H' inv(H P H' + R)
+    double Ht[N * M], PHt[N * M], S[M * M];
+    Reference_Transpose(H, Ht, M, N);
+    Reference_Multiply(ref->P, Ht, PHt, N, N, M);
+    Reference_Multiply(H, PHt, S, M, N, M);
+    for (int i = 0; i < M * M; i++)
+        S[i] += R[i];
+    const double det = S[0] * S[3] - S[1] * S[2];
+    const double Sinv[M * M] = {S[3] / det, -S[1] / det, -S[2] / det, S[0] / det};
+    Reference_Multiply(PHt, Sinv, ref->K, N, M, M);
+
+    // x = x + K (y - H x)
+    double Hx[M], innovation[M], correction[N];
+    Reference_Multiply(H, ref->x, Hx, M, N, 1);
+    for (int i = 0; i < M; i++)
+        innovation[i] = y[i] - Hx[i];
+    Reference_Multiply(ref->K, innovation, correction, N, M, 1);
+    for (int i = 0; i < N; i++)
+        ref->x[i] += correction[i];
+
+    // P = (I - K H) P
+    double KH[N * N], IKH[N * N], P[N * N];
+    Reference_Multiply(ref->K, H, KH, N, M, N);
+    for (int i = 0; i < N * N; i++)
+        IKH[i] = (i % (N + 1) == 0 ? 1.0 : 0.0) - KH[i];
+    Reference_Multiply(IKH, ref->P, P, N, N, N);
+
+    const double estimate = ref->x[0];
+
+    // x = phi x + G u
+    double phix[N], Gu[N];
+    Reference_Multiply(phi, ref->x, phix, N, N, 1);
+    Reference_Multiply(G, u, Gu, N, NUM_INPUTS, 1);
+    for (int i = 0; i < N; i++)
+        ref->x[i] = phix[i] + Gu[i];
+
+    // P = phi P phi' + Q
+    double phit[N * N], phiP[N * N];
+    Reference_Transpose(phi, phit, N, N);
+    Reference_Multiply(phi, P, phiP, N, N, N);
+    Reference_Multiply(phiP, phit, ref->P, N, N, N);
+    for (int i = 0; i < N * N; i++)
+        ref->P[i] += Q[i];
+
+    return estimate;
+}
@@ -0,0 +1,30 @@
+#ifndef KALMAN_REFERENCE_H
+#define KALMAN_REFERENCE_H
+
+#include "kalman.h"
+
+/*
+ * The filter of kalman.c written the textbook way, in double precision: every
+ * matrix is rebuilt for each update, the two measurements are processed
+ * jointly with the inverse of the innovation covariance, and the covariance
+ * goes through full matrix products.  It is what kalman.c is checked against.
+ */
+
+typedef struct
+{
+    double a, b, c;
+    double r_angle, r_rate;
+    double T;
+
+    double x[NUM_STATES];
+    double P[NUM_STATES * NUM_STATES];
+    double K[NUM_STATES * NUM_MEASUREMENTS]; /* gain of the last update */
+} KalmanReference;
+
+/* Tuning of kf, and the initial state of KalmanFilter_Init() */
+void KalmanReference_Init(KalmanReference *ref, const KalmanFilter *kf);
+
+/* Same contract as KalmanFilter_Update() */
+double KalmanReference_Update(KalmanReference *ref, const double y[NUM_MEASUREMENTS], const double u[NUM_INPUTS]);
+
+#endif
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "main.h"
+#include "stubs.h"
+
+RCC_TypeDef Stub_RCC;
+IWDG_TypeDef Stub_IWDG;
+DBGMCU_TypeDef Stub_DBGMCU;
+GPIO_TypeDef Stub_GPIOE;
+DWT_Type Stub_DWT;
+
+// The 96 MHz core clock of SystemClock_Config()
+uint32_t SystemCoreClock = 96000000;
+
+static uint32_t primask;
+static uint8_t *flash;
+static int flash_locked = 1;
+static StubFlashCounters flash_counters;
+
+// The sector sits at its address on the chip, low in the address space where
+// nothing of a hosted process lives
+__attribute__((constructor)) static void Stub_MapFlash(void)
+{
+    void *address = (void *)(uintptr_t)STUB_FLASH_SECTOR7_ADDRESS;
+    flash = mmap(address, STUB_FLASH_SECTOR7_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (flash != address)
+    {
+        perror("stubs: mapping flash sector 7");
+        abort();
+    }
+    Stub_FlashReset();
+}
+
+void Stub_FlashReset(void)
+{
+    memset(flash, 0xFF, STUB_FLASH_SECTOR7_SIZE);
+    flash_locked = 1;
+    flash_counters = (StubFlashCounters){0};
+}
+
+uint8_t *Stub_Flash(void)
+{
+    return flash;
+}
+
+void Stub_FlashCounters(StubFlashCounters *counters)
+{
+    *counters = flash_counters;
+}
+
+uint32_t __get_PRIMASK(void)
+{
+    return primask;
+}
+
+void __set_PRIMASK(uint32_t value)
+{
+    primask = value & 1;
+}
+
+void __disable_irq(void)
+{
+    primask = 1;
+}
+
+void __enable_irq(void)
+{
+    primask = 0;
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *port, uint16_t pin)
+{
+    return (port->IDR & pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void Error_Handler(void)
+{
+    fprintf(stderr, "stubs: Error_Handler\n");
+    abort();
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+    flash_locked = 0;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+    flash_locked = 1;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t type, uint32_t address, uint64_t data)
+{
+    const uint32_t offset = address - STUB_FLASH_SECTOR7_ADDRESS;
+    if (flash_locked || type != FLASH_TYPEPROGRAM_WORD || address % 4 != 0 ||
+        address < STUB_FLASH_SECTOR7_ADDRESS || offset >= STUB_FLASH_SECTOR7_SIZE)
+    {
+        flash_counters.errors++;
+        return HAL_ERROR;
+    }
+
+    // Programming only clears bits, a word has to be erased to take new ones
+    uint32_t word;
+    memcpy(&word, flash + offset, sizeof(word));
+    if ((uint32_t)data & ~word)
+    {
+        flash_counters.errors++;
+        return HAL_ERROR;
+    }
+    word &= (uint32_t)data;
+    memcpy(flash + offset, &word, sizeof(word));
+    flash_counters.programs++;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *erase, uint32_t *sector_error)
+{
+    *sector_error = 0xFFFFFFFFu;
+    if (flash_locked || erase->TypeErase != FLASH_TYPEERASE_SECTORS || erase->Sector != FLASH_SECTOR_7 ||
+        erase->NbSectors != 1)
+    {
+        flash_counters.errors++;
+        *sector_error = erase->Sector;
+        return HAL_ERROR;
+    }
+
+    memset(flash, 0xFF, STUB_FLASH_SECTOR7_SIZE);
+    flash_counters.erases++;
+    return HAL_OK;
+}
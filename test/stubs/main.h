@@ -0,0 +1,24 @@
+#ifndef __MAIN_H
+#define __MAIN_H
+
+/* Host stand-in for Core/Inc/main.h, for the firmware sources of the host
+ * build: the HAL is the one of stm32f4xx_hal.h next to it.  Keep the
+ * priorities in step with the plan there. */
+
+#include "stm32f4xx_hal.h"
+
+/* Sensor interrupt lines */
+#define INT1_Pin GPIO_PIN_4
+#define INT1_GPIO_Port GPIOE
+#define MEMS_INT2_Pin GPIO_PIN_1
+#define MEMS_INT2_GPIO_Port GPIOE
+
+#define IRQ_PRIORITY_CONTROL 0
+#define IRQ_PRIORITY_SENSOR_BUS 1
+#define IRQ_PRIORITY_UART 2
+#define IRQ_PRIORITY_SYSTICK 3
+#define IRQ_PRIORITY_DEFERRED 15
+
+void Error_Handler(void);
+
+#endif
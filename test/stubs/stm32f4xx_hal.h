@@ -0,0 +1,119 @@
+#ifndef STM32F4XX_HAL_H
+#define STM32F4XX_HAL_H
+
+/*
+ * Host stand-in for the HAL and CMSIS headers, only what the firmware sources
+ * of the host build use: PRIMASK, the barrier and the flash programming
+ * interface, the registers of the reset flags, the watchdog and its debug
+ * freeze, the input pins and the cycle counter.
+ *
+ * The flash sector 7 of the settings log is ordinary memory mapped at its
+ * address, 0x08060000, so the firmware reads it as it would on the chip.  It
+ * behaves like NOR flash: erasing sets every bit, programming can only clear
+ * bits.  The test controls are in stubs.h.
+ */
+
+#include <stdint.h>
+
+typedef enum
+{
+    HAL_OK,
+    HAL_ERROR,
+    HAL_BUSY,
+    HAL_TIMEOUT
+} HAL_StatusTypeDef;
+
+/* PRIMASK: the host has no interrupts, it is only kept for the tests */
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+void __disable_irq(void);
+void __enable_irq(void);
+
+#define __DMB() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+/* Reset flags, independent watchdog and debug freeze, plain memory */
+typedef struct
+{
+    volatile uint32_t CSR;
+} RCC_TypeDef;
+
+typedef struct
+{
+    volatile uint32_t KR;
+    volatile uint32_t PR;
+    volatile uint32_t RLR;
+    volatile uint32_t SR;
+} IWDG_TypeDef;
+
+typedef struct
+{
+    volatile uint32_t APB1FZ;
+} DBGMCU_TypeDef;
+
+extern RCC_TypeDef Stub_RCC;
+extern IWDG_TypeDef Stub_IWDG;
+extern DBGMCU_TypeDef Stub_DBGMCU;
+
+#define RCC (&Stub_RCC)
+#define IWDG (&Stub_IWDG)
+#define DBGMCU (&Stub_DBGMCU)
+
+#define RCC_CSR_RMVF (1u << 24)
+#define RCC_CSR_IWDGRSTF (1u << 29)
+#define IWDG_SR_PVU (1u << 0)
+#define IWDG_SR_RVU (1u << 1)
+#define DBGMCU_APB1_FZ_DBG_IWDG_STOP (1u << 12)
+
+extern uint32_t SystemCoreClock;
+
+/* DWT cycle counter, it only moves when a test moves it */
+typedef struct
+{
+    volatile uint32_t CYCCNT;
+} DWT_Type;
+
+extern DWT_Type Stub_DWT;
+
+#define DWT (&Stub_DWT)
+
+/* GPIO inputs, the levels are the bits of IDR a test sets */
+typedef enum
+{
+    GPIO_PIN_RESET,
+    GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef struct
+{
+    uint32_t IDR;
+} GPIO_TypeDef;
+
+extern GPIO_TypeDef Stub_GPIOE;
+
+#define GPIOE (&Stub_GPIOE)
+#define GPIO_PIN_1 ((uint16_t)0x0002)
+#define GPIO_PIN_4 ((uint16_t)0x0010)
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *port, uint16_t pin);
+
+/* Flash */
+#define FLASH_TYPEERASE_SECTORS 0x00000000u
+#define FLASH_VOLTAGE_RANGE_3 0x00000002u
+#define FLASH_TYPEPROGRAM_WORD 0x00000002u
+#define FLASH_SECTOR_7 7u
+
+typedef struct
+{
+    uint32_t TypeErase;
+    uint32_t Banks;
+    uint32_t Sector;
+    uint32_t NbSectors;
+    uint32_t VoltageRange;
+} FLASH_EraseInitTypeDef;
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef STUBS_H
+#define STUBS_H
+
+#include <stdint.h>
+
+/*
+ * Test side of the HAL stand-ins in stm32f4xx_hal.h.
+ */
+
+#define STUB_FLASH_SECTOR7_ADDRESS 0x08060000u
+#define STUB_FLASH_SECTOR7_SIZE 0x20000u
+
+typedef struct
+{
+    uint32_t erases;   /* sectors erased */
+    uint32_t programs; /* words programmed */
+    uint32_t errors;   /* calls that failed: locked, out of the sector, or a bit set back to 1 */
+} StubFlashCounters;
+
+/* Sector 7 as erased, counters back to 0 */
+void Stub_FlashReset(void);
+
+/* The sector as the firmware reads it */
+uint8_t *Stub_Flash(void);
+
+void Stub_FlashCounters(StubFlashCounters *counters);
+
+#endif
@@ -0,0 +1,166 @@
+/*
+ * Frames of the firmware encoder for the tests of the decoder of the UI,
+ * ui/src/telemetry.rs.  telemetry.c runs as is, with the UART ring replaced by
+ * a capture buffer, and the frames are printed as Rust constants:
+ *
+ *     telemetry_vectors > ui/src/telemetry_vectors.rs
+ *
+ * With a file name the output is compared to it instead, the test fails when
+ * the encoder changed and the checked-in vectors were not regenerated.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "telemetry.h"
+#include "UART.h"
+#include "profiler.h"
+
+#define CAPTURE_SIZE 4096
+#define CAPTURE_FRAMES 8
+
+static uint8_t capture[CAPTURE_SIZE];
+static uint32_t capture_length;
+static uint32_t frame_start[CAPTURE_FRAMES + 1];
+static uint32_t frames;
+
+static char output[16384];
+static size_t output_length;
+
+int UartReserve(uint32_t length, uint32_t *position)
+{
+    if (capture_length + length > CAPTURE_SIZE || frames == CAPTURE_FRAMES)
+    {
+        fprintf(stderr, "telemetry_vectors: capture full\n");
+        exit(1);
+    }
+    *position = capture_length;
+    frame_start[frames++] = capture_length;
+    capture_length += length;
+    frame_start[frames] = capture_length;
+    return 1;
+}
+
+// The commit fills exactly its reservation
+void UartCommit(uint32_t position, const void *data, uint32_t length)
+{
+    if (position + length != frame_start[frames])
+    {
+        fprintf(stderr, "telemetry_vectors: frame of %u bytes in a reservation of %u\n", (unsigned)length,
+                (unsigned)(frame_start[frames] - position));
+        exit(1);
+    }
+    memcpy(capture + position, data, length);
+}
+
+uint32_t Profiler_Micros(void)
+{
+    static uint32_t micros = 1000;
+    return micros += 1000;
+}
+
+static void Emit(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+static void Emit(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    output_length += vsnprintf(output + output_length, sizeof(output) - output_length, format, args);
+    va_end(args);
+}
+
+static void Emit_Bytes(const char *name, const uint8_t *bytes, uint32_t length)
+{
+    Emit("const %s: &[u8] = &[", name);
+    for (uint32_t i = 0; i < length; i++)
+        Emit("%s0x%02x,", i % 12 == 0 ? "\n    " : " ", bytes[i]);
+    Emit("\n];\n\n");
+}
+
+// All the frames sent since the last call, as one constant
+static void Emit_Frames(const char *name, uint32_t first)
+{
+    Emit_Bytes(name, capture + frame_start[first], frame_start[frames] - frame_start[first]);
+}
+
+int main(int argc, char **argv)
+{
+    Emit("// Frames of the firmware encoder, mcu/Core/Src/telemetry.c, generated by\n"
+         "// test/telemetry_vectors.c.  Do not edit, regenerate with\n"
+         "//     telemetry_vectors > ui/src/telemetry_vectors.rs\n"
+         "// from the host build.  The values sent are the ones the tests expect.\n\n");
+
+    // seq 0, 2000 us
+    const TelemetrySample sample = {0.125f, -0.5f, 0.25f, -1.5f, 120.0f, 0.0f, 3000.0f, 0.0f};
+    uint32_t first = frames;
+    Telemetry_SendSample(&sample);
+    Emit_Frames("SAMPLE_FRAME", first);
+
+    // seq 1, 3000 us.  Zero bytes all over the payload for the COBS codes
+    const TelemetryHealth health = {1, 0, 7, 2, 0, 300, 5, 1, 0, 65536, 1, 3, {0.01f, -0.02f, 0.0f}};
+    first = frames;
+    Telemetry_SendHealth(&health);
+    Emit_Frames("HEALTH_FRAME", first);
+
+    // seq 2, 4000 us
+    const char text[] = "LQR did not converge, gain kept\r\n";
+    first = frames;
+    Telemetry_SendText(text, sizeof(text) - 1);
+    Emit_Frames("TEXT_FRAME", first);
+
+    // seq 3 and 4: more than TELEMETRY_MAX_PAYLOAD goes out in two frames
+    char long_text[TELEMETRY_MAX_PAYLOAD + 20];
+    for (uint32_t i = 0; i < sizeof(long_text); i++)
+        long_text[i] = (char)('a' + i % 26);
+    first = frames;
+    Telemetry_SendText(long_text, sizeof(long_text));
+    Emit_Frames("LONG_TEXT_FRAMES", first);
+
+    // The sample frame with one bit of the payload flipped.  The COBS codes
+    // are left alone so the frame still decodes, only the CRC fails.
+    uint8_t bad[TELEMETRY_MAX_PAYLOAD * 2];
+    const uint32_t sample_length = frame_start[1] - frame_start[0];
+    memcpy(bad, capture + frame_start[0], sample_length);
+    uint32_t corrupt = sizeof(TelemetryHeader) + 4;
+    for (uint32_t code = 0; code <= corrupt; code += bad[code])
+    {
+        if (code == corrupt)
+            corrupt++;
+    }
+    bad[corrupt] ^= bad[corrupt] == 0x01 ? 0x02 : 0x01;
+    Emit_Bytes("BAD_CRC_FRAME", bad, sample_length);
+
+    // The first half of the health frame, cut off by the delimiter
+    const uint32_t health_length = frame_start[2] - frame_start[1];
+    uint8_t truncated[TELEMETRY_MAX_PAYLOAD];
+    memcpy(truncated, capture + frame_start[1], health_length / 2);
+    truncated[health_length / 2] = 0;
+    Emit_Bytes("TRUNCATED_FRAME", truncated, health_length / 2 + 1);
+
+    if (argc < 2)
+    {
+        fwrite(output, 1, output_length, stdout);
+        return 0;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (!file)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    static char expected[sizeof(output)];
+    const size_t expected_length = fread(expected, 1, sizeof(expected), file);
+    fclose(file);
+
+    if (expected_length != output_length || memcmp(expected, output, output_length) != 0)
+    {
+        printf("%s differs from the frames of the encoder, regenerate it with\n"
+               "    telemetry_vectors > %s\n",
+               argv[1], argv[1]);
+        return 1;
+    }
+    printf("%s matches the encoder\n", argv[1]);
+    return 0;
+}
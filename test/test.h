@@ -0,0 +1,48 @@
+#ifndef TEST_H
+#define TEST_H
+
+/*
+ * Checks of the host unit tests.  Each test file is one executable: a failed
+ * check prints where and what it saw and the run goes on, TEST_RESULT() at
+ * the end of main() makes the exit status non-zero if any failed.
+ *
+ * The values are passed on as doubles with explicit casts, so the checks
+ * also work in files that include fastmath.h and its promotion errors.
+ */
+
+#include <stdio.h>
+
+static int test_checks;
+static int test_failures;
+
+static inline void Test_Check(int passed, const char *expression, const char *file, int line)
+{
+    test_checks++;
+    if (passed)
+        return;
+    test_failures++;
+    printf("%s:%d: check failed: %s\n", file, line, expression);
+}
+
+static inline void Test_Near(double actual, double expected, double tolerance, const char *expression,
+                             const char *file, int line)
+{
+    test_checks++;
+    if (actual - expected <= tolerance && expected - actual <= tolerance)
+        return;
+    test_failures++;
+    printf("%s:%d: %s = %.9g, expected %.9g within %.3g\n", file, line, expression, actual, expected, tolerance);
+}
+
+#define TEST_CHECK(condition) Test_Check((condition) != 0, #condition, __FILE__, __LINE__)
+
+/* |actual - expected| <= tolerance, in double */
+#define TEST_NEAR(actual, expected, tolerance) \
+    Test_Near((double)(actual), (double)(expected), (double)(tolerance), #actual, __FILE__, __LINE__)
+
+#define TEST_RUN(test) (printf("%s\n", #test), test())
+
+/* Exit status of main() */
+#define TEST_RESULT() (printf("%d checks, %d failed\n", test_checks, test_failures), test_failures != 0)
+
+#endif
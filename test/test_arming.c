@@ -0,0 +1,117 @@
+#include "arming.h"
+#include "motor.h"
+#include "test.h"
+
+#define TEST_CALIBRATE_US 3000000u
+#define TEST_STOP_US 1000000u
+#define TEST_SPIN_UP_US 1000000u
+
+/* Commands written by the last step, TEST_UNTOUCHED if it left them alone */
+#define TEST_UNTOUCHED -1.0f
+
+static float left;
+static float right;
+
+static ArmingState Test_Step(Arming *arming, uint32_t now_us)
+{
+    left = TEST_UNTOUCHED;
+    right = TEST_UNTOUCHED;
+    return Arming_Step(arming, now_us, &left, &right);
+}
+
+// The state and the commands of a step at now_us
+static void Test_Phase(Arming *arming, uint32_t now_us, ArmingState state, float command)
+{
+    TEST_CHECK(Test_Step(arming, now_us) == state);
+    TEST_NEAR(left, command, 0.0);
+    TEST_NEAR(right, command, 0.0);
+}
+
+// Each phase holds its command for its whole duration and the next one takes
+// over on the step at its end, the calibration only counts once the stop after
+// it is over
+static void Test_Calibration(uint32_t start_us)
+{
+    Arming arming;
+    Arming_Start(&arming, 1, start_us);
+    TEST_CHECK(Arming_State(&arming) == ARMING_CALIBRATE);
+
+    uint32_t t = start_us;
+    Test_Phase(&arming, t, ARMING_CALIBRATE, MOTOR_COMMAND_MAX);
+    Test_Phase(&arming, t + TEST_CALIBRATE_US - 1, ARMING_CALIBRATE, MOTOR_COMMAND_MAX);
+    TEST_CHECK(!Arming_Calibrated(&arming));
+
+    t += TEST_CALIBRATE_US;
+    Test_Phase(&arming, t, ARMING_STOP, 0.0f);
+    Test_Phase(&arming, t + TEST_STOP_US - 1, ARMING_STOP, 0.0f);
+    TEST_CHECK(!Arming_Calibrated(&arming));
+
+    t += TEST_STOP_US;
+    Test_Phase(&arming, t, ARMING_SPIN_UP, ARMING_IDLE_COMMAND);
+    TEST_CHECK(Arming_Calibrated(&arming));
+    Test_Phase(&arming, t + TEST_SPIN_UP_US - 1, ARMING_SPIN_UP, ARMING_IDLE_COMMAND);
+
+    t += TEST_SPIN_UP_US;
+    Test_Phase(&arming, t, ARMING_ARMED, TEST_UNTOUCHED);
+    Test_Phase(&arming, t + TEST_CALIBRATE_US, ARMING_ARMED, TEST_UNTOUCHED);
+    TEST_CHECK(Arming_State(&arming) == ARMING_ARMED);
+    TEST_CHECK(Arming_Calibrated(&arming));
+}
+
+static void Test_CalibrationSequence(void)
+{
+    Test_Calibration(1000);
+}
+
+// Across the wrap of the microsecond counter, 71.6 minutes after boot
+static void Test_CalibrationWraparound(void)
+{
+    Test_Calibration(0xFFFFFFFFu - TEST_CALIBRATE_US / 2);
+    Test_Calibration(0xFFFFFFFFu - TEST_CALIBRATE_US - TEST_STOP_US / 2);
+}
+
+// Without a calibration the sequence starts at the stop and never reports one
+static void Test_Boot(void)
+{
+    Arming arming;
+    const uint32_t start_us = 0xFFFFFFFFu - TEST_STOP_US / 2;
+    Arming_Start(&arming, 0, start_us);
+
+    Test_Phase(&arming, start_us, ARMING_STOP, 0.0f);
+    Test_Phase(&arming, start_us + TEST_STOP_US, ARMING_SPIN_UP, ARMING_IDLE_COMMAND);
+    Test_Phase(&arming, start_us + TEST_STOP_US + TEST_SPIN_UP_US, ARMING_ARMED, TEST_UNTOUCHED);
+    TEST_CHECK(!Arming_Calibrated(&arming));
+}
+
+// A hold starts the current phase over from its time, as after the settings
+// erase in the stop: the ESCs get a whole stop again
+static void Test_Hold(void)
+{
+    Arming arming;
+    Arming_Start(&arming, 1, 0);
+    Test_Step(&arming, TEST_CALIBRATE_US);
+    TEST_CHECK(Arming_State(&arming) == ARMING_STOP);
+
+    const uint32_t hold_us = TEST_CALIBRATE_US + TEST_STOP_US / 2 + 2000000;
+    Arming_Hold(&arming, hold_us);
+    Test_Phase(&arming, hold_us, ARMING_STOP, 0.0f);
+    Test_Phase(&arming, hold_us + TEST_STOP_US - 1, ARMING_STOP, 0.0f);
+    TEST_CHECK(!Arming_Calibrated(&arming));
+    Test_Phase(&arming, hold_us + TEST_STOP_US, ARMING_SPIN_UP, ARMING_IDLE_COMMAND);
+    TEST_CHECK(Arming_Calibrated(&arming));
+
+    // A hold in the spin-up keeps it at idle for a whole second again
+    Arming_Hold(&arming, hold_us + TEST_STOP_US + 500000);
+    Test_Phase(&arming, hold_us + TEST_STOP_US + 500000 + TEST_SPIN_UP_US - 1, ARMING_SPIN_UP,
+               ARMING_IDLE_COMMAND);
+    Test_Phase(&arming, hold_us + TEST_STOP_US + 500000 + TEST_SPIN_UP_US, ARMING_ARMED, TEST_UNTOUCHED);
+}
+
+int main(void)
+{
+    TEST_RUN(Test_CalibrationSequence);
+    TEST_RUN(Test_CalibrationWraparound);
+    TEST_RUN(Test_Boot);
+    TEST_RUN(Test_Hold);
+    return TEST_RESULT();
+}
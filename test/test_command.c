@@ -0,0 +1,91 @@
+#include <math.h>
+#include <stdlib.h>
+#include "command.h"
+#include "test.h"
+
+static void Test_Value(const char *command, char parameter, float expected)
+{
+    char p = 0;
+    float v = 0.0f;
+    TEST_CHECK(Command_Parse(command, &p, &v));
+    TEST_CHECK(p == parameter);
+    TEST_NEAR(v, expected, 1e-6 * fabs((double)expected));
+}
+
+static void Test_Rejected(const char *command)
+{
+    char p = '?';
+    float v = 42.0f;
+    TEST_CHECK(!Command_Parse(command, &p, &v));
+    TEST_CHECK(p == '?');
+    TEST_NEAR(v, 42.0f, 0.0);
+}
+
+static void Test_Forms(void)
+{
+    Test_Value("p:1.5", 'p', 1.5f);
+    Test_Value("i:-0.25", 'i', -0.25f);
+    Test_Value("d:+3", 'd', 3.0f);
+    Test_Value("q:2e3", 'q', 2000.0f);
+    Test_Value("w:1.25E-2", 'w', 0.0125f);
+    Test_Value("r:.5", 'r', 0.5f);
+    Test_Value("x:7.", 'x', 7.0f);
+    Test_Value("f: 1000\r\n", 'f', 1000.0f);
+    Test_Value("y:0.000012345", 'y', 1.2345e-5f);
+    Test_Value("z:0", 'z', 0.0f);
+
+    // The exponent letter without digits isn't part of the number
+    Test_Value("p:4e", 'p', 4.0f);
+}
+
+// Digits past the precision of a float and the ends of its range
+static void Test_Range(void)
+{
+    Test_Value("p:3.14159265358979323846", 'p', 3.14159265f);
+    Test_Value("p:12345678901234", 'p', 12345678901234.0f);
+    Test_Value("p:1e38", 'p', 1e38f);
+    Test_Value("p:1.5e-37", 'p', 1.5e-37f);
+    Test_Value("p:0.0000000000000000000000000000000000001", 'p', 1e-37f);
+}
+
+// Against the C library, on the kind of values sent
+static void Test_Strtof(void)
+{
+    const char *const values[] = {"0.001", "123.456", "-98765.4321", "6.02e23", "1e-10", "-0.1", "999999999", "2.5e+5"};
+    for (unsigned i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        char command[32];
+        snprintf(command, sizeof(command), "k:%s", values[i]);
+        const float expected = strtof(values[i], NULL);
+
+        char p;
+        float v;
+        TEST_CHECK(Command_Parse(command, &p, &v));
+        TEST_NEAR(v, expected, 2e-7 * fabs((double)expected));
+    }
+}
+
+static void Test_Malformed(void)
+{
+    Test_Rejected("");
+    Test_Rejected("p");
+    Test_Rejected("p:");
+    Test_Rejected("p1.5");
+    Test_Rejected("p:abc");
+    Test_Rejected("p:-");
+    Test_Rejected("p:.");
+    Test_Rejected("p:e5");
+    Test_Rejected("p:nan");
+    Test_Rejected("p:inf");
+    Test_Rejected("p:1e39");
+    Test_Rejected("p:1e999999");
+}
+
+int main(void)
+{
+    TEST_RUN(Test_Forms);
+    TEST_RUN(Test_Range);
+    TEST_RUN(Test_Strtof);
+    TEST_RUN(Test_Malformed);
+    return TEST_RESULT();
+}
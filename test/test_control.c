@@ -0,0 +1,111 @@
+#include <math.h>
+#include "control.h"
+#include "tuning.h"
+#include "test.h"
+
+#define TEST_ANGLE_S 0.005f
+
+typedef struct
+{
+    PIDController pid;
+    KalmanFilter kalman;
+    LQR_Controller lqr;
+    Mixer mixer;
+    Control control;
+} TestLoop;
+
+// The boot tuning of main.c at the 200 Hz angle step
+static void Test_Init(TestLoop *t, ControlLaw law, ControlFilter filter)
+{
+    t->pid = (PIDController){PID_KP, PID_KI, PID_KD, PID_TAU, PID_LIM_MIN, PID_LIM_MAX,
+                             PID_LIM_MIN_INT, PID_LIM_MAX_INT, TEST_ANGLE_S};
+    t->kalman = (KalmanFilter){KALMAN_Q_ANGLE, KALMAN_Q_VELOCITY, KALMAN_Q_BIAS,
+                               KALMAN_R_ANGLE, KALMAN_R_RATE, TEST_ANGLE_S};
+    t->lqr = (LQR_Controller){LQR_Q_ANGLE, LQR_Q_RATE, LQR_R, TEST_ANGLE_S};
+    PIDController_Init(&t->pid);
+    KalmanFilter_Init(&t->kalman);
+    LQR_init(&t->lqr);
+    const MixerCalibration calibration = {CONTROL_THRUST_PER_UNIT, 0.0f};
+    Mixer_Init(&t->mixer, (const MixerCalibration[2]){calibration, calibration});
+
+    t->control = (Control){law, filter, 0.0f, CASCADE_A, CASCADE_B,
+                           COMPLEMENTARY_TAU_S / (COMPLEMENTARY_TAU_S + TEST_ANGLE_S),
+                           &t->pid, &t->kalman, &t->lqr, &t->mixer};
+}
+
+static void Test_Rate(void)
+{
+    TestLoop t;
+    Test_Init(&t, CONTROL_PID, CONTROL_COMPLEMENTARY);
+    for (int i = 0; i < 100; i++)
+        Control_Rate(&t.control, 0.5f, 0.001f);
+    TEST_NEAR(t.control.qf, 0.5f, 0.0);
+    TEST_NEAR(t.control.theta, 0.05f, 1e-5);
+}
+
+// The accelerometer angle is atan2(x, |(y, z)|), the fusion is left out on
+// request
+static void Test_Estimate(void)
+{
+    TestLoop t;
+    Test_Init(&t, CONTROL_PID, CONTROL_COMPLEMENTARY);
+    t.control.theta = 0.3f;
+    Control_Estimate(&t.control, 8000, 0, 13856, 0);
+    TEST_NEAR(t.control.theta_acc, atan2(8000.0, 13856.0), 1e-5);
+    TEST_NEAR(t.control.theta, 0.3f, 0.0);
+
+    // The complementary filter settles on the accelerometer angle
+    for (int i = 0; i < 2000; i++)
+        Control_Estimate(&t.control, 8000, 0, 13856, 1);
+    TEST_NEAR(t.control.theta, atan2(8000.0, 13856.0), 1e-4);
+}
+
+// Every law pushes the arm back toward the setpoint: dF is positive when the
+// arm has to turn toward negative angles.  The cascade closes its rate loop in
+// the rate step that follows the law.
+static void Test_LawSign(void)
+{
+    const ControlLaw laws[] = {CONTROL_PID, CONTROL_CASCADE, CONTROL_LQR};
+    for (unsigned i = 0; i < sizeof(laws) / sizeof(laws[0]); i++)
+    {
+        TestLoop t;
+        Test_Init(&t, laws[i], CONTROL_COMPLEMENTARY);
+        t.control.theta = 0.2f;
+        Control_Law(&t.control);
+        Control_Rate(&t.control, 0.0f, 0.001f);
+        TEST_CHECK(t.control.dF > 0.0f);
+    }
+}
+
+// At the arm bias both motors run the base throttle, anything else is split
+// evenly and reported as applied
+static void Test_Mix(void)
+{
+    TestLoop t;
+    Test_Init(&t, CONTROL_PID, CONTROL_COMPLEMENTARY);
+    float left, right;
+
+    t.control.dF = 0.0f;
+    Control_Mix(&t.control, &left, &right);
+    TEST_NEAR(right - left, -90.0f, 1e-2);
+    TEST_NEAR(t.control.dF_applied, 0.0f, 1e-3);
+
+    t.control.dF = 90.0f;
+    Control_Mix(&t.control, &left, &right);
+    TEST_NEAR(left, right, 1e-3);
+
+    t.control.dF = 5000.0f;
+    Control_Mix(&t.control, &left, &right);
+    TEST_NEAR(left, 0.0f, 1e-2);
+    TEST_NEAR(right, CONTROL_MOTOR_MAX, 1e-2);
+    TEST_NEAR(t.control.dF_applied, CONTROL_MOTOR_MAX + 90.0f, 1e-2);
+}
+
+int main(void)
+{
+    TEST_RUN(Test_Rate);
+    TEST_RUN(Test_Estimate);
+    TEST_RUN(Test_LawSign);
+    TEST_RUN(Test_Mix);
+    return TEST_RESULT();
+}
@@ -0,0 +1,227 @@
+#include <math.h>
+#include "dshot.h"
+#include "esc.h"
+#include "test.h"
+
+#define TEST_POLES 14
+
+static const uint8_t gcr_encode[16] = {
+    0x19, 0x1B, 0x12, 0x13, 0x1D, 0x15, 0x16, 0x17, 0x1A, 0x09, 0x0A, 0x0B, 0x1E, 0x0D, 0x0E, 0x0F};
+
+// The 21 levels of a GCR word, starting low
+static uint32_t Test_Levels(uint32_t gcr)
+{
+    uint32_t levels = 1u << (DSHOT_REPLY_BITS - 1);
+    for (int bit = DSHOT_REPLY_BITS - 2; bit >= 0; bit--)
+        levels |= (((levels >> (bit + 1)) & 1) ^ ((gcr >> bit) & 1)) << bit;
+    return levels;
+}
+
+static uint32_t Test_Gcr(uint32_t value)
+{
+    uint32_t gcr = 0;
+    for (int shift = 12; shift >= 0; shift -= 4)
+        gcr = (gcr << 5) | gcr_encode[(value >> shift) & 0xF];
+    return gcr;
+}
+
+// Throttle 1046 without telemetry, the example of the DShot descriptions
+static void Test_KnownFrames(void)
+{
+    TEST_CHECK(Dshot_Frame(1046, 0, 0) == 0x82C6);
+    TEST_CHECK(Dshot_Frame(1046, 0, 1) == 0x82C9);
+    TEST_CHECK(Dshot_Frame(1046, 1, 0) == 0x82D7);
+    TEST_CHECK(Dshot_Frame(0, 0, 0) == 0x0000);
+    TEST_CHECK(Dshot_Frame(0, 0, 1) == 0x000F);
+    TEST_CHECK(Dshot_Frame(DSHOT_THROTTLE_MAX, 0, 0) == 0xFFEE);
+
+    // Only the 11 bits of the value go out
+    TEST_CHECK(Dshot_Frame(0x800 | 1046, 0, 0) == 0x82C6);
+
+    uint32_t slots[2 * DSHOT_FRAME_BITS] = {0};
+    Dshot_Encode(0x82C6, 3, 1, slots, 2);
+    const uint32_t bits[DSHOT_FRAME_BITS] = {1, 0, 0, 0, 0, 0, 1, 0, 1, 1, 0, 0, 0, 1, 1, 0};
+    for (int i = 0; i < DSHOT_FRAME_BITS; i++)
+    {
+        TEST_CHECK(slots[2 * i] == (bits[i] ? 3u : 1u));
+        TEST_CHECK(slots[2 * i + 1] == 0);
+    }
+}
+
+// The four nibbles of every frame XOR to 0, or to 0xF inverted, and the ESC
+// drops a frame with any bit flipped
+static void Test_Checksum(void)
+{
+    for (uint32_t value = 0; value <= DSHOT_THROTTLE_MAX; value++)
+    {
+        for (int telemetry = 0; telemetry < 2; telemetry++)
+        {
+            for (int inverted = 0; inverted < 2; inverted++)
+            {
+                const uint16_t frame = Dshot_Frame((uint16_t)value, telemetry, inverted);
+                const uint32_t nibbles = (frame ^ (frame >> 4) ^ (frame >> 8) ^ (frame >> 12)) & 0xF;
+                TEST_CHECK(nibbles == (inverted ? 0xFu : 0u));
+                TEST_CHECK((frame >> 5) == value);
+                TEST_CHECK(((frame >> 4) & 1) == (uint32_t)telemetry);
+
+                float command;
+                TEST_CHECK(Esc_Command(frame, inverted, 1000.0f, &command));
+                TEST_CHECK(!Esc_Command(frame, !inverted, 1000.0f, &command));
+                for (int bit = 0; bit < DSHOT_FRAME_BITS; bit++)
+                    TEST_CHECK(!Esc_Command((uint16_t)(frame ^ (1u << bit)), inverted, 1000.0f, &command));
+            }
+        }
+    }
+}
+
+// A reply with every nibble value in every position decodes, and a code that
+// is not one of the 16 fails the reply wherever it is
+static void Test_GcrSymbols(void)
+{
+    int valid[32] = {0};
+    for (int nibble = 0; nibble < 16; nibble++)
+        valid[gcr_encode[nibble]] = 1;
+
+    for (uint32_t nibble = 0; nibble < 16; nibble++)
+    {
+        for (int position = 0; position < 3; position++)
+        {
+            // The checksum nibble makes the four XOR to 0xF
+            uint32_t data = 0x5A3 & ~(0xFu << (4 * position));
+            data |= nibble << (4 * position);
+            const uint32_t value = (data << 4) | (~(data ^ (data >> 4) ^ (data >> 8)) & 0xF);
+
+            uint32_t period_us = 0;
+            TEST_CHECK(Dshot_DecodeReply(Test_Levels(Test_Gcr(value)), &period_us));
+            if (data != 0xFFF)
+                TEST_CHECK(period_us == (data & 0x1FF) << (data >> 9));
+        }
+    }
+
+    const uint32_t gcr = Test_Gcr(0x3F47);
+    for (uint32_t code = 0; code < 32; code++)
+    {
+        for (int shift = 0; shift < 20; shift += 5)
+        {
+            const uint32_t replaced = (gcr & ~(0x1Fu << shift)) | (code << shift);
+            uint32_t period_us;
+            const int decoded = Dshot_DecodeReply(Test_Levels(replaced), &period_us);
+            if (!valid[code])
+                TEST_CHECK(!decoded);
+            else if (code == ((gcr >> shift) & 0x1F))
+                TEST_CHECK(decoded && period_us == 1000);
+        }
+    }
+}
+
+// 1000 us: mantissa 500, exponent 1, checksum 7
+static void Test_KnownReply(void)
+{
+    TEST_CHECK(Test_Gcr(0x3F47) == 0x9BFB7);
+    TEST_CHECK(Esc_Reply(1000) == 0x112ADA);
+
+    uint32_t period_us = 0;
+    TEST_CHECK(Dshot_DecodeReply(0x112ADA, &period_us));
+    TEST_CHECK(period_us == 1000);
+
+    TEST_CHECK(Dshot_DecodeReply(Esc_Reply(DSHOT_PERIOD_STOPPED), &period_us));
+    TEST_CHECK(period_us == DSHOT_PERIOD_STOPPED);
+}
+
+// Every other checksum of a reply is rejected, with valid GCR codes throughout
+static void Test_BadChecksum(void)
+{
+    for (uint32_t checksum = 0; checksum < 16; checksum++)
+    {
+        uint32_t period_us = 0;
+        const int decoded = Dshot_DecodeReply(Test_Levels(Test_Gcr(0x3F40 | checksum)), &period_us);
+        TEST_CHECK(decoded == (checksum == 7));
+    }
+
+    // The checksum of a frame, not inverted, is wrong for a reply
+    uint32_t period_us;
+    TEST_CHECK(!Dshot_DecodeReply(Test_Levels(Test_Gcr(0x3F48)), &period_us));
+}
+
+// The reply carries the period to 9 significant bits
+static void Test_Rpm(void)
+{
+    TEST_NEAR(Dshot_Rpm(1000, TEST_POLES), 60e6 / 7000.0, 1e-2);
+    TEST_NEAR(Dshot_Rpm(DSHOT_PERIOD_STOPPED, TEST_POLES), 0.0, 0.0);
+    TEST_NEAR(Dshot_Rpm(100, 2), 600000.0, 1.0);
+
+    for (float rpm = 300.0f; rpm < 40000.0f; rpm *= 1.07f)
+    {
+        uint32_t period_us;
+        TEST_CHECK(Dshot_DecodeReply(Esc_Reply(Esc_Period(rpm, TEST_POLES)), &period_us));
+        const double decoded = Dshot_Rpm(period_us, TEST_POLES);
+        TEST_NEAR(decoded, rpm, rpm * (1.0 / 256.0 + 1.0 / period_us));
+    }
+
+    // Too slow for the exponent: a stopped motor
+    uint32_t period_us;
+    TEST_CHECK(Dshot_DecodeReply(Esc_Reply(Esc_Period(50.0f, TEST_POLES)), &period_us));
+    TEST_NEAR(Dshot_Rpm(period_us, TEST_POLES), 0.0, 0.0);
+}
+
+// The commands spread over the throttle values, never on the ESC commands
+static void Test_Throttle(void)
+{
+    TEST_CHECK(Dshot_Throttle(0.0f, 1000.0f) == 0);
+    TEST_CHECK(Dshot_Throttle(-5.0f, 1000.0f) == 0);
+    TEST_CHECK(Dshot_Throttle(NAN, 1000.0f) == 0);
+    TEST_CHECK(Dshot_Throttle(0.01f, 1000.0f) == DSHOT_THROTTLE_MIN);
+    TEST_CHECK(Dshot_Throttle(250.0f, 1000.0f) == 548);
+    TEST_CHECK(Dshot_Throttle(1000.0f, 1000.0f) == DSHOT_THROTTLE_MAX);
+    TEST_CHECK(Dshot_Throttle(1500.0f, 1000.0f) == DSHOT_THROTTLE_MAX);
+
+    const float step = 1000.0f / (DSHOT_THROTTLE_MAX - DSHOT_THROTTLE_MIN);
+    for (float command = 1.0f; command <= 1000.0f; command += 0.37f)
+    {
+        float received;
+        TEST_CHECK(Esc_Command(Dshot_Frame(Dshot_Throttle(command, 1000.0f), 0, 1), 1, 1000.0f, &received));
+        TEST_NEAR(received, command, 0.5 * step + 1e-3);
+    }
+}
+
+// The line sampled at 3 samples per bit with the ESC clock 3 % off, the reply
+// on pin 5 with the other pins toggling
+static void Test_LevelsFromSamples(void)
+{
+    const uint32_t pin = 5;
+    const uint32_t expected = Esc_Reply(1000);
+
+    uint16_t samples[128];
+    const uint32_t idle = 10;
+    for (uint32_t i = 0; i < 128; i++)
+    {
+        const uint32_t index = i < idle ? DSHOT_REPLY_BITS : (uint32_t)((i - idle) / (3.0 * 1.03));
+        const int low = index < DSHOT_REPLY_BITS && ((expected >> (DSHOT_REPLY_BITS - 1 - index)) & 1);
+        samples[i] = (uint16_t)((low ? 0 : 1u << pin) | (i & 1 ? 0x8001 : 0));
+    }
+
+    uint32_t levels = 0;
+    TEST_CHECK(Dshot_Levels(samples, 128, 0, pin, 3 * 256, &levels));
+    TEST_CHECK(levels == expected);
+
+    // Cut off while the line is low: no reply
+    TEST_CHECK(!Dshot_Levels(samples, idle + 2, 0, pin, 3 * 256, &levels));
+
+    // Idle line throughout
+    for (uint32_t i = 0; i < 128; i++)
+        samples[i] = 1u << pin;
+    TEST_CHECK(!Dshot_Levels(samples, 128, 0, pin, 3 * 256, &levels));
+}
+
+int main(void)
+{
+    TEST_RUN(Test_KnownFrames);
+    TEST_RUN(Test_Checksum);
+    TEST_RUN(Test_GcrSymbols);
+    TEST_RUN(Test_KnownReply);
+    TEST_RUN(Test_BadChecksum);
+    TEST_RUN(Test_Rpm);
+    TEST_RUN(Test_Throttle);
+    TEST_RUN(Test_LevelsFromSamples);
+    return TEST_RESULT();
+}
@@ -0,0 +1,75 @@
+#include <math.h>
+#include "fastmath.h"
+#include "test.h"
+
+/* The bounds documented in fastmath.h */
+#define TEST_ATAN2_TOLERANCE 2.0e-6 /* rad */
+#define TEST_ASIN_TOLERANCE 2.0e-6  /* rad */
+
+#define TEST_STEPS 1000000
+
+// Every direction of the circle, at radii from the noise floor of the
+// accelerometer to well past its range, against atan2() of the same floats
+static void Test_Atan2(void)
+{
+    const float radii[] = {1e-6f, 1e-3f, 1.0f, 9.81f, 1e4f};
+    double worst = 0.0;
+    for (unsigned r = 0; r < sizeof(radii) / sizeof(radii[0]); r++)
+    {
+        for (int i = 0; i <= TEST_STEPS; i++)
+        {
+            const double theta = -M_PI + 2.0 * M_PI * i / TEST_STEPS;
+            const float y = (float)((double)radii[r] * sin(theta));
+            const float x = (float)((double)radii[r] * cos(theta));
+            const double error = fabs((double)FastMath_Atan2f(y, x) - atan2((double)y, (double)x));
+            worst = fmax(worst, error);
+        }
+    }
+    printf("atan2 worst %.3g rad\n", worst);
+    TEST_NEAR(worst, 0.0, TEST_ATAN2_TOLERANCE);
+
+    // The axes and the origin
+    TEST_NEAR(FastMath_Atan2f(0.0f, 1.0f), 0.0, 0.0);
+    TEST_NEAR(FastMath_Atan2f(1.0f, 0.0f), M_PI_2, TEST_ATAN2_TOLERANCE);
+    TEST_NEAR(FastMath_Atan2f(-1.0f, 0.0f), -M_PI_2, TEST_ATAN2_TOLERANCE);
+    TEST_NEAR(FastMath_Atan2f(0.0f, -1.0f), M_PI, TEST_ATAN2_TOLERANCE);
+    TEST_NEAR(FastMath_Atan2f(0.0f, 0.0f), 0.0, 0.0);
+}
+
+static void Test_Asin(void)
+{
+    double worst = 0.0;
+    for (int i = 0; i <= TEST_STEPS; i++)
+    {
+        const float x = (float)(-1.0 + 2.0 * i / TEST_STEPS);
+        const double error = fabs((double)FastMath_Asinf(x) - asin((double)x));
+        worst = fmax(worst, error);
+    }
+    printf("asin worst %.3g rad\n", worst);
+    TEST_NEAR(worst, 0.0, TEST_ASIN_TOLERANCE);
+
+    // Out of range inputs are clamped
+    TEST_NEAR(FastMath_Asinf(1.5f), M_PI_2, TEST_ASIN_TOLERANCE);
+    TEST_NEAR(FastMath_Asinf(-1.5f), -M_PI_2, TEST_ASIN_TOLERANCE);
+}
+
+// Correctly rounded: the float nearest to the root of the float input
+static void Test_Sqrt(void)
+{
+    int exact = 1;
+    for (int i = 0; i <= TEST_STEPS; i++)
+    {
+        const float x = (float)(1e-6 * pow(1e12, (double)i / TEST_STEPS));
+        exact &= FastMath_Sqrtf(x) == (float)sqrt((double)x);
+    }
+    TEST_CHECK(exact);
+    TEST_NEAR(FastMath_Sqrtf(0.0f), 0.0, 0.0);
+}
+
+int main(void)
+{
+    TEST_RUN(Test_Atan2);
+    TEST_RUN(Test_Asin);
+    TEST_RUN(Test_Sqrt);
+    return TEST_RESULT();
+}
@@ -0,0 +1,130 @@
+#include "gyro_bias.h"
+#include "test.h"
+
+#define TEST_SAMPLES 100
+/* A power of two, so the rest time adds up exactly */
+#define TEST_DT 0.125f
+
+static GyroBias Test_Bias(const float bias[3])
+{
+    GyroBias gb = {TEST_SAMPLES, GYRO_BIAS_MOTION_RAD_S, GYRO_BIAS_REST_RAD_S, GYRO_BIAS_REST_S,
+                   GYRO_BIAS_TRACKING_TAU_S};
+    GyroBias_Init(&gb, bias);
+    return gb;
+}
+
+static int Test_Update(GyroBias *gb, float x, float y, float z, uint32_t count)
+{
+    const float rate[3] = {x, y, z};
+    return GyroBias_Update(gb, rate, count, TEST_DT);
+}
+
+// The stored bias holds until samples have been averaged, then the average
+// takes over on the one tick that reports it
+static void Test_Calibration(void)
+{
+    const float stored[3] = {0.1f, 0.2f, 0.3f};
+    GyroBias gb = Test_Bias(stored);
+
+    for (int i = 0; i < TEST_SAMPLES / 10 - 1; i++)
+    {
+        TEST_CHECK(!Test_Update(&gb, 0.01f, -0.02f, 0.03f, 10));
+        TEST_CHECK(!Test_Update(&gb, 0.5f, 0.5f, 0.5f, 0));
+    }
+    TEST_CHECK(gb.state == GYRO_BIAS_CALIBRATING);
+    TEST_CHECK(gb.count == TEST_SAMPLES - 10);
+    TEST_NEAR(gb.bias[0], 0.1f, 0.0);
+    TEST_NEAR(gb.bias[2], 0.3f, 0.0);
+
+    TEST_CHECK(Test_Update(&gb, 0.01f, -0.02f, 0.03f, 10));
+    TEST_CHECK(gb.state == GYRO_BIAS_TRACKING);
+    TEST_NEAR(gb.bias[0], 0.01f, 1e-7);
+    TEST_NEAR(gb.bias[1], -0.02f, 1e-7);
+    TEST_NEAR(gb.bias[2], 0.03f, 1e-7);
+
+    TEST_CHECK(!Test_Update(&gb, 0.01f, -0.02f, 0.03f, 10));
+    TEST_CHECK(!Test_Update(&gb, 0.01f, -0.02f, 0.03f, TEST_SAMPLES));
+}
+
+// Each rate is an average, it weighs as the samples it holds
+static void Test_Weighting(void)
+{
+    GyroBias gb = Test_Bias(0);
+
+    TEST_CHECK(!Test_Update(&gb, 0.0f, 0.0f, 0.0f, 30));
+    TEST_CHECK(Test_Update(&gb, 0.04f, -0.04f, 0.02f, 70));
+    TEST_NEAR(gb.bias[0], 0.028f, 1e-7);
+    TEST_NEAR(gb.bias[1], -0.028f, 1e-7);
+    TEST_NEAR(gb.bias[2], 0.014f, 1e-7);
+}
+
+// A set further than motion_rate from the average so far throws the average
+// away, the calibration starts over with the next set
+static void Test_Motion(void)
+{
+    GyroBias gb = Test_Bias(0);
+
+    TEST_CHECK(!Test_Update(&gb, 0.01f, 0.01f, 0.01f, 50));
+    TEST_CHECK(!Test_Update(&gb, 0.01f, 0.01f + 2.0f * GYRO_BIAS_MOTION_RAD_S, 0.01f, 10));
+    TEST_CHECK(gb.restarts == 1);
+    TEST_CHECK(gb.count == 0);
+    TEST_NEAR(gb.sum[0], 0.0f, 0.0);
+    TEST_NEAR(gb.sum[1], 0.0f, 0.0);
+    TEST_NEAR(gb.sum[2], 0.0f, 0.0);
+    TEST_CHECK(gb.state == GYRO_BIAS_CALIBRATING);
+
+    TEST_CHECK(!Test_Update(&gb, 0.2f, 0.2f, 0.2f, 50));
+    TEST_CHECK(Test_Update(&gb, 0.2f, 0.2f, 0.2f, 50));
+    TEST_CHECK(gb.restarts == 1);
+    TEST_NEAR(gb.bias[1], 0.2f, 1e-7);
+}
+
+// After rest_time_s within rest_rate the bias low-passes the rate, any motion
+// starts the rest time over
+static void Test_Tracking(void)
+{
+    GyroBias gb = Test_Bias(0);
+    TEST_CHECK(Test_Update(&gb, 0.0f, 0.0f, 0.0f, TEST_SAMPLES));
+
+    const float rate = 0.5f * GYRO_BIAS_REST_RAD_S;
+    const int rest_ticks = (int)(GYRO_BIAS_REST_S / TEST_DT);
+    for (int i = 0; i < rest_ticks - 1; i++)
+        Test_Update(&gb, rate, -rate, rate, 1);
+    TEST_NEAR(gb.bias[0], 0.0f, 0.0);
+
+    const float k = TEST_DT / (GYRO_BIAS_TRACKING_TAU_S + TEST_DT);
+    Test_Update(&gb, rate, -rate, rate, 1);
+    TEST_NEAR(gb.bias[0], rate * k, 1e-9);
+    TEST_NEAR(gb.bias[1], -rate * k, 1e-9);
+
+    const float before = gb.bias[0];
+    Test_Update(&gb, rate, -rate, rate, 1);
+    TEST_NEAR(gb.bias[0], before + (rate - before) * k, 1e-9);
+
+    // Motion on a single axis
+    const float tracked[3] = {gb.bias[0], gb.bias[1], gb.bias[2]};
+    Test_Update(&gb, rate, -rate, 2.0f * GYRO_BIAS_REST_RAD_S, 1);
+    TEST_NEAR(gb.rest_s, 0.0f, 0.0);
+    TEST_NEAR(gb.bias[2], tracked[2], 0.0);
+
+    for (int i = 0; i < rest_ticks - 1; i++)
+        Test_Update(&gb, rate, -rate, rate, 1);
+    TEST_NEAR(gb.bias[0], tracked[0], 0.0);
+    TEST_NEAR(gb.bias[2], tracked[2], 0.0);
+    Test_Update(&gb, rate, -rate, rate, 1);
+    TEST_CHECK(gb.bias[0] > tracked[0]);
+
+    // No new sample, nothing moves
+    const float last = gb.bias[0];
+    Test_Update(&gb, rate, -rate, rate, 0);
+    TEST_NEAR(gb.bias[0], last, 0.0);
+}
+
+int main(void)
+{
+    TEST_RUN(Test_Calibration);
+    TEST_RUN(Test_Weighting);
+    TEST_RUN(Test_Motion);
+    TEST_RUN(Test_Tracking);
+    return TEST_RESULT();
+}
@@ -0,0 +1,82 @@
+#include <math.h>
+#include "ilqr.h"
+#include "model.h"
+#include "tuning.h"
+#include "test.h"
+
+#define TEST_T 0.005f
+
+static LQR_Controller Test_Controller(void)
+{
+    LQR_Controller lqr = {LQR_Q_ANGLE, LQR_Q_RATE, LQR_R, TEST_T};
+    return lqr;
+}
+
+// Both eigenvalues of A - B K inside the unit circle (Jury's criterion)
+static int Test_Stable(const float K[NUMBER_STATES], float T)
+{
+    const double b0 = (double)(L / J) * T * T / 2.0;
+    const double b1 = (double)(L / J) * T;
+    const double a00 = 1.0 - b0 * K[0], a01 = T - b0 * K[1];
+    const double a10 = -b1 * K[0], a11 = 1.0 - b1 * K[1];
+    const double trace = a00 + a11;
+    const double det = a00 * a11 - a01 * a10;
+    return fabs(det) < 1.0 && fabs(trace) < 1.0 + det;
+}
+
+static void Test_Init(void)
+{
+    LQR_Controller lqr = Test_Controller();
+    TEST_CHECK(LQR_init(&lqr) >= 0);
+    TEST_CHECK(lqr.active == 0);
+    TEST_CHECK(lqr.K[0][0] > 0.0f && lqr.K[0][1] > 0.0f);
+    TEST_CHECK(Test_Stable(lqr.K[0], TEST_T));
+
+    const float state[NUMBER_STATES] = {0.1f, -0.2f};
+    TEST_NEAR(LQR_update(&lqr, state), -(lqr.K[0][0] * 0.1f - lqr.K[0][1] * 0.2f), 1e-6);
+}
+
+// New weights go to the inactive buffer and are published as a whole
+static void Test_Synthesize(void)
+{
+    LQR_Controller lqr = Test_Controller();
+    LQR_init(&lqr);
+    const float gain = lqr.K[0][0];
+
+    lqr.r = 10.0f * LQR_R;
+    TEST_CHECK(LQR_synthesize(&lqr) >= 0);
+    TEST_CHECK(lqr.active == 1);
+    TEST_CHECK(lqr.K[1][0] < gain);
+    TEST_NEAR(lqr.K[0][0], gain, 0.0);
+    TEST_CHECK(Test_Stable(lqr.K[1], TEST_T));
+}
+
+// A solve that does not converge publishes nothing
+static void Test_NotConverged(void)
+{
+    LQR_Controller lqr = Test_Controller();
+    LQR_init(&lqr);
+    const float K0 = lqr.K[0][0], K1 = lqr.K[0][1];
+    const float back0 = lqr.K[1][0], back1 = lqr.K[1][1];
+
+    lqr.q_angle = NAN;
+    TEST_CHECK(LQR_synthesize(&lqr) < 0);
+    TEST_CHECK(lqr.active == 0);
+    TEST_NEAR(lqr.K[0][0], K0, 0.0);
+    TEST_NEAR(lqr.K[0][1], K1, 0.0);
+    TEST_NEAR(lqr.K[1][0], back0, 0.0);
+    TEST_NEAR(lqr.K[1][1], back1, 0.0);
+
+    // Without a previous gain the controller stays silent
+    const float state[NUMBER_STATES] = {0.1f, -0.2f};
+    TEST_CHECK(LQR_init(&lqr) < 0);
+    TEST_NEAR(LQR_update(&lqr, state), 0.0, 0.0);
+}
+
+int main(void)
+{
+    TEST_RUN(Test_Init);
+    TEST_RUN(Test_Synthesize);
+    TEST_RUN(Test_NotConverged);
+    return TEST_RESULT();
+}
@@ -0,0 +1,199 @@
+#include <math.h>
+#include <stdint.h>
+#include "kalman.h"
+#include "kalman_reference.h"
+#include "tuning.h"
+#include "test.h"
+
+#define TEST_T 0.005f
+#define TEST_STEPS 4000
+
+/* The filter runs in single precision against the double reference: what the
+ * rounding may add up to over TEST_STEPS on the signals below */
+#define TEST_ESTIMATE_TOLERANCE 1e-5   /* rad */
+#define TEST_COVARIANCE_TOLERANCE 1e-3 /* relative */
+
+typedef struct
+{
+    uint64_t rng;
+    double t;
+} TestSignal;
+
+static double Test_Gaussian(TestSignal *s)
+{
+    s->rng ^= s->rng >> 12;
+    s->rng ^= s->rng << 25;
+    s->rng ^= s->rng >> 27;
+    const uint64_t a = s->rng * 0x2545F4914F6CDD1DULL;
+    s->rng ^= s->rng >> 12;
+    s->rng ^= s->rng << 25;
+    s->rng ^= s->rng >> 27;
+    const uint64_t b = s->rng * 0x2545F4914F6CDD1DULL;
+    const double u1 = ((a >> 11) + 1.0) / 9007199254740993.0;
+    const double u2 = (b >> 11) / 9007199254740992.0;
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+// An arm swinging at 0.5 Hz, read by a noisy accelerometer and a noisy gyro
+// with a bias, and the differential force that would swing it
+static void Test_Next(TestSignal *s, double y[NUM_MEASUREMENTS], double u[NUM_INPUTS])
+{
+    const double w = 2.0 * M_PI * 0.5;
+    const double theta = 0.3 * sin(w * s->t);
+    const double rate = 0.3 * w * cos(w * s->t);
+    y[0] = theta + 0.02 * Test_Gaussian(s);
+    y[1] = rate + 0.02 + 0.01 * Test_Gaussian(s);
+    u[0] = y[1];
+    u[1] = -0.3 * w * w * sin(w * s->t) * 0.1;
+    s->t += TEST_T;
+}
+
+static KalmanFilter Test_Filter(void)
+{
+    KalmanFilter kf = {KALMAN_Q_ANGLE, KALMAN_Q_VELOCITY, KALMAN_Q_BIAS, KALMAN_R_ANGLE, KALMAN_R_RATE, TEST_T};
+    KalmanFilter_Init(&kf);
+    return kf;
+}
+
+// Sequential scalar updates and the hand-written covariance propagation give
+// the joint update of the full matrix form
+static void Test_MatchesReference(void)
+{
+    KalmanFilter kf = Test_Filter();
+    KalmanReference ref;
+    KalmanReference_Init(&ref, &kf);
+    TestSignal signal = {1, 0.0};
+
+    double worst = 0.0;
+    for (int i = 0; i < TEST_STEPS; i++)
+    {
+        double y[NUM_MEASUREMENTS], u[NUM_INPUTS];
+        Test_Next(&signal, y, u);
+        const float32_t yf[NUM_MEASUREMENTS] = {(float32_t)y[0], (float32_t)y[1]};
+        const float32_t uf[NUM_INPUTS] = {(float32_t)u[0], (float32_t)u[1]};
+
+        const double estimate = KalmanFilter_Update(&kf, yf, uf);
+        const double expected = KalmanReference_Update(&ref, y, u);
+        worst = fmax(worst, fabs(estimate - expected));
+    }
+    TEST_NEAR(worst, 0.0, TEST_ESTIMATE_TOLERANCE);
+
+    for (int i = 0; i < NUM_STATES; i++)
+        TEST_NEAR(kf.x[i], ref.x[i], TEST_ESTIMATE_TOLERANCE);
+    for (int i = 0; i < NUM_STATES * NUM_STATES; i++)
+        TEST_NEAR(kf.P[i], ref.P[i], TEST_COVARIANCE_TOLERANCE * fabs(ref.P[i]) + 1e-9);
+}
+
+// The converged gain of the model is the one the full filter ends up with
+static void Test_SteadyStateGain(void)
+{
+    KalmanFilter kf = Test_Filter();
+    KalmanReference ref;
+    KalmanReference_Init(&ref, &kf);
+    TestSignal signal = {2, 0.0};
+
+    for (int i = 0; i < 4 * TEST_STEPS; i++)
+    {
+        double y[NUM_MEASUREMENTS], u[NUM_INPUTS];
+        Test_Next(&signal, y, u);
+        KalmanReference_Update(&ref, y, u);
+    }
+
+    const KalmanModel *m = &kf.model[kf.active];
+    for (int i = 0; i < NUM_STATES * NUM_MEASUREMENTS; i++)
+        TEST_NEAR(m->K[i], ref.K[i], 1e-3 * fabs(ref.K[i]) + 1e-6);
+}
+
+// Once the full filter has converged the steady-state one gives the same
+// estimates
+static void Test_SteadyStateEstimate(void)
+{
+    KalmanFilter full = Test_Filter();
+    KalmanFilter steady = Test_Filter();
+    TestSignal signal = {3, 0.0};
+
+    double worst = 0.0;
+    for (int i = 0; i < 2 * TEST_STEPS; i++)
+    {
+        double y[NUM_MEASUREMENTS], u[NUM_INPUTS];
+        Test_Next(&signal, y, u);
+        const float32_t yf[NUM_MEASUREMENTS] = {(float32_t)y[0], (float32_t)y[1]};
+        const float32_t uf[NUM_INPUTS] = {(float32_t)u[0], (float32_t)u[1]};
+
+        const double a = KalmanFilter_Update(&full, yf, uf);
+        const double b = KalmanFilter_UpdateSteadyState(&steady, yf, uf);
+        if (i >= TEST_STEPS)
+            worst = fmax(worst, fabs(a - b));
+    }
+    TEST_NEAR(worst, 0.0, 1e-3);
+}
+
+// A new model goes to the inactive buffer and is published as a whole
+static void Test_Synthesize(void)
+{
+    KalmanFilter kf = Test_Filter();
+    const uint32_t before = kf.active;
+    const float32_t gain = kf.model[before].K[0];
+
+    kf.T = 2.0f * TEST_T;
+    TEST_CHECK(KalmanFilter_Synthesize(&kf) >= 0);
+    TEST_CHECK(kf.active != before);
+    TEST_NEAR(kf.model[kf.active].T, 2.0f * TEST_T, 0.0);
+    TEST_CHECK(kf.model[kf.active].K[0] != gain);
+    TEST_NEAR(kf.model[before].K[0], gain, 0.0);
+}
+
+// A gain that does not converge is never published
+static void Test_SynthesizeFails(void)
+{
+    KalmanFilter kf = Test_Filter();
+    const uint32_t before = kf.active;
+    float32_t gain[NUM_STATES * NUM_MEASUREMENTS];
+    for (int i = 0; i < NUM_STATES * NUM_MEASUREMENTS; i++)
+        gain[i] = kf.model[before].K[i];
+
+    kf.a = -1.0f;
+    TEST_CHECK(KalmanFilter_Synthesize(&kf) < 0);
+    TEST_CHECK(kf.active == before);
+    for (int i = 0; i < NUM_STATES * NUM_MEASUREMENTS; i++)
+        TEST_NEAR(kf.model[kf.active].K[i], gain[i], 0.0);
+    TEST_NEAR(kf.model[kf.active].T, TEST_T, 0.0);
+}
+
+// A boot-time gain that does not converge is reported and left at zero
+static void Test_InitFails(void)
+{
+    KalmanFilter kf = {KALMAN_Q_ANGLE, KALMAN_Q_VELOCITY, KALMAN_Q_BIAS, KALMAN_R_ANGLE, KALMAN_R_RATE, TEST_T};
+    TEST_CHECK(KalmanFilter_Init(&kf) >= 0);
+
+    kf.a = -1.0f;
+    TEST_CHECK(KalmanFilter_Init(&kf) < 0);
+    for (int i = 0; i < NUM_STATES * NUM_MEASUREMENTS; i++)
+        TEST_NEAR(kf.model[kf.active].K[i], 0.0f, 0.0);
+}
+
+static void Test_ResetBias(void)
+{
+    KalmanFilter kf = Test_Filter();
+    kf.x[2] = 0.5f;
+    for (int i = 0; i < NUM_STATES * NUM_STATES; i++)
+        kf.P[i] = 1.0f;
+    KalmanFilter_ResetBias(&kf, 1e-4f);
+
+    TEST_NEAR(kf.x[2], 0.0, 0.0);
+    TEST_NEAR(kf.P[8], 1e-4f, 0.0);
+    TEST_NEAR(kf.P[2] + kf.P[5] + kf.P[6] + kf.P[7], 0.0, 0.0);
+    TEST_NEAR(kf.P[0], 1.0, 0.0);
+}
+
+int main(void)
+{
+    TEST_RUN(Test_MatchesReference);
+    TEST_RUN(Test_SteadyStateGain);
+    TEST_RUN(Test_SteadyStateEstimate);
+    TEST_RUN(Test_Synthesize);
+    TEST_RUN(Test_SynthesizeFails);
+    TEST_RUN(Test_InitFails);
+    TEST_RUN(Test_ResetBias);
+    return TEST_RESULT();
+}
@@ -0,0 +1,86 @@
+#include <math.h>
+#include "mixer.h"
+#include "control.h"
+#include "test.h"
+
+static const MixerCalibration linear = {0.01f, 0.0f};
+
+// Full thrust 10 N at the top of the range, 30 % of it from the square term
+static const MixerCalibration quadratic = {0.007f, 3e-6f};
+
+static float Test_Thrust(const MixerCalibration *c, float command)
+{
+    return command * (c->linear + c->quadratic * command);
+}
+
+static void Test_Linear(void)
+{
+    Mixer mixer;
+    Mixer_Init(&mixer, (const MixerCalibration[2]){linear, linear});
+    TEST_NEAR(mixer.max_thrust[0], 10.0f, 1e-5);
+
+    float left, right;
+    const float applied = Mixer_Allocate(&mixer, 4.0f, 1.0f, &left, &right);
+    TEST_NEAR(applied, 1.0f, 1e-5);
+    TEST_NEAR(left, 350.0f, 1e-2);
+    TEST_NEAR(right, 450.0f, 1e-2);
+}
+
+// The table inverts the thrust curve to well within the resolution of the outputs
+static void Test_Quadratic(void)
+{
+    Mixer mixer;
+    Mixer_Init(&mixer, (const MixerCalibration[2]){quadratic, linear});
+    TEST_NEAR(mixer.max_thrust[0], 10.0f, 1e-4);
+
+    double worst = 0.0;
+    for (int i = 0; i <= 1000; i++)
+    {
+        const float thrust = i * 0.01f;
+        float left, right;
+        Mixer_Allocate(&mixer, thrust, 0.0f, &left, &right);
+        worst = fmax(worst, fabs((double)Test_Thrust(&quadratic, left) - thrust));
+    }
+    TEST_CHECK(worst < 0.005 * 10.0);
+}
+
+// Near the ends of the range both motors shift to keep the differential
+static void Test_Shift(void)
+{
+    Mixer mixer;
+    Mixer_Init(&mixer, (const MixerCalibration[2]){linear, linear});
+
+    float left, right;
+    float applied = Mixer_Allocate(&mixer, 9.5f, 2.0f, &left, &right);
+    TEST_NEAR(applied, 2.0f, 1e-5);
+    TEST_NEAR(right, CONTROL_MOTOR_MAX, 1e-2);
+    TEST_NEAR(left, 800.0f, 1e-2);
+
+    applied = Mixer_Allocate(&mixer, 0.5f, -2.0f, &left, &right);
+    TEST_NEAR(applied, -2.0f, 1e-5);
+    TEST_NEAR(right, 0.0f, 1e-2);
+    TEST_NEAR(left, 200.0f, 1e-2);
+}
+
+// Past what one motor stopped and the other at full thrust can make, the
+// differential is clipped and the allocation says so
+static void Test_Clip(void)
+{
+    Mixer mixer;
+    Mixer_Init(&mixer, (const MixerCalibration[2]){linear, linear});
+
+    float left, right;
+    const float applied = Mixer_Allocate(&mixer, 5.0f, 25.0f, &left, &right);
+    TEST_NEAR(applied, 10.0f, 1e-5);
+    TEST_NEAR(left, 0.0f, 1e-2);
+    TEST_NEAR(right, CONTROL_MOTOR_MAX, 1e-2);
+}
+
+int main(void)
+{
+    TEST_RUN(Test_Linear);
+    TEST_RUN(Test_Quadratic);
+    TEST_RUN(Test_Shift);
+    TEST_RUN(Test_Clip);
+    return TEST_RESULT();
+}
@@ -0,0 +1,73 @@
+#include "PID.h"
+#include "test.h"
+
+static PIDController Test_Controller(float kp, float ki, float kd)
+{
+    PIDController pid = {kp, ki, kd, 0.02f, -100.0f, 100.0f, -10.0f, 10.0f, 0.1f};
+    PIDController_Init(&pid);
+    return pid;
+}
+
+static void Test_Proportional(void)
+{
+    PIDController pid = Test_Controller(2.0f, 0.0f, 0.0f);
+    TEST_NEAR(PIDController_Update(&pid, 1.0f, 0.0f), 2.0f, 1e-6);
+    TEST_NEAR(PIDController_Update(&pid, 1.0f, 3.0f), -4.0f, 1e-6);
+}
+
+// Trapezoidal rule: the first step only sees half of its error
+static void Test_Integrator(void)
+{
+    PIDController pid = Test_Controller(0.0f, 1.0f, 0.0f);
+    TEST_NEAR(PIDController_Update(&pid, 1.0f, 0.0f), 0.05f, 1e-6);
+    TEST_NEAR(PIDController_Update(&pid, 1.0f, 0.0f), 0.15f, 1e-6);
+    TEST_NEAR(PIDController_Update(&pid, 1.0f, 0.0f), 0.25f, 1e-6);
+}
+
+static void Test_Limits(void)
+{
+    PIDController pid = Test_Controller(0.0f, 100.0f, 0.0f);
+    for (int i = 0; i < 100; i++)
+        PIDController_Update(&pid, 1.0f, 0.0f);
+    TEST_NEAR(pid.integrator, 10.0f, 1e-6);
+
+    pid = Test_Controller(1000.0f, 0.0f, 0.0f);
+    TEST_NEAR(PIDController_Update(&pid, 1.0f, 0.0f), 100.0f, 1e-6);
+    TEST_NEAR(PIDController_Update(&pid, -1.0f, 0.0f), -100.0f, 1e-6);
+}
+
+// Derivative on the measurement, band-limited by tau: a setpoint step gives no
+// kick, a measurement step a negative one
+static void Test_Derivative(void)
+{
+    PIDController pid = Test_Controller(0.0f, 0.0f, 1.0f);
+    TEST_NEAR(PIDController_Update(&pid, 5.0f, 0.0f), 0.0f, 1e-6);
+    TEST_NEAR(PIDController_Update(&pid, 5.0f, 1.0f), -2.0f / (2.0f * 0.02f + 0.1f), 1e-5);
+}
+
+static void Test_BackCalculate(void)
+{
+    PIDController pid = Test_Controller(2.0f, 1.0f, 0.0f);
+    pid.integrator = 1.0f;
+    PIDController_BackCalculate(&pid, -4.0f);
+    TEST_NEAR(pid.integrator, 1.0f + 0.1f * 1.0f / 2.0f * -4.0f, 1e-6);
+
+    PIDController_BackCalculate(&pid, -1000.0f);
+    TEST_NEAR(pid.integrator, -10.0f, 1e-6);
+
+    // Without a proportional gain there is no integral time to bleed it with
+    pid = Test_Controller(0.0f, 1.0f, 0.0f);
+    pid.integrator = 1.0f;
+    PIDController_BackCalculate(&pid, -4.0f);
+    TEST_NEAR(pid.integrator, 1.0f, 0.0);
+}
+
+int main(void)
+{
+    TEST_RUN(Test_Proportional);
+    TEST_RUN(Test_Integrator);
+    TEST_RUN(Test_Limits);
+    TEST_RUN(Test_Derivative);
+    TEST_RUN(Test_BackCalculate);
+    return TEST_RESULT();
+}
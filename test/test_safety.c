@@ -0,0 +1,243 @@
+#include <string.h>
+#include "safety.h"
+#include "control.h"
+#include "motor.h"
+#include "Gyro.h"
+#include "Accelerometer.h"
+#include "profiler.h"
+#include "main.h"
+#include "test.h"
+
+/* The sensor setup of main.c: gyro at 760 Hz, accelerometer at 400 Hz with a
+ * watermark of 4, both FIFOs 32 samples deep */
+#define TEST_GYRO_PERIOD_US 1316
+#define TEST_ACCELEROMETER_PERIOD_US 2500
+#define TEST_ACCELEROMETER_WATERMARK 4
+#define TEST_FIFO_DEPTH 32
+#define TEST_GYRO_WATERMARK_MAX 31
+
+/* SPI and I2C bursts */
+#define TEST_GYRO_READ_US 15
+#define TEST_ACCELEROMETER_READ_US 250
+
+/* The check runs this often, so every phase against the reads is covered */
+#define TEST_STEP_US 100
+
+/* A sensor read every interval_us, which drains its FIFO and dates the
+ * average at the middle of the window, as GyroPublish() does */
+typedef struct
+{
+    uint32_t period_us;
+    uint32_t interval_us;
+    uint32_t read_us;
+    uint32_t next_read_us;
+    uint32_t read_start_us;
+    int reading;
+    int stopped;
+    uint32_t timestamp_us;
+} TestSensor;
+
+static uint32_t now_us;
+static TestSensor gyro;
+static TestSensor accelerometer;
+static int motor_cuts;
+
+uint32_t Profiler_Micros(void)
+{
+    return now_us;
+}
+
+void Motor_Write(float left, float right)
+{
+    if (left == 0.0f && right == 0.0f)
+        motor_cuts++;
+}
+
+void GetGyroSample(GyroSample *sample)
+{
+    *sample = (GyroSample){.timestamp_us = gyro.timestamp_us};
+}
+
+void GetAccelerometerSample(AccelerometerSample *sample)
+{
+    *sample = (AccelerometerSample){.timestamp_us = accelerometer.timestamp_us};
+}
+
+static void Test_SensorStart(TestSensor *sensor, uint32_t period_us, uint32_t interval_us, uint32_t read_us)
+{
+    *sensor = (TestSensor){period_us, interval_us, read_us, now_us, 0, 0, 0, now_us};
+}
+
+static void Test_SensorStep(TestSensor *sensor)
+{
+    if (sensor->reading && now_us - sensor->read_start_us >= sensor->read_us)
+    {
+        uint32_t count = sensor->interval_us / sensor->period_us;
+        count = count < 1 ? 1 : count > TEST_FIFO_DEPTH ? TEST_FIFO_DEPTH : count;
+        sensor->timestamp_us = sensor->read_start_us - (count - 1) * sensor->period_us / 2;
+        sensor->reading = 0;
+    }
+    if (!sensor->reading && !sensor->stopped && (int32_t)(now_us - sensor->next_read_us) >= 0)
+    {
+        sensor->read_start_us = now_us;
+        sensor->next_read_us += sensor->interval_us;
+        sensor->reading = 1;
+    }
+}
+
+/* Runs the sensors and the check for duration_us, returns 1 if the mode
+ * stayed SAFETY_NORMAL throughout */
+static int Test_Run(uint32_t duration_us)
+{
+    int normal = 1;
+    for (uint32_t t = 0; t < duration_us; t += TEST_STEP_US)
+    {
+        now_us += TEST_STEP_US;
+        Test_SensorStep(&gyro);
+        Test_SensorStep(&accelerometer);
+        Safety_CheckSensors();
+        normal &= Safety_Mode() == SAFETY_NORMAL;
+    }
+    return normal;
+}
+
+// Gyro samples per data-ready tick, as ControlRate_Watermark() in main.c
+static uint32_t Test_Watermark(uint32_t rate_hz)
+{
+    const uint32_t watermark = (1000000 / TEST_GYRO_PERIOD_US + rate_hz / 2) / rate_hz;
+    return watermark < 1 ? 1 : watermark > TEST_GYRO_WATERMARK_MAX ? TEST_GYRO_WATERMARK_MAX : watermark;
+}
+
+static void Test_SetTick(uint32_t tick_us, uint32_t gyro_watermark)
+{
+    Safety_SetTickPeriod(tick_us, gyro_watermark * TEST_GYRO_PERIOD_US,
+                         TEST_ACCELEROMETER_WATERMARK * TEST_ACCELEROMETER_PERIOD_US);
+}
+
+// Timer mode at the slowest rate: both sensors are read once per tick, their
+// FIFOs overflow in between and a sample is dated ~20 ms before its read
+static void Test_TimerModeSlowest(void)
+{
+    const uint32_t tick_us = 1000000 / CONTROL_RATE_MIN_HZ;
+    Test_SetTick(tick_us, Test_Watermark(CONTROL_RATE_MIN_HZ));
+    Test_SensorStart(&gyro, TEST_GYRO_PERIOD_US, tick_us, TEST_GYRO_READ_US);
+    Test_SensorStart(&accelerometer, TEST_ACCELEROMETER_PERIOD_US, tick_us, TEST_ACCELEROMETER_READ_US);
+    Safety_Resume();
+
+    TEST_CHECK(Test_Run(5000000));
+    TEST_CHECK(motor_cuts == 0);
+}
+
+// Data-ready mode at 50 Hz: the gyro watermark paces the tick, the
+// accelerometer is read from its own watermark
+static void Test_DataReady50Hz(void)
+{
+    const uint32_t watermark = Test_Watermark(50);
+    const uint32_t tick_us = watermark * TEST_GYRO_PERIOD_US;
+    Test_SetTick(tick_us, watermark);
+    Test_SensorStart(&gyro, TEST_GYRO_PERIOD_US, tick_us, TEST_GYRO_READ_US);
+    Test_SensorStart(&accelerometer, TEST_ACCELEROMETER_PERIOD_US,
+                     TEST_ACCELEROMETER_WATERMARK * TEST_ACCELEROMETER_PERIOD_US, TEST_ACCELEROMETER_READ_US);
+    Safety_Resume();
+
+    TEST_CHECK(Test_Run(5000000));
+    TEST_CHECK(motor_cuts == 0);
+}
+
+// Still at the slowest rate, a lost accelerometer falls back to the gyro
+// alone until it comes back, a lost gyro cuts the motors for good
+static void Test_LostSensors(void)
+{
+    const uint32_t tick_us = 1000000 / CONTROL_RATE_MIN_HZ;
+    Test_SetTick(tick_us, Test_Watermark(CONTROL_RATE_MIN_HZ));
+    Test_SensorStart(&gyro, TEST_GYRO_PERIOD_US, tick_us, TEST_GYRO_READ_US);
+    Test_SensorStart(&accelerometer, TEST_ACCELEROMETER_PERIOD_US, tick_us, TEST_ACCELEROMETER_READ_US);
+    Safety_Resume();
+    TEST_CHECK(Test_Run(1000000));
+
+    accelerometer.stopped = 1;
+    Test_Run(1000000);
+    TEST_CHECK(Safety_Mode() == SAFETY_GYRO_ONLY);
+
+    accelerometer.stopped = 0;
+    accelerometer.next_read_us = now_us;
+    Test_Run(tick_us);
+    TEST_CHECK(Safety_Mode() == SAFETY_NORMAL);
+
+    gyro.stopped = 1;
+    Test_Run(1000000);
+    TEST_CHECK(Safety_Mode() == SAFETY_MOTOR_CUT);
+    TEST_CHECK(motor_cuts == 1);
+
+    gyro.stopped = 0;
+    gyro.next_read_us = now_us;
+    Test_Run(1000000);
+    TEST_CHECK(Safety_Mode() == SAFETY_MOTOR_CUT);
+}
+
+#define TEST_IWDG_KEY_RELOAD 0xAAAA
+
+// Ends a tick of cycles, returns 1 if the watchdog was reloaded
+static int Test_TickEnd(uint32_t cycles)
+{
+    Stub_IWDG.KR = 0;
+    Safety_TickEnd(cycles);
+    return Stub_IWDG.KR == TEST_IWDG_KEY_RELOAD;
+}
+
+// Only a tick that met its deadline reloads the watchdog, and the motors are
+// cut on the SAFETY_MAX_CONSECUTIVE_OVERRUNS-th overrun in a row
+static void Test_Overruns(void)
+{
+    const uint32_t tick_us = 1000;
+    const uint32_t tick_cycles = tick_us * (SystemCoreClock / 1000000);
+    Test_SetTick(tick_us, Test_Watermark(1000));
+
+    TEST_CHECK(Test_TickEnd(tick_cycles));
+
+    // One short of the cut, then a tick on time starts the count over
+    for (int i = 0; i < SAFETY_MAX_CONSECUTIVE_OVERRUNS - 1; i++)
+        TEST_CHECK(!Test_TickEnd(tick_cycles + 1));
+    TEST_CHECK(Safety_Mode() == SAFETY_NORMAL);
+    TEST_CHECK(Test_TickEnd(tick_cycles / 2));
+
+    SafetyCounters counters;
+    Safety_Counters(&counters);
+    TEST_CHECK(counters.tick_overruns == SAFETY_MAX_CONSECUTIVE_OVERRUNS - 1);
+
+    for (int i = 0; i < SAFETY_MAX_CONSECUTIVE_OVERRUNS - 1; i++)
+        TEST_CHECK(!Test_TickEnd(tick_cycles + 1));
+    TEST_CHECK(Safety_Mode() == SAFETY_NORMAL);
+    TEST_CHECK(motor_cuts == 0);
+
+    TEST_CHECK(!Test_TickEnd(tick_cycles + 1));
+    TEST_CHECK(Safety_Mode() == SAFETY_MOTOR_CUT);
+    TEST_CHECK(motor_cuts == 1);
+
+    Safety_Counters(&counters);
+    TEST_CHECK(counters.tick_overruns == 2 * SAFETY_MAX_CONSECUTIVE_OVERRUNS - 1);
+
+    // Latched: more overruns are counted but don't cut again
+    TEST_CHECK(!Test_TickEnd(tick_cycles + 1));
+    TEST_CHECK(motor_cuts == 1);
+}
+
+// The motor cut is latched until the next reset, so each test that cuts runs
+// on its own: without an argument the sensor tests, "overruns" the deadline one
+int main(int argc, char **argv)
+{
+    Safety_Init();
+    Safety_Start();
+
+    if (argc > 1 && strcmp(argv[1], "overruns") == 0)
+    {
+        TEST_RUN(Test_Overruns);
+        return TEST_RESULT();
+    }
+
+    TEST_RUN(Test_TimerModeSlowest);
+    TEST_RUN(Test_DataReady50Hz);
+    // Last, the motor cut is latched
+    TEST_RUN(Test_LostSensors);
+    return TEST_RESULT();
+}
@@ -0,0 +1,202 @@
+#include "main.h"
+#include "scheduler.h"
+#include "test.h"
+
+#define TEST_TICK_US 1000
+#define TEST_BUDGET_US 100
+
+/* Cycles of the table's tasks: each run moves the cycle counter by it */
+enum
+{
+    TEST_RATE,
+    TEST_ANGLE,
+    TEST_TELEMETRY,
+    TEST_HEALTH,
+    TEST_NUM_TASKS
+};
+
+static uint32_t cost_cycles[TEST_NUM_TASKS];
+static uint32_t order[16];
+static uint32_t order_length;
+
+static void Test_Run(uint32_t task)
+{
+    Stub_DWT.CYCCNT += cost_cycles[task];
+    if (order_length < sizeof(order) / sizeof(order[0]))
+        order[order_length++] = task;
+}
+
+static void Test_Rate(void)
+{
+    Test_Run(TEST_RATE);
+}
+
+static void Test_Angle(void)
+{
+    Test_Run(TEST_ANGLE);
+}
+
+static void Test_Telemetry(void)
+{
+    Test_Run(TEST_TELEMETRY);
+}
+
+static void Test_Health(void)
+{
+    Test_Run(TEST_HEALTH);
+}
+
+static SchedulerTask tasks[TEST_NUM_TASKS];
+
+static uint32_t Test_Cycles(uint32_t us)
+{
+    return us * (SystemCoreClock / 1000000);
+}
+
+static void Test_Init(void)
+{
+    const SchedulerTask table[TEST_NUM_TASKS] = {
+        [TEST_RATE] = {"rate", Test_Rate, SCHEDULER_TICK, 1, 0, TEST_BUDGET_US},
+        [TEST_ANGLE] = {"angle", Test_Angle, SCHEDULER_TICK, 4, 2, TEST_BUDGET_US},
+        [TEST_TELEMETRY] = {"telemetry", Test_Telemetry, SCHEDULER_BACKGROUND, 2, 1, TEST_BUDGET_US},
+        [TEST_HEALTH] = {"health", Test_Health, SCHEDULER_BACKGROUND, 5, 0, TEST_BUDGET_US},
+    };
+    for (int i = 0; i < TEST_NUM_TASKS; i++)
+    {
+        tasks[i] = table[i];
+        cost_cycles[i] = Test_Cycles(TEST_BUDGET_US / 2);
+    }
+    order_length = 0;
+    Scheduler_Init(tasks, TEST_NUM_TASKS, TEST_TICK_US);
+}
+
+// Every task is released every period ticks from its offset, the tick tasks
+// run in the tick in table order, the background ones from the main loop
+static void Test_Release(void)
+{
+    Test_Init();
+
+    for (int i = 0; i < 20; i++)
+    {
+        Scheduler_Tick();
+        while (tasks[TEST_TELEMETRY].pending || tasks[TEST_HEALTH].pending)
+            Scheduler_RunPending();
+    }
+
+    TEST_CHECK(tasks[TEST_RATE].runs == 20);
+    TEST_CHECK(tasks[TEST_ANGLE].runs == 5);
+    TEST_CHECK(tasks[TEST_TELEMETRY].runs == 10);
+    TEST_CHECK(tasks[TEST_HEALTH].runs == 4);
+    for (int i = 0; i < TEST_NUM_TASKS; i++)
+    {
+        TEST_CHECK(tasks[i].misses == 0);
+        TEST_CHECK(tasks[i].overruns == 0);
+    }
+
+    // Ticks 0, 1 and 2: health, telemetry and the angle task at its offset
+    const uint32_t expected[] = {TEST_RATE, TEST_HEALTH, TEST_RATE, TEST_TELEMETRY, TEST_RATE, TEST_ANGLE};
+    for (uint32_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+        TEST_CHECK(order[i] == expected[i]);
+}
+
+// A background task released again before it ran is a miss, and
+// Scheduler_RunPending() runs one task per call, the highest first
+static void Test_BackgroundMiss(void)
+{
+    Test_Init();
+
+    // Ticks 0 to 9: telemetry released 5 times, health twice, nothing run
+    for (int i = 0; i < 10; i++)
+        Scheduler_Tick();
+    TEST_CHECK(tasks[TEST_TELEMETRY].misses == 4);
+    TEST_CHECK(tasks[TEST_HEALTH].misses == 1);
+
+    order_length = 0;
+    Scheduler_RunPending();
+    TEST_CHECK(order_length == 1 && order[0] == TEST_TELEMETRY);
+    TEST_CHECK(tasks[TEST_HEALTH].pending);
+    Scheduler_RunPending();
+    TEST_CHECK(order_length == 2 && order[1] == TEST_HEALTH);
+    Scheduler_RunPending();
+    TEST_CHECK(order_length == 2);
+
+    // Still running when released again, from a tick that preempted it
+    tasks[TEST_TELEMETRY].running = 1;
+    Scheduler_Tick(); // tick 10
+    Scheduler_Tick(); // tick 11, telemetry
+    TEST_CHECK(tasks[TEST_TELEMETRY].misses == 5);
+}
+
+// A tick task that ends after its next release misses its deadline, one that
+// runs past its budget overruns
+static void Test_TickMiss(void)
+{
+    Test_Init();
+
+    // Over budget but within the tick
+    cost_cycles[TEST_RATE] = Test_Cycles(2 * TEST_BUDGET_US);
+    Scheduler_Tick();
+    TEST_CHECK(tasks[TEST_RATE].overruns == 1);
+    TEST_CHECK(tasks[TEST_RATE].misses == 0);
+    TEST_CHECK(tasks[TEST_RATE].max_cycles == Test_Cycles(2 * TEST_BUDGET_US));
+
+    // Past the tick
+    cost_cycles[TEST_RATE] = Test_Cycles(TEST_TICK_US) + 1;
+    Scheduler_Tick();
+    TEST_CHECK(tasks[TEST_RATE].overruns == 2);
+    TEST_CHECK(tasks[TEST_RATE].misses == 1);
+
+    // The angle task runs after the rate task in the same tick, its deadline
+    // is four ticks from the start of the tick
+    cost_cycles[TEST_RATE] = Test_Cycles(TEST_TICK_US) + 1;
+    cost_cycles[TEST_ANGLE] = Test_Cycles(3 * TEST_TICK_US) - 1;
+    Scheduler_Tick(); // tick 2
+    TEST_CHECK(tasks[TEST_RATE].misses == 2);
+    TEST_CHECK(tasks[TEST_ANGLE].runs == 1);
+    TEST_CHECK(tasks[TEST_ANGLE].misses == 0);
+
+    cost_cycles[TEST_RATE] = Test_Cycles(TEST_BUDGET_US / 2);
+    cost_cycles[TEST_ANGLE] = Test_Cycles(4 * TEST_TICK_US) + 1;
+    for (int i = 3; i <= 6; i++)
+        Scheduler_Tick();
+    TEST_CHECK(tasks[TEST_ANGLE].runs == 2);
+    TEST_CHECK(tasks[TEST_ANGLE].misses == 1);
+
+    // A longer tick moves the deadline
+    Scheduler_SetTickPeriod(2 * TEST_TICK_US);
+    cost_cycles[TEST_RATE] = Test_Cycles(TEST_TICK_US) + 1;
+    Scheduler_Tick();
+    TEST_CHECK(tasks[TEST_RATE].misses == 2);
+}
+
+// The offset is kept while it fits in the new period, a period of 0 is 1
+static void Test_SetPeriod(void)
+{
+    Test_Init();
+
+    Scheduler_SetPeriod(&tasks[TEST_ANGLE], 8);
+    TEST_CHECK(tasks[TEST_ANGLE].period == 8);
+    TEST_CHECK(tasks[TEST_ANGLE].offset == 2);
+
+    Scheduler_SetPeriod(&tasks[TEST_ANGLE], 2);
+    TEST_CHECK(tasks[TEST_ANGLE].period == 2);
+    TEST_CHECK(tasks[TEST_ANGLE].offset == 0);
+
+    Scheduler_SetPeriod(&tasks[TEST_HEALTH], 0);
+    TEST_CHECK(tasks[TEST_HEALTH].period == 1);
+    TEST_CHECK(tasks[TEST_HEALTH].offset == 0);
+
+    // Released on every even tick from now on
+    for (int i = 0; i < 10; i++)
+        Scheduler_Tick();
+    TEST_CHECK(tasks[TEST_ANGLE].runs == 5);
+}
+
+int main(void)
+{
+    TEST_RUN(Test_Release);
+    TEST_RUN(Test_BackgroundMiss);
+    TEST_RUN(Test_TickMiss);
+    TEST_RUN(Test_SetPeriod);
+    return TEST_RESULT();
+}
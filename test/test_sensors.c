@@ -0,0 +1,158 @@
+#include "sensors.h"
+#include "I2C.h"
+#include "test.h"
+
+/* Bus stand-ins of the sensor drivers: a read holds its bus until the test
+ * completes it, which runs the driver callback as the DMA interrupt would */
+typedef struct
+{
+    int busy;
+    void (*callback)(void);
+    unsigned int reads;
+} TestBus;
+
+static TestBus gyro_bus;
+static TestBus accelerometer_bus;
+static uint32_t published;
+
+static int Test_StartRead(TestBus *bus)
+{
+    if (bus->busy)
+        return 0;
+    bus->busy = 1;
+    bus->reads++;
+    return 1;
+}
+
+static void Test_Complete(TestBus *bus)
+{
+    bus->busy = 0;
+    bus->callback();
+}
+
+void GyroSetCallback(GyroCallback callback)
+{
+    gyro_bus.callback = callback;
+}
+
+void AccelerometerSetCallback(AccelerometerCallback callback)
+{
+    accelerometer_bus.callback = callback;
+}
+
+int GyroStartRead()
+{
+    return Test_StartRead(&gyro_bus);
+}
+
+int AccelerometerStartRead()
+{
+    return Test_StartRead(&accelerometer_bus);
+}
+
+// The sample counts the reads, so a set shows which of them it holds
+void GetGyroSample(GyroSample *sample)
+{
+    *sample = (GyroSample){.count = gyro_bus.reads - gyro_bus.busy};
+}
+
+void GetAccelerometerSample(AccelerometerSample *sample)
+{
+    *sample = (AccelerometerSample){.count = accelerometer_bus.reads - accelerometer_bus.busy};
+}
+
+int GyroSetWatermark(unsigned char watermark)
+{
+    return !gyro_bus.busy;
+}
+
+void GyroCheckTimeout()
+{
+}
+
+void I2CCheckTimeout()
+{
+}
+
+static void Test_Published(void)
+{
+    published++;
+}
+
+static void Test_Reset(void)
+{
+    gyro_bus = (TestBus){0};
+    accelerometer_bus = (TestBus){0};
+    published = 0;
+    Sensors_Init(Test_Published);
+    Sensors_SetMode(SENSORS_TIMER);
+}
+
+// A set is published once both bursts of the round have landed
+static void Test_Round(void)
+{
+    Test_Reset();
+    Sensors_StartRound();
+    Test_Complete(&gyro_bus);
+    TEST_CHECK(published == 0);
+    Test_Complete(&accelerometer_bus);
+    TEST_CHECK(published == 1);
+
+    SensorSet set;
+    Sensors_Latest(&set);
+    TEST_CHECK(set.gyro.count == 1);
+    TEST_CHECK(set.accelerometer.count == 1);
+}
+
+// The accelerometer burst of a round is still on the I2C bus when the next
+// round starts, so only the gyro is read again.  Its late completion lands
+// first, then the gyro one completes the new round.
+static void Test_LateCompletion(void)
+{
+    Test_Reset();
+    Sensors_StartRound();
+    Test_Complete(&gyro_bus);
+
+    Sensors_StartRound();
+    TEST_CHECK(gyro_bus.busy);
+    TEST_CHECK(accelerometer_bus.reads == 1);
+
+    Test_Complete(&accelerometer_bus);
+    TEST_CHECK(published == 0);
+    Test_Complete(&gyro_bus);
+    TEST_CHECK(published == 1);
+
+    SensorSet set;
+    Sensors_Latest(&set);
+    TEST_CHECK(set.gyro.count == 2);
+    TEST_CHECK(set.accelerometer.count == 1);
+
+    // The next round starts both bursts again
+    Sensors_StartRound();
+    Test_Complete(&accelerometer_bus);
+    Test_Complete(&gyro_bus);
+    TEST_CHECK(published == 2);
+}
+
+// Same, but the late completion lands after the new round is published: it
+// doesn't publish a second set
+static void Test_LateCompletionAfterRound(void)
+{
+    Test_Reset();
+    Sensors_StartRound();
+    Test_Complete(&gyro_bus);
+
+    Sensors_StartRound();
+    Test_Complete(&gyro_bus);
+    TEST_CHECK(published == 1);
+    Test_Complete(&accelerometer_bus);
+    TEST_CHECK(published == 1);
+}
+
+int main(void)
+{
+    TEST_RUN(Test_Round);
+    TEST_RUN(Test_LateCompletion);
+    TEST_RUN(Test_LateCompletionAfterRound);
+    return TEST_RESULT();
+}
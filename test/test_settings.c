@@ -0,0 +1,187 @@
+#include <string.h>
+#include "settings.h"
+#include "stubs.h"
+#include "test.h"
+
+/* Magic, settings and CRC of the current layout */
+#define TEST_RECORD_SIZE (sizeof(Settings) + 8)
+
+static Settings Test_Settings(uint32_t flags, float bias)
+{
+    Settings settings = {flags, {bias, -bias, 2.0f * bias}};
+    return settings;
+}
+
+static StubFlashCounters Test_Counters(void)
+{
+    StubFlashCounters counters;
+    Stub_FlashCounters(&counters);
+    return counters;
+}
+
+static void Test_Empty(void)
+{
+    Stub_FlashReset();
+    Settings_Init();
+    TEST_CHECK(Settings_Get()->flags == 0);
+    TEST_CHECK(!Settings_Full());
+    TEST_CHECK(Test_Counters().programs == 0);
+}
+
+// The last record wins, across a reboot
+static void Test_SaveLoad(void)
+{
+    Stub_FlashReset();
+    Settings_Init();
+    Settings first = Test_Settings(SETTINGS_ESC_CALIBRATED, 0.01f);
+    Settings second = Test_Settings(SETTINGS_ESC_CALIBRATED | SETTINGS_GYRO_BIAS, 0.02f);
+    TEST_CHECK(Settings_Save(&first));
+    TEST_CHECK(Settings_Save(&second));
+    TEST_CHECK(memcmp(Settings_Get(), &second, sizeof(second)) == 0);
+
+    Settings_Init();
+    TEST_CHECK(memcmp(Settings_Get(), &second, sizeof(second)) == 0);
+    TEST_CHECK(Test_Counters().errors == 0);
+}
+
+// A save cut short by a power loss leaves the previous settings
+static void Test_PowerLoss(void)
+{
+    Stub_FlashReset();
+    Settings_Init();
+    Settings first = Test_Settings(SETTINGS_GYRO_BIAS, 0.01f);
+    Settings second = Test_Settings(SETTINGS_GYRO_BIAS, 0.03f);
+    TEST_CHECK(Settings_Save(&first));
+    TEST_CHECK(Settings_Save(&second));
+
+    // Only the magic and the flags of the second record made it
+    memset(Stub_Flash() + TEST_RECORD_SIZE + 8, 0xFF, TEST_RECORD_SIZE - 8);
+    Settings_Init();
+    TEST_CHECK(memcmp(Settings_Get(), &first, sizeof(first)) == 0);
+
+    // The next record goes after the broken one
+    Settings third = Test_Settings(SETTINGS_GYRO_BIAS, 0.04f);
+    TEST_CHECK(Settings_Save(&third));
+    Settings_Init();
+    TEST_CHECK(memcmp(Settings_Get(), &third, sizeof(third)) == 0);
+}
+
+// A full sector loads and stays as it is through the boot, the erase waits
+// for Settings_Compact()
+static void Test_FullDeferred(void)
+{
+    Stub_FlashReset();
+    Settings_Init();
+    Settings settings = Test_Settings(0, 0.0f);
+    uint32_t saves = 0;
+    for (;;)
+    {
+        settings = Test_Settings(SETTINGS_GYRO_BIAS, 0.001f * (saves % 100));
+        if (!Settings_Save(&settings))
+            break;
+        saves++;
+    }
+    TEST_CHECK(saves == STUB_FLASH_SECTOR7_SIZE / TEST_RECORD_SIZE);
+    TEST_CHECK(Settings_Full());
+    const Settings last = *Settings_Get();
+
+    Settings_Init();
+    TEST_CHECK(Settings_Full());
+    TEST_CHECK(Test_Counters().erases == 0);
+    TEST_CHECK(memcmp(Settings_Get(), &last, sizeof(last)) == 0);
+    TEST_CHECK(!Settings_Save(&settings));
+
+    TEST_CHECK(Settings_Compact());
+    TEST_CHECK(Test_Counters().erases == 1);
+    TEST_CHECK(!Settings_Full());
+    TEST_CHECK(memcmp(Settings_Get(), &last, sizeof(last)) == 0);
+
+    // One record left, the current settings
+    Settings_Init();
+    TEST_CHECK(memcmp(Settings_Get(), &last, sizeof(last)) == 0);
+    uint32_t magic;
+    memcpy(&magic, Stub_Flash() + TEST_RECORD_SIZE, sizeof(magic));
+    TEST_CHECK(magic == 0xFFFFFFFFu);
+    TEST_CHECK(Test_Counters().errors == 0);
+}
+
+// Anything that isn't a record counts as a full sector, the compaction keeps
+// the settings loaded before it
+static void Test_Garbage(void)
+{
+    Stub_FlashReset();
+    Settings_Init();
+    Settings settings = Test_Settings(SETTINGS_ESC_CALIBRATED, 0.0f);
+    TEST_CHECK(Settings_Save(&settings));
+    const uint32_t garbage = 0x12345678u;
+    memcpy(Stub_Flash() + TEST_RECORD_SIZE, &garbage, sizeof(garbage));
+
+    Settings_Init();
+    TEST_CHECK(Settings_Full());
+    TEST_CHECK(Test_Counters().erases == 0);
+    TEST_CHECK(Settings_Get()->flags == SETTINGS_ESC_CALIBRATED);
+
+    TEST_CHECK(Settings_Compact());
+    Settings_Init();
+    TEST_CHECK(!Settings_Full());
+    TEST_CHECK(Settings_Get()->flags == SETTINGS_ESC_CALIBRATED);
+}
+
+// Defaults need no record after the erase
+static void Test_CompactDefaults(void)
+{
+    Stub_FlashReset();
+    const uint32_t garbage = 0;
+    memcpy(Stub_Flash(), &garbage, sizeof(garbage));
+    Settings_Init();
+    TEST_CHECK(Settings_Full());
+
+    TEST_CHECK(Settings_Compact());
+    TEST_CHECK(Test_Counters().programs == 0);
+    TEST_CHECK(!Settings_Full());
+}
+
+// A record of an older, shorter layout: the fields it lacks keep their
+// defaults
+static void Test_OlderLayout(void)
+{
+    Stub_FlashReset();
+    Settings_Init();
+    Settings settings = Test_Settings(SETTINGS_ESC_CALIBRATED | SETTINGS_GYRO_BIAS, 0.05f);
+    TEST_CHECK(Settings_Save(&settings));
+
+    // Magic, flags only and the CRC over them, as the first layout wrote it
+    uint8_t *flash = Stub_Flash();
+    uint32_t record[3] = {0x53450000u | 12u, SETTINGS_ESC_CALIBRATED, 0};
+    uint32_t crc = 0xFFFFFFFFu;
+    const uint8_t *bytes = (const uint8_t *)record;
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        crc ^= bytes[i];
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+    }
+    record[2] = ~crc;
+    memcpy(flash + TEST_RECORD_SIZE, record, sizeof(record));
+
+    Settings_Init();
+    TEST_CHECK(Settings_Get()->flags == SETTINGS_ESC_CALIBRATED);
+    TEST_CHECK(Settings_Get()->gyro_bias[0] == 0.0f);
+
+    // And the log goes on after it
+    TEST_CHECK(Settings_Save(&settings));
+    Settings_Init();
+    TEST_CHECK(memcmp(Settings_Get(), &settings, sizeof(settings)) == 0);
+}
+
+int main(void)
+{
+    TEST_RUN(Test_Empty);
+    TEST_RUN(Test_SaveLoad);
+    TEST_RUN(Test_PowerLoss);
+    TEST_RUN(Test_FullDeferred);
+    TEST_RUN(Test_Garbage);
+    TEST_RUN(Test_CompactDefaults);
+    TEST_RUN(Test_OlderLayout);
+    return TEST_RESULT();
+}
@@ -4,6 +4,8 @@ use eframe::egui;
 use egui_plot::{Line, Plot, PlotPoints};
 use std::{sync::mpsc, thread, time};
 
+mod telemetry;
+
 #[derive(PartialEq)]
 enum Menu {
     Filters,
@@ -14,6 +16,7 @@ enum Menu {
 enum Filter {
     Complementary,
     Kalman,
+    KalmanSteadyState,
 }
 
 #[derive(PartialEq)]
@@ -25,7 +28,8 @@ enum Controller {
 
 struct MyApp {
     tx: mpsc::Sender<String>,
-    rx: mpsc::Receiver<String>,
+    rx: mpsc::Receiver<Vec<u8>>,
+    decoder: telemetry::Decoder,
     kp: f64,
     ki: f64,
     kd: f64,
@@ -33,30 +37,41 @@ struct MyApp {
     x: f64,
     y: f64,
     z: f64,
+    lqr_q: f64,
+    lqr_w: f64,
+    lqr_r: f64,
     page: Menu,
     filter: Filter,
     controller: Controller,
+    data_ready: bool,
+    rate: f64,
+    health: Option<telemetry::Health>,
     data: Vec<(f64, f64)>, // Store (x, y) pairs for the plot
-    time: f64,             // A variable to simulate time for updating the chart
 }
 
 impl MyApp {
-    fn new(tx: mpsc::Sender<String>, rx: mpsc::Receiver<String>) -> Self {
+    fn new(tx: mpsc::Sender<String>, rx: mpsc::Receiver<Vec<u8>>) -> Self {
         Self {
             tx,
             rx,
+            decoder: telemetry::Decoder::default(),
             kp: 0.5,
             ki: 0.5,
             kd: 0.5,
             a: 0.99,
-            x: 1.,
-            y: 2.,
-            z: 3.,
+            x: 0.1,
+            y: 0.2,
+            z: 0.3,
+            lqr_q: 1000.,
+            lqr_w: 10.,
+            lqr_r: 100.,
             page: Menu::Filters,
             filter: Filter::Complementary,
             controller: Controller::PID,
+            data_ready: false,
+            rate: 1000.,
+            health: None,
             data: Vec::new(),
-            time: 0.,
         }
     }
 }
@@ -71,6 +86,26 @@ impl eframe::App for MyApp {
                 if ui.button("Algorithmes").clicked() {
                     self.page = Menu::Algos;
                 }
+                if ui.button("Profilage").clicked() {
+                    self.tx.send("T".to_string()).unwrap();
+                }
+                // Runs at the next power up of the ESCs
+                if ui.button("Calibrer ESC").clicked() {
+                    self.tx.send("E".to_string()).unwrap();
+                }
+                if ui
+                    .checkbox(&mut self.data_ready, "Synchro capteurs")
+                    .changed()
+                {
+                    let command = if self.data_ready { "D" } else { "H" };
+                    self.tx.send(command.to_string()).unwrap();
+                }
+                ui.label("Fréquence (Hz)");
+                let t = self.rate;
+                ui.add(egui::Slider::new(&mut self.rate, 10.0..=2000.0).logarithmic(true));
+                if t != self.rate {
+                    self.tx.send(format!("f:{}", self.rate.round())).unwrap();
+                }
             });
         });
 
@@ -104,6 +139,12 @@ impl eframe::App for MyApp {
                                 self.filter = Filter::Kalman;
                                 self.tx.send("K".to_string()).unwrap();
                             }
+                            if self.filter != Filter::KalmanSteadyState
+                                && ui.button("Gain stationnaire").clicked()
+                            {
+                                self.filter = Filter::KalmanSteadyState;
+                                self.tx.send("S".to_string()).unwrap();
+                            }
                         });
                         ui.horizontal(|ui| {
                             ui.label("x");
@@ -188,21 +229,77 @@ impl eframe::App for MyApp {
                                 && ui.button("Activer").clicked()
                             {
                                 self.controller = Controller::LQR;
+                                self.tx.send("L".to_string()).unwrap();
+                            }
+                        });
+                        ui.horizontal(|ui| {
+                            ui.label("Q angle");
+                            let t = self.lqr_q;
+                            ui.add(egui::Slider::new(&mut self.lqr_q, 0.0..=10000.0));
+                            if t != self.lqr_q {
+                                self.tx.send(format!("q:{}", self.lqr_q)).unwrap();
                             }
                         });
                         ui.horizontal(|ui| {
-                            ui.label("a");
-                            ui.add(egui::Slider::new(&mut self.a, 0.0..=10.0));
+                            ui.label("Q vitesse");
+                            let t = self.lqr_w;
+                            ui.add(egui::Slider::new(&mut self.lqr_w, 0.0..=10000.0));
+                            if t != self.lqr_w {
+                                self.tx.send(format!("w:{}", self.lqr_w)).unwrap();
+                            }
                         });
                         ui.horizontal(|ui| {
-                            ui.label("b");
-                            ui.add(egui::Slider::new(&mut self.a, 0.0..=10.0));
+                            ui.label("R");
+                            let t = self.lqr_r;
+                            ui.add(egui::Slider::new(&mut self.lqr_r, 0.01..=10000.0));
+                            if t != self.lqr_r {
+                                self.tx.send(format!("r:{}", self.lqr_r)).unwrap();
+                            }
                         });
                     }
                 });
 
+                if let Some(health) = &self.health {
+                    ui.group(|ui| {
+                        let mode = match health.mode {
+                            telemetry::SafetyMode::Normal => "normal".to_string(),
+                            telemetry::SafetyMode::GyroOnly => "gyro seul".to_string(),
+                            telemetry::SafetyMode::MotorCut => "moteurs coupés".to_string(),
+                            telemetry::SafetyMode::Unknown(mode) => format!("inconnu ({})", mode),
+                        };
+                        ui.label(format!(
+                            "Sécurité: {}{}",
+                            mode,
+                            if health.watchdog_reset { "  (reset watchdog)" } else { "" }
+                        ));
+                        ui.label(format!(
+                            "dépassements: {}  gyro seul: {}  timeouts gyro: {}",
+                            health.tick_overruns, health.gyro_only_entries, health.gyro_timeouts
+                        ));
+                        ui.label(format!(
+                            "I2C erreurs: {}  timeouts: {}  récupérations: {}",
+                            health.i2c_errors, health.i2c_timeouts, health.i2c_recoveries
+                        ));
+                        ui.label(format!(
+                            "ESC erreurs: {}  trames sautées: {}",
+                            health.esc_errors, health.esc_skipped
+                        ));
+                        ui.label(format!(
+                            "Biais gyro{}: {:.1} {:.1} {:.1} mrad/s  reprises: {}",
+                            if health.gyro_bias_calibrating { " (calibration)" } else { "" },
+                            health.gyro_bias[0] * 1000.0,
+                            health.gyro_bias[1] * 1000.0,
+                            health.gyro_bias[2] * 1000.0,
+                            health.gyro_bias_restarts
+                        ));
+                    });
+                }
+
                 ui.group(|ui| {
-                    ui.label("Angle");
+                    ui.label(format!(
+                        "Angle    trames perdues: {}  invalides: {}",
+                        self.decoder.lost_frames, self.decoder.bad_frames
+                    ));
                     let sin: PlotPoints = self
                         .data
                         .iter()
@@ -216,30 +313,35 @@ impl eframe::App for MyApp {
             });
         });
 
-        if let Ok(v) = self.rx.try_recv() {
-            self.time += 0.1;
-
-            self.data.push((
-                self.time,
-                v.trim()
-                    .chars()
-                    .filter(|&c| !c.is_ascii_control()) // Filter out control characters like '\0', '\n', etc.
-                    .collect::<String>()
-                    .parse()
-                    .expect("Failed to parse the string to f64"),
-            ));
+        while let Ok(bytes) = self.rx.try_recv() {
+            for frame in self.decoder.push(&bytes) {
+                match frame.payload {
+                    telemetry::Payload::Sample(sample) => {
+                        self.data.push((
+                            frame.timestamp_us as f64 * 1e-6,
+                            (sample.estimate as f64).to_degrees(),
+                        ));
+                    }
+                    // Text (e.g. the timing report) goes to the console
+                    telemetry::Payload::Text(text) => print!("{}", text),
+                    telemetry::Payload::Health(health) => self.health = Some(health),
+                }
+            }
 
             // Keep the data size under a certain limit to avoid excessive memory usage
-            if self.data.len() > 100 {
-                self.data.remove(0); // Remove the oldest data point
+            if self.data.len() > 1000 {
+                let excess = self.data.len() - 1000;
+                self.data.drain(..excess); // Remove the oldest data points
             }
         }
+
+        ctx.request_repaint();
     }
 }
 
 fn main() {
     let (tx_app_to_mcu, rx_app_to_mcu) = mpsc::channel::<String>();
-    let (tx_mcu_to_app, rx_mcu_to_app) = mpsc::channel::<String>();
+    let (tx_mcu_to_app, rx_mcu_to_app) = mpsc::channel::<Vec<u8>>();
 
     let handle_a = thread::spawn(move || {
         let port_name = "/dev/ttyUSB0";
@@ -248,20 +350,12 @@ fn main() {
         let mut port = serialport::new(port_name, baud_rate).open().unwrap();
 
         loop {
-            let mut buffer = [0; 64];
+            // Raw bytes, the frames are decoded by the app
+            let mut buffer = [0; 512];
             let n = port.read(&mut buffer[..]);
             if let Ok(t) = n {
                 if t != 0 {
-                    if let Ok(s) = std::str::from_utf8(&buffer) {
-                        // println!("{:?}", s);
-                        if let Some(pos) = s.find('\n') {
-                            let data = &s[..pos];
-                            // println!("rx: {:?}", data);
-                            tx_mcu_to_app.send(data.to_string()).unwrap();
-                        }
-                    } else {
-                        println!("Invalid UTF-8 sequence");
-                    }
+                    tx_mcu_to_app.send(buffer[..t].to_vec()).unwrap();
                 }
             }
 
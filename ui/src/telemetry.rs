@@ -0,0 +1,331 @@
+//! Decoder for the binary telemetry frames sent by the firmware
+//! (see `mcu/Core/Inc/telemetry.h`).
+//!
+//! A frame is `COBS(header | payload | crc16) 0x00`, all fields little-endian.
+
+pub const SAMPLE: u8 = 0x01;
+pub const TEXT: u8 = 0x02;
+pub const HEALTH: u8 = 0x03;
+
+const HEADER_LEN: usize = 7;
+const SAMPLE_LEN: usize = 32;
+const HEALTH_LEN: usize = 51;
+
+#[derive(Debug, Clone, PartialEq)]
+pub struct Sample {
+    pub angle: f32,
+    pub rate: f32,
+    pub estimate: f32,
+    pub control: f32,
+    pub left_motor: f32,
+    pub right_motor: f32,
+    /// Measured by bidirectional DShot, 0 without it
+    pub left_rpm: f32,
+    pub right_rpm: f32,
+}
+
+/// Safety mode of the control loop (`SafetyMode` in `mcu/Core/Inc/safety.h`)
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum SafetyMode {
+    Normal,
+    GyroOnly,
+    MotorCut,
+    Unknown(u8),
+}
+
+/// Fault counters, all since the last reset of the board
+#[derive(Debug, Clone, PartialEq)]
+pub struct Health {
+    pub mode: SafetyMode,
+    pub watchdog_reset: bool,
+    pub tick_overruns: u32,
+    pub gyro_only_entries: u32,
+    pub gyro_timeouts: u32,
+    pub i2c_errors: u32,
+    pub i2c_timeouts: u32,
+    pub i2c_recoveries: u32,
+    pub esc_errors: u32,
+    pub esc_skipped: u32,
+    /// Still averaging the startup calibration, the bias is the stored one
+    pub gyro_bias_calibrating: bool,
+    /// Calibrations started over because the arm moved
+    pub gyro_bias_restarts: u32,
+    /// rad/s, x y z
+    pub gyro_bias: [f32; 3],
+}
+
+#[derive(Debug, Clone, PartialEq)]
+pub enum Payload {
+    Sample(Sample),
+    Text(String),
+    Health(Health),
+}
+
+#[derive(Debug, Clone, PartialEq)]
+pub struct Frame {
+    pub seq: u16,
+    pub timestamp_us: u32,
+    pub payload: Payload,
+}
+
+/// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF)
+pub fn crc16(data: &[u8]) -> u16 {
+    let mut crc: u16 = 0xFFFF;
+    for &b in data {
+        let mut x = ((crc >> 8) as u8) ^ b;
+        x ^= x >> 4;
+        crc = (crc << 8) ^ ((x as u16) << 12) ^ ((x as u16) << 5) ^ (x as u16);
+    }
+    crc
+}
+
+/// Decode one COBS block (without the 0x00 delimiter)
+pub fn cobs_decode(input: &[u8]) -> Option<Vec<u8>> {
+    let mut out = Vec::with_capacity(input.len());
+    let mut i = 0;
+    while i < input.len() {
+        let code = input[i] as usize;
+        if code == 0 || i + code > input.len() {
+            return None;
+        }
+        out.extend_from_slice(&input[i + 1..i + code]);
+        i += code;
+        if code != 0xFF && i < input.len() {
+            out.push(0);
+        }
+    }
+    Some(out)
+}
+
+fn f32_at(data: &[u8], offset: usize) -> f32 {
+    f32::from_le_bytes(data[offset..offset + 4].try_into().unwrap())
+}
+
+fn u32_at(data: &[u8], offset: usize) -> u32 {
+    u32::from_le_bytes(data[offset..offset + 4].try_into().unwrap())
+}
+
+/// Check and parse a decoded frame (header | payload | crc16)
+pub fn parse(data: &[u8]) -> Option<Frame> {
+    if data.len() < HEADER_LEN + 2 {
+        return None;
+    }
+    let (body, crc) = data.split_at(data.len() - 2);
+    if crc16(body) != u16::from_le_bytes([crc[0], crc[1]]) {
+        return None;
+    }
+
+    let seq = u16::from_le_bytes([body[1], body[2]]);
+    let timestamp_us = u32::from_le_bytes(body[3..7].try_into().unwrap());
+    let payload = &body[HEADER_LEN..];
+
+    let payload = match body[0] {
+        SAMPLE if payload.len() == SAMPLE_LEN => Payload::Sample(Sample {
+            angle: f32_at(payload, 0),
+            rate: f32_at(payload, 4),
+            estimate: f32_at(payload, 8),
+            control: f32_at(payload, 12),
+            left_motor: f32_at(payload, 16),
+            right_motor: f32_at(payload, 20),
+            left_rpm: f32_at(payload, 24),
+            right_rpm: f32_at(payload, 28),
+        }),
+        TEXT => Payload::Text(String::from_utf8_lossy(payload).into_owned()),
+        HEALTH if payload.len() == HEALTH_LEN => Payload::Health(Health {
+            mode: match payload[0] {
+                0 => SafetyMode::Normal,
+                1 => SafetyMode::GyroOnly,
+                2 => SafetyMode::MotorCut,
+                other => SafetyMode::Unknown(other),
+            },
+            watchdog_reset: payload[1] != 0,
+            tick_overruns: u32_at(payload, 2),
+            gyro_only_entries: u32_at(payload, 6),
+            gyro_timeouts: u32_at(payload, 10),
+            i2c_errors: u32_at(payload, 14),
+            i2c_timeouts: u32_at(payload, 18),
+            i2c_recoveries: u32_at(payload, 22),
+            esc_errors: u32_at(payload, 26),
+            esc_skipped: u32_at(payload, 30),
+            gyro_bias_calibrating: payload[34] == 0,
+            gyro_bias_restarts: u32_at(payload, 35),
+            gyro_bias: [f32_at(payload, 39), f32_at(payload, 43), f32_at(payload, 47)],
+        }),
+        _ => return None,
+    };
+
+    Some(Frame {
+        seq,
+        timestamp_us,
+        payload,
+    })
+}
+
+/// Splits the byte stream on the 0x00 delimiter and decodes the frames,
+/// keeping count of what was lost on the way.
+#[derive(Default)]
+pub struct Decoder {
+    pending: Vec<u8>,
+    last_seq: Option<u16>,
+    pub bad_frames: u32,
+    pub lost_frames: u32,
+}
+
+impl Decoder {
+    pub fn push(&mut self, bytes: &[u8]) -> Vec<Frame> {
+        let mut frames = Vec::new();
+        for &b in bytes {
+            if b != 0 {
+                self.pending.push(b);
+                continue;
+            }
+            if self.pending.is_empty() {
+                continue;
+            }
+            match cobs_decode(&self.pending).as_deref().and_then(parse) {
+                Some(frame) => {
+                    if let Some(last) = self.last_seq {
+                        // A reset of the board starts over at 0, only count forward gaps
+                        let gap = frame.seq.wrapping_sub(last).wrapping_sub(1);
+                        if gap < 0x8000 {
+                            self.lost_frames += gap as u32;
+                        }
+                    }
+                    self.last_seq = Some(frame.seq);
+                    frames.push(frame);
+                }
+                None => self.bad_frames += 1,
+            }
+            self.pending.clear();
+        }
+        frames
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    include!("telemetry_vectors.rs");
+
+    fn decode_one(bytes: &[u8]) -> Frame {
+        let mut decoder = Decoder::default();
+        let mut frames = decoder.push(bytes);
+        assert_eq!(decoder.bad_frames, 0);
+        assert_eq!(frames.len(), 1);
+        frames.remove(0)
+    }
+
+    #[test]
+    fn sample() {
+        let frame = decode_one(SAMPLE_FRAME);
+        assert_eq!(frame.seq, 0);
+        assert_eq!(frame.timestamp_us, 2000);
+        assert_eq!(
+            frame.payload,
+            Payload::Sample(Sample {
+                angle: 0.125,
+                rate: -0.5,
+                estimate: 0.25,
+                control: -1.5,
+                left_motor: 120.0,
+                right_motor: 0.0,
+                left_rpm: 3000.0,
+                right_rpm: 0.0,
+            })
+        );
+    }
+
+    #[test]
+    fn health() {
+        // 7 header bytes, the 51 of TelemetryHealth and the CRC
+        assert_eq!(cobs_decode(&HEALTH_FRAME[..HEALTH_FRAME.len() - 1]).unwrap().len(), HEADER_LEN + HEALTH_LEN + 2);
+
+        let frame = decode_one(HEALTH_FRAME);
+        assert_eq!(frame.seq, 1);
+        assert_eq!(frame.timestamp_us, 3000);
+        assert_eq!(
+            frame.payload,
+            Payload::Health(Health {
+                mode: SafetyMode::GyroOnly,
+                watchdog_reset: false,
+                tick_overruns: 7,
+                gyro_only_entries: 2,
+                gyro_timeouts: 0,
+                i2c_errors: 300,
+                i2c_timeouts: 5,
+                i2c_recoveries: 1,
+                esc_errors: 0,
+                esc_skipped: 65536,
+                gyro_bias_calibrating: false,
+                gyro_bias_restarts: 3,
+                gyro_bias: [0.01, -0.02, 0.0],
+            })
+        );
+    }
+
+    #[test]
+    fn text() {
+        let frame = decode_one(TEXT_FRAME);
+        assert_eq!(frame.seq, 2);
+        assert_eq!(frame.payload, Payload::Text("LQR did not converge, gain kept\r\n".into()));
+    }
+
+    #[test]
+    fn long_text() {
+        let mut decoder = Decoder::default();
+        let frames = decoder.push(LONG_TEXT_FRAMES);
+        assert_eq!(frames.len(), 2);
+        assert_eq!((frames[0].seq, frames[1].seq), (3, 4));
+
+        let mut text = String::new();
+        for frame in &frames {
+            match &frame.payload {
+                Payload::Text(chunk) => text.push_str(chunk),
+                other => panic!("not text: {:?}", other),
+            }
+        }
+        let expected: String = (0..116).map(|i| (b'a' + i % 26) as char).collect();
+        assert_eq!(text, expected);
+    }
+
+    #[test]
+    fn bad_crc() {
+        let decoded = cobs_decode(&BAD_CRC_FRAME[..BAD_CRC_FRAME.len() - 1]).unwrap();
+        assert!(parse(&decoded).is_none());
+
+        let mut decoder = Decoder::default();
+        assert!(decoder.push(BAD_CRC_FRAME).is_empty());
+        assert_eq!(decoder.bad_frames, 1);
+    }
+
+    // The delimiter ends the broken frame and the next one decodes
+    #[test]
+    fn truncated() {
+        let mut decoder = Decoder::default();
+        assert!(decoder.push(TRUNCATED_FRAME).is_empty());
+        assert_eq!(decoder.bad_frames, 1);
+
+        let frames = decoder.push(TEXT_FRAME);
+        assert_eq!(frames.len(), 1);
+        assert_eq!(frames[0].seq, 2);
+    }
+
+    // Byte by byte, and the frames lost around the corrupt ones are counted
+    #[test]
+    fn stream() {
+        let mut stream = Vec::new();
+        for frame in [SAMPLE_FRAME, BAD_CRC_FRAME, TRUNCATED_FRAME, TEXT_FRAME, LONG_TEXT_FRAMES] {
+            stream.extend_from_slice(frame);
+        }
+
+        let mut decoder = Decoder::default();
+        let mut seqs = Vec::new();
+        for &b in &stream {
+            seqs.extend(decoder.push(&[b]).iter().map(|frame| frame.seq));
+        }
+        assert_eq!(seqs, [0, 2, 3, 4]);
+        assert_eq!(decoder.bad_frames, 2);
+        assert_eq!(decoder.lost_frames, 1);
+    }
+}
@@ -0,0 +1,56 @@
+// Frames of the firmware encoder, mcu/Core/Src/telemetry.c, generated by
+// test/telemetry_vectors.c.  Do not edit, regenerate with
+//     telemetry_vectors > ui/src/telemetry_vectors.rs
+// from the host build.  The values sent are the ones the tests expect.
+
+const SAMPLE_FRAME: &[u8] = &[
+    0x02, 0x01, 0x01, 0x03, 0xd0, 0x07, 0x01, 0x01, 0x01, 0x01, 0x02, 0x3e,
+    0x01, 0x01, 0x02, 0xbf, 0x01, 0x03, 0x80, 0x3e, 0x01, 0x03, 0xc0, 0xbf,
+    0x01, 0x03, 0xf0, 0x42, 0x01, 0x01, 0x01, 0x01, 0x04, 0x80, 0x3b, 0x45,
+    0x01, 0x01, 0x01, 0x03, 0x64, 0x03, 0x00,
+];
+
+const HEALTH_FRAME: &[u8] = &[
+    0x03, 0x03, 0x01, 0x03, 0xb8, 0x0b, 0x01, 0x02, 0x01, 0x02, 0x07, 0x01,
+    0x01, 0x02, 0x02, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x03, 0x2c, 0x01,
+    0x01, 0x02, 0x05, 0x01, 0x01, 0x02, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x01, 0x01, 0x01, 0x02, 0x01, 0x03, 0x01, 0x03, 0x01, 0x01, 0x09, 0x0a,
+    0xd7, 0x23, 0x3c, 0x0a, 0xd7, 0xa3, 0xbc, 0x01, 0x01, 0x01, 0x03, 0x0b,
+    0x37, 0x00,
+];
+
+const TEXT_FRAME: &[u8] = &[
+    0x03, 0x02, 0x02, 0x03, 0xa0, 0x0f, 0x01, 0x24, 0x4c, 0x51, 0x52, 0x20,
+    0x64, 0x69, 0x64, 0x20, 0x6e, 0x6f, 0x74, 0x20, 0x63, 0x6f, 0x6e, 0x76,
+    0x65, 0x72, 0x67, 0x65, 0x2c, 0x20, 0x67, 0x61, 0x69, 0x6e, 0x20, 0x6b,
+    0x65, 0x70, 0x74, 0x0d, 0x0a, 0xaa, 0x16, 0x00,
+];
+
+const LONG_TEXT_FRAMES: &[u8] = &[
+    0x03, 0x02, 0x03, 0x03, 0x88, 0x13, 0x01, 0x63, 0x61, 0x62, 0x63, 0x64,
+    0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70,
+    0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x61, 0x62,
+    0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e,
+    0x6f, 0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a,
+    0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c,
+    0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+    0x79, 0x7a, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+    0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72, 0xbb, 0x23, 0x00, 0x03,
+    0x02, 0x04, 0x03, 0x70, 0x17, 0x01, 0x17, 0x73, 0x74, 0x75, 0x76, 0x77,
+    0x78, 0x79, 0x7a, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x6b, 0x6c, 0x9d, 0xa2, 0x00,
+];
+
+const BAD_CRC_FRAME: &[u8] = &[
+    0x02, 0x01, 0x01, 0x03, 0xd0, 0x07, 0x01, 0x01, 0x01, 0x01, 0x02, 0x3f,
+    0x01, 0x01, 0x02, 0xbf, 0x01, 0x03, 0x80, 0x3e, 0x01, 0x03, 0xc0, 0xbf,
+    0x01, 0x03, 0xf0, 0x42, 0x01, 0x01, 0x01, 0x01, 0x04, 0x80, 0x3b, 0x45,
+    0x01, 0x01, 0x01, 0x03, 0x64, 0x03, 0x00,
+];
+
+const TRUNCATED_FRAME: &[u8] = &[
+    0x03, 0x03, 0x01, 0x03, 0xb8, 0x0b, 0x01, 0x02, 0x01, 0x02, 0x07, 0x01,
+    0x01, 0x02, 0x02, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x03, 0x2c, 0x01,
+    0x01, 0x02, 0x05, 0x01, 0x01, 0x02, 0x01, 0x00,
+];
+